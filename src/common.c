@@ -14,7 +14,9 @@ void panic(const char* fmt, ...) {
     char buffer[1024];
     vsnprintf(buffer, sizeof(buffer), fmt, args);
 
-    printf("\nPANIC: %s\n\n", buffer);
+    // stderr, so machine-readable output and raw samples on stdout stay intact.
+    fflush(stdout);
+    fprintf(stderr, "\nPANIC: %s\n\n", buffer);
 
     va_end(args);
 
@@ -30,7 +32,8 @@ void warn(const char* fmt, ...) {
     char buffer[1024];
     vsnprintf(buffer, sizeof(buffer), fmt, args);
 
-    printf("\nWARN: %s\n\n", buffer);
+    fflush(stdout);
+    fprintf(stderr, "\nWARN: %s\n\n", buffer);
 
     va_end(args);
 }
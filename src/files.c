@@ -3,8 +3,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <string.h>
+#include <strings.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "common.h"
 
+#if defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 const char* FileBasePath = "";
 
 MemoryFile MemoryFileCreate(const char* path) {
@@ -95,3 +109,188 @@ int MemoryFileWrite(MemoryFile* file, const char* path) {
     fclose(fp);
     return 0;
 }
+
+static void _FileResolvePath(const char* path, char* fpath, u64 fpathSize) {
+    if (path[0] != '/')
+        snprintf(fpath, fpathSize, "%s%s", FileBasePath, path);
+    else
+        snprintf(fpath, fpathSize, "%s", path);
+}
+
+MemoryFile MemoryFileMap(const char* path, int writable) {
+    if (path == NULL)
+        panic("MemoryFileMap: path is NULL");
+
+    MemoryFile hndl = {0};
+
+    char fpath[512];
+    _FileResolvePath(path, fpath, sizeof(fpath));
+
+#if defined(_WIN32) || defined(WIN32)
+    HANDLE file = CreateFileA(
+        fpath, GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE)
+        panic("MemoryFileMap: CreateFile failed (path : %s)", fpath);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        panic("MemoryFileMap: file is empty or unreadable (path : %s)", fpath);
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        panic("MemoryFileMap: CreateFileMapping failed (path : %s)", fpath);
+
+    hndl.data_void = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (hndl.data_void == NULL)
+        panic("MemoryFileMap: MapViewOfFile failed (path : %s)", fpath);
+
+    hndl.size = fileSize.QuadPart;
+#else
+    int fd = open(fpath, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        panic("MemoryFileMap: open failed (path : %s)", fpath);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        panic("MemoryFileMap: file is empty or unreadable (path : %s)", fpath);
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        panic("MemoryFileMap: mmap failed (path : %s)", fpath);
+
+    hndl.data_void = data;
+    hndl.size = st.st_size;
+#endif
+
+    return hndl;
+}
+
+void MemoryFileUnmap(MemoryFile* file) {
+    if (file->data_void) {
+#if defined(_WIN32) || defined(WIN32)
+        UnmapViewOfFile(file->data_void);
+#else
+        munmap(file->data_void, file->size);
+#endif
+    }
+    file->data_void = 0;
+    file->size = 0;
+}
+
+int FileGetInfo(const char* path, FileInfo* info) {
+    char fpath[512];
+    _FileResolvePath(path, fpath, sizeof(fpath));
+
+    struct stat st;
+    if (stat(fpath, &st) != 0)
+        return 1;
+
+    info->size = st.st_size;
+    info->modifiedTime = st.st_mtime;
+    info->isDirectory = S_ISDIR(st.st_mode);
+    return 0;
+}
+
+u64 FileReadAt(const char* path, u64 offset, void* buffer, u64 size) {
+    char fpath[512];
+    _FileResolvePath(path, fpath, sizeof(fpath));
+
+#if defined(_WIN32) || defined(WIN32)
+    FILE* fp = fopen(fpath, "rb");
+    if (fp == NULL)
+        return 0;
+
+    u64 bytesRead = 0;
+    if (_fseeki64(fp, offset, SEEK_SET) == 0)
+        bytesRead = fread(buffer, 1, size, fp);
+
+    fclose(fp);
+    return bytesRead;
+#else
+    int fd = open(fpath, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    ssize_t bytesRead = pread(fd, buffer, size, offset);
+    close(fd);
+
+    return bytesRead > 0 ? (u64)bytesRead : 0;
+#endif
+}
+
+static int _FileComparePaths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int _FileHasExtension(const char* name, const char** extensions) {
+    if (extensions == NULL)
+        return 1;
+
+    const char* dot = strrchr(name, '.');
+    if (dot == NULL)
+        return 0;
+
+    for (unsigned i = 0; extensions[i] != NULL; i++) {
+        if (strcasecmp(dot + 1, extensions[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void FileListDirectory(const char* path, const char** extensions, ListData* pathList) {
+    char fpath[512];
+    _FileResolvePath(path, fpath, sizeof(fpath));
+
+    DIR* dir = opendir(fpath);
+    if (dir == NULL) {
+        warn("FileListDirectory: opendir failed (path : %s)", fpath);
+        return;
+    }
+
+    u64 firstIndex = pathList->elementCount;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        u64 childLength = strlen(path) + 1 + strlen(entry->d_name) + 1;
+        char* childPath = (char*)malloc(childLength);
+        if (childPath == NULL)
+            panic("FileListDirectory: malloc failed");
+
+        int needsSlash = path[0] != '\0' && path[strlen(path) - 1] != '/';
+        snprintf(childPath, childLength, "%s%s%s", path, needsSlash ? "/" : "", entry->d_name);
+
+        FileInfo info;
+        if (FileGetInfo(childPath, &info) != 0) {
+            free(childPath);
+            continue;
+        }
+
+        if (info.isDirectory) {
+            FileListDirectory(childPath, extensions, pathList);
+            free(childPath);
+        }
+        else if (_FileHasExtension(entry->d_name, extensions))
+            ListAdd(pathList, &childPath);
+        else
+            free(childPath);
+    }
+
+    closedir(dir);
+
+    qsort(
+        (char**)pathList->data + firstIndex, pathList->elementCount - firstIndex,
+        sizeof(char*), _FileComparePaths
+    );
+}
@@ -3,6 +3,8 @@
 
 #include "type.h"
 
+#include "list.h"
+
 typedef struct {
     union {
         s8* data_s8;
@@ -20,4 +22,28 @@ void MemoryFileDestroy(MemoryFile* file);
 
 int MemoryFileWrite(MemoryFile* file, const char *path);
 
+// Map a file into memory instead of reading it. With writable set, stores
+// through the mapping go straight to the file.
+MemoryFile MemoryFileMap(const char* path, int writable);
+
+void MemoryFileUnmap(MemoryFile* file);
+
+typedef struct {
+    u64 size;
+    s64 modifiedTime; // Seconds since the epoch.
+    int isDirectory;
+} FileInfo;
+
+// Returns 0 on success.
+int FileGetInfo(const char* path, FileInfo* info);
+
+// Read up to size bytes at offset without loading the whole file.
+// Returns the amount of bytes read.
+u64 FileReadAt(const char* path, u64 offset, void* buffer, u64 size);
+
+// Recursively collect the files under path whose extension (without the dot)
+// is in the NULL-terminated extensions list; pass NULL to collect every file.
+// Paths are appended to pathList as malloc'd char* in sorted order.
+void FileListDirectory(const char* path, const char** extensions, ListData* pathList);
+
 #endif // FILES_H
\ No newline at end of file
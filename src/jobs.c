@@ -0,0 +1,79 @@
+#include "jobs.h"
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+typedef struct {
+    JobFunction jobFunction;
+    void* userData;
+
+    u64 jobCount;
+    u64 nextJob; // Accessed atomically.
+} _JobsContext;
+
+static void* _JobsWorker(void* arg) {
+    _JobsContext* context = (_JobsContext*)arg;
+
+    while (1) {
+        u64 jobIndex = __atomic_fetch_add(&context->nextJob, 1, __ATOMIC_RELAXED);
+        if (jobIndex >= context->jobCount)
+            break;
+
+        context->jobFunction(context->userData, jobIndex);
+    }
+
+    return NULL;
+}
+
+u32 JobsGetCpuCount(void) {
+#if defined(_WIN32) || defined(WIN32)
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    long cpuCount = (long)systemInfo.dwNumberOfProcessors;
+#else
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cpuCount > 0 ? (u32)cpuCount : 1;
+}
+
+void JobsRun(u64 jobCount, u32 threadCount, JobFunction jobFunction, void* userData) {
+    if (threadCount == 0)
+        threadCount = JobsGetCpuCount();
+    if (threadCount > jobCount)
+        threadCount = (u32)jobCount;
+
+    _JobsContext context;
+    context.jobFunction = jobFunction;
+    context.userData = userData;
+    context.jobCount = jobCount;
+    context.nextJob = 0;
+
+    // No point in spawning a thread for a single worker.
+    if (threadCount <= 1) {
+        _JobsWorker(&context);
+        return;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * threadCount);
+    if (threads == NULL)
+        panic("JobsRun: malloc fail");
+
+    for (u32 i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, _JobsWorker, &context) != 0)
+            panic("JobsRun: pthread_create fail");
+    }
+
+    for (u32 i = 0; i < threadCount; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
@@ -0,0 +1,16 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "type.h"
+
+typedef void (*JobFunction)(void* userData, u64 jobIndex);
+
+// Number of online CPUs (at least 1).
+u32 JobsGetCpuCount(void);
+
+// Call jobFunction for every job index in [0, jobCount) spread over
+// threadCount worker threads (0 = one per CPU), and wait for all of them.
+// Jobs are handed out one at a time, so uneven job sizes balance out.
+void JobsRun(u64 jobCount, u32 threadCount, JobFunction jobFunction, void* userData);
+
+#endif // JOBS_H
@@ -7,300 +7,2403 @@
 
 #include "opusProcess.h"
 
+#include "oggProcess.h"
+
+#include "opusInspect.h"
+
 #include "wavProcess.h"
 
+#include "jobs.h"
+
+#include "opusTarget.h"
+
+
+#include <libgen.h>
+#include <string.h>
+#include "type.h"
+
+// Helper para obtener el nombre base sin extensión
+char* baseName(const char* path) {
+    static char buf[256];
+    snprintf(buf, sizeof(buf), "%s", path);
+    char* base = basename(buf);
+    char* dot = strrchr(base, '.');
+    if (dot) *dot = '\0';
+    return base;
+}
+
+// Returns the index of the option in argv, or 0 if it isn't present.
+static int FindOption(int argc, char** argv, const char* name) {
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0)
+            return i;
+    }
+    return 0;
+}
+
+// Returns the argument following the option, or NULL if it isn't present.
+static const char* GetOptionValue(int argc, char** argv, const char* name) {
+    int i = FindOption(argc, argv, name);
+    return (i != 0 && i + 1 < argc) ? argv[i + 1] : NULL;
+}
+
+// Number of arguments before the first option; options go after the
+// positional arguments of a command.
+static int CountPositionalArgs(int argc, char** argv) {
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0)
+            return i;
+    }
+    return argc;
+}
+
+// Load the --profiles file if given; profiles is always initialized.
+static void LoadEncodeProfiles(int argc, char** argv, ListData* profiles) {
+    const char* profilesPath = GetOptionValue(argc, argv, "--profiles");
+    if (profilesPath)
+        OpusLoadProfiles(profilesPath, profiles);
+    else
+        ListInit(profiles, sizeof(OpusEncodeProfile), 1);
+}
+
+// Apply the options that modify any profile (--seekable, --dtx).
+static void ApplyProfileOptions(int argc, char** argv, OpusEncodeProfile* profile) {
+    const char* seekableArg = GetOptionValue(argc, argv, "--seekable");
+    if (seekableArg) {
+        profile->predictionDisabled = 1;
+        profile->entryInterval = (u32)strtoul(seekableArg, NULL, 10);
+        if (profile->entryInterval == 0)
+            panic("--seekable expects the amount of packets between entry points");
+    }
+
+    if (FindOption(argc, argv, "--dtx")) {
+        if (profile->rateMode == OPUS_RATE_CBR)
+            warn("Profile '%s' is CBR, --dtx is ignored", profile->name);
+        else
+            profile->dtx = 1;
+    }
+}
+
+// Resolve --profile (and the optional --profiles file) into profile; fallback
+// is used when --profile isn't given.
+static void GetEncodeProfile(int argc, char** argv, const OpusEncodeProfile* fallback, OpusEncodeProfile* profile) {
+    ListData profiles;
+    LoadEncodeProfiles(argc, argv, &profiles);
+
+    const char* profileName = GetOptionValue(argc, argv, "--profile");
+    const OpusEncodeProfile* found = profileName ? OpusFindProfile(&profiles, profileName) : fallback;
+    if (found == NULL)
+        panic("Unknown encoding profile '%s'", profileName);
+
+    *profile = *found;
+    ListDestroy(&profiles);
+
+    ApplyProfileOptions(argc, argv, profile);
+}
+
+// Drop the silent head and tail of the input (--trim). Loop points, if given,
+// are kept inside the remaining audio and moved with it.
+static void TrimInput(s16* samples, u32* sampleCount, u32 channelCount, u32 sampleRate, u32* loopStart, u32* loopEnd) {
+    u64 frameCount = *sampleCount / channelCount;
+
+    u64 head, tail;
+    PcmFindSilence(samples, frameCount, channelCount, &head, &tail);
+
+    if (head == frameCount) {
+        warn("Input is silent, not trimming");
+        return;
+    }
+
+    if (loopStart && loopEnd) {
+        head = MIN(head, (u64)*loopStart);
+        u64 keepEnd = MIN((u64)*loopEnd, frameCount);
+        if (frameCount - tail < keepEnd)
+            tail = frameCount - keepEnd;
+    }
+
+    u64 keptCount = frameCount - head - tail;
+    memmove(samples, samples + head * channelCount, sizeof(s16) * keptCount * channelCount);
+    *sampleCount = (u32)(keptCount * channelCount);
+
+    printf(
+        "Trimmed silence: head %llu samples (%.3fs), tail %llu samples (%.3fs)\n",
+        (unsigned long long)head, (double)head / sampleRate, (unsigned long long)tail, (double)tail / sampleRate
+    );
+
+    if (loopStart && loopEnd && head != 0) {
+        *loopStart -= (u32)head;
+        *loopEnd -= (u32)MIN(head, (u64)*loopEnd);
+        printf("Loop points moved to start=%u end=%u\n", *loopStart, *loopEnd);
+    }
+}
+
+static void PrintLoudness(const PcmLoudness* loudness) {
+    printf(
+        "%.1f LUFS, LRA %.1f LU, true peak %.1f dBTP",
+        loudness->integrated, loudness->range, loudness->truePeak
+    );
+}
+
+// Gain bringing loudness to target LUFS, plus offset dB on top, held so the
+// true peak stays under the --true-peak ceiling (default -1 dBTP). limited is
+// set when it had to. Silent signals only get offset.
+static double LoudnessGain(int argc, char** argv, const PcmLoudness* loudness, double target, double offset, int* limited) {
+    const char* ceilingArg = GetOptionValue(argc, argv, "--true-peak");
+    double ceiling = ceilingArg ? atof(ceilingArg) : -1.0;
+
+    *limited = 0;
+    if (loudness->integrated <= PCM_LOUDNESS_SILENT)
+        return offset;
+
+    double gain = target - loudness->integrated + offset;
+    if (loudness->truePeak + gain > ceiling) {
+        gain = ceiling - loudness->truePeak;
+        *limited = 1;
+    }
+    return gain;
+}
+
+// Bring the input to the --loudness target and/or apply the fixed --gain
+// (e.g. an album gain from the loudness command) before it is encoded.
+static void NormalizeInput(int argc, char** argv, s16* samples, u32 sampleCount, u32 channelCount, u32 sampleRate) {
+    const char* targetArg = GetOptionValue(argc, argv, "--loudness");
+    const char* gainArg = GetOptionValue(argc, argv, "--gain");
+    if (targetArg == NULL && gainArg == NULL)
+        return;
+
+    double gain = gainArg ? atof(gainArg) : 0.0;
+
+    if (targetArg) {
+        printf("Measuring loudness..");
+        fflush(stdout);
+
+        PcmLoudnessMeter meter;
+        PcmLoudnessMeasure(samples, sampleCount / channelCount, channelCount, sampleRate, &meter);
+
+        PcmLoudness loudness;
+        PcmLoudnessResult(&meter, 1, &loudness);
+        PcmLoudnessMeterDestroy(&meter);
+
+        printf(" OK\nLoudness: ");
+        PrintLoudness(&loudness);
+        printf("\n");
+
+        if (loudness.integrated <= PCM_LOUDNESS_SILENT)
+            warn("Input is silent, --loudness is ignored");
+
+        // --gain goes on top of the target, and the ceiling holds for the sum.
+        int limited;
+        gain = LoudnessGain(argc, argv, &loudness, atof(targetArg), gain, &limited);
+        if (limited)
+            printf("Gain is limited by the true peak ceiling\n");
+    }
+
+    printf("Applying %+.2f dB gain..", gain);
+    fflush(stdout);
+
+    PcmApplyGain(samples, sampleCount, gain);
+
+    printf(" OK\n");
+}
+
+// --gain for decodes, as OPUS_SET_GAIN (1/256 dB).
+static int GetDecoderGain(int argc, char** argv) {
+    const char* gainArg = GetOptionValue(argc, argv, "--gain");
+    if (gainArg == NULL)
+        return 0;
+
+    double gain = atof(gainArg) * 256.0;
+    if (gain < -32768.0 || gain > 32767.0)
+        panic("--gain must be within -128..128 dB");
+    return (int)lrint(gain);
+}
+
+// --preview for decodes: the output rate (--rate, default
+// OPUS_PREVIEW_SAMPLE_RATE) of a mono preview, 0 without --preview.
+static u32 GetPreviewRate(int argc, char** argv) {
+    if (!FindOption(argc, argv, "--preview"))
+        return 0;
+
+    const char* rateArg = GetOptionValue(argc, argv, "--rate");
+    u32 sampleRate = rateArg ? (u32)atoi(rateArg) : OPUS_PREVIEW_SAMPLE_RATE;
+    if (sampleRate != 8000 && sampleRate != 12000 && sampleRate != 16000 && sampleRate != 24000 && sampleRate != 48000)
+        panic("--rate must be 8000, 12000, 16000, 24000 or 48000 for --preview");
+    return sampleRate;
+}
+
+// Decode outputs, as OpusDecodeSink adapters.
+
+typedef struct {
+    const char* path;
+    WavWriter writer;
+} WavSink;
+
+static void WavSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    WavSink* sink = (WavSink*)userData;
+    if (WavWriterOpen(&sink->writer, sink->path, sampleRate, (u16)channelCount) != 0)
+        panic("Could not open \"%s\" for writing", sink->path);
+}
+static void WavSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    WavWriterWrite(&((WavSink*)userData)->writer, samples, sampleCount);
+}
+static void WavSinkEnd(void* userData) {
+    WavSink* sink = (WavSink*)userData;
+    if (WavWriterClose(&sink->writer) != 0)
+        panic("Could not write the WAV file \"%s\"", sink->path);
+}
+
+// Headerless interleaved s16 (native endianness); path "-" is stdout.
+typedef struct {
+    const char* path;
+    FILE* fp;
+    u32 channelCount;
+} RawSink;
+
+static void RawSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    (void)sampleRate;
+    RawSink* sink = (RawSink*)userData;
+    sink->channelCount = channelCount;
+    sink->fp = strcmp(sink->path, "-") == 0 ? stdout : fopen(sink->path, "wb");
+    if (sink->fp == NULL)
+        panic("Could not open \"%s\" for writing", sink->path);
+}
+static void RawSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    RawSink* sink = (RawSink*)userData;
+    u64 count = sampleCount * sink->channelCount;
+    if (fwrite(samples, sizeof(s16), count, sink->fp) != count)
+        panic("Could not write the raw samples to \"%s\"", sink->path);
+}
+static void RawSinkEnd(void* userData) {
+    RawSink* sink = (RawSink*)userData;
+    if (sink->fp == stdout ? fflush(stdout) != 0 : fclose(sink->fp) != 0)
+        panic("Could not write the raw samples to \"%s\"", sink->path);
+}
+
+typedef struct {
+    u64 hash;
+    u32 channelCount;
+} HashSink;
+
+static void HashSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    (void)sampleRate;
+    HashSink* sink = (HashSink*)userData;
+    sink->hash = PCM_HASH_INIT;
+    sink->channelCount = channelCount;
+}
+static void HashSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    HashSink* sink = (HashSink*)userData;
+    sink->hash = PcmHashUpdate(sink->hash, samples, sampleCount * sink->channelCount);
+}
+
+typedef struct {
+    PcmStats stats;
+    u32 channelCount;
+} StatsSink;
+
+static void StatsSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    (void)sampleRate;
+    StatsSink* sink = (StatsSink*)userData;
+    memset(&sink->stats, 0, sizeof(PcmStats));
+    sink->channelCount = channelCount;
+}
+static void StatsSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    StatsSink* sink = (StatsSink*)userData;
+    PcmStatsAdd(&sink->stats, samples, sampleCount * sink->channelCount);
+}
+
+// Written on end to path, as JSON when json is set; an error is left in
+// error (empty on success).
+typedef struct {
+    const char* path;
+    u32 binSamples;
+    u32 levelCount;
+    int json;
+
+    PcmPeaks peaks;
+    u32 sampleRate;
+    char error[160];
+} PeaksSink;
+
+static void PeaksSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    PeaksSink* sink = (PeaksSink*)userData;
+    sink->sampleRate = sampleRate;
+    sink->error[0] = '\0';
+    PcmPeaksInit(&sink->peaks, channelCount, sink->binSamples, sink->levelCount);
+}
+static void PeaksSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    PcmPeaksAdd(&((PeaksSink*)userData)->peaks, samples, sampleCount);
+}
+static void PeaksSinkEnd(void* userData) {
+    PeaksSink* sink = (PeaksSink*)userData;
+    PcmPeaksFinish(&sink->peaks);
+    if (PcmPeaksWrite(&sink->peaks, sink->sampleRate, sink->json, sink->path) != 0)
+        snprintf(sink->error, sizeof(sink->error), "could not write the peaks file");
+}
+
+static void GetPeaksOptions(int argc, char** argv, u32* binSamples, u32* levelCount) {
+    const char* binArg = GetOptionValue(argc, argv, "--bin");
+    const char* levelsArg = GetOptionValue(argc, argv, "--levels");
+    *binSamples = binArg ? (u32)atoi(binArg) : PCM_PEAKS_BIN_SAMPLES;
+    *levelCount = levelsArg ? (u32)atoi(levelsArg) : PCM_PEAKS_LEVELS;
+
+    // Checked here rather than where the peaks are built (maybe on a worker thread).
+    PcmPeaks check;
+    PcmPeaksInit(&check, 1, *binSamples, *levelCount);
+    PcmPeaksDestroy(&check);
+}
+
+static int HasSuffix(const char* string, const char* suffix) {
+    size_t length = strlen(string), suffixLength = strlen(suffix);
+    return length >= suffixLength && strcasecmp(string + length - suffixLength, suffix) == 0;
+}
+
+// --raw - writes the decoded samples to stdout.
+static int IsRawToStdout(int argc, char** argv) {
+    const char* rawPath = GetOptionValue(argc, argv, "--raw");
+    return rawPath != NULL && strcmp(rawPath, "-") == 0;
+}
+
+// Decode an OPUS file of any variant once, streaming the samples to every
+// output asked for: a WAV at wavPath (may be NULL), --raw, --peaks, --hash
+// and --stats. With none of them the decode only runs (a benchmark). Honors
+// --gain and --preview. Returns the samples decoded per channel.
+static u64 DecodeToOutputs(u8* data, u64 size, const char* wavPath, int argc, char** argv) {
+    const OpusVariant* variant = OpusFindVariant(data, size);
+    if (variant == NULL)
+        OpusPreprocess(data); // Reports why and exits.
+
+    OpusVariantMetadata metadata;
+    OpusReadVariantMetadata(variant, data, size, &metadata);
+
+    OpusFileHeader* fileHeader = (OpusFileHeader*)(data + variant->locateHeader(data, size));
+    OpusPreprocess((u8*)fileHeader);
+
+    const char* rawPath = GetOptionValue(argc, argv, "--raw");
+    const char* peaksPath = GetOptionValue(argc, argv, "--peaks");
+    int hash = FindOption(argc, argv, "--hash");
+    int stats = FindOption(argc, argv, "--stats");
+
+    // Keep stdout clean when the samples go there.
+    FILE* report = IsRawToStdout(argc, argv) ? stderr : stdout;
+
+    OpusStreamDecoder streamDecoder;
+    u32 previewRate = GetPreviewRate(argc, argv);
+    if (previewRate != 0) {
+        if (OpusGetMultistreamChunk(fileHeader) != NULL)
+            panic("--preview is not supported for multistream files");
+        OpusStreamDecoderInitPreview(&streamDecoder, fileHeader, metadata.numSamples, previewRate);
+    }
+    else
+        OpusStreamDecoderInit(&streamDecoder, fileHeader, metadata.numSamples, 0, 0);
+
+    int gain = GetDecoderGain(argc, argv);
+    if (gain != 0)
+        OpusStreamDecoderSetGain(&streamDecoder, gain);
+
+    OpusDecodeSink sinks[5];
+    u32 sinkCount = 0;
+
+    WavSink wavSink = { .path = wavPath };
+    if (wavPath != NULL)
+        sinks[sinkCount++] = (OpusDecodeSink){ &wavSink, WavSinkBegin, WavSinkWrite, WavSinkEnd };
+
+    RawSink rawSink = { .path = rawPath };
+    if (rawPath != NULL)
+        sinks[sinkCount++] = (OpusDecodeSink){ &rawSink, RawSinkBegin, RawSinkWrite, RawSinkEnd };
+
+    PeaksSink peaksSink = { .path = peaksPath };
+    if (peaksPath != NULL) {
+        GetPeaksOptions(argc, argv, &peaksSink.binSamples, &peaksSink.levelCount);
+        peaksSink.json = HasSuffix(peaksPath, ".json");
+        sinks[sinkCount++] = (OpusDecodeSink){ &peaksSink, PeaksSinkBegin, PeaksSinkWrite, PeaksSinkEnd };
+    }
+
+    HashSink hashSink;
+    if (hash)
+        sinks[sinkCount++] = (OpusDecodeSink){ &hashSink, HashSinkBegin, HashSinkWrite, NULL };
+
+    StatsSink statsSink;
+    if (stats)
+        sinks[sinkCount++] = (OpusDecodeSink){ &statsSink, StatsSinkBegin, StatsSinkWrite, NULL };
+
+    if (previewRate != 0)
+        fprintf(report, "Decoding preview (mono, %uhz)..", previewRate);
+    else
+        fprintf(report, "Decoding (channels=%u, sampleRate=%u)..", streamDecoder.channelCount, streamDecoder.sampleRate);
+    fflush(report);
+
+    u32 sampleRate = streamDecoder.sampleRate;
+    u64 decodedSamples = OpusDecodeToSinks(&streamDecoder, sinks, sinkCount);
+    if (streamDecoder.error[0] != '\0')
+        panic("Decode: %s", streamDecoder.error);
+    OpusStreamDecoderDestroy(&streamDecoder);
+
+    fprintf(report, " OK\n");
+
+    if (peaksPath != NULL) {
+        if (peaksSink.error[0] != '\0')
+            panic("Peaks \"%s\": %s", peaksPath, peaksSink.error);
+        PcmPeaksDestroy(&peaksSink.peaks);
+    }
+
+    if (hash || stats)
+        fprintf(report, "\n");
+    if (hash)
+        fprintf(report, "Hash (FNV-1a 64 of the s16le samples): %016llx\n", (unsigned long long)hashSink.hash);
+    if (stats) {
+        const PcmStats* pcmStats = &statsSink.stats;
+        fprintf(report, "Samples: %llu per channel (%.3fs)\n",
+            (unsigned long long)decodedSamples, (double)decodedSamples / sampleRate);
+        fprintf(report, "Peak:    %.2f dBFS\n", PcmStatsPeakDb(pcmStats));
+        fprintf(report, "RMS:     %.2f dBFS\n", PcmStatsRmsDb(pcmStats));
+        fprintf(report, "DC:      %.2f\n", pcmStats->count != 0 ? pcmStats->sum / pcmStats->count : 0.0);
+        fprintf(report, "Clipped: %llu samples\n", (unsigned long long)pcmStats->clippedCount);
+    }
+
+    return decodedSamples;
+}
+
+static void PrintLoop(const PcmLoop* loop, u32 sampleRate) {
+    printf(
+        "start=%u end=%u (%0.3f to %0.3f seconds), seam %.1f dB, %.1fs repeated%s",
+        loop->loopStart, loop->loopEnd, (double)loop->loopStart / sampleRate, (double)loop->loopEnd / sampleRate,
+        loop->discontinuity, loop->repeatSeconds, loop->seamless ? "" : " (not seamless)"
+    );
+}
+
+// Search the loop of the input (auto-detect). Returns 0 if none was found
+// or the one found isn't seamless.
+static int DetectLoop(const s16* samples, u32 sampleCount, u32 channelCount, u32 sampleRate, u32* loopStart, u32* loopEnd) {
+    printf("Detecting loop..");
+    fflush(stdout);
+
+    PcmLoop loop;
+    int found = PcmFindLoop(samples, sampleCount / channelCount, channelCount, sampleRate, &loop);
+
+    printf(" OK\n");
+    if (!found) {
+        warn("No repeated material found, the loop can't be detected");
+        return 0;
+    }
+
+    printf("Detected loop: ");
+    PrintLoop(&loop, sampleRate);
+    printf("\n");
+
+    // A loop that doesn't join cleanly clicks on every pass; the auto loop
+    // is the safer default.
+    if (!loop.seamless) {
+        warn("The detected loop isn't seamless, it is not used");
+        return 0;
+    }
+
+    *loopStart = loop.loopStart;
+    *loopEnd = loop.loopEnd;
+    return 1;
+}
+
+// Analyze the input for --adapt and print what was found.
+static void AnalyzeInput(const s16* samples, u32 sampleCount, u32 channelCount, u32 sampleRate, PcmAnalysis* analysis) {
+    printf("Analyzing..");
+    fflush(stdout);
+
+    PcmAnalyze(samples, sampleCount / channelCount, channelCount, sampleRate, analysis);
+
+    printf(" OK\nAnalysis: ");
+    if (channelCount == 2)
+        printf("side level %.1f dB%s, ", analysis->sideLevel, analysis->identicalChannels ? " (identical channels)" : "");
+    printf(
+        "bandwidth %uHz, %u silent stretches (%.1f%%)\n",
+        analysis->bandwidth, analysis->silentStretchCount,
+        analysis->sampleCount != 0 ? 100.0 * analysis->silentSamples / analysis->sampleCount : 0.0
+    );
+}
+
+static void PrintQuality(const PcmQuality* quality) {
+    printf(
+        "SNR %.2f dB, segmental SNR %.2f dB, peak error %u, spectral distance %.2f dB",
+        quality->snr, quality->segmentalSnr, quality->peakError, quality->spectralDistance
+    );
+}
+
+// Decode the built file and print its quality against the input (--measure).
+static void MeasureInput(const OpusEncodeInput* input, const MemoryFile* file) {
+    printf("Measuring..");
+    fflush(stdout);
+
+    PcmQuality quality;
+    OpusMeasureInput(input, file, &quality);
+
+    printf(" OK\nQuality: ");
+    PrintQuality(&quality);
+    printf("\n");
+}
+
+// Encode input at its profile's bitrate, or search the bitrate when
+// --target-size or --target-snr is given. label names the progress line.
+static MemoryFile EncodeInput(int argc, char** argv, const OpusEncodeInput* input, const char* label) {
+    const char* sizeArg = GetOptionValue(argc, argv, "--target-size");
+    const char* snrArg = GetOptionValue(argc, argv, "--target-snr");
+
+    if (sizeArg == NULL && snrArg == NULL) {
+        printf("%s..", label);
+        fflush(stdout);
+
+        MemoryFile mfOpus = OpusBuildInput(input, input->profile.bitRate);
+
+        printf(" OK\n");
+
+        if (FindOption(argc, argv, "--measure"))
+            MeasureInput(input, &mfOpus);
+        return mfOpus;
+    }
+    if (sizeArg && snrArg)
+        panic("--target-size and --target-snr can't be combined");
+
+    int targetKind = sizeArg ? OPUS_TARGET_SIZE : OPUS_TARGET_SNR;
+    double target = strtod(sizeArg ? sizeArg : snrArg, NULL);
+    if (targetKind == OPUS_TARGET_SIZE && target <= 0.0)
+        panic("--target-size expects a positive byte count");
+
+    const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+    u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
+
+    if (targetKind == OPUS_TARGET_SIZE)
+        printf("%s (target size %.0f bytes)..", label, target);
+    else
+        printf("%s (target SNR %.2f dB)..", label, target);
+    fflush(stdout);
+
+    OpusTargetResult result;
+    MemoryFile mfOpus = OpusBuildTargeted(input, targetKind, target, threadCount, &result);
+
+    printf(" OK\n");
+
+    printf("Chose %d bps: %llu bytes", result.bitRate, (unsigned long long)result.size);
+    if (targetKind == OPUS_TARGET_SNR)
+        printf(", SNR %.2f dB", result.snr);
+    printf(" (%u trial encodes in %u rounds)\n", result.trialCount, result.roundCount);
+
+    if (!result.reached)
+        warn("The target can't be reached with Opus bitrates; using the closest one (%d bps)", result.bitRate);
+
+    if (FindOption(argc, argv, "--measure"))
+        MeasureInput(input, &mfOpus);
+
+    return mfOpus;
+}
+
+// Options that consume the argument after them.
+static const char* ValueOptions[] = { "--catalog", "--timeline", "--jobs", "--profile", "--profiles", "--loop", "--seekable",
+    "--target-size", "--target-snr", "--margin", "--crossfade",
+    "--preroll", "--format", "--bitrate", "--rate", "--duration", "--pad", "--loudness", "--true-peak", "--gain",
+    "--bin", "--levels", "--wav", "--raw", "--peaks", NULL };
+
+static const char* OpusExtensions[] = { "opus", "lopus", NULL };
+static const char* AudioExtensions[] = { "opus", "lopus", "wav", NULL };
+
+// Collect the positional arguments from argv[first] on, expanding directories
+// to the files with the given extensions they contain. Elements are malloc'd
+// char*.
+static void CollectInputPaths(int argc, char** argv, int first, const char** extensions, ListData* paths) {
+    ListInit(paths, sizeof(char*), 64);
+
+    for (int i = first; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            for (unsigned j = 0; ValueOptions[j] != NULL; j++) {
+                if (strcmp(argv[i], ValueOptions[j]) == 0)
+                    i++;
+            }
+            continue;
+        }
+
+        FileInfo info;
+        if (FileGetInfo(argv[i], &info) != 0) {
+            warn("Could not stat \"%s\", skipping", argv[i]);
+            continue;
+        }
+
+        if (info.isDirectory)
+            FileListDirectory(argv[i], extensions, paths);
+        else {
+            char* path = strdup(argv[i]);
+            ListAdd(paths, &path);
+        }
+    }
+}
+
+static void DestroyInputPaths(ListData* paths) {
+    for (u64 i = 0; i < paths->elementCount; i++)
+        free(*(char**)ListGet(paths, i));
+    ListDestroy(paths);
+}
+
+// Commands that take a list of files/directories instead of <file in> <file out>.
+static int IsPathListCommand(const char* command) {
+    return
+        strcasecmp(command, "info") == 0 || strcasecmp(command, "packets") == 0 ||
+        strcasecmp(command, "verify") == 0 || strcasecmp(command, "loudness") == 0 ||
+        strcasecmp(command, "find_loops") == 0 || strcasecmp(command, "check_loops") == 0 ||
+        strcasecmp(command, "peaks") == 0;
+}
+
+typedef struct {
+    ListData* paths;
+    PcmLoudnessMeter* meters; // Left zeroed (empty) for files that failed.
+    char (*errors)[160]; // Empty for files measured.
+} LoudnessJobs;
+
+// Read a WAV, or decode an OPUS file of any variant in memory, to
+// interleaved s16 samples (free with free()). sampleCount is per channel.
+// Returns NULL with the reason in error (errorSize bytes) if the file can't
+// be read or decoded; never panics on bad files, so it can run on workers.
+static s16* ReadAudioFile(
+    const char* path, u32* channelCount, u32* sampleRate, u64* sampleCount, char* error, u64 errorSize
+) {
+    FileInfo fileInfo;
+    if (FileGetInfo(path, &fileInfo) != 0 || fileInfo.size == 0) {
+        snprintf(error, errorSize, "file is missing or empty");
+        return NULL;
+    }
+
+    MemoryFile mfInput = MemoryFileMap(path, 0);
+
+    s16* samples = NULL;
+    if (mfInput.size >= 4 && memcmp(mfInput.data_u8, "RIFF", 4) == 0) {
+        if (WavCheck(mfInput.data_u8, mfInput.size, error, errorSize) == 0) {
+            *channelCount = WavGetChannelCount(mfInput.data_u8, mfInput.size);
+            *sampleRate = WavGetSampleRate(mfInput.data_u8, mfInput.size);
+            samples = WavGetPCM16(mfInput.data_u8, mfInput.size);
+            *sampleCount = WavGetSampleCount(mfInput.data_u8, mfInput.size) / *channelCount;
+        }
+    }
+    else {
+        OpusFileHeader* fileHeader = OpusCheckContainer(mfInput.data_u8, mfInput.size, 0, error, errorSize);
+        if (fileHeader != NULL) {
+            *channelCount = fileHeader->channelCount;
+            *sampleRate = fileHeader->sampleRate;
+
+            OpusVariantMetadata metadata;
+            OpusReadVariantMetadata(OpusFindVariant(mfInput.data_u8, mfInput.size), mfInput.data_u8, mfInput.size, &metadata);
+
+            // Packet by packet (multistream files too), so a bad packet is an
+            // error for this file rather than a panic.
+            OpusStreamDecoder streamDecoder;
+            OpusStreamDecoderInit(&streamDecoder, fileHeader, metadata.numSamples, 0, 0);
+
+            ListData decoded;
+            ListInit(&decoded, sizeof(s16), (u64)OPUS_DECODE_BLOCK_SAMPLES * *channelCount);
+            s16* block = (s16*)malloc(sizeof(s16) * OPUS_DECODE_BLOCK_SAMPLES * *channelCount);
+            if (block == NULL)
+                panic("ReadAudioFile: malloc fail");
+
+            u64 count;
+            while ((count = OpusStreamDecoderRead(&streamDecoder, block, OPUS_DECODE_BLOCK_SAMPLES)) != 0)
+                ListAddRange(&decoded, block, count * *channelCount);
+            free(block);
+
+            if (streamDecoder.error[0] != '\0') {
+                snprintf(error, errorSize, "%s", streamDecoder.error);
+                ListDestroy(&decoded);
+            }
+            else {
+                samples = (s16*)decoded.data;
+                *sampleCount = decoded.elementCount / *channelCount;
+            }
+
+            OpusStreamDecoderDestroy(&streamDecoder);
+        }
+    }
+
+    MemoryFileUnmap(&mfInput);
+    return samples;
+}
+
+// Measure one WAV or OPUS file.
+static void LoudnessJob(void* userData, u64 jobIndex) {
+    LoudnessJobs* jobs = (LoudnessJobs*)userData;
+    const char* path = *(char**)ListGet(jobs->paths, jobIndex);
+
+    u32 channelCount, sampleRate;
+    u64 sampleCount;
+    s16* samples = ReadAudioFile(path, &channelCount, &sampleRate, &sampleCount, jobs->errors[jobIndex], sizeof(jobs->errors[0]));
+    if (samples == NULL)
+        return;
+
+    PcmLoudnessMeasure(samples, sampleCount, channelCount, sampleRate, jobs->meters + jobIndex);
+    free(samples);
+}
+
+typedef struct {
+    ListData* paths;
+    PcmLoop* loops;
+    int* found;
+    u32* sampleRates;
+    char (*errors)[160]; // Empty for files searched.
+} FindLoopsJobs;
+
+static void FindLoopsJob(void* userData, u64 jobIndex) {
+    FindLoopsJobs* jobs = (FindLoopsJobs*)userData;
+    const char* path = *(char**)ListGet(jobs->paths, jobIndex);
+
+    u32 channelCount, sampleRate;
+    u64 sampleCount;
+    s16* samples = ReadAudioFile(path, &channelCount, &sampleRate, &sampleCount, jobs->errors[jobIndex], sizeof(jobs->errors[0]));
+    if (samples == NULL)
+        return;
+    jobs->sampleRates[jobIndex] = sampleRate;
+
+    jobs->found[jobIndex] = PcmFindLoop(samples, sampleCount, channelCount, sampleRate, jobs->loops + jobIndex);
+    free(samples);
+}
+
+typedef struct {
+    ListData* paths;
+    OpusVerifyResult* results;
+} VerifyJobs;
+
+static void VerifyJob(void* userData, u64 jobIndex) {
+    VerifyJobs* jobs = (VerifyJobs*)userData;
+    const char* path = *(char**)ListGet(jobs->paths, jobIndex);
+    OpusVerifyResult* result = jobs->results + jobIndex;
+
+    // MemoryFileMap panics on empty or missing files; report those instead.
+    FileInfo fileInfo;
+    if (FileGetInfo(path, &fileInfo) != 0 || fileInfo.size == 0) {
+        memset(result, 0, sizeof(OpusVerifyResult));
+        result->status = OPUS_VERIFY_BAD_CONTAINER;
+        snprintf(result->message, sizeof(result->message), "file is missing or empty");
+        return;
+    }
+
+    MemoryFile mfOpus = MemoryFileMap(path, 0);
+    OpusVerify(mfOpus.data_u8, mfOpus.size, result);
+    MemoryFileUnmap(&mfOpus);
+}
+
+typedef struct {
+    ListData* paths;
+    OpusLoopCheckResult* results;
+} CheckLoopsJobs;
+
+static void CheckLoopsJob(void* userData, u64 jobIndex) {
+    CheckLoopsJobs* jobs = (CheckLoopsJobs*)userData;
+    const char* path = *(char**)ListGet(jobs->paths, jobIndex);
+    OpusLoopCheckResult* result = jobs->results + jobIndex;
+
+    FileInfo fileInfo;
+    if (FileGetInfo(path, &fileInfo) != 0 || fileInfo.size == 0) {
+        memset(result, 0, sizeof(OpusLoopCheckResult));
+        result->status = OPUS_LOOP_CHECK_ERROR;
+        snprintf(result->message, sizeof(result->message), "file is missing or empty");
+        return;
+    }
+
+    MemoryFile mfOpus = MemoryFileMap(path, 0);
+    OpusCheckLoop(mfOpus.data_u8, mfOpus.size, result);
+    MemoryFileUnmap(&mfOpus);
+}
+
+// peaks streams each decode into a PeaksSink; only the bins are kept.
+typedef struct {
+    ListData* paths;
+    u32 binSamples;
+    u32 levelCount;
+    int json;
+
+    u64* sampleCounts;
+    char (*errors)[160]; // Empty for files written.
+} PeaksJobs;
+
+static void PeaksJob(void* userData, u64 jobIndex) {
+    PeaksJobs* jobs = (PeaksJobs*)userData;
+    const char* path = *(char**)ListGet(jobs->paths, jobIndex);
+    char* error = jobs->errors[jobIndex];
+
+    FileInfo fileInfo;
+    if (FileGetInfo(path, &fileInfo) != 0 || fileInfo.size == 0) {
+        snprintf(error, sizeof(jobs->errors[0]), "file is missing or empty");
+        return;
+    }
+
+    MemoryFile mfOpus = MemoryFileMap(path, 0);
+
+    // The container checks that OpusPreprocess would panic on, plus the
+    // bounds of every chunk; bad packets end the decode with an error.
+    OpusFileHeader* fileHeader = OpusCheckContainer(mfOpus.data_u8, mfOpus.size, 0, error, sizeof(jobs->errors[0]));
+    if (fileHeader == NULL) {
+        MemoryFileUnmap(&mfOpus);
+        return;
+    }
+
+    OpusVariantMetadata metadata;
+    OpusReadVariantMetadata(OpusFindVariant(mfOpus.data_u8, mfOpus.size), mfOpus.data_u8, mfOpus.size, &metadata);
+
+    OpusStreamDecoder streamDecoder;
+    OpusStreamDecoderInit(&streamDecoder, fileHeader, metadata.numSamples, 0, 0);
+
+    char outPath[4096];
+    snprintf(outPath, sizeof(outPath), "%s%s", path, jobs->json ? ".peaks.json" : ".peaks");
+
+    PeaksSink peaksSink = {
+        .path = outPath, .binSamples = jobs->binSamples, .levelCount = jobs->levelCount, .json = jobs->json
+    };
+    // Ended here rather than by OpusDecodeToSinks, so a stream cut short by
+    // a bad packet leaves no peaks file.
+    OpusDecodeSink sink = { &peaksSink, PeaksSinkBegin, PeaksSinkWrite, NULL };
+    jobs->sampleCounts[jobIndex] = OpusDecodeToSinks(&streamDecoder, &sink, 1);
+
+    if (streamDecoder.error[0] != '\0')
+        snprintf(error, sizeof(jobs->errors[0]), "%s", streamDecoder.error);
+    else {
+        PeaksSinkEnd(&peaksSink);
+        if (peaksSink.error[0] != '\0')
+            snprintf(error, sizeof(jobs->errors[0]), "%s", peaksSink.error);
+    }
+
+    OpusStreamDecoderDestroy(&streamDecoder);
+    PcmPeaksDestroy(&peaksSink.peaks);
+    MemoryFileUnmap(&mfOpus);
+}
+
+// diff --decode runs both decoders side by side, one block at a time, so
+// memory stays bounded on multi-hour files.
+#define DIFF_DECODE_BLOCK_SAMPLES (48000 * 10)
+
+typedef struct {
+    OpusStreamDecoder decoders[2];
+    s16* blocks[2];
+    u64 readCounts[2];
+} DiffDecodeJobs;
+
+static void DiffDecodeJob(void* userData, u64 jobIndex) {
+    DiffDecodeJobs* jobs = (DiffDecodeJobs*)userData;
+    jobs->readCounts[jobIndex] = OpusStreamDecoderRead(
+        jobs->decoders + jobIndex, jobs->blocks[jobIndex], DIFF_DECODE_BLOCK_SAMPLES
+    );
+}
+
+typedef struct {
+    int capcom; // Capcom container instead of Nintendo.
+    OpusEncodeProfile profile;
+    const char* path;
+
+    u64 outputSize;
+    PcmQuality quality; // Only with --measure.
+} EncodeOutput;
+
+typedef struct {
+    s16* samples;
+    u32 sampleCount;
+    u32 sampleRate;
+    u32 channelCount;
+
+    u32 loopStart;
+    u32 loopEnd;
+
+    int measure; // Decode each output and measure it against the samples.
+
+    EncodeOutput* outputs;
+} EncodeJobs;
+
+// Parse an output spec of make_multi: FORMAT[:PROFILE]=PATH, where FORMAT is
+// nintendo or capcom and PROFILE defaults to the format's usual profile.
+static void ParseEncodeOutput(const char* spec, ListData* profiles, EncodeOutput* output) {
+    const char* equals = strchr(spec, '=');
+    if (equals == NULL || equals[1] == '\0')
+        panic("Invalid output '%s', expected FORMAT[:PROFILE]=PATH", spec);
+
+    char format[64];
+    snprintf(format, sizeof(format), "%.*s", (int)(equals - spec), spec);
+
+    char* profileName = strchr(format, ':');
+    if (profileName != NULL)
+        *profileName++ = '\0';
+
+    if (strcasecmp(format, "nintendo") == 0)
+        output->capcom = 0;
+    else if (strcasecmp(format, "capcom") == 0)
+        output->capcom = 1;
+    else
+        panic("Invalid output format '%s' in '%s', expected nintendo or capcom", format, spec);
+
+    const OpusEncodeProfile* profile = output->capcom ? OPUS_CAPCOM_PROFILE : OPUS_DEFAULT_PROFILE;
+    if (profileName != NULL && *profileName != '\0') {
+        profile = OpusFindProfile(profiles, profileName);
+        if (profile == NULL)
+            panic("Unknown encoding profile '%s'", profileName);
+    }
+    output->profile = *profile;
+
+    output->path = equals + 1;
+    output->outputSize = 0;
+}
+
+static void EncodeJob(void* userData, u64 jobIndex) {
+    EncodeJobs* jobs = (EncodeJobs*)userData;
+    EncodeOutput* output = jobs->outputs + jobIndex;
+
+    OpusEncodeInput input = {
+        jobs->samples, jobs->sampleCount, jobs->sampleRate, jobs->channelCount,
+        output->profile, output->capcom, jobs->loopStart, jobs->loopEnd
+    };
+    MemoryFile mfOpus = OpusBuildInput(&input, output->profile.bitRate);
+
+    if (jobs->measure)
+        OpusMeasureInput(&input, &mfOpus, &output->quality);
+
+    MemoryFileWrite(&mfOpus, output->path);
+
+    output->outputSize = mfOpus.size;
+    MemoryFileDestroy(&mfOpus);
+}
+
+int main(int argc, char** argv) {
+    // Machine-readable output goes to stdout, so keep it clean.
+    int machineOutput = FindOption(argc, argv, "--json") || FindOption(argc, argv, "--csv") || IsRawToStdout(argc, argv);
+
+    if (!machineOutput) {
+        printf(
+            "Nintendo OPUS <-> WAV converter tool v1.2\n"
+            "https://github.com/conhlee/nopus\n"
+            "\n"
+        );
+    }
+
+    if (argc < 3 || (argc < 4 && !IsPathListCommand(argv[1]) && strcasecmp(argv[1], "decode") != 0)) {
+        printf("usage: %s <make_wav/make_opus/make_capcom_opus/make_capcom_wav> <file in> <file out> [loop_start loop_end|auto|auto-detect]\n", argv[0]);
+        printf("       make_opus/make_capcom_opus: [--profile name] [--profiles profile file] [--seekable entry interval]\n");
+        printf("                                   [--target-size bytes|--target-snr dB] [--jobs thread count] [--measure] [--adapt] [--trim] [--dtx]\n");
+        printf("                                   [--loudness LUFS] [--true-peak dBTP] [--gain dB]\n");
+        printf("       make_wav/make_capcom_wav: [--gain dB] [--preview [--rate hz]] [--raw path|-] [--peaks path] [--hash] [--stats]\n");
+        printf("       %s <decode> <opus in> [--wav path] [--raw path|-] [--peaks path] [--hash] [--stats] [--gain dB] [--preview [--rate hz]]\n", argv[0]);
+        printf("       %s <make_multi> <wav in> <format[:profile]=opus out..> [--loop start:end|auto|auto-detect] [--profiles profile file] [--seekable entry interval] [--jobs thread count] [--measure] [--adapt] [--trim] [--dtx] [--loudness LUFS] [--true-peak dBTP] [--gain dB]\n", argv[0]);
+        printf("       %s <rewrap_capcom> <opus in> <capcom opus out> [loop_start loop_end|auto]\n", argv[0]);
+        printf("       %s <rewrap_nintendo> <capcom opus in> <opus out>\n", argv[0]);
+        printf("       %s <set_loop> <capcom opus> <loop_start loop_end|none>\n", argv[0]);
+        printf("       %s <splice> <opus file> <wav in> <start sample> [--margin packets] [--crossfade samples] [--profile name] [--profiles profile file]\n", argv[0]);
+        printf("       %s <cut> <opus in> <opus out> <start sample> <end sample|end> [--preroll packets] [--format nintendo|capcom] [--loop start:end|auto|none]\n", argv[0]);
+        printf("       %s <transcode> <opus in> <opus out> [--format nintendo|capcom] [--profile name] [--profiles profile file] [--bitrate bps] [--rate hz] [--loop start:end|auto|none] [--seekable entry interval]\n", argv[0]);
+        printf("       %s <repacketize> <opus in> <opus out> [--duration ms] [--pad bytes|max] [--unpad]\n", argv[0]);
+        printf("       %s <ogg_to_opus> <ogg opus in> <opus out> [no_range]\n", argv[0]);
+        printf("       %s <opus_to_ogg> <opus in> <ogg opus out>\n", argv[0]);
+        printf("       %s <info> <opus files/dirs..> [--json|--csv] [--catalog catalog file]\n", argv[0]);
+        printf("       %s <packets> <opus files..> [--json] [--timeline window seconds]\n", argv[0]);
+        printf("       %s <verify> <opus files/dirs..> [--json] [--jobs thread count]\n", argv[0]);
+        printf("       %s <check_loops> <opus files/dirs..> [--json] [--jobs thread count]\n", argv[0]);
+        printf("       %s <peaks> <opus files/dirs..> [--json] [--bin samples] [--levels count] [--jobs thread count]\n", argv[0]);
+        printf("       %s <diff> <opus a> <opus b> [--decode] [--json]\n", argv[0]);
+        printf("       %s <find_loops> <wav/opus files/dirs..> [--json] [--jobs thread count]\n", argv[0]);
+        printf("       %s <loudness> <wav/opus files/dirs..> [--json] [--jobs thread count] [--loudness LUFS] [--true-peak dBTP]\n", argv[0]);
+        printf("       'auto' can be used to automatically set loop from start to end of audio\n");
+        printf("       'auto-detect' searches the loop in the audio (falls back to 'auto')\n");
+        return 1;
+    }
+
+    if (strcasecmp(argv[1], "make_wav") == 0) {
+        if (!machineOutput)
+            printf("- Converting OPUS at path \"%s\" to WAV at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfOpus = MemoryFileCreate(argv[2]);
+        if (!mfOpus.data_void || mfOpus.size == 0) {
+            printf("Error: Could not read input OPUS file.\n");
+            return 1;
+        }
+
+        const OpusVariant* variant = OpusFindVariant(mfOpus.data_u8, mfOpus.size);
+        if (variant == NULL)
+            OpusPreprocess(mfOpus.data_u8); // Reports why (e.g. an Ogg Opus file) and exits.
+        if (variant != OPUS_NINTENDO_VARIANT && !machineOutput)
+            printf("(Detected %s OPUS format)\n", variant->title);
+
+        u64 decodedSamples = DecodeToOutputs(mfOpus.data_u8, mfOpus.size, argv[3], argc, argv);
+        MemoryFileDestroy(&mfOpus);
+
+        if (decodedSamples == 0) {
+            fprintf(machineOutput ? stderr : stdout, "Error: Failed to decode OPUS file.\n");
+            return 1;
+        }
+    }
+    else if (strcasecmp(argv[1], "decode") == 0) {
+        const char* wavPath = GetOptionValue(argc, argv, "--wav");
+
+        if (!machineOutput)
+            printf("- Decoding OPUS at path \"%s\"..\n\n", argv[2]);
+
+        // Mapped, so only the packets being decoded are paged in.
+        MemoryFile mfOpus = MemoryFileMap(argv[2], 0);
+
+        u64 decodedSamples = DecodeToOutputs(mfOpus.data_u8, mfOpus.size, wavPath, argc, argv);
+        MemoryFileUnmap(&mfOpus);
+
+        if (decodedSamples == 0) {
+            fprintf(machineOutput ? stderr : stdout, "Error: Failed to decode OPUS file.\n");
+            return 1;
+        }
+    }
+    else if (strcasecmp(argv[1], "make_opus") == 0) {
+        printf("- Converting WAV at path \"%s\" to OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfWav = MemoryFileCreate(argv[2]);
+        if (!mfWav.data_void || mfWav.size == 0) {
+            printf("Error: Could not read input WAV file.\n");
+            return 1;
+        }
+
+        WavPreprocess(mfWav.data_u8, mfWav.size);
+
+        u32 channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
+        u32 sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+
+        s16* samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
+        u32 sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+
+        if (!samples || sampleCount == 0) {
+            printf("Error: Failed to extract PCM samples from WAV.\n");
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+
+        if (FindOption(argc, argv, "--trim"))
+            TrimInput(samples, &sampleCount, channelCount, sampleRate, NULL, NULL);
+        NormalizeInput(argc, argv, samples, sampleCount, channelCount, sampleRate);
+
+        OpusEncodeProfile profile;
+        GetEncodeProfile(argc, argv, OPUS_DEFAULT_PROFILE, &profile);
+
+        if (FindOption(argc, argv, "--adapt")) {
+            PcmAnalysis analysis;
+            AnalyzeInput(samples, sampleCount, channelCount, sampleRate, &analysis);
+
+            printf("Adapt: ");
+            OpusAdaptProfile(&analysis, channelCount, &profile, stdout);
+        }
+
+        printf("Profile ");
+        OpusPrintProfile(stdout, &profile);
+
+        OpusEncodeInput input = { samples, sampleCount, sampleRate, channelCount, profile, 0, 0, 0 };
+
+        MemoryFile mfOpus = EncodeInput(argc, argv, &input, "Encoding");
+        if (!mfOpus.data_void || mfOpus.size == 0) {
+            printf("Error: Failed to encode OPUS file.\n");
+            free(samples);
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+        
+        free(samples);
+        MemoryFileDestroy(&mfWav);
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOpus, argv[3]);
+        MemoryFileDestroy(&mfOpus);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "make_capcom_opus") == 0) {
+        printf("- Converting WAV at path \"%s\" to Capcom OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        // Parse loop points if provided
+        u32 loopStart = 0;
+        u32 loopEnd = 0;
+        int hasLoopPoints = 0;
+        int useAutoLoop = 0;
+        int useDetectLoop = 0;
+        
+        int positionalCount = CountPositionalArgs(argc, argv);
+
+        if (positionalCount >= 5) {
+            // Check if auto loop was requested
+            if (strcmp(argv[4], "auto") == 0) {
+                useAutoLoop = 1;
+                printf("Auto loop points will be used (0 to end of sample)\n");
+            } else if (strcmp(argv[4], "auto-detect") == 0) {
+                useDetectLoop = 1;
+            } else if (positionalCount >= 6) {
+                loopStart = atoi(argv[4]);
+                loopEnd = atoi(argv[5]);
+                hasLoopPoints = 1;
+                printf("Loop points: start=%u end=%u\n", loopStart, loopEnd);
+            } else {
+                printf("Warning: Both loop_start and loop_end must be provided. Using no loop points.\n");
+            }
+        }
+
+        MemoryFile mfWav = MemoryFileCreate(argv[2]);
+
+        WavPreprocess(mfWav.data_u8, mfWav.size);
+
+        u32 channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
+        u32 sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+
+        s16* samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
+        u32 sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+
+        // Calcular el número de muestras por canal para los puntos de loop
+        u32 samplesPerChannel = (channelCount > 0) ? (sampleCount / channelCount) : 0;
+
+        // Depuración: imprimir información de entrada
+        printf("WAV info: sampleCount=%u, channelCount=%u, sampleRate=%u\n", sampleCount, channelCount, sampleRate);
+        if (!samples || sampleCount == 0 || channelCount == 0) {
+            printf("[ERROR] WAV extraction failed: samples=%p, sampleCount=%u, channelCount=%u\n", (void*)samples, sampleCount, channelCount);
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+
+        if (FindOption(argc, argv, "--trim")) {
+            TrimInput(
+                samples, &sampleCount, channelCount, sampleRate,
+                hasLoopPoints ? &loopStart : NULL, hasLoopPoints ? &loopEnd : NULL
+            );
+            samplesPerChannel = sampleCount / channelCount;
+        }
+        NormalizeInput(argc, argv, samples, sampleCount, channelCount, sampleRate);
+
+        // Detected loops fall back to the auto loop.
+        if (useDetectLoop) {
+            if (DetectLoop(samples, sampleCount, channelCount, sampleRate, &loopStart, &loopEnd))
+                hasLoopPoints = 1;
+            else
+                useAutoLoop = 1;
+        }
+        
+        // For auto loop mode
+        if (useAutoLoop) {
+            loopStart = 0;
+            loopEnd = samplesPerChannel;
+            hasLoopPoints = 1;
+            printf("Using auto loop points: start=0 end=%u samples (%0.3f seconds)\n", 
+                   samplesPerChannel, (float)samplesPerChannel / sampleRate);
+        }
+        // Validate loop points if provided manually
+        else if (hasLoopPoints) {
+            if (loopEnd > samplesPerChannel) {
+                printf("Warning: Loop end exceeds sample count. Clamping to %u samples.\n", samplesPerChannel);
+                loopEnd = samplesPerChannel;
+            }
+            
+            if (loopStart >= loopEnd) {
+                printf("Warning: Loop start must be less than loop end. Disabling loops.\n");
+                loopStart = 0;
+                loopEnd = 0;
+                hasLoopPoints = 0;
+            } else {
+                printf("Validated loop points: start=%u end=%u samples (%0.3f to %0.3f seconds)\n",
+                       loopStart, loopEnd, (float)loopStart / sampleRate, (float)loopEnd / sampleRate);
+            }
+        }
+
+        OpusEncodeProfile profile;
+        GetEncodeProfile(argc, argv, OPUS_CAPCOM_PROFILE, &profile);
+
+        if (FindOption(argc, argv, "--adapt")) {
+            PcmAnalysis analysis;
+            AnalyzeInput(samples, sampleCount, channelCount, sampleRate, &analysis);
+
+            printf("Adapt: ");
+            OpusAdaptProfile(&analysis, channelCount, &profile, stdout);
+        }
+
+        printf("Profile ");
+        OpusPrintProfile(stdout, &profile);
+
+        // Si no hay puntos de loop, se pasan como 0
+        if (!hasLoopPoints) {
+            loopStart = 0;
+            loopEnd = 0;
+        }
+
+        // The frame unit size fields follow the profile; configData uses the default bytes.
+        OpusEncodeInput input = { samples, sampleCount, sampleRate, channelCount, profile, 1, loopStart, loopEnd };
+
+        MemoryFile mfOpus = EncodeInput(argc, argv, &input, "Encoding to Capcom OPUS format");
+        if (!mfOpus.data_void || mfOpus.size == 0) {
+            printf("Error: Failed to encode Capcom OPUS file.\n");
+            free(samples);
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+        
+        free(samples);
+        MemoryFileDestroy(&mfWav);
+
+        printf("Writing Capcom OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOpus, argv[3]);
+        MemoryFileDestroy(&mfOpus);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "make_multi") == 0) {
+        int positionalCount = CountPositionalArgs(argc, argv);
+
+        ListData profiles;
+        LoadEncodeProfiles(argc, argv, &profiles);
+
+        if (positionalCount < 4)
+            panic("make_multi: no outputs given");
+        u32 outputCount = positionalCount - 3;
+        EncodeOutput* outputs = (EncodeOutput*)malloc(sizeof(EncodeOutput) * outputCount);
+        if (outputs == NULL)
+            panic("make_multi: malloc fail");
+
+        // Check every output before spending time on the encode.
+        for (u32 i = 0; i < outputCount; i++) {
+            ParseEncodeOutput(argv[3 + i], &profiles, outputs + i);
+            ApplyProfileOptions(argc, argv, &outputs[i].profile);
+        }
+
+        printf("- Encoding WAV at path \"%s\" to %u outputs..\n\n", argv[2], outputCount);
+
+        MemoryFile mfWav = MemoryFileCreate(argv[2]);
+        if (!mfWav.data_void || mfWav.size == 0) {
+            printf("Error: Could not read input WAV file.\n");
+            return 1;
+        }
+
+        WavPreprocess(mfWav.data_u8, mfWav.size);
+
+        EncodeJobs jobs;
+        jobs.channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
+        jobs.sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+        jobs.samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
+        jobs.sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+        jobs.outputs = outputs;
+        jobs.measure = FindOption(argc, argv, "--measure") != 0;
+
+        MemoryFileDestroy(&mfWav);
+
+        if (!jobs.samples || jobs.sampleCount == 0) {
+            printf("Error: Failed to extract PCM samples from WAV.\n");
+            return 1;
+        }
+
+        // Loop points only apply to the Capcom outputs.
+        jobs.loopStart = 0;
+        jobs.loopEnd = 0;
+
+        const char* loopArg = GetOptionValue(argc, argv, "--loop");
+        int autoLoop = loopArg && strcmp(loopArg, "auto") == 0;
+        int detectLoop = loopArg && strcmp(loopArg, "auto-detect") == 0;
+        if (loopArg && !autoLoop && !detectLoop && sscanf(loopArg, "%u:%u", &jobs.loopStart, &jobs.loopEnd) != 2)
+            panic("Invalid --loop '%s', expected start:end, auto or auto-detect", loopArg);
+
+        if (FindOption(argc, argv, "--trim")) {
+            int hasLoop = loopArg && !autoLoop && !detectLoop;
+            TrimInput(
+                jobs.samples, &jobs.sampleCount, jobs.channelCount, jobs.sampleRate,
+                hasLoop ? &jobs.loopStart : NULL, hasLoop ? &jobs.loopEnd : NULL
+            );
+        }
+
+        if (detectLoop)
+            autoLoop = !DetectLoop(jobs.samples, jobs.sampleCount, jobs.channelCount, jobs.sampleRate, &jobs.loopStart, &jobs.loopEnd);
+        if (autoLoop)
+            jobs.loopEnd = jobs.sampleCount / jobs.channelCount;
+
+        // Check the loop once here rather than in every Capcom encode job.
+        int hasCapcomOutput = 0;
+        for (u32 i = 0; i < outputCount; i++)
+            hasCapcomOutput |= outputs[i].capcom;
+        if (hasCapcomOutput)
+            _OpusCheckCapcomLoop(jobs.sampleCount / jobs.channelCount, &jobs.loopStart, &jobs.loopEnd);
+
+        NormalizeInput(argc, argv, jobs.samples, jobs.sampleCount, jobs.channelCount, jobs.sampleRate);
+
+        if (FindOption(argc, argv, "--adapt")) {
+            PcmAnalysis analysis;
+            AnalyzeInput(jobs.samples, jobs.sampleCount, jobs.channelCount, jobs.sampleRate, &analysis);
+
+            for (u32 i = 0; i < outputCount; i++) {
+                printf("Adapt %s: ", outputs[i].path);
+                OpusAdaptProfile(&analysis, jobs.channelCount, &outputs[i].profile, stdout);
+            }
+        }
+
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
+
+        printf("Encoding..");
+        fflush(stdout);
+
+        JobsRun(outputCount, threadCount, EncodeJob, &jobs);
+
+        printf(" OK\n\n");
+
+        for (u32 i = 0; i < outputCount; i++) {
+            printf(
+                "%s (%s) -> \"%s\" (%llu bytes)\n",
+                outputs[i].capcom ? "capcom" : "nintendo", outputs[i].profile.name,
+                outputs[i].path, (unsigned long long)outputs[i].outputSize
+            );
+            if (jobs.measure) {
+                printf("  ");
+                PrintQuality(&outputs[i].quality);
+                printf("\n");
+            }
+        }
+
+        free(jobs.samples);
+        free(outputs);
+        ListDestroy(&profiles);
+    }
+    else if (strcasecmp(argv[1], "make_capcom_wav") == 0) {
+        if (!machineOutput)
+            printf("- Converting Capcom OPUS at path \"%s\" to WAV at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfOpus = MemoryFileCreate(argv[2]);
+        if (!mfOpus.data_void || mfOpus.size == 0) {
+            printf("Error: Could not read input Capcom OPUS file.\n");
+            return 1;
+        }
+
+        const OpusVariant* variant = OpusFindVariant(mfOpus.data_u8, mfOpus.size);
+        if (variant == NULL || strcmp(variant->name, "capcom") != 0) {
+            printf("Error: Input is not a Capcom OPUS file.\n");
+            MemoryFileDestroy(&mfOpus);
+            return 1;
+        }
+
+        u64 decodedSamples = DecodeToOutputs(mfOpus.data_u8, mfOpus.size, argv[3], argc, argv);
+        MemoryFileDestroy(&mfOpus);
+
+        if (decodedSamples == 0) {
+            printf("Error: Failed to decode Capcom OPUS file.\n");
+            return 1;
+        }
+    }
+    else if (strcasecmp(argv[1], "rewrap_capcom") == 0) {
+        printf("- Rewrapping OPUS at path \"%s\" to Capcom OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfOpus = MemoryFileCreate(argv[2]);
+        if (!mfOpus.data_void || mfOpus.size == 0) {
+            printf("Error: Could not read input OPUS file.\n");
+            return 1;
+        }
+
+        if (OpusIsCapcomFormat(mfOpus.data_u8, mfOpus.size)) {
+            printf("Error: Input is already a Capcom OPUS file.\n");
+            MemoryFileDestroy(&mfOpus);
+            return 1;
+        }
+
+        OpusPreprocess(mfOpus.data_u8);
+
+        u32 loopStart = 0;
+        u32 loopEnd = 0;
+
+        if (argc >= 5) {
+            if (strcmp(argv[4], "auto") == 0) {
+                // Clamped to the sample count by OpusRewrapCapcom.
+                loopEnd = 0xFFFFFFFF;
+                printf("Auto loop points will be used (0 to end of sample)\n");
+            } else if (argc >= 6) {
+                loopStart = strtoul(argv[4], NULL, 10);
+                loopEnd = strtoul(argv[5], NULL, 10);
+                printf("Loop points: start=%u end=%u\n", loopStart, loopEnd);
+            } else {
+                printf("Warning: Both loop_start and loop_end must be provided. Using no loop points.\n");
+            }
+        }
+
+        printf("Rewrapping..");
+        fflush(stdout);
+
+        MemoryFile mfCapcom = OpusRewrapCapcom(mfOpus.data_u8, mfOpus.size, loopStart, loopEnd, NULL);
+        MemoryFileDestroy(&mfOpus);
+
+        printf(" OK\n");
+
+        printf("Writing Capcom OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfCapcom, argv[3]);
+        MemoryFileDestroy(&mfCapcom);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "rewrap_nintendo") == 0) {
+        printf("- Rewrapping Capcom OPUS at path \"%s\" to OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfCapcom = MemoryFileCreate(argv[2]);
+        if (!mfCapcom.data_void || mfCapcom.size == 0) {
+            printf("Error: Could not read input Capcom OPUS file.\n");
+            return 1;
+        }
+
+        if (!OpusIsCapcomFormat(mfCapcom.data_u8, mfCapcom.size)) {
+            printf("Error: Input is not a Capcom OPUS file.\n");
+            MemoryFileDestroy(&mfCapcom);
+            return 1;
+        }
+
+        printf("Rewrapping..");
+        fflush(stdout);
+
+        MemoryFile mfOpus = OpusRewrapNintendo(mfCapcom.data_u8, mfCapcom.size);
+        MemoryFileDestroy(&mfCapcom);
+
+        printf(" OK\n");
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOpus, argv[3]);
+        MemoryFileDestroy(&mfOpus);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "set_loop") == 0) {
+        u32 loopStart = 0;
+        u32 loopEnd = 0;
+
+        if (strcmp(argv[3], "none") == 0) {
+            printf("- Removing loop points from Capcom OPUS at path \"%s\"..\n\n", argv[2]);
+        } else if (argc >= 5) {
+            loopStart = strtoul(argv[3], NULL, 10);
+            loopEnd = strtoul(argv[4], NULL, 10);
+            printf("- Setting loop points of Capcom OPUS at path \"%s\" to start=%u end=%u..\n\n", argv[2], loopStart, loopEnd);
+        } else {
+            printf("Error: Both loop_start and loop_end must be provided (or 'none').\n");
+            return 1;
+        }
+
+        // Only the 8-byte loop field is written; the rest of the file is never read.
+        MemoryFile mfCapcom = MemoryFileMap(argv[2], 1);
+
+        if (!OpusIsCapcomFormat(mfCapcom.data_u8, mfCapcom.size)) {
+            printf("Error: Input is not a Capcom OPUS file (use rewrap_capcom first).\n");
+            MemoryFileUnmap(&mfCapcom);
+            return 1;
+        }
+
+        printf("Patching loop info..");
+        fflush(stdout);
+
+        OpusCapcomSetLoop(mfCapcom.data_u8, loopStart, loopEnd);
+        MemoryFileUnmap(&mfCapcom);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "splice") == 0) {
+        if (CountPositionalArgs(argc, argv) < 5) {
+            printf("Error: splice expects <opus file> <wav in> <start sample>.\n");
+            return 1;
+        }
+
+        u32 startSample = strtoul(argv[4], NULL, 10);
+
+        printf("- Splicing WAV at path \"%s\" into OPUS at path \"%s\" at sample %u..\n\n", argv[3], argv[2], startSample);
+
+        MemoryFile mfWav = MemoryFileCreate(argv[3]);
+
+        WavPreprocess(mfWav.data_u8, mfWav.size);
+
+        u32 channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
+        u32 sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+
+        s16* samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
+        u32 sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+
+        if (!samples || sampleCount == 0) {
+            printf("Error: Failed to extract PCM samples from WAV.\n");
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+
+        // Only the rewritten packets and their final ranges are written.
+        MemoryFile mfOpus = MemoryFileMap(argv[2], 1);
+
+        int isCapcom = OpusIsCapcomFormat(mfOpus.data_u8, mfOpus.size);
+        OpusFileHeader* fileHeader = OpusGetFileHeader(mfOpus.data_u8, mfOpus.size);
+        if (fileHeader->channelCount != channelCount || fileHeader->sampleRate != sampleRate) {
+            printf(
+                "Error: The WAV (%u channels, %uhz) doesn't match the OPUS (%u channels, %uhz).\n",
+                channelCount, sampleRate, fileHeader->channelCount, fileHeader->sampleRate
+            );
+            MemoryFileUnmap(&mfOpus);
+            free(samples);
+            MemoryFileDestroy(&mfWav);
+            return 1;
+        }
+
+        OpusEncodeProfile profile;
+        GetEncodeProfile(argc, argv, isCapcom ? OPUS_CAPCOM_PROFILE : OPUS_DEFAULT_PROFILE, &profile);
+
+        const char* marginArg = GetOptionValue(argc, argv, "--margin");
+        u32 marginPackets = marginArg ? strtoul(marginArg, NULL, 10) : OPUS_SPLICE_MARGIN_PACKETS;
+        const char* crossfadeArg = GetOptionValue(argc, argv, "--crossfade");
+        u32 crossfadeSamples = crossfadeArg ? strtoul(crossfadeArg, NULL, 10) : 0;
+
+        printf("Re-encoding..");
+        fflush(stdout);
+
+        OpusSpliceResult result;
+        OpusSplice(
+            mfOpus.data_u8, mfOpus.size, samples, sampleCount, startSample,
+            &profile, marginPackets, crossfadeSamples, &result
+        );
+
+        MemoryFileUnmap(&mfOpus);
+        free(samples);
+        MemoryFileDestroy(&mfWav);
+
+        printf(" OK\n");
+
+        printf(
+            "Rewrote packets %u-%u (%u of %u)",
+            result.firstPacket, result.firstPacket + result.packetCount - 1, result.packetCount, result.totalPackets
+        );
+        if (result.paddedCount != 0)
+            printf(", %u padded to their original size", result.paddedCount);
+        printf("\n");
+    }
+    else if (strcasecmp(argv[1], "cut") == 0) {
+        if (CountPositionalArgs(argc, argv) < 6) {
+            printf("Error: cut expects <opus in> <opus out> <start sample> <end sample|end>.\n");
+            return 1;
+        }
+
+        MemoryFile mfIn = MemoryFileMap(argv[2], 0);
+
+        int sourceCapcom = OpusIsCapcomFormat(mfIn.data_u8, mfIn.size);
+        OpusFileHeader* fileHeader = OpusGetFileHeader(mfIn.data_u8, mfIn.size);
+
+        int capcom = sourceCapcom;
+        const char* formatArg = GetOptionValue(argc, argv, "--format");
+        if (formatArg && strcasecmp(formatArg, "capcom") == 0)
+            capcom = 1;
+        else if (formatArg && strcasecmp(formatArg, "nintendo") == 0)
+            capcom = 0;
+        else if (formatArg)
+            panic("Unknown output format '%s' (use nintendo or capcom)", formatArg);
+
+        u32 sourceLength = sourceCapcom ?
+            ((OpusCapcomHeader*)mfIn.data_u8)->numSamples :
+            (u32)(OpusGetPacketSampleCount(fileHeader) - fileHeader->preSkipSamples);
+
+        u32 start = strtoul(argv[4], NULL, 10);
+        u32 end = strcmp(argv[5], "end") == 0 ? sourceLength : strtoul(argv[5], NULL, 10);
+
+        printf(
+            "- Cutting samples %u-%u of OPUS at path \"%s\" to %s OPUS at path \"%s\"..\n\n",
+            start, end, argv[2], capcom ? "Capcom" : "Nintendo", argv[3]
+        );
+
+        // Keep the source loop if it lies inside the cut.
+        u32 loopStart = 0, loopEnd = 0;
+        u32 sourceLoopStart, sourceLoopEnd;
+        if (
+            sourceCapcom && OpusCapcomGetLoop(mfIn.data_u8, &sourceLoopStart, &sourceLoopEnd) &&
+            sourceLoopStart >= start && sourceLoopEnd <= end
+        ) {
+            loopStart = sourceLoopStart - start;
+            loopEnd = sourceLoopEnd - start;
+        }
+
+        const char* loopArg = GetOptionValue(argc, argv, "--loop");
+        if (loopArg && strcmp(loopArg, "auto") == 0) {
+            loopStart = 0;
+            loopEnd = end - start;
+        }
+        else if (loopArg && strcmp(loopArg, "none") == 0)
+            loopStart = loopEnd = 0;
+        else if (loopArg && sscanf(loopArg, "%u:%u", &loopStart, &loopEnd) != 2)
+            panic("--loop expects start:end, auto or none");
+
+        if (capcom && (loopStart != 0 || loopEnd != 0))
+            printf("Loop points: start=%u end=%u\n", loopStart, loopEnd);
+
+        const char* prerollArg = GetOptionValue(argc, argv, "--preroll");
+        u32 prerollPackets = prerollArg ? strtoul(prerollArg, NULL, 10) : OPUS_CUT_PREROLL_PACKETS;
+
+        printf("Cutting..");
+        fflush(stdout);
+
+        OpusCutResult result;
+        MemoryFile mfOut = OpusCut(
+            mfIn.data_u8, mfIn.size, start, end, prerollPackets,
+            capcom, loopStart, loopEnd, &result
+        );
+        MemoryFileUnmap(&mfIn);
+
+        printf(" OK\n");
+
+        printf(
+            "Copied packets %u-%u (pre-skip %u samples)\n",
+            result.firstPacket, result.firstPacket + result.packetCount - 1, result.preSkipSamples
+        );
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOut, argv[3]);
+        MemoryFileDestroy(&mfOut);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "repacketize") == 0) {
+        const char* durationArg = GetOptionValue(argc, argv, "--duration");
+        const char* padArg = GetOptionValue(argc, argv, "--pad");
+        int unpad = FindOption(argc, argv, "--unpad") != 0;
+
+        if (durationArg == NULL && padArg == NULL && !unpad)
+            panic("repacketize expects --duration, --pad or --unpad");
+        if (padArg && unpad)
+            panic("--pad and --unpad can't be combined");
+
+        printf("- Repacketizing OPUS at path \"%s\" to OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfIn = MemoryFileMap(argv[2], 0);
+
+        OpusFileHeader* fileHeader = OpusGetFileHeader(mfIn.data_u8, mfIn.size);
+        OpusPreprocess((u8*)fileHeader);
+
+        u32 maxDuration = 0;
+        if (durationArg) {
+            double milliseconds = atof(durationArg);
+            if (milliseconds < 2.5 || milliseconds > 120.0)
+                panic("--duration expects 2.5 to 120 milliseconds");
+            maxDuration = (u32)(milliseconds * fileHeader->sampleRate / 1000.0);
+        }
+
+        int padMode = padArg ? OPUS_REPACKETIZE_PAD : unpad ? OPUS_REPACKETIZE_UNPAD : OPUS_REPACKETIZE_KEEP;
+        u32 padSize = padArg && strcmp(padArg, "max") != 0 ? strtoul(padArg, NULL, 10) : 0;
+        if (padArg && strcmp(padArg, "max") != 0 && padSize == 0)
+            panic("--pad expects a packet size in bytes or max");
+
+        printf("Repacketizing..");
+        fflush(stdout);
+
+        OpusRepacketizeResult result;
+        MemoryFile mfOut = OpusRepacketize(mfIn.data_u8, mfIn.size, maxDuration, padMode, padSize, &result);
+        MemoryFileUnmap(&mfIn);
+
+        printf(" OK\n");
+
+        printf(
+            "Packets: %u -> %u, data: %llu -> %llu bytes (%+.2f%%)\n",
+            result.packetCountBefore, result.packetCountAfter,
+            (unsigned long long)result.dataSizeBefore, (unsigned long long)result.dataSizeAfter,
+            result.dataSizeBefore != 0 ? 100.0 * ((double)result.dataSizeAfter - result.dataSizeBefore) / result.dataSizeBefore : 0.0
+        );
+        if (padMode == OPUS_REPACKETIZE_PAD) {
+            printf("Padded %u packets to %u bytes", result.paddedCount, result.padSize);
+            if (result.oversizeCount != 0)
+                printf(", %u were already larger", result.oversizeCount);
+            printf("\n");
+        }
+        if (padMode == OPUS_REPACKETIZE_UNPAD)
+            printf("Stripped padding from %u packets\n", result.unpaddedCount);
+        if (result.frameUnitSize != 0)
+            printf("Fixed packet size: %u bytes (packet header included)\n", result.frameUnitSize);
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOut, argv[3]);
+        MemoryFileDestroy(&mfOut);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "transcode") == 0) {
+        MemoryFile mfIn = MemoryFileMap(argv[2], 0);
+
+        const OpusVariant* variant = OpusFindVariant(mfIn.data_u8, mfIn.size);
+        if (variant == NULL)
+            OpusPreprocess(mfIn.data_u8); // Reports why (e.g. an Ogg Opus file) and exits.
+
+        OpusFileHeader* fileHeader = (OpusFileHeader*)(mfIn.data_u8 + variant->locateHeader(mfIn.data_u8, mfIn.size));
+        OpusPreprocess((u8*)fileHeader);
+
+        OpusVariantMetadata metadata;
+        OpusReadVariantMetadata(variant, mfIn.data_u8, mfIn.size, &metadata);
+
+        int sourceCapcom = strcmp(variant->name, "capcom") == 0;
+
+        int capcom = sourceCapcom;
+        const char* formatArg = GetOptionValue(argc, argv, "--format");
+        if (formatArg && strcasecmp(formatArg, "capcom") == 0)
+            capcom = 1;
+        else if (formatArg && strcasecmp(formatArg, "nintendo") == 0)
+            capcom = 0;
+        else if (formatArg)
+            panic("Unknown output format '%s' (use nintendo or capcom)", formatArg);
+
+        const char* rateArg = GetOptionValue(argc, argv, "--rate");
+        u32 sampleRate = rateArg ? (u32)atoi(rateArg) : fileHeader->sampleRate;
+        if (sampleRate != 8000 && sampleRate != 12000 && sampleRate != 16000 && sampleRate != 24000 && sampleRate != 48000)
+            panic("--rate must be 8000, 12000, 16000, 24000 or 48000");
+
+        const char* bitRateArg = GetOptionValue(argc, argv, "--bitrate");
+        int bitRate = bitRateArg ? atoi(bitRateArg) : 0;
+        if (bitRateArg && (bitRate < OPUS_TARGET_BITRATE_MIN || bitRate > OPUS_TARGET_BITRATE_MAX))
+            panic("--bitrate must be between %d and %d", OPUS_TARGET_BITRATE_MIN, OPUS_TARGET_BITRATE_MAX);
+
+        printf(
+            "- Transcoding %s OPUS at path \"%s\" to %s OPUS at path \"%s\"..\n\n",
+            variant->title, argv[2], capcom ? "Capcom" : "Nintendo", argv[3]
+        );
+
+        OpusEncodeProfile profile;
+        GetEncodeProfile(argc, argv, capcom ? OPUS_CAPCOM_PROFILE : OPUS_DEFAULT_PROFILE, &profile);
+
+        if (bitRateArg)
+            profile.bitRate = bitRate;
+
+        printf("Profile ");
+        OpusPrintProfile(stdout, &profile);
+
+        u32 length = OpusTranscodeLength(fileHeader, metadata.numSamples, sampleRate);
+
+        // The source loop is kept, moved to the output rate.
+        u32 loopStart = 0, loopEnd = 0;
+        if (metadata.hasLoop) {
+            loopStart = (u32)(((u64)metadata.loopStart * sampleRate + fileHeader->sampleRate / 2) / fileHeader->sampleRate);
+            loopEnd = (u32)(((u64)metadata.loopEnd * sampleRate + fileHeader->sampleRate / 2) / fileHeader->sampleRate);
+        }
+
+        const char* loopArg = GetOptionValue(argc, argv, "--loop");
+        if (loopArg && strcmp(loopArg, "auto") == 0) {
+            loopStart = 0;
+            loopEnd = length;
+        }
+        else if (loopArg && strcmp(loopArg, "none") == 0)
+            loopStart = loopEnd = 0;
+        else if (loopArg && sscanf(loopArg, "%u:%u", &loopStart, &loopEnd) != 2)
+            panic("--loop expects start:end, auto or none");
+
+        if (capcom && (loopStart != 0 || loopEnd != 0))
+            printf("Loop points: start=%u end=%u\n", loopStart, loopEnd);
+
+        printf("Transcoding..");
+        fflush(stdout);
+
+        MemoryFile mfOut = OpusTranscode(
+            fileHeader, metadata.numSamples, sampleRate, &profile, capcom, loopStart, loopEnd,
+            sourceCapcom ? ((OpusCapcomHeader*)mfIn.data_u8)->configData : NULL
+        );
+        MemoryFileUnmap(&mfIn);
+
+        printf(" OK\n");
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOut, argv[3]);
+
+        printf(" OK (%llu bytes, %u samples at %uhz)\n", (unsigned long long)mfOut.size, length, sampleRate);
+        MemoryFileDestroy(&mfOut);
+    }
+    else if (strcasecmp(argv[1], "ogg_to_opus") == 0) {
+        printf("- Remuxing Ogg Opus at path \"%s\" to OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        // The final range is only needed by tools that verify it; skipping it avoids the decode.
+        int computeFinalRange = !(argc >= 5 && strcmp(argv[4], "no_range") == 0);
+
+        MemoryFile mfOgg = MemoryFileMap(argv[2], 0);
+
+        printf(computeFinalRange ? "Remuxing (recomputing final ranges).." : "Remuxing..");
+        fflush(stdout);
+
+        MemoryFile mfOpus = OggOpusImport(mfOgg.data_u8, mfOgg.size, computeFinalRange);
+        MemoryFileUnmap(&mfOgg);
+
+        printf(" OK\n");
+
+        printf("Writing OPUS..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOpus, argv[3]);
+        MemoryFileDestroy(&mfOpus);
+
+        printf(" OK\n");
+    }
+    else if (strcasecmp(argv[1], "opus_to_ogg") == 0) {
+        printf("- Remuxing OPUS at path \"%s\" to Ogg Opus at path \"%s\"..\n\n", argv[2], argv[3]);
+
+        MemoryFile mfOpus = MemoryFileMap(argv[2], 0);
 
-#include <libgen.h>
-#include <string.h>
-#include "type.h"
+        // Wrappers like Capcom's store the exact length; plain Nintendo files keep the whole last packet.
+        const OpusVariant* variant = OpusFindVariant(mfOpus.data_u8, mfOpus.size);
+        if (variant != NULL && variant != OPUS_NINTENDO_VARIANT)
+            printf("(Detected %s OPUS format)\n", variant->title);
 
-// Helper para obtener el nombre base sin extensión
-char* baseName(const char* path) {
-    static char buf[256];
-    snprintf(buf, sizeof(buf), "%s", path);
-    char* base = basename(buf);
-    char* dot = strrchr(base, '.');
-    if (dot) *dot = '\0';
-    return base;
-}
+        OpusVariantMetadata metadata;
+        OpusReadVariantMetadata(variant, mfOpus.data_u8, mfOpus.size, &metadata);
+        u32 numSamples = metadata.numSamples;
 
-int main(int argc, char** argv) {
-    printf(
-        "Nintendo OPUS <-> WAV converter tool v1.2\n"
-        "https://github.com/conhlee/nopus\n"
-        "\n"
-    );
+        OpusFileHeader* fileHeader = OpusGetFileHeader(mfOpus.data_u8, mfOpus.size);
+        OpusPreprocess((u8*)fileHeader);
 
-    if (argc < 4) {
-        printf("usage: %s <make_wav/make_opus/make_capcom_opus/make_capcom_wav> <file in> <file out> [loop_start loop_end|auto]\n", argv[0]);
-        printf("       'auto' can be used to automatically set loop from start to end of audio\n");
-        return 1;
+        printf("Remuxing..");
+        fflush(stdout);
+
+        MemoryFile mfOgg = OggOpusExport(fileHeader, numSamples);
+        MemoryFileUnmap(&mfOpus);
+
+        printf(" OK\n");
+
+        printf("Writing Ogg Opus..");
+        fflush(stdout);
+
+        MemoryFileWrite(&mfOgg, argv[3]);
+        MemoryFileDestroy(&mfOgg);
+
+        printf(" OK\n");
     }
+    else if (strcasecmp(argv[1], "info") == 0) {
+        int printFormat = OPUS_PRINT_TEXT;
+        if (FindOption(argc, argv, "--json"))
+            printFormat = OPUS_PRINT_JSON;
+        else if (FindOption(argc, argv, "--csv"))
+            printFormat = OPUS_PRINT_CSV;
 
-    if (strcasecmp(argv[1], "make_wav") == 0) {
-        printf("- Converting OPUS at path \"%s\" to WAV at path \"%s\"..\n\n", argv[2], argv[3]);
+        const char* catalogPath = GetOptionValue(argc, argv, "--catalog");
 
-        MemoryFile mfOpus = MemoryFileCreate(argv[2]);
-        if (!mfOpus.data_void || mfOpus.size == 0) {
-            printf("Error: Could not read input OPUS file.\n");
-            return 1;
-        }
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, OpusExtensions, &paths);
 
-        u32 channelCount, sampleRate;
-        ListData samples;
+        ListData catalog;
+        OpusCatalogLoad(catalogPath ? catalogPath : "", &catalog);
 
-        if (OpusIsCapcomFormat(mfOpus.data_u8, mfOpus.size)) {
-            printf("(Detected Capcom OPUS format)\n");
-            channelCount = OpusCapcomGetChannelCount(mfOpus.data_u8);
-            sampleRate   = OpusCapcomGetSampleRate(mfOpus.data_u8);
+        ListData entries;
+        ListInit(&entries, sizeof(OpusCatalogEntry), paths.elementCount + 1);
 
-            printf("Decoding..");
-            fflush(stdout);
+        u64 probedCount = 0;
+        u64 printedCount = 0;
 
-            samples = OpusDecodeCapcom(mfOpus.data_u8);
-        } else {
-            OpusPreprocess(mfOpus.data_u8);
-            channelCount = OpusGetChannelCount(mfOpus.data_u8);
-            sampleRate   = OpusGetSampleRate(mfOpus.data_u8);
+        OpusPrintProbeHeader(stdout, printFormat);
 
-            printf("Decoding..");
-            fflush(stdout);
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            const char* path = *(char**)ListGet(&paths, i);
+
+            // Files that can't be read get an error entry (and no catalog entry);
+            // the scan goes on.
+            FileInfo fileInfo;
+            if (FileGetInfo(path, &fileInfo) != 0) {
+                OpusPrintProbeError(stdout, printFormat, printedCount++, path, "could not stat the file");
+                continue;
+            }
+
+            OpusCatalogEntry entry = {0};
 
-            samples = OpusDecode(mfOpus.data_u8);
+            // Unchanged files are served from the catalog without opening them.
+            OpusCatalogEntry* cached = OpusCatalogFind(&catalog, path);
+            if (cached && cached->size == fileInfo.size && cached->modifiedTime == fileInfo.modifiedTime)
+                entry = *cached;
+            else {
+                entry.size = fileInfo.size;
+                entry.modifiedTime = fileInfo.modifiedTime;
+
+                int probeResult = OpusProbe(path, fileInfo.size, &entry.info);
+                if (probeResult < 0) {
+                    OpusPrintProbeError(stdout, printFormat, printedCount++, path, "could not read the file");
+                    continue;
+                }
+                entry.valid = probeResult == 0;
+                probedCount++;
+            }
+            entry.path = strdup(path);
+
+            OpusPrintProbeInfo(stdout, printFormat, printedCount++, path, &entry.info, entry.valid);
+
+            ListAdd(&entries, &entry);
         }
 
-        if (!samples.data || samples.elementCount == 0) {
-            printf("Error: Failed to decode OPUS file.\n");
-            MemoryFileDestroy(&mfOpus);
-            return 1;
+        OpusPrintProbeFooter(stdout, printFormat);
+
+        if (catalogPath) {
+            OpusCatalogMerge(&entries, &catalog);
+            OpusCatalogSave(catalogPath, &entries);
+
+            if (!machineOutput)
+                printf("\nCatalog: %llu files, %llu probed\n", (unsigned long long)paths.elementCount, (unsigned long long)probedCount);
         }
+        else
+            OpusCatalogDestroy(&catalog);
 
-        printf(" OK\n");
+        OpusCatalogDestroy(&entries);
+        DestroyInputPaths(&paths);
+    }
+    else if (strcasecmp(argv[1], "packets") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
 
-        MemoryFileDestroy(&mfOpus);
+        const char* timelineArg = GetOptionValue(argc, argv, "--timeline");
+        double timelineWindow = timelineArg ? atof(timelineArg) : 1.0;
 
-        printf("Creating WAV..");
-        fflush(stdout);
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, OpusExtensions, &paths);
 
-        MemoryFile mfWav = WavBuild(
-            (s16*)samples.data, samples.elementCount,
-            sampleRate, channelCount
-        );
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("[\n");
 
-        ListDestroy(&samples);
+        u64 failedCount = 0;
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            const char* path = *(char**)ListGet(&paths, i);
 
-        if (!mfWav.data_void || mfWav.size == 0) {
-            printf("Error: Failed to build WAV file.\n");
-            return 1;
+            if (printFormat == OPUS_PRINT_JSON && i != 0)
+                printf(",\n");
+            else if (printFormat == OPUS_PRINT_TEXT && i != 0)
+                printf("\n");
+
+            // A bad file gets an error entry; the others are still listed.
+            FileInfo fileInfo;
+            if (FileGetInfo(path, &fileInfo) != 0 || fileInfo.size == 0) {
+                OpusPrintPacketStatsError(stdout, printFormat, path, "file is missing or empty");
+                failedCount++;
+                continue;
+            }
+
+            MemoryFile mfOpus = MemoryFileMap(path, 0);
+
+            char error[160];
+            OpusFileHeader* fileHeader = OpusCheckContainer(mfOpus.data_u8, mfOpus.size, 1, error, sizeof(error));
+            if (fileHeader == NULL) {
+                OpusPrintPacketStatsError(stdout, printFormat, path, error);
+                MemoryFileUnmap(&mfOpus);
+                failedCount++;
+                continue;
+            }
+
+            OpusPacketStats stats;
+            OpusAnalyzePackets(fileHeader, mfOpus.size - ((u8*)fileHeader - mfOpus.data_u8), timelineWindow, &stats);
+
+            OpusPrintPacketStats(stdout, printFormat, path, fileHeader, &stats);
+
+            // Wrappers like Capcom's store their own length; flag files where it disagrees with the packets.
+            OpusVariantMetadata metadata;
+            OpusReadVariantMetadata(OpusFindVariant(mfOpus.data_u8, mfOpus.size), mfOpus.data_u8, mfOpus.size, &metadata);
+            if (printFormat == OPUS_PRINT_TEXT && metadata.numSamples != 0) {
+                u64 packetSamples = stats.totalSamples - MIN(stats.totalSamples, (u64)fileHeader->preSkipSamples);
+                printf(
+                    "container num_samples=%u (%s the packets)\n", metadata.numSamples,
+                    metadata.numSamples <= packetSamples ? "within" : "EXCEEDS"
+                );
+            }
+
+            OpusPacketStatsDestroy(&stats);
+            MemoryFileUnmap(&mfOpus);
         }
 
-        MemoryFileWrite(&mfWav, argv[3]);
-        MemoryFileDestroy(&mfWav);
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("]\n");
 
-        printf(" OK\n");
-    }
-    else if (strcasecmp(argv[1], "make_opus") == 0) {
-        printf("- Converting WAV at path \"%s\" to OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+        DestroyInputPaths(&paths);
 
-        MemoryFile mfWav = MemoryFileCreate(argv[2]);
-        if (!mfWav.data_void || mfWav.size == 0) {
-            printf("Error: Could not read input WAV file.\n");
+        if (failedCount != 0)
             return 1;
+    }
+    else if (strcasecmp(argv[1], "verify") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
+
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
+
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, OpusExtensions, &paths);
+
+        OpusVerifyResult* results = (OpusVerifyResult*)calloc(paths.elementCount + 1, sizeof(OpusVerifyResult));
+        if (results == NULL)
+            panic("verify: malloc fail");
+
+        if (!machineOutput) {
+            printf("Verifying %llu files..", (unsigned long long)paths.elementCount);
+            fflush(stdout);
         }
 
-        WavPreprocess(mfWav.data_u8, mfWav.size);
+        VerifyJobs jobs = { &paths, results };
+        JobsRun(paths.elementCount, threadCount, VerifyJob, &jobs);
 
-        u32 channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
-        u32 sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+        if (!machineOutput)
+            printf(" OK\n\n");
 
-        s16* samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
-        u32 sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+        // Results are printed in input order, whichever thread finished first.
+        u64 badCount = 0;
 
-        if (!samples || sampleCount == 0) {
-            printf("Error: Failed to extract PCM samples from WAV.\n");
-            MemoryFileDestroy(&mfWav);
-            return 1;
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("[\n");
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            OpusPrintVerifyResult(stdout, printFormat, i, *(char**)ListGet(&paths, i), results + i);
+            if (results[i].status != OPUS_VERIFY_OK)
+                badCount++;
         }
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("\n]\n");
 
-        printf("Encoding..");
-        fflush(stdout);
+        if (!machineOutput)
+            printf("\n%llu of %llu files failed verification\n", (unsigned long long)badCount, (unsigned long long)paths.elementCount);
 
-        MemoryFile mfOpus = OpusBuild(samples, sampleCount, sampleRate, channelCount);
-        if (!mfOpus.data_void || mfOpus.size == 0) {
-            printf("Error: Failed to encode OPUS file.\n");
-            free(samples);
-            MemoryFileDestroy(&mfWav);
+        free(results);
+        DestroyInputPaths(&paths);
+
+        if (badCount != 0)
             return 1;
+    }
+    else if (strcasecmp(argv[1], "check_loops") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
+
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
+
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, OpusExtensions, &paths);
+
+        OpusLoopCheckResult* results = (OpusLoopCheckResult*)calloc(paths.elementCount + 1, sizeof(OpusLoopCheckResult));
+        if (results == NULL)
+            panic("check_loops: malloc fail");
+
+        if (!machineOutput) {
+            printf("Checking loops of %llu files..", (unsigned long long)paths.elementCount);
+            fflush(stdout);
         }
 
-        printf(" OK\n");
-        
-        free(samples);
-        MemoryFileDestroy(&mfWav);
+        CheckLoopsJobs jobs = { &paths, results };
+        JobsRun(paths.elementCount, threadCount, CheckLoopsJob, &jobs);
 
-        printf("Writing OPUS..");
-        fflush(stdout);
+        if (!machineOutput)
+            printf(" OK\n\n");
 
-        MemoryFileWrite(&mfOpus, argv[3]);
-        MemoryFileDestroy(&mfOpus);
+        u64 loopCount = 0;
+        u64 badCount = 0;
 
-        printf(" OK\n");
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("[\n");
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            OpusPrintLoopCheckResult(stdout, printFormat, i, *(char**)ListGet(&paths, i), results + i);
+            if (results[i].status != OPUS_LOOP_CHECK_NO_LOOP)
+                loopCount++;
+            if (results[i].status == OPUS_LOOP_CHECK_BAD || results[i].status == OPUS_LOOP_CHECK_ERROR)
+                badCount++;
+        }
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("\n]\n");
+
+        if (!machineOutput)
+            printf("\n%llu of %llu loops are bad or could not be checked\n", (unsigned long long)badCount, (unsigned long long)loopCount);
+
+        free(results);
+        DestroyInputPaths(&paths);
+
+        if (badCount != 0)
+            return 1;
     }
-    else if (strcasecmp(argv[1], "make_capcom_opus") == 0) {
-        printf("- Converting WAV at path \"%s\" to Capcom OPUS at path \"%s\"..\n\n", argv[2], argv[3]);
+    else if (strcasecmp(argv[1], "peaks") == 0) {
+        int json = FindOption(argc, argv, "--json");
 
-        // Parse loop points if provided
-        u32 loopStart = 0;
-        u32 loopEnd = 0;
-        int hasLoopPoints = 0;
-        int useAutoLoop = 0;
-        
-        if (argc >= 5) {
-            // Check if auto loop was requested
-            if (strcmp(argv[4], "auto") == 0) {
-                useAutoLoop = 1;
-                printf("Auto loop points will be used (0 to end of sample)\n");
-            } else if (argc >= 6) {
-                loopStart = atoi(argv[4]);
-                loopEnd = atoi(argv[5]);
-                hasLoopPoints = 1;
-                printf("Loop points: start=%u end=%u\n", loopStart, loopEnd);
-            } else {
-                printf("Warning: Both loop_start and loop_end must be provided. Using no loop points.\n");
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
+
+        PeaksJobs jobs;
+        GetPeaksOptions(argc, argv, &jobs.binSamples, &jobs.levelCount);
+        jobs.json = json;
+
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, OpusExtensions, &paths);
+
+        jobs.paths = &paths;
+        jobs.sampleCounts = (u64*)calloc(paths.elementCount + 1, sizeof(u64));
+        jobs.errors = (char (*)[160])calloc(paths.elementCount + 1, sizeof(jobs.errors[0]));
+        if (jobs.sampleCounts == NULL || jobs.errors == NULL)
+            panic("peaks: malloc fail");
+
+        if (!machineOutput) {
+            printf("Building peaks of %llu files..", (unsigned long long)paths.elementCount);
+            fflush(stdout);
+        }
+
+        JobsRun(paths.elementCount, threadCount, PeaksJob, &jobs);
+
+        if (!machineOutput)
+            printf(" OK\n\n");
+
+        u64 failedCount = 0;
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            const char* path = *(char**)ListGet(&paths, i);
+            if (jobs.errors[i][0] != '\0') {
+                printf("ERR  %s: %s\n", path, jobs.errors[i]);
+                failedCount++;
             }
+            else if (!machineOutput)
+                printf("OK   %s%s (%llu samples)\n", path, json ? ".peaks.json" : ".peaks", (unsigned long long)jobs.sampleCounts[i]);
         }
 
-        MemoryFile mfWav = MemoryFileCreate(argv[2]);
+        free(jobs.errors);
+        free(jobs.sampleCounts);
+        DestroyInputPaths(&paths);
 
-        WavPreprocess(mfWav.data_u8, mfWav.size);
+        if (failedCount != 0)
+            return 1;
+    }
+    else if (strcasecmp(argv[1], "find_loops") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
 
-        u32 channelCount = WavGetChannelCount(mfWav.data_u8, mfWav.size);
-        u32 sampleRate = WavGetSampleRate(mfWav.data_u8, mfWav.size);
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
 
-        s16* samples = WavGetPCM16(mfWav.data_u8, mfWav.size);
-        u32 sampleCount = WavGetSampleCount(mfWav.data_u8, mfWav.size);
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, AudioExtensions, &paths);
 
-        // Calcular el número de muestras por canal para los puntos de loop
-        u32 samplesPerChannel = (channelCount > 0) ? (sampleCount / channelCount) : 0;
+        PcmLoop* loops = (PcmLoop*)calloc(paths.elementCount + 1, sizeof(PcmLoop));
+        int* found = (int*)calloc(paths.elementCount + 1, sizeof(int));
+        u32* sampleRates = (u32*)calloc(paths.elementCount + 1, sizeof(u32));
+        char (*errors)[160] = (char (*)[160])calloc(paths.elementCount + 1, sizeof(errors[0]));
+        if (loops == NULL || found == NULL || sampleRates == NULL || errors == NULL)
+            panic("find_loops: malloc fail");
 
-        // Depuración: imprimir información de entrada
-        printf("WAV info: sampleCount=%u, channelCount=%u, sampleRate=%u\n", sampleCount, channelCount, sampleRate);
-        if (!samples || sampleCount == 0 || channelCount == 0) {
-            printf("[ERROR] WAV extraction failed: samples=%p, sampleCount=%u, channelCount=%u\n", (void*)samples, sampleCount, channelCount);
-            MemoryFileDestroy(&mfWav);
-            return 1;
-        }
-        
-        // For auto loop mode
-        if (useAutoLoop) {
-            loopStart = 0;
-            loopEnd = samplesPerChannel;
-            hasLoopPoints = 1;
-            printf("Using auto loop points: start=0 end=%u samples (%0.3f seconds)\n", 
-                   samplesPerChannel, (float)samplesPerChannel / sampleRate);
+        if (!machineOutput) {
+            printf("Searching loops in %llu files..", (unsigned long long)paths.elementCount);
+            fflush(stdout);
         }
-        // Validate loop points if provided manually
-        else if (hasLoopPoints) {
-            if (loopEnd > samplesPerChannel) {
-                printf("Warning: Loop end exceeds sample count. Clamping to %u samples.\n", samplesPerChannel);
-                loopEnd = samplesPerChannel;
+
+        FindLoopsJobs jobs = { &paths, loops, found, sampleRates, errors };
+        JobsRun(paths.elementCount, threadCount, FindLoopsJob, &jobs);
+
+        if (!machineOutput)
+            printf(" OK\n\n");
+
+        u64 missingCount = 0;
+        u64 failedCount = 0;
+
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("[\n");
+        for (u64 i = 0; i < paths.elementCount; i++) {
+            const char* path = *(char**)ListGet(&paths, i);
+            const PcmLoop* loop = loops + i;
+
+            if (errors[i][0] != '\0') {
+                OpusPrintProbeError(stdout, printFormat, i, path, errors[i]);
+                failedCount++;
+                continue;
             }
-            
-            if (loopStart >= loopEnd) {
-                printf("Warning: Loop start must be less than loop end. Disabling loops.\n");
-                loopStart = 0;
-                loopEnd = 0;
-                hasLoopPoints = 0;
-            } else {
-                printf("Validated loop points: start=%u end=%u samples (%0.3f to %0.3f seconds)\n",
-                       loopStart, loopEnd, (float)loopStart / sampleRate, (float)loopEnd / sampleRate);
+
+            if (printFormat == OPUS_PRINT_JSON) {
+                printf("%s  {\"path\": ", i != 0 ? ",\n" : "");
+                OpusPrintJsonString(stdout, path);
+                if (found[i]) {
+                    printf(
+                        ", \"loop_start\": %u, \"loop_end\": %u, \"seam_db\": %.2f, \"repeat_seconds\": %.2f, \"seamless\": %s}",
+                        loop->loopStart, loop->loopEnd, loop->discontinuity, loop->repeatSeconds, loop->seamless ? "true" : "false"
+                    );
+                }
+                else
+                    printf(", \"loop_start\": null, \"loop_end\": null}");
             }
-        }
+            else if (found[i]) {
+                printf("%s: ", path);
+                PrintLoop(loop, jobs.sampleRates[i]);
+                printf("\n");
+            }
+            else
+                printf("%s: no loop found\n", path);
 
-        printf("Encoding to Capcom OPUS format..");
-        fflush(stdout);
+            if (!found[i])
+                missingCount++;
+        }
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("\n]\n");
 
-        // Si no hay puntos de loop, se pasan como 0
-        if (!hasLoopPoints) {
-            loopStart = 0;
-            loopEnd = 0;
+        if (!machineOutput) {
+            printf("\n%llu of %llu files without a loop\n", (unsigned long long)missingCount, (unsigned long long)paths.elementCount);
+            if (failedCount != 0)
+                printf("%llu files could not be read\n", (unsigned long long)failedCount);
         }
 
-        // (Llamada antigua eliminada, solo se usa la versión extendida más abajo)
-        // Usar valores por defecto para configData y criticalBytes, y no igualar tamaños de paquetes
-        u8 configData[16] = {0x00, 0x77, 0xC1, 0x02, 0x04, 0x00, 0x00, 0x00, 0xE6, 0x07, 0x0C, 0x0E, 0x0D, 0x10, 0x23, 0x00};
-        u8 criticalBytes[8] = {0x00, 0x02, 0xF8, 0x00, 0x80, 0xBB, 0x00, 0x00};
-        MemoryFile mfOpus = OpusBuildCapcom(samples, sampleCount, sampleRate, channelCount, loopStart, loopEnd, configData, criticalBytes, NULL, 0);
-        if (!mfOpus.data_void || mfOpus.size == 0) {
-            printf("Error: Failed to encode Capcom OPUS file.\n");
-            free(samples);
-            MemoryFileDestroy(&mfWav);
+        free(errors);
+        free(sampleRates);
+        free(found);
+        free(loops);
+        DestroyInputPaths(&paths);
+
+        if (failedCount != 0)
             return 1;
-        }
+    }
+    else if (strcasecmp(argv[1], "loudness") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
 
-        printf(" OK\n");
-        
-        free(samples);
-        MemoryFileDestroy(&mfWav);
+        const char* jobsArg = GetOptionValue(argc, argv, "--jobs");
+        u32 threadCount = jobsArg ? (u32)atoi(jobsArg) : 0;
 
-        printf("Writing Capcom OPUS..");
-        fflush(stdout);
+        const char* targetArg = GetOptionValue(argc, argv, "--loudness");
+        double target = targetArg ? atof(targetArg) : 0.0;
 
-        MemoryFileWrite(&mfOpus, argv[3]);
-        MemoryFileDestroy(&mfOpus);
+        ListData paths;
+        CollectInputPaths(argc, argv, 2, AudioExtensions, &paths);
+        if (paths.elementCount == 0)
+            panic("loudness: no input files");
 
-        printf(" OK\n");
-    }
-    else if (strcasecmp(argv[1], "make_capcom_wav") == 0) {
-        printf("- Converting Capcom OPUS at path \"%s\" to WAV at path \"%s\"..\n\n", argv[2], argv[3]);
+        PcmLoudnessMeter* meters = (PcmLoudnessMeter*)calloc(paths.elementCount, sizeof(PcmLoudnessMeter));
+        char (*errors)[160] = (char (*)[160])calloc(paths.elementCount, sizeof(errors[0]));
+        if (meters == NULL || errors == NULL)
+            panic("loudness: malloc fail");
 
-        MemoryFile mfOpus = MemoryFileCreate(argv[2]);
-        if (!mfOpus.data_void || mfOpus.size == 0) {
-            printf("Error: Could not read input Capcom OPUS file.\n");
-            return 1;
+        if (!machineOutput) {
+            printf("Measuring %llu files..", (unsigned long long)paths.elementCount);
+            fflush(stdout);
         }
 
-        u32 channelCount = OpusCapcomGetChannelCount(mfOpus.data_u8);
-        u32 sampleRate   = OpusCapcomGetSampleRate(mfOpus.data_u8);
+        LoudnessJobs jobs = { &paths, meters, errors };
+        JobsRun(paths.elementCount, threadCount, LoudnessJob, &jobs);
 
-        printf("Decoding Capcom OPUS (channels=%u, sampleRate=%u)..", channelCount, sampleRate);
-        fflush(stdout);
+        if (!machineOutput)
+            printf(" OK\n\n");
 
-        ListData samples = OpusDecodeCapcom(mfOpus.data_u8);
-        if (!samples.data || samples.elementCount == 0) {
-            printf("Error: Failed to decode Capcom OPUS file.\n");
-            MemoryFileDestroy(&mfOpus);
-            return 1;
-        }
+        // Every file on its own, then all of them gated together as an album
+        // (files that failed add nothing to it).
+        u64 failedCount = 0;
+        if (printFormat == OPUS_PRINT_JSON)
+            printf("{\"tracks\": [\n");
+        for (u64 i = 0; i <= paths.elementCount; i++) {
+            int album = i == paths.elementCount;
+            if (album && paths.elementCount == 1 && printFormat != OPUS_PRINT_JSON)
+                break;
 
-        printf(" OK\n");
-        MemoryFileDestroy(&mfOpus);
+            if (!album && errors[i][0] != '\0') {
+                OpusPrintProbeError(stdout, printFormat, i, *(char**)ListGet(&paths, i), errors[i]);
+                failedCount++;
+                continue;
+            }
 
-        printf("Creating WAV..");
-        fflush(stdout);
+            PcmLoudness loudness;
+            if (album)
+                PcmLoudnessResult(meters, (u32)paths.elementCount, &loudness);
+            else
+                PcmLoudnessResult(meters + i, 1, &loudness);
 
-        MemoryFile mfWav = WavBuild(
-            (s16*)samples.data, samples.elementCount,
-            sampleRate, channelCount
-        );
+            int limited = 0;
+            double gain = targetArg ? LoudnessGain(argc, argv, &loudness, target, 0.0, &limited) : 0.0;
+
+            if (printFormat == OPUS_PRINT_JSON) {
+                if (album)
+                    printf("\n], \"album\": {");
+                else {
+                    printf("%s  {\"path\": ", i != 0 ? ",\n" : "");
+                    OpusPrintJsonString(stdout, *(char**)ListGet(&paths, i));
+                    printf(", ");
+                }
+                printf("\"integrated\": %.2f, \"range\": %.2f, \"true_peak\": ", loudness.integrated, loudness.range);
+                if (isfinite(loudness.truePeak))
+                    printf("%.2f", loudness.truePeak);
+                else
+                    printf("null");
+                if (targetArg)
+                    printf(", \"gain\": %.2f, \"gain_limited\": %s", gain, limited ? "true" : "false");
+                printf(album ? "}}\n" : "}");
+            }
+            else {
+                if (album)
+                    printf("\nAlbum: ");
+                else
+                    printf("%s: ", *(char**)ListGet(&paths, i));
+                PrintLoudness(&loudness);
+                if (targetArg)
+                    printf(", gain %+.2f dB%s", gain, limited ? " (true peak limited)" : "");
+                printf("\n");
+            }
+        }
 
-        ListDestroy(&samples);
+        for (u64 i = 0; i < paths.elementCount; i++)
+            PcmLoudnessMeterDestroy(meters + i);
+        free(errors);
+        free(meters);
+        DestroyInputPaths(&paths);
 
-        if (!mfWav.data_void || mfWav.size == 0) {
-            printf("Error: Failed to build WAV file.\n");
+        if (failedCount != 0)
             return 1;
+    }
+    else if (strcasecmp(argv[1], "diff") == 0) {
+        int printFormat = FindOption(argc, argv, "--json") ? OPUS_PRINT_JSON : OPUS_PRINT_TEXT;
+
+        MemoryFile mfA = MemoryFileMap(argv[2], 0);
+        MemoryFile mfB = MemoryFileMap(argv[3], 0);
+
+        OpusFileHeader* fileHeaders[2] = {
+            OpusGetFileHeader(mfA.data_u8, mfA.size), OpusGetFileHeader(mfB.data_u8, mfB.size)
+        };
+        OpusPreprocess((u8*)fileHeaders[0]);
+        OpusPreprocess((u8*)fileHeaders[1]);
+
+        OpusDiffResult result;
+        int differs = OpusDiff(mfA.data_u8, mfA.size, mfB.data_u8, mfB.size, &result);
+
+        PcmDifference sampleDifference = { 0 };
+        int decoded = 0;
+
+        if (FindOption(argc, argv, "--decode")) {
+            if (
+                fileHeaders[0]->channelCount != fileHeaders[1]->channelCount ||
+                fileHeaders[0]->sampleRate != fileHeaders[1]->sampleRate
+            )
+                warn("diff: channel count or sample rate differ, skipping the sample comparison");
+            else {
+                if (!machineOutput) {
+                    printf("Decoding both files..");
+                    fflush(stdout);
+                }
+
+                OpusVariantMetadata metadatas[2];
+                OpusReadVariantMetadata(OpusFindVariant(mfA.data_u8, mfA.size), mfA.data_u8, mfA.size, metadatas + 0);
+                OpusReadVariantMetadata(OpusFindVariant(mfB.data_u8, mfB.size), mfB.data_u8, mfB.size, metadatas + 1);
+
+                u32 channelCount = fileHeaders[0]->channelCount;
+
+                DiffDecodeJobs jobs;
+                for (u32 i = 0; i < 2; i++) {
+                    OpusStreamDecoderInit(jobs.decoders + i, fileHeaders[i], metadatas[i].numSamples, 0, 0);
+                    jobs.blocks[i] = (s16*)malloc(sizeof(s16) * DIFF_DECODE_BLOCK_SAMPLES * channelCount);
+                    if (jobs.blocks[i] == NULL)
+                        panic("diff: malloc fail");
+                }
+
+                // Only the overlap is compared; the length difference shows in the packet totals.
+                do {
+                    JobsRun(2, 2, DiffDecodeJob, &jobs);
+                    PcmDifferenceAdd(
+                        &sampleDifference, jobs.blocks[0], jobs.blocks[1],
+                        MIN(jobs.readCounts[0], jobs.readCounts[1]) * channelCount
+                    );
+                } while (jobs.readCounts[0] == DIFF_DECODE_BLOCK_SAMPLES && jobs.readCounts[1] == DIFF_DECODE_BLOCK_SAMPLES);
+
+                for (u32 i = 0; i < 2; i++) {
+                    if (jobs.decoders[i].error[0] != '\0')
+                        panic("diff: \"%s\": %s", argv[2 + i], jobs.decoders[i].error);
+                    OpusStreamDecoderDestroy(jobs.decoders + i);
+                    free(jobs.blocks[i]);
+                }
+
+                decoded = 1;
+                if (sampleDifference.differingCount != 0)
+                    differs = 1;
+
+                if (!machineOutput)
+                    printf(" OK\n\n");
+            }
         }
 
-        MemoryFileWrite(&mfWav, argv[3]);
-        MemoryFileDestroy(&mfWav);
+        OpusPrintDiffResult(
+            stdout, printFormat, argv[2], argv[3], &result,
+            decoded ? &sampleDifference : NULL, fileHeaders[0]->channelCount
+        );
 
-        printf(" OK\n");
+        if (!machineOutput)
+            printf("\n%s\n", differs ? "Files differ" : "Files are identical");
+
+        MemoryFileUnmap(&mfA);
+        MemoryFileUnmap(&mfB);
+
+        if (differs)
+            return 1;
     }
     else {
         printf("Unknown command '%s'\n", argv[1]);
-        printf("Use make_wav, make_opus, make_capcom_opus or make_capcom_wav\n");
+        printf("Use make_wav, decode, make_opus, make_capcom_opus, make_multi, make_capcom_wav, rewrap_capcom, rewrap_nintendo, set_loop, splice, cut, repacketize, transcode, ogg_to_opus, opus_to_ogg, info, packets, verify, check_loops, diff, find_loops, loudness or peaks\n");
         return 1;
     }
 
-    printf("\nAll done.\n");
+    if (!machineOutput)
+        printf("\nAll done.\n");
 }
\ No newline at end of file
@@ -0,0 +1,567 @@
+#ifndef OGG_PROCESS_H
+#define OGG_PROCESS_H
+
+#include <stdlib.h>
+
+#include <stddef.h>
+
+#include <string.h>
+
+#include <opus/opus.h>
+
+#include "files.h"
+
+#include "list.h"
+
+#include "type.h"
+
+#include "common.h"
+
+#include "opusProcess.h"
+
+#define OGG_PAGE_MAGIC IDENTIFIER_TO_U32('O','g','g','S')
+
+#define OGG_HEADER_TYPE_CONTINUED (0x01)
+#define OGG_HEADER_TYPE_BOS (0x02) // Beginning of stream.
+#define OGG_HEADER_TYPE_EOS (0x04) // End of stream.
+
+// Pages are flushed once their body reaches this size (libogg uses the same soft limit).
+#define OGG_PAGE_BODY_TARGET (4096)
+
+// Serial number of the logical stream written by OggOpusExport.
+#define OGG_NOPUS_SERIAL IDENTIFIER_TO_U32('n','o','p','s')
+
+// Ogg Opus always counts granule positions at 48kHz.
+#define OGG_OPUS_GRANULE_RATE (48000)
+
+typedef struct __attribute__((packed)) {
+    u32 capturePattern; // Compare to OGG_PAGE_MAGIC.
+    u8 version; // Always 0.
+    u8 headerType; // OGG_HEADER_TYPE_* flags.
+    u64 granulePosition; // End sample (at 48kHz) of the last packet finished on this page.
+    u32 serialNumber;
+    u32 pageSequence;
+    u32 checksum; // CRC32 of the whole page with this field zeroed.
+    u8 segmentCount;
+    u8 segmentTable[0]; // Lacing values; followed by the page body.
+} OggPageHeader;
+
+typedef struct __attribute__((packed)) {
+    char magic[8]; // "OpusHead"
+    u8 version; // 1
+    u8 channelCount;
+    u16 preSkip; // At 48kHz.
+    u32 inputSampleRate; // Informational only.
+    s16 outputGain; // Q7.8 dB.
+    u8 mappingFamily; // 0 = mono/stereo, no mapping table follows.
+} OggOpusHead;
+
+// Families 1 (Vorbis channel order, up to 8 channels) and 255 (undefined
+// order) follow OggOpusHead with the stream count, the coupled count and one
+// mapping byte per channel, with the same meaning as in OpusMultistreamChunk.
+#define OGG_OPUS_MAPPING_FAMILY_VORBIS (1)
+#define OGG_OPUS_MAPPING_FAMILY_UNDEFINED (255)
+
+// Family 1 channel k (Vorbis order) is channel OggVorbisToWavOrder[n - 1][k]
+// of an n-channel file, which keeps the channels in WAV order as nopus encodes
+// them from WAV files.
+static const u8 OggVorbisToWavOrder[8][8] = {
+    { 0 },
+    { 0, 1 },
+    { 0, 2, 1 },
+    { 0, 1, 2, 3 },
+    { 0, 2, 1, 3, 4 },
+    { 0, 2, 1, 4, 5, 3 },
+    { 0, 2, 1, 5, 6, 4, 3 },
+    { 0, 2, 1, 6, 7, 4, 5, 3 },
+};
+
+static u32 _OggCrcTable[256];
+
+static void _OggCrcInit(void) {
+    if (_OggCrcTable[1] != 0)
+        return;
+
+    for (u32 i = 0; i < 256; i++) {
+        u32 r = i << 24;
+        for (unsigned j = 0; j < 8; j++)
+            r = (r & 0x80000000) ? (r << 1) ^ 0x04C11DB7 : (r << 1);
+        _OggCrcTable[i] = r;
+    }
+}
+
+static u32 _OggCrcUpdate(u32 crc, const u8* data, u64 size) {
+    for (u64 i = 0; i < size; i++)
+        crc = (crc << 8) ^ _OggCrcTable[(crc >> 24) ^ data[i]];
+    return crc;
+}
+
+// Ogg CRC: polynomial 0x04C11DB7, no reflection, zero init, no final XOR.
+u32 OggCrc(const u8* data, u64 size) {
+    _OggCrcInit();
+    return _OggCrcUpdate(0, data, size);
+}
+
+int OggIsOggFormat(const u8* data, u64 dataSize) {
+    if (dataSize < sizeof(OggPageHeader))
+        return 0;
+    u32 magic;
+    memcpy(&magic, data, 4);
+    return magic == OGG_PAGE_MAGIC;
+}
+
+// Calls packetCallback for every complete packet of the first logical stream.
+// Packets that span pages are reassembled into scratch; others point into oggData.
+static void _OggForEachPacket(
+    const u8* oggData, u64 dataSize,
+    void (*packetCallback)(void* userData, const u8* packet, u32 packetSize),
+    void* userData
+) {
+    ListData scratch;
+    ListInit(&scratch, sizeof(u8), 8192);
+
+    u32 streamSerial = 0;
+    int haveSerial = 0;
+
+    u64 offset = 0;
+    while (offset + sizeof(OggPageHeader) <= dataSize) {
+        OggPageHeader* page = (OggPageHeader*)(oggData + offset);
+        if (page->capturePattern != OGG_PAGE_MAGIC)
+            panic("Ogg page at 0x%llX has no capture pattern", (unsigned long long)offset);
+        if (page->version != 0)
+            panic("Ogg page at 0x%llX has unsupported version %u", (unsigned long long)offset, page->version);
+
+        u64 headerSize = sizeof(OggPageHeader) + page->segmentCount;
+        if (offset + headerSize > dataSize)
+            panic("Ogg page at 0x%llX is truncated", (unsigned long long)offset);
+
+        u64 bodySize = 0;
+        for (unsigned i = 0; i < page->segmentCount; i++)
+            bodySize += page->segmentTable[i];
+        if (offset + headerSize + bodySize > dataSize)
+            panic("Ogg page at 0x%llX is truncated", (unsigned long long)offset);
+
+        // Verify the page checksum with the field zeroed.
+        u32 storedChecksum = page->checksum;
+        u8 headerCopy[sizeof(OggPageHeader) + 255];
+        memcpy(headerCopy, page, headerSize);
+        ((OggPageHeader*)headerCopy)->checksum = 0;
+
+        u32 crc = OggCrc(headerCopy, headerSize);
+        crc = _OggCrcUpdate(crc, oggData + offset + headerSize, bodySize);
+        if (crc != storedChecksum)
+            panic("Ogg page %u has a bad checksum", page->pageSequence);
+
+        if (!haveSerial) {
+            streamSerial = page->serialNumber;
+            haveSerial = 1;
+        }
+
+        // Pages of other (multiplexed) logical streams are skipped.
+        if (page->serialNumber == streamSerial) {
+            const u8* body = oggData + offset + headerSize;
+            u64 packetStart = 0;
+            u64 packetLen = 0;
+
+            // A continued page with nothing buffered means the stream started mid-packet.
+            int dropContinuation = (page->headerType & OGG_HEADER_TYPE_CONTINUED) && scratch.elementCount == 0;
+            if (!(page->headerType & OGG_HEADER_TYPE_CONTINUED))
+                scratch.elementCount = 0;
+
+            for (unsigned i = 0; i < page->segmentCount; i++) {
+                packetLen += page->segmentTable[i];
+                if (page->segmentTable[i] == 255)
+                    continue;
+
+                // Packet ends on this segment.
+                if (dropContinuation) {
+                    dropContinuation = 0;
+                }
+                else if (scratch.elementCount != 0) {
+                    ListAddRange(&scratch, (void*)(body + packetStart), packetLen);
+                    packetCallback(userData, (u8*)scratch.data, scratch.elementCount);
+                    scratch.elementCount = 0;
+                }
+                else
+                    packetCallback(userData, body + packetStart, packetLen);
+
+                packetStart += packetLen;
+                packetLen = 0;
+            }
+
+            // Packet continues on the next page.
+            if (packetLen != 0 && !dropContinuation)
+                ListAddRange(&scratch, (void*)(body + packetStart), packetLen);
+        }
+
+        offset += headerSize + bodySize;
+    }
+
+    ListDestroy(&scratch);
+}
+
+typedef struct {
+    u32 packetIndex;
+
+    ListData packetData; // Nintendo OpusPacketHeader records.
+    u32 packetCount;
+    u32 uniformPacketSize; // 0 once two packets differ in size.
+
+    // One decoder per elementary stream; NULL if final ranges are not recomputed.
+    OpusDecoder** decoders;
+    u32 streamCount;
+    s16* decodeBuffer;
+
+    const OpusMultistreamChunk* multistreamChunk; // NULL for family 0.
+    u8* streamPacket;
+} _OggImportState;
+
+static void _OggImportPacket(void* userData, const u8* packet, u32 packetSize) {
+    _OggImportState* state = (_OggImportState*)userData;
+
+    u32 packetIndex = state->packetIndex++;
+
+    // OpusHead was already parsed by OggOpusImport.
+    if (packetIndex == 0)
+        return;
+    if (packetIndex == 1) {
+        if (packetSize < 8 || memcmp(packet, "OpusTags", 8) != 0)
+            panic("Ogg Opus stream has no OpusTags packet");
+        return;
+    }
+
+    // Multistream packets store the XOR of the streams' final ranges.
+    u32 finalRange = 0;
+    for (u32 i = 0; state->decoders != NULL && i < state->streamCount; i++) {
+        const u8* streamPacket = packet;
+        u32 streamPacketSize = packetSize;
+        if (state->multistreamChunk != NULL) {
+            streamPacket = state->streamPacket;
+            streamPacketSize = _OpusGetStreamPacket(packet, packetSize, i, state->streamCount, state->streamPacket);
+            if (streamPacketSize == 0)
+                panic("OggOpusImport: multistream framing of packet %u is invalid", state->packetCount);
+        }
+
+        int samplesDecoded = opus_decode(
+            state->decoders[i], streamPacket, streamPacketSize,
+            state->decodeBuffer, OGG_OPUS_GRANULE_RATE / 1000 * 120, 0
+        );
+        if (samplesDecoded < 0)
+            panic("OggOpusImport: opus_decode failed on packet %u: %s", state->packetCount, opus_strerror(samplesDecoded));
+
+        u32 streamFinalRange;
+        opus_decoder_ctl(state->decoders[i], OPUS_GET_FINAL_RANGE(&streamFinalRange));
+        finalRange ^= streamFinalRange;
+    }
+
+    u32 packetSizeBE = __builtin_bswap32(packetSize);
+    u32 finalRangeBE = __builtin_bswap32(finalRange);
+    ListAddRange(&state->packetData, &packetSizeBE, 4);
+    ListAddRange(&state->packetData, &finalRangeBE, 4);
+    ListAddRange(&state->packetData, (void*)packet, packetSize);
+
+    if (state->packetCount == 0)
+        state->uniformPacketSize = packetSize;
+    else if (state->uniformPacketSize != packetSize)
+        state->uniformPacketSize = 0;
+
+    state->packetCount++;
+}
+
+// Remux an Ogg Opus file into a Nintendo OPUS file. Packets are copied as-is;
+// the encoder final range (not stored in Ogg) is recovered by decoding each
+// packet when computeFinalRange is set, and left as 0 otherwise.
+MemoryFile OggOpusImport(const u8* oggData, u64 dataSize, int computeFinalRange) {
+    if (!OggIsOggFormat(oggData, dataSize))
+        panic("OggOpusImport: input is not an Ogg file");
+
+    _OggImportState state = {0};
+    ListInit(&state.packetData, sizeof(u8), dataSize);
+
+    // OpusHead has to be parsed before the decoder can be created, so peek at
+    // the first packet; it always fits on the first page.
+    const OggPageHeader* firstPage = (const OggPageHeader*)oggData;
+    const u8* firstBody = oggData + sizeof(OggPageHeader) + firstPage->segmentCount;
+    if (
+        firstPage->segmentCount == 0 ||
+        (u64)(firstBody - oggData) + sizeof(OggOpusHead) > dataSize ||
+        memcmp(firstBody, "OpusHead", 8) != 0
+    )
+        panic("Ogg stream is not Opus (no OpusHead packet)");
+
+    OggOpusHead head;
+    memcpy(&head, firstBody, sizeof(OggOpusHead));
+
+    if (head.outputGain != 0)
+        warn("Ogg Opus output gain (%d/256 dB) is not representable and will be ignored", head.outputGain);
+
+    // Families 1 and 255 become a multistream chunk, with the channels put
+    // back in WAV order.
+    u8 multistreamData[sizeof(OpusMultistreamChunk) + 255];
+    OpusMultistreamChunk* multistreamChunk = NULL;
+
+    if (head.mappingFamily == 0) {
+        if (head.channelCount != 1 && head.channelCount != 2)
+            panic("Invalid Ogg Opus channel count (%u)", head.channelCount);
+    }
+    else if (head.mappingFamily == OGG_OPUS_MAPPING_FAMILY_VORBIS || head.mappingFamily == OGG_OPUS_MAPPING_FAMILY_UNDEFINED) {
+        const u8* table = firstBody + sizeof(OggOpusHead);
+        if ((u64)(table - oggData) + 2 + head.channelCount > dataSize)
+            panic("Ogg Opus channel mapping table is truncated");
+
+        u32 streamCount = table[0];
+        u32 coupledCount = table[1];
+        if (
+            head.channelCount == 0 || streamCount == 0 || coupledCount > streamCount || streamCount + coupledCount > 255 ||
+            (head.mappingFamily == OGG_OPUS_MAPPING_FAMILY_VORBIS && head.channelCount > 8)
+        )
+            panic(
+                "Invalid Ogg Opus channel mapping (family %u, %u channels, %u streams, %u coupled)",
+                head.mappingFamily, head.channelCount, streamCount, coupledCount
+            );
+
+        multistreamChunk = (OpusMultistreamChunk*)multistreamData;
+        multistreamChunk->chunkId = CHUNK_MULTISTREAM_ID;
+        multistreamChunk->chunkSize = 2 + head.channelCount;
+        multistreamChunk->streamCount = (u8)streamCount;
+        multistreamChunk->coupledCount = (u8)coupledCount;
+
+        for (u32 k = 0; k < head.channelCount; k++) {
+            u8 mapping = table[2 + k];
+            if (mapping != 255 && mapping >= streamCount + coupledCount)
+                panic("Invalid Ogg Opus channel mapping (channel %u maps to %u)", k, mapping);
+
+            u32 channel = head.mappingFamily == OGG_OPUS_MAPPING_FAMILY_VORBIS ?
+                OggVorbisToWavOrder[head.channelCount - 1][k] : k;
+            multistreamChunk->channelMapping[channel] = mapping;
+        }
+    }
+    else
+        panic("Ogg Opus channel mapping family %u is not supported", head.mappingFamily);
+
+    state.multistreamChunk = multistreamChunk;
+    state.streamCount = multistreamChunk != NULL ? multistreamChunk->streamCount : 1;
+
+    if (computeFinalRange) {
+        state.decoders = (OpusDecoder**)malloc(sizeof(OpusDecoder*) * state.streamCount);
+        if (!state.decoders)
+            panic("OggOpusImport: failed to alloc decoders");
+
+        for (u32 i = 0; i < state.streamCount; i++) {
+            u32 streamChannelCount = multistreamChunk == NULL ?
+                head.channelCount : (i < multistreamChunk->coupledCount ? 2 : 1);
+
+            int error;
+            state.decoders[i] = opus_decoder_create(OGG_OPUS_GRANULE_RATE, streamChannelCount, &error);
+            if (error != OPUS_OK)
+                panic("OggOpusImport: opus_decoder_create fail: %s", opus_strerror(error));
+        }
+
+        state.decodeBuffer = (s16*)malloc(OGG_OPUS_GRANULE_RATE / 1000 * 120 * 2 * sizeof(s16));
+        if (!state.decodeBuffer)
+            panic("OggOpusImport: failed to alloc decode buffer");
+
+        // An elementary packet is never larger than the Ogg file.
+        if (multistreamChunk != NULL && (state.streamPacket = (u8*)malloc(dataSize)) == NULL)
+            panic("OggOpusImport: failed to alloc packet buffer");
+    }
+
+    _OggForEachPacket(oggData, dataSize, _OggImportPacket, &state);
+
+    if (state.decoders) {
+        for (u32 i = 0; i < state.streamCount; i++)
+            opus_decoder_destroy(state.decoders[i]);
+        free(state.decoders);
+        free(state.decodeBuffer);
+        free(state.streamPacket);
+    }
+
+    if (state.packetCount == 0)
+        panic("OggOpusImport: Ogg Opus stream has no audio packets");
+
+    u32 multistreamSize = multistreamChunk != NULL ? 8 + multistreamChunk->chunkSize : 0;
+
+    MemoryFile result;
+    result.size = sizeof(OpusFileHeader) + multistreamSize + sizeof(OpusDataChunk) + state.packetData.elementCount;
+    result.data_void = malloc(result.size);
+    if (!result.data_void)
+        panic("OggOpusImport: failed to allocate output buffer");
+
+    OpusFileHeader* fileHeader = (OpusFileHeader*)result.data_void;
+
+    fileHeader->chunkId = CHUNK_HEADER_ID;
+    fileHeader->chunkSize = sizeof(OpusFileHeader) - 8;
+    fileHeader->version = OPUS_VERSION;
+    fileHeader->channelCount = head.channelCount;
+    // CBR packet size including the 8-byte OpusPacketHeader, like OpusBuildCapcom.
+    fileHeader->frameSize = state.uniformPacketSize != 0 ?
+        (u16)(state.uniformPacketSize + sizeof(OpusPacketHeader)) : 0;
+    fileHeader->sampleRate = OGG_OPUS_GRANULE_RATE;
+    fileHeader->dataOffset = sizeof(OpusFileHeader) + multistreamSize;
+    fileHeader->seekOffset = 0x00000000;
+    fileHeader->contextOffset = 0x00000000;
+    fileHeader->preSkipSamples = head.preSkip;
+    fileHeader->_pad16 = 0x0000;
+
+    memcpy(fileHeader + 1, multistreamData, multistreamSize);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    dataChunk->chunkId = CHUNK_DATA_ID;
+    dataChunk->chunkSize = state.packetData.elementCount;
+
+    memcpy(dataChunk->data, state.packetData.data, state.packetData.elementCount);
+
+    ListDestroy(&state.packetData);
+
+    return result;
+}
+
+typedef struct {
+    ListData* out;
+
+    u32 pageSequence;
+
+    u8 segmentTable[255];
+    u32 segmentCount;
+
+    ListData body;
+} _OggPageWriter;
+
+static void _OggFlushPage(_OggPageWriter* writer, u64 granulePosition, u8 headerType) {
+    OggPageHeader page;
+    page.capturePattern = OGG_PAGE_MAGIC;
+    page.version = 0;
+    page.headerType = headerType;
+    page.granulePosition = granulePosition;
+    page.serialNumber = OGG_NOPUS_SERIAL;
+    page.pageSequence = writer->pageSequence++;
+    page.checksum = 0;
+    page.segmentCount = (u8)writer->segmentCount;
+
+    u64 pageStart = writer->out->elementCount;
+
+    ListAddRange(writer->out, &page, sizeof(OggPageHeader));
+    ListAddRange(writer->out, writer->segmentTable, writer->segmentCount);
+    ListAddRange(writer->out, writer->body.data, writer->body.elementCount);
+
+    u8* pageData = (u8*)writer->out->data + pageStart;
+    u32 crc = OggCrc(pageData, writer->out->elementCount - pageStart);
+    memcpy(pageData + offsetof(OggPageHeader, checksum), &crc, 4);
+
+    writer->segmentCount = 0;
+    writer->body.elementCount = 0;
+}
+
+// Packets are never split across pages; a packet that would overflow the
+// segment table flushes the current page first.
+static void _OggWritePacket(_OggPageWriter* writer, const u8* packet, u32 packetSize, u64* pendingGranule) {
+    u32 segmentsNeeded = packetSize / 255 + 1;
+    if (writer->segmentCount + segmentsNeeded > 255)
+        _OggFlushPage(writer, *pendingGranule, 0);
+
+    for (u32 i = 0; i < segmentsNeeded - 1; i++)
+        writer->segmentTable[writer->segmentCount++] = 255;
+    writer->segmentTable[writer->segmentCount++] = (u8)(packetSize % 255);
+
+    ListAddRange(&writer->body, (void*)packet, packetSize);
+}
+
+// Remux a Nintendo OPUS file into Ogg Opus. numSamples is the playable length
+// per channel (at the file sample rate) used to trim the last page; 0 keeps
+// every decoded sample. Multistream packets already have the Ogg multistream
+// framing, so they are copied as they are; the layout goes into OpusHead.
+MemoryFile OggOpusExport(OpusFileHeader* fileHeader, u32 numSamples) {
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+
+    ListData out;
+    ListInit(&out, sizeof(u8), dataChunk->chunkSize + dataChunk->chunkSize / 32 + 1024);
+
+    _OggPageWriter writer = {0};
+    writer.out = &out;
+    ListInit(&writer.body, sizeof(u8), OGG_PAGE_BODY_TARGET * 2);
+
+    u64 granule = 0;
+
+    // Header pages: OpusHead and OpusTags each get a page of their own.
+    const OpusMultistreamChunk* multistreamChunk = OpusGetMultistreamChunk(fileHeader);
+
+    u8 headPacket[sizeof(OggOpusHead) + 2 + 255];
+    u32 headSize = sizeof(OggOpusHead);
+
+    OggOpusHead head;
+    memcpy(head.magic, "OpusHead", 8);
+    head.version = 1;
+    head.channelCount = fileHeader->channelCount;
+    head.preSkip = (u16)((u64)fileHeader->preSkipSamples * OGG_OPUS_GRANULE_RATE / fileHeader->sampleRate);
+    head.inputSampleRate = fileHeader->sampleRate;
+    head.outputGain = 0;
+    head.mappingFamily = 0;
+
+    if (multistreamChunk != NULL) {
+        u32 channelCount = fileHeader->channelCount;
+        head.mappingFamily = channelCount <= 8 ? OGG_OPUS_MAPPING_FAMILY_VORBIS : OGG_OPUS_MAPPING_FAMILY_UNDEFINED;
+
+        u8* table = headPacket + sizeof(OggOpusHead);
+        table[0] = multistreamChunk->streamCount;
+        table[1] = multistreamChunk->coupledCount;
+        for (u32 k = 0; k < channelCount; k++) {
+            u32 channel = head.mappingFamily == OGG_OPUS_MAPPING_FAMILY_VORBIS ? OggVorbisToWavOrder[channelCount - 1][k] : k;
+            table[2 + k] = multistreamChunk->channelMapping[channel];
+        }
+        headSize += 2 + channelCount;
+    }
+    memcpy(headPacket, &head, sizeof(OggOpusHead));
+
+    _OggWritePacket(&writer, headPacket, headSize, &granule);
+    _OggFlushPage(&writer, 0, OGG_HEADER_TYPE_BOS);
+
+    static const char vendor[] = "nopus";
+    u8 tags[8 + 4 + STR_LIT_LEN(vendor) + 4];
+    u32 vendorLength = STR_LIT_LEN(vendor);
+    u32 commentCount = 0;
+    memcpy(tags, "OpusTags", 8);
+    memcpy(tags + 8, &vendorLength, 4);
+    memcpy(tags + 12, vendor, vendorLength);
+    memcpy(tags + 12 + vendorLength, &commentCount, 4);
+
+    _OggWritePacket(&writer, tags, sizeof(tags), &granule);
+    _OggFlushPage(&writer, 0, 0);
+
+    u64 endGranule = 0;
+    if (numSamples != 0)
+        endGranule = head.preSkip + (u64)numSamples * OGG_OPUS_GRANULE_RATE / fileHeader->sampleRate;
+
+    unsigned offset = 0;
+    while (offset < dataChunk->chunkSize) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        offset += sizeof(OpusPacketHeader) + packetSize;
+
+        int packetSamples = opus_packet_get_nb_samples(packetHeader->packet, packetSize, OGG_OPUS_GRANULE_RATE);
+        if (packetSamples < 0)
+            panic("OggOpusExport: invalid packet: %s", opus_strerror(packetSamples));
+
+        _OggWritePacket(&writer, packetHeader->packet, packetSize, &granule);
+        granule += packetSamples;
+
+        if (offset >= dataChunk->chunkSize) {
+            // End trimming is expressed by a last granule below the decoded length.
+            if (endGranule != 0 && endGranule < granule)
+                granule = endGranule;
+            _OggFlushPage(&writer, granule, OGG_HEADER_TYPE_EOS);
+        }
+        else if (writer.body.elementCount >= OGG_PAGE_BODY_TARGET)
+            _OggFlushPage(&writer, granule, 0);
+    }
+
+    ListDestroy(&writer.body);
+
+    MemoryFile result;
+    result.data_void = out.data;
+    result.size = out.elementCount;
+
+    return result;
+}
+
+#endif // OGG_PROCESS_H
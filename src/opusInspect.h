@@ -0,0 +1,1843 @@
+#ifndef OPUS_INSPECT_H
+#define OPUS_INSPECT_H
+
+#include <stdlib.h>
+
+#include <stdio.h>
+
+#include <string.h>
+
+#include <stdarg.h>
+
+#include <opus/opus.h>
+
+#include "files.h"
+
+#include "list.h"
+
+#include "type.h"
+
+#include "common.h"
+
+#include "opusProcess.h"
+
+#include "oggProcess.h"
+
+#include "pcmProcess.h"
+
+// Enough for the Capcom header, the Nintendo header, the data chunk header
+// and the TOC byte of the first packet.
+#define OPUS_PROBE_HEAD_SIZE (512)
+
+// Ogg pages are at most 65307 bytes, so the last one always starts in here.
+#define OPUS_PROBE_OGG_TAIL_SIZE (65536 + 512)
+
+#define OPUS_FORMAT_UNKNOWN (0)
+#define OPUS_FORMAT_OGG (1)
+// Formats from OPUS_FORMAT_VARIANT on are the entries of OpusVariants, in order.
+#define OPUS_FORMAT_VARIANT (2)
+
+#define OPUS_FORMAT_COUNT (OPUS_FORMAT_VARIANT + OPUS_VARIANT_COUNT)
+
+const char* OpusFormatName(u32 format) {
+    if (format == OPUS_FORMAT_OGG)
+        return "ogg";
+    if (format >= OPUS_FORMAT_VARIANT && format < OPUS_FORMAT_COUNT)
+        return OpusVariants[format - OPUS_FORMAT_VARIANT].name;
+    return "unknown";
+}
+
+// Returns OPUS_FORMAT_COUNT if name is not a format.
+u32 OpusFormatFromName(const char* name) {
+    for (u32 format = 0; format < OPUS_FORMAT_COUNT; format++) {
+        if (strcmp(OpusFormatName(format), name) == 0)
+            return format;
+    }
+    return OPUS_FORMAT_COUNT;
+}
+
+#define OPUS_LENGTH_NONE (0) // Not derivable without walking the packets (VBR).
+#define OPUS_LENGTH_HEADER (1) // Stored in the header (container sample count, Ogg last granule).
+#define OPUS_LENGTH_CBR (2) // Estimated from the CBR frame size; may include end padding.
+
+static const char* OpusLengthSourceNames[] = { "none", "header", "cbr" };
+
+typedef struct {
+    u32 format; // OPUS_FORMAT_*
+    u32 channelCount;
+    u32 sampleRate;
+    u32 preSkipSamples;
+    u32 frameSize; // CBR packet size including the 8-byte packet header, 0 if VBR.
+    u64 dataSize; // Size of the Opus packet data.
+    u64 numSamples; // Per channel, pre-skip excluded.
+    u32 lengthSource; // OPUS_LENGTH_*
+    u32 hasLoop;
+    u32 loopStart;
+    u32 loopEnd;
+} OpusProbeInfo;
+
+static void _OpusProbeOggTail(const char* path, u64 fileSize, OpusProbeInfo* info) {
+    u64 tailSize = MIN(fileSize, (u64)OPUS_PROBE_OGG_TAIL_SIZE);
+    u8* tail = (u8*)malloc(tailSize);
+    if (tail == NULL)
+        panic("OpusProbe: failed to allocate tail buffer");
+
+    tailSize = FileReadAt(path, fileSize - tailSize, tail, tailSize);
+
+    // The last page is the last capture pattern whose header fits.
+    for (s64 i = (s64)tailSize - (s64)sizeof(OggPageHeader); i >= 0; i--) {
+        const OggPageHeader* page = (const OggPageHeader*)(tail + i);
+        if (page->capturePattern != OGG_PAGE_MAGIC || page->version != 0)
+            continue;
+
+        if (page->granulePosition > info->preSkipSamples) {
+            info->numSamples = page->granulePosition - info->preSkipSamples;
+            info->lengthSource = OPUS_LENGTH_HEADER;
+        }
+        break;
+    }
+
+    free(tail);
+}
+
+// Parse the container headers from the first few hundred bytes of a file.
+// Returns 0 on success, 1 if the file is not a recognized OPUS file, -1 if
+// it can't be read.
+int OpusProbe(const char* path, u64 fileSize, OpusProbeInfo* info) {
+    memset(info, 0, sizeof(OpusProbeInfo));
+
+    u8 head[OPUS_PROBE_HEAD_SIZE];
+    u64 headSize = FileReadAt(path, 0, head, sizeof(head));
+    if (headSize == 0 && fileSize != 0)
+        return -1;
+    if (headSize < 4)
+        return 1;
+
+    if (OggIsOggFormat(head, headSize)) {
+        const OggPageHeader* page = (const OggPageHeader*)head;
+        u64 bodyOffset = sizeof(OggPageHeader) + page->segmentCount;
+        if (bodyOffset + sizeof(OggOpusHead) > headSize || memcmp(head + bodyOffset, "OpusHead", 8) != 0)
+            return 1;
+
+        OggOpusHead opusHead;
+        memcpy(&opusHead, head + bodyOffset, sizeof(OggOpusHead));
+
+        info->format = OPUS_FORMAT_OGG;
+        info->channelCount = opusHead.channelCount;
+        info->sampleRate = OGG_OPUS_GRANULE_RATE;
+        info->preSkipSamples = opusHead.preSkip;
+        info->dataSize = fileSize;
+
+        _OpusProbeOggTail(path, fileSize, info);
+        return 0;
+    }
+
+    const OpusVariant* variant = OpusFindVariant(head, headSize);
+    if (variant == NULL)
+        return 1;
+
+    info->format = OPUS_FORMAT_VARIANT + (u32)(variant - OpusVariants);
+
+    OpusVariantMetadata metadata;
+    OpusReadVariantMetadata(variant, head, headSize, &metadata);
+
+    if (metadata.numSamples != 0) {
+        info->numSamples = metadata.numSamples;
+        info->lengthSource = OPUS_LENGTH_HEADER;
+    }
+    info->hasLoop = metadata.hasLoop;
+    info->loopStart = metadata.loopStart;
+    info->loopEnd = metadata.loopEnd;
+
+    u64 nintendoOff = variant->locateHeader(head, headSize);
+
+    if (nintendoOff + sizeof(OpusFileHeader) > headSize)
+        return 1;
+
+    const OpusFileHeader* fileHeader = (const OpusFileHeader*)(head + nintendoOff);
+
+    info->channelCount = fileHeader->channelCount;
+    info->sampleRate = fileHeader->sampleRate;
+    info->preSkipSamples = fileHeader->preSkipSamples;
+    info->frameSize = fileHeader->frameSize;
+
+    u64 dataOff = (u64)nintendoOff + fileHeader->dataOffset;
+
+    // A seek chunk can push the data chunk out of the head; read it separately.
+    // fileHeader is not used past this point.
+    if (dataOff + sizeof(OpusDataChunk) + sizeof(OpusPacketHeader) + 2 > headSize) {
+        headSize = FileReadAt(path, dataOff, head, sizeof(head));
+        dataOff = 0;
+    }
+    if (dataOff + sizeof(OpusDataChunk) > headSize)
+        return 0; // Header fields are known; the length is not.
+
+    const OpusDataChunk* dataChunk = (const OpusDataChunk*)(head + dataOff);
+    if (dataChunk->chunkId != CHUNK_DATA_ID)
+        return 1;
+
+    info->dataSize = dataChunk->chunkSize;
+
+    // CBR: every packet has the same size and (in practice) the same duration
+    // as the first one, so the length follows from the data size.
+    u64 tocOff = dataOff + sizeof(OpusDataChunk) + sizeof(OpusPacketHeader);
+    if (info->lengthSource == OPUS_LENGTH_NONE && info->frameSize != 0 && tocOff < headSize) {
+        u64 packetCount = info->dataSize / info->frameSize;
+        u64 totalSamples = packetCount * opus_packet_get_samples_per_frame(head + tocOff, info->sampleRate) *
+            opus_packet_get_nb_frames(head + tocOff, info->frameSize - sizeof(OpusPacketHeader));
+
+        if (totalSamples > info->preSkipSamples) {
+            info->numSamples = totalSamples - info->preSkipSamples;
+            info->lengthSource = OPUS_LENGTH_CBR;
+        }
+    }
+
+    return 0;
+}
+
+// Asset catalog: one tab-separated line per file, keyed by path, size and
+// modification time so a rescan only probes files that changed. Formats are
+// stored by name, so the catalog survives changes to the variant registry.
+
+#define OPUS_CATALOG_MAGIC "# nopus catalog v3"
+
+typedef struct {
+    char* path;
+    u64 size;
+    s64 modifiedTime;
+    OpusProbeInfo info;
+    int valid; // 0 if the file was not a recognized OPUS file.
+} OpusCatalogEntry;
+
+static int _OpusCatalogCompare(const void* a, const void* b) {
+    return strcmp(((const OpusCatalogEntry*)a)->path, ((const OpusCatalogEntry*)b)->path);
+}
+
+// Load a catalog into entries (sorted by path). A missing file yields an empty catalog.
+void OpusCatalogLoad(const char* path, ListData* entries) {
+    ListInit(entries, sizeof(OpusCatalogEntry), 1024);
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+
+    char line[4096];
+    if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, OPUS_CATALOG_MAGIC, STR_LIT_LEN(OPUS_CATALOG_MAGIC)) != 0) {
+        warn("Catalog \"%s\" has an unknown format and will be rebuilt", path);
+        fclose(fp);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* tab = strchr(line, '\t');
+        if (tab == NULL)
+            continue;
+        *tab = '\0';
+
+        OpusCatalogEntry entry = {0};
+        unsigned long long size, numSamples, dataSize;
+        long long modifiedTime;
+        char formatName[32];
+
+        int fieldCount = sscanf(
+            tab + 1, "%llu\t%lld\t%d\t%31s\t%u\t%u\t%u\t%u\t%llu\t%llu\t%u\t%u\t%u\t%u",
+            &size, &modifiedTime, &entry.valid,
+            formatName, &entry.info.channelCount, &entry.info.sampleRate,
+            &entry.info.preSkipSamples, &entry.info.frameSize, &dataSize, &numSamples,
+            &entry.info.lengthSource, &entry.info.hasLoop, &entry.info.loopStart, &entry.info.loopEnd
+        );
+        if (fieldCount == 14)
+            entry.info.format = OpusFormatFromName(formatName);
+        if (
+            fieldCount != 14 ||
+            entry.info.format >= OPUS_FORMAT_COUNT ||
+            entry.info.lengthSource >= sizeof(OpusLengthSourceNames) / sizeof(OpusLengthSourceNames[0])
+        )
+            continue;
+
+        entry.path = strdup(line);
+        entry.size = size;
+        entry.modifiedTime = modifiedTime;
+        entry.info.dataSize = dataSize;
+        entry.info.numSamples = numSamples;
+
+        ListAdd(entries, &entry);
+    }
+
+    fclose(fp);
+
+    qsort(entries->data, entries->elementCount, sizeof(OpusCatalogEntry), _OpusCatalogCompare);
+}
+
+// Returns NULL if path is not in the (sorted) catalog.
+OpusCatalogEntry* OpusCatalogFind(ListData* entries, const char* path) {
+    OpusCatalogEntry key = { .path = (char*)path };
+    return (OpusCatalogEntry*)bsearch(
+        &key, entries->data, entries->elementCount, sizeof(OpusCatalogEntry), _OpusCatalogCompare
+    );
+}
+
+// Write the catalog through a temporary file so an interrupted scan never leaves a truncated one.
+int OpusCatalogSave(const char* path, ListData* entries) {
+    qsort(entries->data, entries->elementCount, sizeof(OpusCatalogEntry), _OpusCatalogCompare);
+
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+
+    FILE* fp = fopen(tempPath, "w");
+    if (fp == NULL) {
+        warn("OpusCatalogSave: fopen failed (path : %s)", tempPath);
+        return 1;
+    }
+
+    fprintf(fp, "%s\n", OPUS_CATALOG_MAGIC);
+
+    for (u64 i = 0; i < entries->elementCount; i++) {
+        const OpusCatalogEntry* entry = (const OpusCatalogEntry*)ListGet(entries, i);
+        fprintf(
+            fp, "%s\t%llu\t%lld\t%d\t%s\t%u\t%u\t%u\t%u\t%llu\t%llu\t%u\t%u\t%u\t%u\n",
+            entry->path, (unsigned long long)entry->size, (long long)entry->modifiedTime, entry->valid,
+            OpusFormatName(entry->info.format), entry->info.channelCount, entry->info.sampleRate,
+            entry->info.preSkipSamples, entry->info.frameSize,
+            (unsigned long long)entry->info.dataSize, (unsigned long long)entry->info.numSamples,
+            entry->info.lengthSource, entry->info.hasLoop, entry->info.loopStart, entry->info.loopEnd
+        );
+    }
+
+    if (fclose(fp) != 0 || rename(tempPath, path) != 0) {
+        warn("OpusCatalogSave: failed to write catalog (path : %s)", path);
+        return 1;
+    }
+    return 0;
+}
+
+// Sort entries and append the previous entries that were not rescanned, as
+// long as their file still exists. Dropped previous entries are freed.
+void OpusCatalogMerge(ListData* entries, ListData* previous) {
+    qsort(entries->data, entries->elementCount, sizeof(OpusCatalogEntry), _OpusCatalogCompare);
+
+    u64 scannedCount = entries->elementCount;
+    for (u64 i = 0; i < previous->elementCount; i++) {
+        OpusCatalogEntry* entry = (OpusCatalogEntry*)ListGet(previous, i);
+
+        ListData scanned = *entries;
+        scanned.elementCount = scannedCount;
+
+        FileInfo fileInfo;
+        if (OpusCatalogFind(&scanned, entry->path) == NULL && FileGetInfo(entry->path, &fileInfo) == 0)
+            ListAdd(entries, entry);
+        else
+            free(entry->path);
+    }
+
+    ListDestroy(previous);
+}
+
+void OpusCatalogDestroy(ListData* entries) {
+    for (u64 i = 0; i < entries->elementCount; i++)
+        free(((OpusCatalogEntry*)ListGet(entries, i))->path);
+    ListDestroy(entries);
+}
+
+// Output formats for OpusPrintProbeInfo.
+#define OPUS_PRINT_TEXT (0)
+#define OPUS_PRINT_JSON (1)
+#define OPUS_PRINT_CSV (2)
+
+// Print the JSON string for str (quotes included).
+void OpusPrintJsonString(FILE* fp, const char* str) {
+    fputc('"', fp);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((u8)*str < 0x20)
+            fprintf(fp, "\\u%04x", (u8)*str);
+        else
+            fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+void OpusPrintProbeHeader(FILE* fp, int printFormat) {
+    if (printFormat == OPUS_PRINT_CSV)
+        fprintf(fp, "path,format,channels,sample_rate,pre_skip,frame_size,data_size,num_samples,duration,length_source,loop_start,loop_end,error\n");
+    else if (printFormat == OPUS_PRINT_JSON)
+        fprintf(fp, "[\n");
+}
+
+void OpusPrintProbeFooter(FILE* fp, int printFormat) {
+    if (printFormat == OPUS_PRINT_JSON)
+        fprintf(fp, "\n]\n");
+}
+
+static void _OpusPrintCsvString(FILE* fp, const char* str) {
+    // Quoted; embedded quotes are doubled.
+    fputc('"', fp);
+    for (const char* c = str; *c; c++) {
+        if (*c == '"')
+            fputc('"', fp);
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+// index is used to separate JSON array elements.
+void OpusPrintProbeInfo(FILE* fp, int printFormat, u64 index, const char* path, const OpusProbeInfo* info, int valid) {
+    double duration = info->sampleRate != 0 ? (double)info->numSamples / info->sampleRate : 0.0;
+
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "%s  {\"path\": ", index != 0 ? ",\n" : "");
+        OpusPrintJsonString(fp, path);
+        if (!valid) {
+            fprintf(fp, ", \"format\": \"unknown\"}");
+            return;
+        }
+        fprintf(
+            fp,
+            ", \"format\": \"%s\", \"channels\": %u, \"sample_rate\": %u, \"pre_skip\": %u, "
+            "\"frame_size\": %u, \"data_size\": %llu, ",
+            OpusFormatName(info->format), info->channelCount, info->sampleRate, info->preSkipSamples,
+            info->frameSize, (unsigned long long)info->dataSize
+        );
+        if (info->lengthSource != OPUS_LENGTH_NONE)
+            fprintf(fp, "\"num_samples\": %llu, \"duration\": %.3f, ", (unsigned long long)info->numSamples, duration);
+        else
+            fprintf(fp, "\"num_samples\": null, \"duration\": null, ");
+        fprintf(fp, "\"length_source\": \"%s\", ", OpusLengthSourceNames[info->lengthSource]);
+        if (info->hasLoop)
+            fprintf(fp, "\"loop\": {\"start\": %u, \"end\": %u}}", info->loopStart, info->loopEnd);
+        else
+            fprintf(fp, "\"loop\": null}");
+    }
+    else if (printFormat == OPUS_PRINT_CSV) {
+        _OpusPrintCsvString(fp, path);
+
+        if (!valid) {
+            fprintf(fp, ",unknown,,,,,,,,,,,\n");
+            return;
+        }
+        fprintf(
+            fp, ",%s,%u,%u,%u,%u,%llu,",
+            OpusFormatName(info->format), info->channelCount, info->sampleRate, info->preSkipSamples,
+            info->frameSize, (unsigned long long)info->dataSize
+        );
+        if (info->lengthSource != OPUS_LENGTH_NONE)
+            fprintf(fp, "%llu,%.3f,", (unsigned long long)info->numSamples, duration);
+        else
+            fprintf(fp, ",,");
+        fprintf(fp, "%s,", OpusLengthSourceNames[info->lengthSource]);
+        if (info->hasLoop)
+            fprintf(fp, "%u,%u,\n", info->loopStart, info->loopEnd);
+        else
+            fprintf(fp, ",,\n");
+    }
+    else {
+        if (!valid) {
+            fprintf(fp, "%s: not a recognized OPUS file\n", path);
+            return;
+        }
+        fprintf(
+            fp, "%s: %s, %uch, %uhz, %s",
+            path, OpusFormatName(info->format), info->channelCount, info->sampleRate,
+            info->frameSize != 0 ? "CBR" : "VBR"
+        );
+        if (info->lengthSource != OPUS_LENGTH_NONE)
+            fprintf(
+                fp, ", %llu samples (%.3fs%s)", (unsigned long long)info->numSamples, duration,
+                info->lengthSource == OPUS_LENGTH_CBR ? ", estimated" : ""
+            );
+        if (info->hasLoop)
+            fprintf(fp, ", loop %u-%u", info->loopStart, info->loopEnd);
+        fprintf(fp, "\n");
+    }
+}
+
+// A file that couldn't be probed at all, as an entry of the same listing.
+void OpusPrintProbeError(FILE* fp, int printFormat, u64 index, const char* path, const char* error) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "%s  {\"path\": ", index != 0 ? ",\n" : "");
+        OpusPrintJsonString(fp, path);
+        fprintf(fp, ", \"error\": ");
+        OpusPrintJsonString(fp, error);
+        fprintf(fp, "}");
+    }
+    else if (printFormat == OPUS_PRINT_CSV) {
+        _OpusPrintCsvString(fp, path);
+        fprintf(fp, ",,,,,,,,,,,,");
+        _OpusPrintCsvString(fp, error);
+        fprintf(fp, "\n");
+    }
+    else
+        fprintf(fp, "%s: error: %s\n", path, error);
+}
+
+// Container checks for the commands that go over many files: what
+// OpusPreprocess panics on, plus every offset and size against the end of the
+// file.
+
+static OpusFileHeader* _OpusContainerFail(char* error, u64 errorSize, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error, errorSize, format, args);
+    va_end(args);
+
+    return NULL;
+}
+
+// Layout of the multistream chunk of fileHeader, whose dataOffset is known to
+// fit the file: returns 0, or 1 with the reason in error. The mapping has to
+// end before the data chunk and only name streams that exist.
+static int _OpusCheckMultistreamChunk(
+    const OpusFileHeader* fileHeader, const OpusMultistreamChunk* multistreamChunk, char* error, u64 errorSize
+) {
+    u32 streamCount = multistreamChunk->streamCount;
+    u32 coupledCount = multistreamChunk->coupledCount;
+    if (
+        fileHeader->channelCount == 0 || streamCount == 0 || coupledCount > streamCount ||
+        streamCount + coupledCount > 255 || multistreamChunk->chunkSize < 2u + fileHeader->channelCount ||
+        sizeof(OpusFileHeader) + sizeof(OpusMultistreamChunk) + fileHeader->channelCount > fileHeader->dataOffset
+    ) {
+        _OpusContainerFail(
+            error, errorSize, "invalid multistream layout (%u channels, %u streams, %u coupled)",
+            fileHeader->channelCount, streamCount, coupledCount
+        );
+        return 1;
+    }
+
+    for (u32 i = 0; i < fileHeader->channelCount; i++) {
+        u8 mapping = multistreamChunk->channelMapping[i];
+        if (mapping != 255 && mapping >= streamCount + coupledCount) {
+            _OpusContainerFail(error, errorSize, "invalid multistream channel mapping (channel %u maps to %u)", i, mapping);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns the Nintendo header of an OPUS file of any variant held in memory,
+// or NULL with the reason in error. Never panics, so it can run on worker
+// threads; the chunks the header points to are known to fit in size bytes.
+// allowTruncated lets the packets of the data chunk run past the end, for
+// walks that stop there by themselves (OpusAnalyzePackets).
+OpusFileHeader* OpusCheckContainer(u8* data, u64 size, int allowTruncated, char* error, u64 errorSize) {
+    const OpusVariant* variant = OpusFindVariant(data, size);
+    if (variant == NULL) {
+        if (size >= 4 && OggIsOggFormat(data, size))
+            return _OpusContainerFail(error, errorSize, "Ogg Opus file (see ogg_to_opus)");
+        return _OpusContainerFail(error, errorSize, "unknown OPUS container");
+    }
+
+    u64 headerOffset = variant->locateHeader(data, size);
+    if (headerOffset + sizeof(OpusFileHeader) > size)
+        return _OpusContainerFail(error, errorSize, "file header is truncated");
+
+    OpusFileHeader* fileHeader = (OpusFileHeader*)(data + headerOffset);
+    u64 available = size - headerOffset;
+
+    if (
+        fileHeader->sampleRate != 48000 && fileHeader->sampleRate != 24000 &&
+        fileHeader->sampleRate != 16000 && fileHeader->sampleRate != 12000 &&
+        fileHeader->sampleRate != 8000
+    )
+        return _OpusContainerFail(error, errorSize, "invalid sample rate (%uhz)", fileHeader->sampleRate);
+
+    if ((u64)fileHeader->dataOffset + sizeof(OpusDataChunk) > available)
+        return _OpusContainerFail(error, errorSize, "data chunk offset 0x%X is past the end of the file", fileHeader->dataOffset);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    if (dataChunk->chunkId != CHUNK_DATA_ID)
+        return _OpusContainerFail(error, errorSize, "data chunk ID is nonmatching");
+    if (!allowTruncated && dataChunk->chunkSize > available - fileHeader->dataOffset - sizeof(OpusDataChunk))
+        return _OpusContainerFail(error, errorSize, "data chunk size 0x%X overruns the file", dataChunk->chunkSize);
+
+    if (fileHeader->seekOffset != 0) {
+        if ((u64)fileHeader->seekOffset + sizeof(OpusSeekChunk) > available)
+            return _OpusContainerFail(error, errorSize, "seek chunk offset 0x%X is past the end of the file", fileHeader->seekOffset);
+
+        const OpusSeekChunk* seekChunk = (const OpusSeekChunk*)((const u8*)fileHeader + fileHeader->seekOffset);
+        if (seekChunk->chunkId == CHUNK_SEEK_ID && (u64)fileHeader->seekOffset + sizeof(OpusSeekChunk) + seekChunk->chunkSize > available)
+            return _OpusContainerFail(error, errorSize, "seek chunk size 0x%X overruns the file", seekChunk->chunkSize);
+    }
+
+    // The multistream chunk sits between the header and the data chunk, so
+    // it fits once its mapping ends before dataOffset.
+    const OpusMultistreamChunk* multistreamChunk = OpusGetMultistreamChunk(fileHeader);
+    if (multistreamChunk == NULL) {
+        if (fileHeader->channelCount != 1 && fileHeader->channelCount != 2)
+            return _OpusContainerFail(error, errorSize, "invalid channel count (%u)", fileHeader->channelCount);
+        return fileHeader;
+    }
+
+    if (_OpusCheckMultistreamChunk(fileHeader, multistreamChunk, error, errorSize) != 0)
+        return NULL;
+    return fileHeader;
+}
+
+// Packet-level stream analysis. Only the TOC byte of every packet is read;
+// nothing is decoded.
+
+#define OPUS_MODE_SILK (0)
+#define OPUS_MODE_HYBRID (1)
+#define OPUS_MODE_CELT (2)
+
+static const char* OpusModeNames[] = { "silk", "hybrid", "celt" };
+
+// Indexed by OPUS_BANDWIDTH_* - OPUS_BANDWIDTH_NARROWBAND.
+static const char* OpusBandwidthNames[] = { "narrowband", "mediumband", "wideband", "superwideband", "fullband" };
+
+// Frame durations in tenths of a millisecond, indexed by OpusTocInfo.durationIndex.
+static const u32 OpusFrameDurations[] = { 25, 50, 100, 200, 400, 600 };
+#define OPUS_FRAME_DURATION_COUNT (6)
+
+typedef struct {
+    u32 mode; // OPUS_MODE_*
+    u32 bandwidth; // OPUS_BANDWIDTH_*
+    u32 durationIndex; // Index into OpusFrameDurations.
+    u32 stereo;
+    u32 frameCountCode; // 0: one frame, 1: two equal, 2: two different, 3: arbitrary.
+} OpusTocInfo;
+
+void OpusParseToc(u8 toc, OpusTocInfo* info) {
+    u32 config = toc >> 3;
+
+    if (config < 12) {
+        info->mode = OPUS_MODE_SILK;
+        info->bandwidth = OPUS_BANDWIDTH_NARROWBAND + config / 4;
+        info->durationIndex = 2 + config % 4; // 10, 20, 40, 60ms
+    }
+    else if (config < 16) {
+        info->mode = OPUS_MODE_HYBRID;
+        info->bandwidth = OPUS_BANDWIDTH_SUPERWIDEBAND + (config - 12) / 2;
+        info->durationIndex = 2 + config % 2; // 10, 20ms
+    }
+    else {
+        static const u32 celtBandwidths[] = {
+            OPUS_BANDWIDTH_NARROWBAND, OPUS_BANDWIDTH_WIDEBAND,
+            OPUS_BANDWIDTH_SUPERWIDEBAND, OPUS_BANDWIDTH_FULLBAND
+        };
+        info->mode = OPUS_MODE_CELT;
+        info->bandwidth = celtBandwidths[(config - 16) / 4];
+        info->durationIndex = config % 4; // 2.5, 5, 10, 20ms
+    }
+
+    info->stereo = (toc >> 2) & 1;
+    info->frameCountCode = toc & 3;
+}
+
+#define OPUS_SIZE_HISTOGRAM_STEP (32)
+#define OPUS_SIZE_HISTOGRAM_BUCKETS (41) // Last bucket holds everything >= 1280 bytes.
+
+#define OPUS_FRAMES_PER_PACKET_MAX (48)
+
+typedef struct {
+    u64 packetCount;
+    u64 totalSamples; // Per channel, pre-skip included.
+    u64 payloadBytes; // Opus packet bytes, OpusPacketHeader excluded.
+
+    u32 minPacketSize;
+    u32 maxPacketSize;
+
+    u64 modeCounts[3];
+    u64 bandwidthCounts[5];
+    u64 durationCounts[OPUS_FRAME_DURATION_COUNT];
+    u64 framesPerPacketCounts[OPUS_FRAMES_PER_PACKET_MAX + 1];
+    u64 stereoCount;
+
+    u64 sizeHistogram[OPUS_SIZE_HISTOGRAM_BUCKETS];
+
+    u32 timelineWindowSamples;
+    ListData timelineBytes; // u64 payload bytes per timeline window.
+
+    // First packet that could not be parsed; the walk stops there.
+    int truncated;
+    u64 invalidPacketIndex;
+    u64 invalidPacketOffset; // Relative to the data chunk payload.
+} OpusPacketStats;
+
+// Walk every packet of the data chunk. availableSize is the amount of bytes
+// after fileHeader that can safely be read.
+void OpusAnalyzePackets(OpusFileHeader* fileHeader, u64 availableSize, double timelineWindowSeconds, OpusPacketStats* stats) {
+    memset(stats, 0, sizeof(OpusPacketStats));
+    stats->minPacketSize = 0xFFFFFFFF;
+    stats->timelineWindowSamples = (u32)(timelineWindowSeconds * fileHeader->sampleRate);
+    if (stats->timelineWindowSamples == 0)
+        stats->timelineWindowSamples = fileHeader->sampleRate;
+
+    ListInit(&stats->timelineBytes, sizeof(u64), 1024);
+
+    // Nothing can be read when the data chunk header is already past the end.
+    if ((u64)fileHeader->dataOffset + sizeof(OpusDataChunk) > availableSize) {
+        stats->truncated = 1;
+        stats->minPacketSize = 0;
+        return;
+    }
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+
+    u64 dataSize = dataChunk->chunkSize;
+    u64 dataAvailable = availableSize - fileHeader->dataOffset - sizeof(OpusDataChunk);
+    if (dataSize > dataAvailable) {
+        dataSize = dataAvailable;
+        stats->truncated = 1;
+    }
+
+    u64 offset = 0;
+    while (offset < dataSize) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = offset + sizeof(OpusPacketHeader) <= dataSize ?
+            __builtin_bswap32(packetHeader->packetSize) : 0;
+
+        int frameCount = packetSize != 0 && offset + sizeof(OpusPacketHeader) + packetSize <= dataSize ?
+            opus_packet_get_nb_frames(packetHeader->packet, packetSize) : OPUS_INVALID_PACKET;
+        if (frameCount <= 0 || frameCount > OPUS_FRAMES_PER_PACKET_MAX) {
+            stats->truncated = 1;
+            stats->invalidPacketIndex = stats->packetCount;
+            stats->invalidPacketOffset = offset;
+            break;
+        }
+
+        OpusTocInfo toc;
+        OpusParseToc(packetHeader->packet[0], &toc);
+
+        u32 packetSamples = (u32)frameCount * opus_packet_get_samples_per_frame(packetHeader->packet, fileHeader->sampleRate);
+
+        // Attribute the packet to the window it starts in.
+        u64 window = stats->totalSamples / stats->timelineWindowSamples;
+        while (stats->timelineBytes.elementCount <= window) {
+            u64 zero = 0;
+            ListAdd(&stats->timelineBytes, &zero);
+        }
+        ((u64*)stats->timelineBytes.data)[window] += packetSize;
+
+        stats->packetCount++;
+        stats->totalSamples += packetSamples;
+        stats->payloadBytes += packetSize;
+
+        stats->minPacketSize = MIN(stats->minPacketSize, packetSize);
+        stats->maxPacketSize = MAX(stats->maxPacketSize, packetSize);
+
+        stats->modeCounts[toc.mode]++;
+        stats->bandwidthCounts[toc.bandwidth - OPUS_BANDWIDTH_NARROWBAND]++;
+        stats->durationCounts[toc.durationIndex]++;
+        stats->framesPerPacketCounts[frameCount]++;
+        stats->stereoCount += toc.stereo;
+
+        stats->sizeHistogram[MIN(packetSize / OPUS_SIZE_HISTOGRAM_STEP, OPUS_SIZE_HISTOGRAM_BUCKETS - 1)]++;
+
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    if (stats->packetCount == 0)
+        stats->minPacketSize = 0;
+}
+
+void OpusPacketStatsDestroy(OpusPacketStats* stats) {
+    ListDestroy(&stats->timelineBytes);
+}
+
+static void _OpusPrintCounts(
+    FILE* fp, int printFormat, const char* title,
+    const u64* counts, u32 count, const char** names, const u32* values
+) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, ",\n  \"%s\": {", title);
+        int first = 1;
+        for (u32 i = 0; i < count; i++) {
+            if (counts[i] == 0)
+                continue;
+            if (names)
+                fprintf(fp, "%s\"%s\": %llu", first ? "" : ", ", names[i], (unsigned long long)counts[i]);
+            else
+                fprintf(fp, "%s\"%u\": %llu", first ? "" : ", ", values ? values[i] : i, (unsigned long long)counts[i]);
+            first = 0;
+        }
+        fprintf(fp, "}");
+    }
+    else {
+        fprintf(fp, "%s:", title);
+        for (u32 i = 0; i < count; i++) {
+            if (counts[i] == 0)
+                continue;
+            if (names)
+                fprintf(fp, " %s=%llu", names[i], (unsigned long long)counts[i]);
+            else
+                fprintf(fp, " %u=%llu", values ? values[i] : i, (unsigned long long)counts[i]);
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+// The last window is usually partial; its bitrate is taken over its real length.
+static double _OpusTimelineWindowSeconds(OpusFileHeader* fileHeader, const OpusPacketStats* stats, u64 window) {
+    u64 windowStart = window * stats->timelineWindowSamples;
+    u64 windowSamples = MIN((u64)stats->timelineWindowSamples, stats->totalSamples - windowStart);
+    return (double)windowSamples / fileHeader->sampleRate;
+}
+
+void OpusPrintPacketStats(FILE* fp, int printFormat, const char* path, OpusFileHeader* fileHeader, const OpusPacketStats* stats) {
+    u64 playableSamples = stats->totalSamples > fileHeader->preSkipSamples ?
+        stats->totalSamples - fileHeader->preSkipSamples : 0;
+    double duration = (double)playableSamples / fileHeader->sampleRate;
+    double totalDuration = (double)stats->totalSamples / fileHeader->sampleRate;
+    double averageBitrate = totalDuration > 0 ? stats->payloadBytes * 8.0 / totalDuration : 0.0;
+    double overhead = stats->payloadBytes != 0 ?
+        100.0 * stats->packetCount * sizeof(OpusPacketHeader) / (stats->payloadBytes + stats->packetCount * sizeof(OpusPacketHeader)) : 0.0;
+
+    u32 histogramStarts[OPUS_SIZE_HISTOGRAM_BUCKETS];
+    for (u32 i = 0; i < OPUS_SIZE_HISTOGRAM_BUCKETS; i++)
+        histogramStarts[i] = i * OPUS_SIZE_HISTOGRAM_STEP;
+
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "{\n  \"path\": ");
+        OpusPrintJsonString(fp, path);
+        fprintf(
+            fp,
+            ",\n  \"channels\": %u, \"sample_rate\": %u, \"pre_skip\": %u,\n"
+            "  \"packets\": %llu, \"total_samples\": %llu, \"num_samples\": %llu, \"duration\": %.3f,\n"
+            "  \"payload_bytes\": %llu, \"header_overhead_percent\": %.2f, \"average_bitrate\": %.0f,\n"
+            "  \"min_packet_size\": %u, \"max_packet_size\": %u, \"stereo_packets\": %llu",
+            fileHeader->channelCount, fileHeader->sampleRate, fileHeader->preSkipSamples,
+            (unsigned long long)stats->packetCount, (unsigned long long)stats->totalSamples,
+            (unsigned long long)playableSamples, duration,
+            (unsigned long long)stats->payloadBytes, overhead, averageBitrate,
+            stats->minPacketSize, stats->maxPacketSize, (unsigned long long)stats->stereoCount
+        );
+        fprintf(fp, ",\n  \"seek_entries\": %u", OpusGetSeekEntryCount(OpusGetSeekChunk(fileHeader)));
+        if (stats->truncated)
+            fprintf(
+                fp, ",\n  \"invalid_packet\": {\"index\": %llu, \"offset\": %llu}",
+                (unsigned long long)stats->invalidPacketIndex, (unsigned long long)stats->invalidPacketOffset
+            );
+    }
+    else {
+        fprintf(fp, "%s\n", path);
+        fprintf(
+            fp, "channels=%u sample_rate=%u pre_skip=%u\n",
+            fileHeader->channelCount, fileHeader->sampleRate, fileHeader->preSkipSamples
+        );
+        fprintf(
+            fp, "packets=%llu samples=%llu (%llu after pre-skip, %.3fs)\n",
+            (unsigned long long)stats->packetCount, (unsigned long long)stats->totalSamples,
+            (unsigned long long)playableSamples, duration
+        );
+        fprintf(
+            fp, "payload=%llu bytes, packet header overhead %.2f%%, average bitrate %.0f bps\n",
+            (unsigned long long)stats->payloadBytes, overhead, averageBitrate
+        );
+        fprintf(fp, "packet size: min=%u max=%u\n", stats->minPacketSize, stats->maxPacketSize);
+        if (OpusGetSeekChunk(fileHeader) != NULL)
+            fprintf(fp, "seek entry points: %u\n", OpusGetSeekEntryCount(OpusGetSeekChunk(fileHeader)));
+        if (stats->truncated)
+            fprintf(
+                fp, "WARNING: packet %llu at data offset 0x%llX is invalid or truncated, stopped there\n",
+                (unsigned long long)stats->invalidPacketIndex, (unsigned long long)stats->invalidPacketOffset
+            );
+    }
+
+    _OpusPrintCounts(fp, printFormat, "modes", stats->modeCounts, 3, OpusModeNames, NULL);
+    _OpusPrintCounts(fp, printFormat, "bandwidths", stats->bandwidthCounts, 5, OpusBandwidthNames, NULL);
+    _OpusPrintCounts(fp, printFormat, "frame_durations_ms_x10", stats->durationCounts, OPUS_FRAME_DURATION_COUNT, NULL, OpusFrameDurations);
+    _OpusPrintCounts(fp, printFormat, "frames_per_packet", stats->framesPerPacketCounts, OPUS_FRAMES_PER_PACKET_MAX + 1, NULL, NULL);
+    _OpusPrintCounts(fp, printFormat, "size_histogram", stats->sizeHistogram, OPUS_SIZE_HISTOGRAM_BUCKETS, NULL, histogramStarts);
+
+    // Bitrate per timeline window.
+    double windowSeconds = (double)stats->timelineWindowSamples / fileHeader->sampleRate;
+    const u64* timeline = (const u64*)stats->timelineBytes.data;
+
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, ",\n  \"timeline_window\": %.3f,\n  \"timeline_bitrate\": [", windowSeconds);
+        for (u64 i = 0; i < stats->timelineBytes.elementCount; i++)
+            fprintf(fp, "%s%.0f", i != 0 ? ", " : "", timeline[i] * 8.0 / _OpusTimelineWindowSeconds(fileHeader, stats, i));
+        fprintf(fp, "]\n}\n");
+    }
+    else {
+        fprintf(fp, "bitrate timeline (%.3fs windows, kbps):", windowSeconds);
+        for (u64 i = 0; i < stats->timelineBytes.elementCount; i++)
+            fprintf(fp, "%s%.1f", i % 16 == 0 ? "\n  " : " ", timeline[i] * 8.0 / _OpusTimelineWindowSeconds(fileHeader, stats, i) / 1000.0);
+        fprintf(fp, "\n");
+    }
+}
+
+// A file whose container can't be walked, in place of its packet stats.
+void OpusPrintPacketStatsError(FILE* fp, int printFormat, const char* path, const char* error) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "{\n  \"path\": ");
+        OpusPrintJsonString(fp, path);
+        fprintf(fp, ",\n  \"error\": ");
+        OpusPrintJsonString(fp, error);
+        fprintf(fp, "\n}\n");
+    }
+    else
+        fprintf(fp, "%s\nERROR: %s\n", path, error);
+}
+
+// Integrity verification. Every packet is decoded and the decoder final range
+// is compared to the one stored in its packet header, which catches
+// corruption inside packets that still parse fine.
+
+#define OPUS_VERIFY_OK (0)
+#define OPUS_VERIFY_BAD_CONTAINER (1) // Headers or chunk sizes are inconsistent.
+#define OPUS_VERIFY_BAD_PACKET (2) // A packet is truncated or fails to decode.
+#define OPUS_VERIFY_RANGE_MISMATCH (3) // Decoded final range differs from the stored one.
+#define OPUS_VERIFY_BAD_LENGTH (4) // Stored length or loop does not fit the packets.
+
+static const char* OpusVerifyStatusNames[] = { "ok", "bad_container", "bad_packet", "range_mismatch", "bad_length" };
+
+typedef struct {
+    u32 status; // OPUS_VERIFY_*
+    char message[160];
+
+    // Set for OPUS_VERIFY_BAD_PACKET and OPUS_VERIFY_RANGE_MISMATCH; the walk stops there.
+    int hasPacket;
+    u64 packetIndex;
+    u64 packetOffset; // Absolute offset in the file.
+    u32 storedRange;
+    u32 decodedRange;
+
+    u64 packetCount; // Packets decoded.
+    u64 uncheckedCount; // Packets stored without a final range (zero), decoded but not compared.
+    u64 decodedSamples; // Per channel, pre-skip included.
+} OpusVerifyResult;
+
+static int _OpusVerifyFail(OpusVerifyResult* result, u32 status, const char* format, ...) {
+    result->status = status;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(result->message, sizeof(result->message), format, args);
+    va_end(args);
+
+    return (int)status;
+}
+
+// Verify a Nintendo or Capcom OPUS file held in memory. Never panics, so it
+// can run on worker threads; returns the OPUS_VERIFY_* status.
+int OpusVerify(const u8* data, u64 size, OpusVerifyResult* result) {
+    memset(result, 0, sizeof(OpusVerifyResult));
+
+    // Unknown containers are checked as plain Nintendo files, which reports
+    // what is wrong with the header.
+    const OpusVariant* variant = OpusFindVariant(data, size);
+    u64 headerOffset = variant ? variant->locateHeader(data, size) : 0;
+
+    int isCapcom = variant != NULL && strcmp(variant->name, "capcom") == 0;
+    if (isCapcom && size < sizeof(OpusCapcomHeader))
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "Capcom header is truncated");
+
+    if (headerOffset + sizeof(OpusFileHeader) > size)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "file header is truncated");
+
+    const OpusFileHeader* fileHeader = (const OpusFileHeader*)(data + headerOffset);
+    u64 available = size - headerOffset;
+
+    if (fileHeader->chunkId == OGG_OPUS_ID)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "Ogg Opus files carry no final range");
+    if (fileHeader->chunkId != CHUNK_HEADER_ID)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "file header ID is nonmatching");
+
+    if (
+        fileHeader->sampleRate != 48000 && fileHeader->sampleRate != 24000 &&
+        fileHeader->sampleRate != 16000 && fileHeader->sampleRate != 12000 &&
+        fileHeader->sampleRate != 8000
+    )
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "invalid sample rate (%uhz)", fileHeader->sampleRate);
+
+    // Multistream files are checked stream by stream; the stored final range
+    // is the XOR of the streams' ranges.
+    const OpusMultistreamChunk* multistreamChunk = NULL;
+    if (
+        (u64)fileHeader->dataOffset <= available &&
+        (multistreamChunk = OpusGetMultistreamChunk((OpusFileHeader*)fileHeader)) != NULL
+    ) {
+        char layoutError[128];
+        if (_OpusCheckMultistreamChunk(fileHeader, multistreamChunk, layoutError, sizeof(layoutError)) != 0)
+            return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "%s", layoutError);
+    }
+    else if (fileHeader->channelCount != 1 && fileHeader->channelCount != 2)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "invalid channel count (%u)", fileHeader->channelCount);
+
+    if (isCapcom && ((const OpusCapcomHeader*)data)->channelCount != fileHeader->channelCount)
+        return _OpusVerifyFail(
+            result, OPUS_VERIFY_BAD_CONTAINER, "Capcom channel count (%u) differs from the file header (%u)",
+            ((const OpusCapcomHeader*)data)->channelCount, fileHeader->channelCount
+        );
+
+    if ((u64)fileHeader->dataOffset + sizeof(OpusDataChunk) > available)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "data chunk offset 0x%X is past the end of the file", fileHeader->dataOffset);
+
+    const OpusDataChunk* dataChunk = (const OpusDataChunk*)((const u8*)fileHeader + fileHeader->dataOffset);
+    if (dataChunk->chunkId != CHUNK_DATA_ID)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "data chunk ID is nonmatching");
+
+    u64 dataAvailable = available - fileHeader->dataOffset - sizeof(OpusDataChunk);
+    if (dataChunk->chunkSize > dataAvailable)
+        return _OpusVerifyFail(
+            result, OPUS_VERIFY_BAD_CONTAINER, "data chunk size 0x%X overruns the file (0x%llX bytes available)",
+            dataChunk->chunkSize, (unsigned long long)dataAvailable
+        );
+
+    const OpusSeekChunk* seekChunk = NULL;
+    if (fileHeader->seekOffset != 0) {
+        if ((u64)fileHeader->seekOffset + sizeof(OpusSeekChunk) > available)
+            return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "seek chunk offset 0x%X is past the end of the file", fileHeader->seekOffset);
+
+        seekChunk = (const OpusSeekChunk*)((const u8*)fileHeader + fileHeader->seekOffset);
+        if (seekChunk->chunkId != CHUNK_SEEK_ID)
+            return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "seek chunk ID is nonmatching");
+        if ((u64)fileHeader->seekOffset + sizeof(OpusSeekChunk) + seekChunk->chunkSize > available)
+            return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "seek chunk size 0x%X overruns the file", seekChunk->chunkSize);
+    }
+    u32 seekEntryCount = OpusGetSeekEntryCount(seekChunk);
+    u32 nextSeekEntry = 0;
+
+    u32 streamCount = multistreamChunk != NULL ? multistreamChunk->streamCount : 1;
+
+    OpusDecoder* decoders[255];
+    for (u32 i = 0; i < streamCount; i++) {
+        u32 streamChannelCount = multistreamChunk == NULL ?
+            fileHeader->channelCount : (i < multistreamChunk->coupledCount ? 2 : 1);
+
+        int opusError;
+        decoders[i] = opus_decoder_create(fileHeader->sampleRate, streamChannelCount, &opusError);
+        if (opusError != OPUS_OK) {
+            for (u32 j = 0; j < i; j++)
+                opus_decoder_destroy(decoders[j]);
+            return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "opus_decoder_create fail: %s", opus_strerror(opusError));
+        }
+    }
+
+    // Largest possible packet duration is 120ms.
+    u32 maxPacketSamples = fileHeader->sampleRate / 1000 * 120;
+    s16* pcm = (s16*)malloc(sizeof(s16) * maxPacketSamples * 2);
+    // Elementary packets split out of multistream packets.
+    u8* streamPacket = multistreamChunk != NULL ? (u8*)malloc(MAX(dataChunk->chunkSize, 1u)) : NULL;
+    if (pcm == NULL || (multistreamChunk != NULL && streamPacket == NULL)) {
+        for (u32 i = 0; i < streamCount; i++)
+            opus_decoder_destroy(decoders[i]);
+        free(pcm);
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "malloc fail");
+    }
+
+    u64 dataStart = headerOffset + fileHeader->dataOffset + sizeof(OpusDataChunk);
+
+    u64 offset = 0;
+    while (offset < dataChunk->chunkSize) {
+        const OpusPacketHeader* packetHeader = (const OpusPacketHeader*)(dataChunk->data + offset);
+
+        result->packetIndex = result->packetCount;
+        result->packetOffset = dataStart + offset;
+
+        if (offset + sizeof(OpusPacketHeader) > dataChunk->chunkSize) {
+            result->hasPacket = 1;
+            _OpusVerifyFail(result, OPUS_VERIFY_BAD_PACKET, "packet header is cut off by the end of the data chunk");
+            break;
+        }
+
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+        if (packetSize == 0 || offset + sizeof(OpusPacketHeader) + packetSize > dataChunk->chunkSize) {
+            result->hasPacket = 1;
+            _OpusVerifyFail(result, OPUS_VERIFY_BAD_PACKET, "packet size 0x%X does not fit the data chunk", packetSize);
+            break;
+        }
+
+        // Entry points must start a packet at the sample offset they claim.
+        if (nextSeekEntry < seekEntryCount && seekChunk->entries[nextSeekEntry].dataOffset < offset) {
+            _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "seek entry %u is not on a packet boundary", nextSeekEntry);
+            break;
+        }
+        if (nextSeekEntry < seekEntryCount && seekChunk->entries[nextSeekEntry].dataOffset == offset) {
+            if (seekChunk->entries[nextSeekEntry].sampleOffset != result->decodedSamples) {
+                result->hasPacket = 1;
+                _OpusVerifyFail(
+                    result, OPUS_VERIFY_BAD_CONTAINER, "seek entry %u claims sample %u, the packet starts at %llu",
+                    nextSeekEntry, seekChunk->entries[nextSeekEntry].sampleOffset, (unsigned long long)result->decodedSamples
+                );
+                break;
+            }
+            for (u32 i = 0; i < streamCount; i++)
+                opus_decoder_ctl(decoders[i], OPUS_RESET_STATE);
+            nextSeekEntry++;
+        }
+
+        int decodedSamples = 0;
+        u32 decodedRange = 0;
+        for (u32 i = 0; i < streamCount; i++) {
+            const u8* packet = packetHeader->packet;
+            u32 size = packetSize;
+            if (multistreamChunk != NULL) {
+                size = _OpusGetStreamPacket(packetHeader->packet, packetSize, i, streamCount, streamPacket);
+                packet = streamPacket;
+                if (size == 0) {
+                    result->hasPacket = 1;
+                    _OpusVerifyFail(result, OPUS_VERIFY_BAD_PACKET, "multistream framing of stream %u is invalid", i);
+                    break;
+                }
+            }
+
+            int streamSamples = opus_decode(decoders[i], packet, (opus_int32)size, pcm, (int)maxPacketSamples, 0);
+            if (streamSamples < 0) {
+                result->hasPacket = 1;
+                _OpusVerifyFail(result, OPUS_VERIFY_BAD_PACKET, "decode failed: %s", opus_strerror(streamSamples));
+                break;
+            }
+            if (i != 0 && streamSamples != decodedSamples) {
+                result->hasPacket = 1;
+                _OpusVerifyFail(
+                    result, OPUS_VERIFY_BAD_PACKET, "stream %u decodes to %d samples, stream 0 to %d",
+                    i, streamSamples, decodedSamples
+                );
+                break;
+            }
+            decodedSamples = streamSamples;
+
+            u32 streamRange;
+            opus_decoder_ctl(decoders[i], OPUS_GET_FINAL_RANGE(&streamRange));
+            decodedRange ^= streamRange;
+        }
+        if (result->status != OPUS_VERIFY_OK)
+            break;
+
+        u32 storedRange = __builtin_bswap32(packetHeader->finalRange);
+        if (storedRange == 0)
+            result->uncheckedCount++;
+        else if (storedRange != decodedRange) {
+            result->hasPacket = 1;
+            result->storedRange = storedRange;
+            result->decodedRange = decodedRange;
+            _OpusVerifyFail(
+                result, OPUS_VERIFY_RANGE_MISMATCH, "final range 0x%08X differs from the stored 0x%08X",
+                decodedRange, storedRange
+            );
+            break;
+        }
+
+        result->packetCount++;
+        result->decodedSamples += (u64)decodedSamples;
+
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    free(streamPacket);
+    free(pcm);
+    for (u32 i = 0; i < streamCount; i++)
+        opus_decoder_destroy(decoders[i]);
+
+    if (result->status != OPUS_VERIFY_OK)
+        return (int)result->status;
+
+    if (nextSeekEntry < seekEntryCount)
+        return _OpusVerifyFail(result, OPUS_VERIFY_BAD_CONTAINER, "seek entry %u is past the last packet", nextSeekEntry);
+
+    if (fileHeader->preSkipSamples > result->decodedSamples)
+        return _OpusVerifyFail(
+            result, OPUS_VERIFY_BAD_LENGTH, "pre-skip (%u) is longer than the stream (%llu samples)",
+            fileHeader->preSkipSamples, (unsigned long long)result->decodedSamples
+        );
+
+    OpusVariantMetadata metadata;
+    OpusReadVariantMetadata(variant, data, size, &metadata);
+
+    u64 playableSamples = result->decodedSamples - fileHeader->preSkipSamples;
+    if (metadata.numSamples > playableSamples)
+        return _OpusVerifyFail(
+            result, OPUS_VERIFY_BAD_LENGTH, "container num_samples (%u) exceeds the decoded length (%llu)",
+            metadata.numSamples, (unsigned long long)playableSamples
+        );
+
+    u64 loopLimit = metadata.numSamples != 0 ? metadata.numSamples : playableSamples;
+    if (metadata.hasLoop && (metadata.loopStart >= metadata.loopEnd || metadata.loopEnd > loopLimit))
+        return _OpusVerifyFail(
+            result, OPUS_VERIFY_BAD_LENGTH, "loop %u-%u does not fit the length (%llu)",
+            metadata.loopStart, metadata.loopEnd, (unsigned long long)loopLimit
+        );
+
+    return OPUS_VERIFY_OK;
+}
+
+void OpusPrintVerifyResult(FILE* fp, int printFormat, u64 index, const char* path, const OpusVerifyResult* result) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "%s  {\"path\": ", index != 0 ? ",\n" : "");
+        OpusPrintJsonString(fp, path);
+        fprintf(
+            fp, ", \"status\": \"%s\", \"packets\": %llu, \"unchecked_packets\": %llu, \"decoded_samples\": %llu",
+            OpusVerifyStatusNames[result->status], (unsigned long long)result->packetCount,
+            (unsigned long long)result->uncheckedCount, (unsigned long long)result->decodedSamples
+        );
+        if (result->status == OPUS_VERIFY_OK) {
+            fprintf(fp, ", \"error\": null}");
+            return;
+        }
+
+        fprintf(fp, ", \"error\": {\"message\": ");
+        OpusPrintJsonString(fp, result->message);
+        if (result->hasPacket) {
+            fprintf(
+                fp, ", \"packet\": %llu, \"offset\": %llu",
+                (unsigned long long)result->packetIndex, (unsigned long long)result->packetOffset
+            );
+            if (result->status == OPUS_VERIFY_RANGE_MISMATCH)
+                fprintf(fp, ", \"stored_range\": %u, \"decoded_range\": %u", result->storedRange, result->decodedRange);
+        }
+        fprintf(fp, "}}");
+    }
+    else {
+        if (result->status == OPUS_VERIFY_OK) {
+            fprintf(fp, "OK   %s (%llu packets", path, (unsigned long long)result->packetCount);
+            if (result->uncheckedCount != 0)
+                fprintf(fp, ", %llu without final range", (unsigned long long)result->uncheckedCount);
+            fprintf(fp, ")\n");
+            return;
+        }
+
+        fprintf(fp, "BAD  %s: ", path);
+        if (result->hasPacket)
+            fprintf(
+                fp, "packet %llu at 0x%llX: ",
+                (unsigned long long)result->packetIndex, (unsigned long long)result->packetOffset
+            );
+        fprintf(fp, "%s\n", result->message);
+    }
+}
+
+// Loop checks decode only what playback hears around the jump: the audio up
+// to loopEnd and from loopStart on, plus the audio after loopEnd when the
+// file has some. Each window is reached with OpusStreamDecoderSeek, so a
+// check costs a few packets however long the file is.
+
+#define OPUS_LOOP_CHECK_OK (0)
+#define OPUS_LOOP_CHECK_BAD (1) // The splice clicks or jumps in spectrum.
+#define OPUS_LOOP_CHECK_NO_LOOP (2)
+#define OPUS_LOOP_CHECK_ERROR (3) // The file or its loop can't be checked.
+
+static const char* OpusLoopCheckStatusNames[] = { "ok", "bad", "no_loop", "error" };
+
+typedef struct {
+    u32 status; // OPUS_LOOP_CHECK_*
+    char message[160];
+
+    u32 sampleRate;
+    u64 numSamples; // Per channel, pre-skip excluded.
+    u32 loopStart;
+    u32 loopEnd;
+
+    PcmSplice splice;
+
+    // The audio after loopEnd against the audio after loopStart (see
+    // PcmSeamMismatch); a match means the loop was cut from a longer render
+    // at a point where both continue alike, which outweighs the splice scores.
+    int hasContinuation;
+    double continuation;
+} OpusLoopCheckResult;
+
+static int _OpusLoopCheckFail(OpusLoopCheckResult* result, u32 status, const char* format, ...) {
+    result->status = status;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(result->message, sizeof(result->message), format, args);
+    va_end(args);
+
+    return (int)status;
+}
+
+// OpusGetPacketSampleCount that stops at the first packet overrunning the
+// data chunk or failing to parse instead of panicking.
+static u64 _OpusLoopCheckPacketSamples(const OpusFileHeader* fileHeader) {
+    const OpusDataChunk* dataChunk = (const OpusDataChunk*)((const u8*)fileHeader + fileHeader->dataOffset);
+
+    u64 sampleCount = 0;
+    u64 offset = 0;
+    while (offset + sizeof(OpusPacketHeader) <= dataChunk->chunkSize) {
+        const OpusPacketHeader* packetHeader = (const OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+        if (packetSize == 0 || offset + sizeof(OpusPacketHeader) + packetSize > dataChunk->chunkSize)
+            break;
+
+        int packetSamples = opus_packet_get_nb_samples(packetHeader->packet, (opus_int32)packetSize, fileHeader->sampleRate);
+        if (packetSamples < 0)
+            break;
+
+        sampleCount += packetSamples;
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    return sampleCount;
+}
+
+// Check the loop of an OPUS file held in memory; returns the
+// OPUS_LOOP_CHECK_* status. Never panics, so it can run on worker threads:
+// container problems are reported, and a bad packet shows as the stream
+// ending early, but only the loop windows are decoded; run verify on files
+// that may be corrupt.
+int OpusCheckLoop(const u8* data, u64 size, OpusLoopCheckResult* result) {
+    memset(result, 0, sizeof(OpusLoopCheckResult));
+
+    const OpusVariant* variant = OpusFindVariant(data, size);
+    if (variant == NULL)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "unknown container");
+
+    u64 headerOffset = variant->locateHeader(data, size);
+    if (headerOffset + sizeof(OpusFileHeader) > size)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "file header is truncated");
+
+    OpusFileHeader* fileHeader = (OpusFileHeader*)(data + headerOffset);
+    u64 available = size - headerOffset;
+
+    if (fileHeader->chunkId != CHUNK_HEADER_ID)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "file header ID is nonmatching");
+    if ((u64)fileHeader->dataOffset + sizeof(OpusDataChunk) > available)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "data chunk offset 0x%X is past the end of the file", fileHeader->dataOffset);
+    if ((u64)fileHeader->seekOffset + sizeof(OpusSeekChunk) > available)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "seek chunk offset 0x%X is past the end of the file", fileHeader->seekOffset);
+    if (OpusGetMultistreamChunk(fileHeader) != NULL)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "multistream files are not supported");
+    if (fileHeader->channelCount != 1 && fileHeader->channelCount != 2)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "invalid channel count (%u)", fileHeader->channelCount);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    if (dataChunk->chunkId != CHUNK_DATA_ID)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "data chunk ID is nonmatching");
+    if (dataChunk->chunkSize > available - fileHeader->dataOffset - sizeof(OpusDataChunk))
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "data chunk size 0x%X overruns the file", dataChunk->chunkSize);
+
+    OpusVariantMetadata metadata;
+    OpusReadVariantMetadata(variant, data, size, &metadata);
+
+    u64 packetSamples = _OpusLoopCheckPacketSamples(fileHeader);
+    u64 playableSamples = packetSamples - MIN(packetSamples, (u64)fileHeader->preSkipSamples);
+
+    result->sampleRate = fileHeader->sampleRate;
+    result->numSamples = metadata.numSamples != 0 ? MIN((u64)metadata.numSamples, playableSamples) : playableSamples;
+    result->loopStart = metadata.loopStart;
+    result->loopEnd = metadata.loopEnd;
+
+    if (!metadata.hasLoop)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_NO_LOOP, "no loop");
+    if (metadata.loopStart >= metadata.loopEnd || metadata.loopEnd > result->numSamples)
+        return _OpusLoopCheckFail(
+            result, OPUS_LOOP_CHECK_ERROR, "loop %u-%u does not fit the length (%llu)",
+            metadata.loopStart, metadata.loopEnd, (unsigned long long)result->numSamples
+        );
+    if (metadata.loopEnd < PCM_SPLICE_WINDOW || result->numSamples - metadata.loopStart < PCM_SPLICE_WINDOW)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "loop is too close to the ends of the file to check");
+
+    u32 channelCount = fileHeader->channelCount;
+
+    // before: the window up to loopEnd, then what follows it in the file.
+    // after: the window from loopStart on.
+    s16* before = (s16*)malloc(sizeof(s16) * (PCM_SPLICE_WINDOW + PCM_SEAM_WINDOW) * channelCount);
+    s16* after = (s16*)malloc(sizeof(s16) * MAX(PCM_SPLICE_WINDOW, PCM_SEAM_WINDOW) * channelCount);
+    if (before == NULL || after == NULL) {
+        free(before);
+        free(after);
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "malloc fail");
+    }
+
+    OpusStreamDecoder streamDecoder;
+    OpusStreamDecoderInit(&streamDecoder, fileHeader, result->numSamples, 0, 0);
+
+    u64 beforeCount = 0;
+    if (OpusStreamDecoderSeek(&streamDecoder, metadata.loopEnd - PCM_SPLICE_WINDOW, OPUS_SEEK_PREROLL_PACKETS))
+        beforeCount = OpusStreamDecoderRead(&streamDecoder, before, PCM_SPLICE_WINDOW + PCM_SEAM_WINDOW);
+
+    u64 afterCount = 0;
+    if (OpusStreamDecoderSeek(&streamDecoder, metadata.loopStart, OPUS_SEEK_PREROLL_PACKETS))
+        afterCount = OpusStreamDecoderRead(&streamDecoder, after, MAX(PCM_SPLICE_WINDOW, PCM_SEAM_WINDOW));
+
+    OpusStreamDecoderDestroy(&streamDecoder);
+
+    if (beforeCount < PCM_SPLICE_WINDOW || afterCount < PCM_SPLICE_WINDOW) {
+        free(before);
+        free(after);
+        if (streamDecoder.error[0] != '\0')
+            return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "stream ends before the loop windows: %s", streamDecoder.error);
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_ERROR, "stream ends before the loop windows");
+    }
+
+    PcmMeasureSplice(before, after, channelCount, &result->splice);
+
+    u64 continuationCount = beforeCount - PCM_SPLICE_WINDOW;
+    if (continuationCount != 0) {
+        result->hasContinuation = 1;
+        result->continuation = PcmSeamMismatch(
+            after, before + (u64)PCM_SPLICE_WINDOW * channelCount, continuationCount * channelCount
+        );
+    }
+
+    free(before);
+    free(after);
+
+    int bad = result->hasContinuation && result->continuation < PCM_LOOP_SEAMLESS ? 0 : result->splice.bad;
+    if (!bad)
+        return OPUS_LOOP_CHECK_OK;
+
+    if (result->splice.click > PCM_SPLICE_CLICK)
+        return _OpusLoopCheckFail(result, OPUS_LOOP_CHECK_BAD, "click at the splice (%.1f dB)", result->splice.click);
+    return _OpusLoopCheckFail(
+        result, OPUS_LOOP_CHECK_BAD, "spectral jump at the splice (%.1f dB, %.1f dB around it)",
+        result->splice.spectralJump, result->splice.spectralFlux
+    );
+}
+
+void OpusPrintLoopCheckResult(FILE* fp, int printFormat, u64 index, const char* path, const OpusLoopCheckResult* result) {
+    int checked = result->status == OPUS_LOOP_CHECK_OK || result->status == OPUS_LOOP_CHECK_BAD;
+
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "%s  {\"path\": ", index != 0 ? ",\n" : "");
+        OpusPrintJsonString(fp, path);
+        fprintf(fp, ", \"status\": \"%s\"", OpusLoopCheckStatusNames[result->status]);
+        if (result->status != OPUS_LOOP_CHECK_NO_LOOP && result->sampleRate != 0)
+            fprintf(fp, ", \"loop_start\": %u, \"loop_end\": %u", result->loopStart, result->loopEnd);
+        if (checked) {
+            fprintf(
+                fp, ", \"click_db\": %.2f, \"spectral_jump_db\": %.2f, \"spectral_flux_db\": %.2f",
+                result->splice.click, result->splice.spectralJump, result->splice.spectralFlux
+            );
+            if (result->hasContinuation)
+                fprintf(fp, ", \"continuation_db\": %.2f", result->continuation);
+            else
+                fprintf(fp, ", \"continuation_db\": null");
+        }
+        if (result->status == OPUS_LOOP_CHECK_OK)
+            fprintf(fp, ", \"error\": null}");
+        else {
+            fprintf(fp, ", \"error\": ");
+            OpusPrintJsonString(fp, result->message);
+            fprintf(fp, "}");
+        }
+        return;
+    }
+
+    if (result->status == OPUS_LOOP_CHECK_NO_LOOP) {
+        fprintf(fp, "--   %s: no loop\n", path);
+        return;
+    }
+    if (!checked) {
+        fprintf(fp, "ERR  %s: %s\n", path, result->message);
+        return;
+    }
+
+    fprintf(
+        fp, "%s  %s: %u-%u, click %.1f dB, spectral jump %.1f dB (flux %.1f dB)",
+        result->status == OPUS_LOOP_CHECK_OK ? "OK " : "BAD", path, result->loopStart, result->loopEnd,
+        result->splice.click, result->splice.spectralJump, result->splice.spectralFlux
+    );
+    if (result->hasContinuation)
+        fprintf(fp, ", continuation %.1f dB", result->continuation);
+    fprintf(fp, "\n");
+}
+
+// Structural comparison of two OPUS files. The packet streams are aligned on
+// their playback position (pre-skip excluded), so files with a different
+// pre-skip or a few extra packets still pair up where they overlap. Only TOC
+// bytes and packet headers are read; nothing is decoded.
+
+#define OPUS_DIFF_FIELD_MAX (32)
+
+typedef struct {
+    const char* name;
+    char valueA[40];
+    char valueB[40];
+} OpusDiffField;
+
+typedef struct {
+    int present; // Unset if the stream had no packet at this position.
+    u64 index;
+    u64 offset; // Absolute offset in the file.
+    u32 packetSize;
+    u32 finalRange;
+} OpusDiffPacket;
+
+typedef struct {
+    u32 fieldCount;
+    OpusDiffField fields[OPUS_DIFF_FIELD_MAX];
+
+    u64 packetCounts[2];
+    u64 totalSamples[2]; // Per channel, pre-skip included.
+    int truncated[2]; // The walk stopped at a packet that could not be parsed.
+
+    u64 alignedCount; // Packet pairs starting at the same playback sample.
+    u64 unalignedCounts[2]; // Packets without a counterpart.
+    u64 sizeMismatchCount; // Aligned pairs of different packet size.
+    u64 rangeMismatchCount; // Aligned pairs of different final range.
+    u64 differingCount; // Aligned pairs that are not byte-identical.
+
+    int diverged;
+    s64 divergingPosition; // Playback sample where the first difference starts.
+    OpusDiffPacket divergingPackets[2];
+} OpusDiffResult;
+
+typedef struct {
+    const OpusDataChunk* dataChunk;
+    u64 dataSize; // Clamped to the bytes available.
+    u64 dataStart; // Absolute offset of the data chunk payload.
+    u32 sampleRate;
+
+    int valid; // Unset at the end of the stream or at an invalid packet.
+    int truncated;
+
+    u64 offset; // Of the current packet, relative to the payload.
+    u64 index;
+    s64 position; // Playback sample of the current packet.
+    u64 totalSamples;
+
+    const OpusPacketHeader* packetHeader;
+    u32 packetSize;
+    u32 packetSamples;
+} _OpusDiffCursor;
+
+static void _OpusDiffCursorLoad(_OpusDiffCursor* cursor) {
+    cursor->valid = 0;
+    if (cursor->offset >= cursor->dataSize)
+        return;
+
+    const OpusPacketHeader* packetHeader = (const OpusPacketHeader*)(cursor->dataChunk->data + cursor->offset);
+    u32 packetSize = cursor->offset + sizeof(OpusPacketHeader) <= cursor->dataSize ?
+        __builtin_bswap32(packetHeader->packetSize) : 0;
+
+    int packetSamples = packetSize != 0 && cursor->offset + sizeof(OpusPacketHeader) + packetSize <= cursor->dataSize ?
+        opus_packet_get_nb_samples(packetHeader->packet, (opus_int32)packetSize, cursor->sampleRate) : OPUS_INVALID_PACKET;
+    if (packetSamples <= 0) {
+        cursor->truncated = 1;
+        return;
+    }
+
+    cursor->valid = 1;
+    cursor->packetHeader = packetHeader;
+    cursor->packetSize = packetSize;
+    cursor->packetSamples = (u32)packetSamples;
+}
+
+static void _OpusDiffCursorInit(_OpusDiffCursor* cursor, const u8* data, u64 size, const OpusFileHeader* fileHeader) {
+    memset(cursor, 0, sizeof(_OpusDiffCursor));
+
+    u64 headerOffset = (const u8*)fileHeader - data;
+    cursor->dataChunk = (const OpusDataChunk*)((const u8*)fileHeader + fileHeader->dataOffset);
+    cursor->dataStart = headerOffset + fileHeader->dataOffset + sizeof(OpusDataChunk);
+    cursor->sampleRate = fileHeader->sampleRate;
+    cursor->position = -(s64)fileHeader->preSkipSamples;
+
+    cursor->dataSize = cursor->dataChunk->chunkSize;
+    if (cursor->dataStart > size)
+        cursor->dataSize = 0;
+    else if (cursor->dataSize > size - cursor->dataStart) {
+        cursor->dataSize = size - cursor->dataStart;
+        cursor->truncated = 1;
+    }
+
+    _OpusDiffCursorLoad(cursor);
+}
+
+static void _OpusDiffCursorNext(_OpusDiffCursor* cursor) {
+    cursor->offset += sizeof(OpusPacketHeader) + cursor->packetSize;
+    cursor->index++;
+    cursor->position += cursor->packetSamples;
+    cursor->totalSamples += cursor->packetSamples;
+
+    _OpusDiffCursorLoad(cursor);
+}
+
+static void _OpusDiffSetPacket(OpusDiffPacket* packet, const _OpusDiffCursor* cursor) {
+    packet->present = 1;
+    packet->index = cursor->index;
+    packet->offset = cursor->dataStart + cursor->offset;
+    packet->packetSize = cursor->packetSize;
+    packet->finalRange = __builtin_bswap32(cursor->packetHeader->finalRange);
+}
+
+static void _OpusDiffText(OpusDiffResult* result, const char* name, const char* valueA, const char* valueB) {
+    if (strcmp(valueA, valueB) == 0 || result->fieldCount == OPUS_DIFF_FIELD_MAX)
+        return;
+
+    OpusDiffField* field = result->fields + result->fieldCount++;
+    field->name = name;
+    snprintf(field->valueA, sizeof(field->valueA), "%s", valueA);
+    snprintf(field->valueB, sizeof(field->valueB), "%s", valueB);
+}
+
+static void _OpusDiffNumber(OpusDiffResult* result, const char* name, u64 valueA, u64 valueB) {
+    char textA[24], textB[24];
+    snprintf(textA, sizeof(textA), "%llu", (unsigned long long)valueA);
+    snprintf(textB, sizeof(textB), "%llu", (unsigned long long)valueB);
+    _OpusDiffText(result, name, textA, textB);
+}
+
+static void _OpusDiffLoopText(char* text, u64 textSize, const OpusVariantMetadata* metadata) {
+    if (metadata->hasLoop)
+        snprintf(text, textSize, "%u-%u", metadata->loopStart, metadata->loopEnd);
+    else
+        snprintf(text, textSize, "none");
+}
+
+// Compare two OPUS files held in memory. The file headers must have been
+// checked (OpusPreprocess) by the caller; packets are bounds-checked here.
+// Returns 1 if anything differs.
+int OpusDiff(const u8* dataA, u64 sizeA, const u8* dataB, u64 sizeB, OpusDiffResult* result) {
+    memset(result, 0, sizeof(OpusDiffResult));
+
+    const u8* datas[2] = { dataA, dataB };
+    u64 sizes[2] = { sizeA, sizeB };
+
+    const OpusVariant* variants[2];
+    const OpusFileHeader* fileHeaders[2];
+    OpusVariantMetadata metadatas[2];
+    for (u32 i = 0; i < 2; i++) {
+        variants[i] = OpusFindVariant(datas[i], sizes[i]);
+        fileHeaders[i] = (const OpusFileHeader*)(datas[i] + (variants[i] ? variants[i]->locateHeader(datas[i], sizes[i]) : 0));
+        OpusReadVariantMetadata(variants[i], datas[i], sizes[i], metadatas + i);
+    }
+
+    // Container and header fields.
+    _OpusDiffText(
+        result, "container",
+        variants[0] ? variants[0]->name : "unknown", variants[1] ? variants[1]->name : "unknown"
+    );
+
+    _OpusDiffNumber(result, "version", fileHeaders[0]->version, fileHeaders[1]->version);
+    _OpusDiffNumber(result, "channel_count", fileHeaders[0]->channelCount, fileHeaders[1]->channelCount);
+    _OpusDiffNumber(result, "frame_size", fileHeaders[0]->frameSize, fileHeaders[1]->frameSize);
+    _OpusDiffNumber(result, "sample_rate", fileHeaders[0]->sampleRate, fileHeaders[1]->sampleRate);
+    _OpusDiffNumber(result, "data_offset", fileHeaders[0]->dataOffset, fileHeaders[1]->dataOffset);
+    _OpusDiffNumber(result, "seek_offset", fileHeaders[0]->seekOffset, fileHeaders[1]->seekOffset);
+    _OpusDiffNumber(result, "context_offset", fileHeaders[0]->contextOffset, fileHeaders[1]->contextOffset);
+    _OpusDiffNumber(result, "pre_skip", fileHeaders[0]->preSkipSamples, fileHeaders[1]->preSkipSamples);
+
+    const OpusDataChunk* dataChunks[2] = {
+        (const OpusDataChunk*)((const u8*)fileHeaders[0] + fileHeaders[0]->dataOffset),
+        (const OpusDataChunk*)((const u8*)fileHeaders[1] + fileHeaders[1]->dataOffset)
+    };
+    _OpusDiffNumber(result, "data_size", dataChunks[0]->chunkSize, dataChunks[1]->chunkSize);
+    _OpusDiffNumber(
+        result, "seek_entries",
+        OpusGetSeekEntryCount(OpusGetSeekChunk((OpusFileHeader*)fileHeaders[0])),
+        OpusGetSeekEntryCount(OpusGetSeekChunk((OpusFileHeader*)fileHeaders[1]))
+    );
+
+    _OpusDiffNumber(result, "num_samples", metadatas[0].numSamples, metadatas[1].numSamples);
+
+    char loopA[40], loopB[40];
+    _OpusDiffLoopText(loopA, sizeof(loopA), metadatas + 0);
+    _OpusDiffLoopText(loopB, sizeof(loopB), metadatas + 1);
+    _OpusDiffText(result, "loop", loopA, loopB);
+
+    // Wrapper fields not covered by the metadata.
+    if (
+        variants[0] != NULL && variants[1] != NULL &&
+        strcmp(variants[0]->name, "capcom") == 0 && strcmp(variants[1]->name, "capcom") == 0 &&
+        sizeA >= sizeof(OpusCapcomHeader) && sizeB >= sizeof(OpusCapcomHeader)
+    ) {
+        const OpusCapcomHeader* capcomHeaders[2] = { (const OpusCapcomHeader*)dataA, (const OpusCapcomHeader*)dataB };
+
+        _OpusDiffNumber(result, "capcom_channel_count", capcomHeaders[0]->channelCount, capcomHeaders[1]->channelCount);
+        _OpusDiffNumber(result, "capcom_frame_unit_size", capcomHeaders[0]->frameUnitSize, capcomHeaders[1]->frameUnitSize);
+        _OpusDiffNumber(result, "capcom_extra_chunks", capcomHeaders[0]->extraChunks, capcomHeaders[1]->extraChunks);
+        _OpusDiffNumber(result, "capcom_data_offset", capcomHeaders[0]->dataOffset, capcomHeaders[1]->dataOffset);
+
+        char configA[40], configB[40];
+        for (u32 i = 0; i < sizeof(capcomHeaders[0]->configData); i++) {
+            snprintf(configA + i * 2, 3, "%02X", capcomHeaders[0]->configData[i]);
+            snprintf(configB + i * 2, 3, "%02X", capcomHeaders[1]->configData[i]);
+        }
+        _OpusDiffText(result, "capcom_config_data", configA, configB);
+    }
+
+    // Packet streams, merged on playback position.
+    _OpusDiffCursor cursors[2];
+    for (u32 i = 0; i < 2; i++)
+        _OpusDiffCursorInit(cursors + i, datas[i], sizes[i], fileHeaders[i]);
+
+    while (cursors[0].valid || cursors[1].valid) {
+        int aligned = cursors[0].valid && cursors[1].valid && cursors[0].position == cursors[1].position;
+
+        if (aligned) {
+            const _OpusDiffCursor* a = cursors + 0;
+            const _OpusDiffCursor* b = cursors + 1;
+
+            result->alignedCount++;
+
+            int sizeMismatch = a->packetSize != b->packetSize;
+            int rangeMismatch = a->packetHeader->finalRange != b->packetHeader->finalRange;
+            result->sizeMismatchCount += sizeMismatch;
+            result->rangeMismatchCount += rangeMismatch;
+
+            if (sizeMismatch || rangeMismatch || memcmp(a->packetHeader->packet, b->packetHeader->packet, a->packetSize) != 0) {
+                result->differingCount++;
+
+                if (!result->diverged) {
+                    result->diverged = 1;
+                    result->divergingPosition = a->position;
+                    _OpusDiffSetPacket(result->divergingPackets + 0, a);
+                    _OpusDiffSetPacket(result->divergingPackets + 1, b);
+                }
+            }
+
+            _OpusDiffCursorNext(cursors + 0);
+            _OpusDiffCursorNext(cursors + 1);
+            continue;
+        }
+
+        // The stream that is behind (or the only one left) has an unpaired packet.
+        u32 side = !cursors[0].valid || (cursors[1].valid && cursors[1].position < cursors[0].position);
+
+        result->unalignedCounts[side]++;
+        if (!result->diverged) {
+            result->diverged = 1;
+            result->divergingPosition = cursors[side].position;
+            _OpusDiffSetPacket(result->divergingPackets + side, cursors + side);
+        }
+
+        _OpusDiffCursorNext(cursors + side);
+    }
+
+    for (u32 i = 0; i < 2; i++) {
+        result->packetCounts[i] = cursors[i].index;
+        result->totalSamples[i] = cursors[i].totalSamples;
+        result->truncated[i] = cursors[i].truncated;
+    }
+
+    return result->fieldCount != 0 || result->diverged || result->truncated[0] != result->truncated[1];
+}
+
+static void _OpusPrintDiffPacket(FILE* fp, int printFormat, const OpusDiffPacket* packet) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        if (!packet->present) {
+            fprintf(fp, "null");
+            return;
+        }
+        fprintf(
+            fp, "{\"index\": %llu, \"offset\": %llu, \"size\": %u, \"final_range\": %u}",
+            (unsigned long long)packet->index, (unsigned long long)packet->offset,
+            packet->packetSize, packet->finalRange
+        );
+    }
+    else {
+        if (!packet->present) {
+            fprintf(fp, "(none)");
+            return;
+        }
+        fprintf(
+            fp, "packet %llu at 0x%llX, size %u, final range 0x%08X",
+            (unsigned long long)packet->index, (unsigned long long)packet->offset,
+            packet->packetSize, packet->finalRange
+        );
+    }
+}
+
+// sampleDifference is NULL if the files were not decoded.
+void OpusPrintDiffResult(
+    FILE* fp, int printFormat, const char* pathA, const char* pathB,
+    const OpusDiffResult* result, const PcmDifference* sampleDifference, u32 channelCount
+) {
+    if (printFormat == OPUS_PRINT_JSON) {
+        fprintf(fp, "{\n  \"a\": ");
+        OpusPrintJsonString(fp, pathA);
+        fprintf(fp, ", \"b\": ");
+        OpusPrintJsonString(fp, pathB);
+
+        fprintf(fp, ",\n  \"header_differences\": [");
+        for (u32 i = 0; i < result->fieldCount; i++) {
+            fprintf(fp, "%s{\"field\": \"%s\", \"a\": ", i != 0 ? ", " : "", result->fields[i].name);
+            OpusPrintJsonString(fp, result->fields[i].valueA);
+            fprintf(fp, ", \"b\": ");
+            OpusPrintJsonString(fp, result->fields[i].valueB);
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "]");
+
+        fprintf(
+            fp,
+            ",\n  \"packets\": [%llu, %llu], \"total_samples\": [%llu, %llu], \"truncated\": [%s, %s],\n"
+            "  \"aligned\": %llu, \"unaligned\": [%llu, %llu], \"size_mismatches\": %llu, \"range_mismatches\": %llu,"
+            " \"differing\": %llu",
+            (unsigned long long)result->packetCounts[0], (unsigned long long)result->packetCounts[1],
+            (unsigned long long)result->totalSamples[0], (unsigned long long)result->totalSamples[1],
+            result->truncated[0] ? "true" : "false", result->truncated[1] ? "true" : "false",
+            (unsigned long long)result->alignedCount,
+            (unsigned long long)result->unalignedCounts[0], (unsigned long long)result->unalignedCounts[1],
+            (unsigned long long)result->sizeMismatchCount, (unsigned long long)result->rangeMismatchCount,
+            (unsigned long long)result->differingCount
+        );
+
+        fprintf(fp, ",\n  \"first_difference\": ");
+        if (result->diverged) {
+            fprintf(fp, "{\"position\": %lld, \"a\": ", (long long)result->divergingPosition);
+            _OpusPrintDiffPacket(fp, printFormat, result->divergingPackets + 0);
+            fprintf(fp, ", \"b\": ");
+            _OpusPrintDiffPacket(fp, printFormat, result->divergingPackets + 1);
+            fprintf(fp, "}");
+        }
+        else
+            fprintf(fp, "null");
+
+        if (sampleDifference != NULL) {
+            fprintf(
+                fp,
+                ",\n  \"samples\": {\"compared\": %llu, \"differing\": %llu, \"max_difference\": %u, \"snr\": %.2f",
+                (unsigned long long)(sampleDifference->sampleCount / channelCount),
+                (unsigned long long)sampleDifference->differingCount, sampleDifference->maxDifference,
+                PcmDifferenceSnr(sampleDifference)
+            );
+            if (sampleDifference->differingCount != 0)
+                fprintf(fp, ", \"first_difference\": %llu}", (unsigned long long)(sampleDifference->firstDifference / channelCount));
+            else
+                fprintf(fp, ", \"first_difference\": null}");
+        }
+
+        fprintf(fp, "\n}\n");
+        return;
+    }
+
+    fprintf(fp, "a: %s\nb: %s\n", pathA, pathB);
+
+    if (result->fieldCount != 0) {
+        fprintf(fp, "header differences:\n");
+        for (u32 i = 0; i < result->fieldCount; i++)
+            fprintf(fp, "  %s: %s / %s\n", result->fields[i].name, result->fields[i].valueA, result->fields[i].valueB);
+    }
+    else
+        fprintf(fp, "headers: identical\n");
+
+    fprintf(
+        fp, "packets: %llu / %llu, samples: %llu / %llu\n",
+        (unsigned long long)result->packetCounts[0], (unsigned long long)result->packetCounts[1],
+        (unsigned long long)result->totalSamples[0], (unsigned long long)result->totalSamples[1]
+    );
+    for (u32 i = 0; i < 2; i++) {
+        if (result->truncated[i])
+            fprintf(fp, "WARNING: %s has an invalid or truncated packet, compared up to there\n", i == 0 ? pathA : pathB);
+    }
+    fprintf(
+        fp, "aligned packets: %llu (%llu differ: %llu in size, %llu in final range), unaligned: %llu / %llu\n",
+        (unsigned long long)result->alignedCount, (unsigned long long)result->differingCount,
+        (unsigned long long)result->sizeMismatchCount, (unsigned long long)result->rangeMismatchCount,
+        (unsigned long long)result->unalignedCounts[0], (unsigned long long)result->unalignedCounts[1]
+    );
+
+    if (result->diverged) {
+        fprintf(fp, "first difference at sample %lld:\n  a: ", (long long)result->divergingPosition);
+        _OpusPrintDiffPacket(fp, printFormat, result->divergingPackets + 0);
+        fprintf(fp, "\n  b: ");
+        _OpusPrintDiffPacket(fp, printFormat, result->divergingPackets + 1);
+        fprintf(fp, "\n");
+    }
+    else
+        fprintf(fp, "packet streams: identical\n");
+
+    if (sampleDifference != NULL) {
+        fprintf(
+            fp, "decoded samples: %llu compared per channel, %llu differ",
+            (unsigned long long)(sampleDifference->sampleCount / channelCount),
+            (unsigned long long)sampleDifference->differingCount
+        );
+        if (sampleDifference->differingCount != 0)
+            fprintf(
+                fp, " (first at sample %llu, max difference %u, SNR %.2f dB)",
+                (unsigned long long)(sampleDifference->firstDifference / channelCount),
+                sampleDifference->maxDifference, PcmDifferenceSnr(sampleDifference)
+            );
+        fprintf(fp, "\n");
+    }
+}
+
+#endif // OPUS_INSPECT_H
@@ -3,8 +3,12 @@
 
 #include <stdlib.h>
 
+#include <stdio.h>
+
 #include <string.h>
 
+#include <stdarg.h>
+
 #include <opus/opus.h>
 
 #include "files.h"
@@ -15,10 +19,16 @@
 
 #include "common.h"
 
+#include "jobs.h"
+
+#include "opusProfile.h"
+
 #define CHUNK_HEADER_ID (0x80000001)
-//#define CHUNK_CONTEXT_ID (0x80000003)
+#define CHUNK_SEEK_ID (0x80000002)
+#define CHUNK_CONTEXT_ID (0x80000003)
 #define CHUNK_DATA_ID (0x80000004)
 #define CHUNK_CAPCOM_DATA_ID (0x80000004)
+#define CHUNK_MULTISTREAM_ID (0x80000005)
 
 #define OPUS_VERSION (0)
 
@@ -31,14 +41,14 @@ typedef struct __attribute__((packed)) {
 
     u8 version; // Compare to OPUS_VERSION.
 
-    u8 channelCount; // Values that are not 1 or 2 are illegal.
+    u8 channelCount; // 1 or 2, or up to 255 with a multistream chunk.
 
     u16 frameSize; // Frame size if constant bitrate, 0 if variable bitrate.
 
     u32 sampleRate; // Allowed values: 48000, 24000, 16000, 12000, and 8000.
 
     u32 dataOffset; // Offset to the data chunk (OpusDataChunk).
-    u32 _unk14; // Offset to a section with the ID 0x80000002, can't find it anywhere ..
+    u32 seekOffset; // Offset to the seek chunk (OpusSeekChunk, ID 0x80000002), 0 if absent. Only written by seekable encodes.
     u32 contextOffset; // Offset to a section with the ID 0x80000003, supposedly holds looping info.
 
     u16 preSkipSamples; // The amount of samples that should be skipped at the beginning of playback.
@@ -53,6 +63,23 @@ typedef struct __attribute__((packed)) {
     u8 data[0]; // Dynamically sized Opus packets (OpusPacketHeader).
 } OpusDataChunk;
 
+// Seek chunk. The official name of chunk 0x80000002 is 'offset info', but
+// no retail file has one; nopus stores the entry points of seekable encodes
+// in it. Every entry packet was encoded from a freshly reset encoder, so a
+// freshly reset decoder can start there. Decoders reset at each entry even
+// when playing sequentially, so both paths produce the same samples.
+typedef struct __attribute__((packed)) {
+    u32 sampleOffset; // Per channel, from the start of the stream (pre-skip included).
+    u32 dataOffset; // Offset of the packet relative to OpusDataChunk::data.
+} OpusSeekEntry;
+
+typedef struct __attribute__((packed)) {
+    u32 chunkId; // Compare to CHUNK_SEEK_ID.
+    u32 chunkSize; // Exclusive of chunkId and chunkSize; entry count * sizeof(OpusSeekEntry).
+
+    OpusSeekEntry entries[0];
+} OpusSeekChunk;
+
 typedef struct __attribute__((packed)) {
     // Note: both of these fields are in big-endian, might just be the DSPs endianness..
     u32 packetSize; // Length of the Opus packet.
@@ -60,6 +87,28 @@ typedef struct __attribute__((packed)) {
     u8 packet[0];
 } OpusPacketHeader;
 
+#define OPUS_PACKETSIZE_MAX (1275)
+
+// A 120ms packet holds up to six maximum-size frames plus its framing bytes.
+#define OPUS_PACKET_BUFFER_SIZE (OPUS_PACKETSIZE_MAX * 6 + 16)
+
+// Multistream chunk, present in files with more than two channels. It
+// directly follows the file header, which holds no offset for it. Every
+// packet in the data chunk is then an Opus multistream packet: one packet per
+// elementary stream, all but the last with self-delimited framing (RFC 6716
+// appendix B). The first coupledCount streams are stereo, the others mono.
+typedef struct __attribute__((packed)) {
+    u32 chunkId; // Compare to CHUNK_MULTISTREAM_ID.
+    u32 chunkSize; // Exclusive of chunkId and chunkSize; 2 + channel count.
+
+    u8 streamCount;
+    u8 coupledCount;
+
+    // Per output channel: 2 * stream + channel for coupled streams,
+    // coupledCount + stream for mono streams, 255 for silence.
+    u8 channelMapping[0];
+} OpusMultistreamChunk;
+
 // Capcom OPUS file header (first 0x30 bytes of the file).
 // Immediately followed by a standard Nintendo OpusFileHeader at the offset
 // stored in dataOffset.
@@ -67,14 +116,30 @@ typedef struct __attribute__((packed)) {
     u32 numSamples;    // Total decoded samples per channel
     u32 channelCount;  // Number of channels (1 or 2)
     u64 loopInfo;      // 8 bytes: loopStart (u32) + loopEnd (u32); all 0xFF if no loop
-    u32 unknown1;      // CBR frame unit size including 8-byte OpusPacketHeader (e.g. 0xF8)
-    u32 frameSize;     // CBR frame unit size at offset 0x10
+    u32 frameUnitSize; // CBR frame unit size including 8-byte OpusPacketHeader (e.g. 0xF8), 0 if VBR
     u32 extraChunks;   // Number of extra chunks after this header (usually 0)
-    u32 padding1;      // Reserved / null
+    u32 _null18;       // Reserved / null
     u32 dataOffset;    // Offset to the embedded Nintendo OpusFileHeader (typically 0x30)
     u8 configData[16]; // Game-specific configuration bytes (ignored by vgmstream)
 } OpusCapcomHeader;
 
+_Static_assert(sizeof(OpusCapcomHeader) == 0x30, "OpusCapcomHeader must be 0x30 bytes");
+
+#define CAPCOM_LOOP_NONE (0xFFFFFFFFFFFFFFFFull)
+
+// Default game-specific config bytes, copied from the original Capcom files.
+static const u8 OpusCapcomDefaultConfig[16] = {
+    0x00, 0x77, 0xC1, 0x02, 0x04, 0x00, 0x00, 0x00,
+    0xE6, 0x07, 0x0C, 0x0E, 0x0D, 0x10, 0x23, 0x00
+};
+
+u64 OpusCapcomMakeLoopInfo(u32 loopStart, u32 loopEnd) {
+    // 0xFFFFFFFF = no loop, matching vgmstream convention
+    if (loopStart == 0 && loopEnd == 0)
+        return CAPCOM_LOOP_NONE;
+    return ((u64)loopEnd << 32) | loopStart;
+}
+
 // Returns 1 if data looks like a Capcom OPUS file, 0 for Nintendo OPUS (or unknown).
 // Detection: first dword is NOT CHUNK_HEADER_ID, but the dword at dataOffset (0x1C) IS.
 int OpusIsCapcomFormat(const u8* data, u32 dataSize) {
@@ -88,24 +153,295 @@ int OpusIsCapcomFormat(const u8* data, u32 dataSize) {
         return 0;
     u32 nintendoOff;
     memcpy(&nintendoOff, data + 0x1C, 4);
-    if (nintendoOff + 4 > dataSize)
+    if ((u64)nintendoOff + 4 > dataSize) // u64, as nintendoOff can be near 0xFFFFFFFF.
         return 0;
     u32 nintendoChunkId;
     memcpy(&nintendoChunkId, data + nintendoOff, 4);
     return nintendoChunkId == CHUNK_HEADER_ID;
 }
 
+// Container variants: the Nintendo chunks (0x80000001/0x80000004) wrapped in
+// a game- or middleware-specific header. Layouts follow vgmstream (see
+// docs/opus_loop_vgm.c). Multistream/layered layouts are not handled.
+
+typedef struct {
+    u32 numSamples; // Per channel, pre-skip excluded; 0 if the container doesn't store it.
+
+    int hasLoop;
+    u32 loopStart;
+    u32 loopEnd;
+} OpusVariantMetadata;
+
+typedef struct {
+    const char* name; // Short identifier (e.g. "capcom").
+    const char* title; // Human-readable name (e.g. "Capcom").
+
+    // Returns 1 if data looks like this variant. dataSize may only cover the
+    // start of the file; callbacks never read past it.
+    int (*sniff)(const u8* data, u64 dataSize);
+    // Offset of the Nintendo OpusFileHeader.
+    u64 (*locateHeader)(const u8* data, u64 dataSize);
+    // Length and loop stored by the wrapper; NULL if it stores neither.
+    void (*readMetadata)(const u8* data, u64 dataSize, OpusVariantMetadata* metadata);
+} OpusVariant;
+
+// Bounds-checked reads; 0 past dataSize.
+static u32 _OpusReadU32(const u8* data, u64 dataSize, u64 offset) {
+    u32 value = 0;
+    if (offset + 4 <= dataSize)
+        memcpy(&value, data + offset, 4);
+    return value;
+}
+static u32 _OpusReadU32BE(const u8* data, u64 dataSize, u64 offset) {
+    return __builtin_bswap32(_OpusReadU32(data, dataSize, offset));
+}
+
+// The points are kept as stored (even if invalid) so verify can report them.
+static void _OpusSetVariantLoop(OpusVariantMetadata* metadata, int hasLoop, u32 loopStart, u32 loopEnd) {
+    metadata->hasLoop = hasLoop != 0;
+    metadata->loopStart = hasLoop ? loopStart : 0;
+    metadata->loopEnd = hasLoop ? loopEnd : 0;
+}
+
+// Plain Nintendo: the header is at the start of the file.
+static int _OpusSniffNintendo(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x00) == CHUNK_HEADER_ID;
+}
+
+// Capcom [Monster Hunter Rise, Resident Evil: Revelations]: see OpusCapcomHeader.
+static int _OpusSniffCapcom(const u8* data, u64 dataSize) {
+    return OpusIsCapcomFormat(data, (u32)MIN(dataSize, (u64)0xFFFFFFFF));
+}
+static void _OpusReadCapcomMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32(data, dataSize, 0x00);
+    u32 loopStart = _OpusReadU32(data, dataSize, 0x08);
+    u32 loopEnd = _OpusReadU32(data, dataSize, 0x0C);
+    _OpusSetVariantLoop(metadata, ((const OpusCapcomHeader*)data)->loopInfo != CAPCOM_LOOP_NONE, loopStart, loopEnd);
+}
+
+// Procyon Studio "sadf" [Xenoblade Chronicles 2].
+static int _OpusSniffNop(const u8* data, u64 dataSize) {
+    return
+        _OpusReadU32(data, dataSize, 0x00) == IDENTIFIER_TO_U32('s','a','d','f') &&
+        _OpusReadU32(data, dataSize, 0x08) == IDENTIFIER_TO_U32('o','p','u','s');
+}
+static void _OpusReadNopMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32(data, dataSize, 0x28);
+    _OpusSetVariantLoop(
+        metadata, dataSize > 0x19 && data[0x19] != 0,
+        _OpusReadU32(data, dataSize, 0x2C), _OpusReadU32(data, dataSize, 0x30)
+    );
+}
+
+// Edelweiss "EWNO" [Sakuna: Of Rice and Ruin].
+static int _OpusSniffNsopus(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x00) == IDENTIFIER_TO_U32('E','W','N','O');
+}
+
+// Edelweiss "OPUSNX" [Astebreed].
+static int _OpusSniffOpusnx(const u8* data, u64 dataSize) {
+    return
+        _OpusReadU32(data, dataSize, 0x00) == IDENTIFIER_TO_U32('O','P','U','S') &&
+        _OpusReadU32(data, dataSize, 0x04) == IDENTIFIER_TO_U32('N','X','\0','\0');
+}
+
+// Idea Factory "RSND" [Birushana: Ichijuu no Kaze].
+static int _OpusSniffRsnd(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x00) == IDENTIFIER_TO_U32('R','S','N','D');
+}
+static void _OpusReadRsndMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    _OpusSetVariantLoop(
+        metadata, dataSize > 0x07 && data[0x07] != 0,
+        _OpusReadU32(data, dataSize, 0x08), _OpusReadU32(data, dataSize, 0x0C)
+    );
+}
+
+// "OPUS" magic: Prototype [Clannad] (header at 0x18), AQUASTYLE .opusx
+// [Touhou Genso Wanderer -Reloaded-] (header at 0x10) and Bandai Namco
+// NUS3 [Taiko no Tatsujin] (big-endian fields, header at the offset at 0x20).
+// The header check in OpusFindVariant tells them apart.
+static int _OpusSniffOpusMagic(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x00) == IDENTIFIER_TO_U32('O','P','U','S');
+}
+static void _OpusReadPrototypeMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32(data, dataSize, 0x08);
+    u32 loopEnd = _OpusReadU32(data, dataSize, 0x10);
+    _OpusSetVariantLoop(metadata, loopEnd != 0, _OpusReadU32(data, dataSize, 0x0C), loopEnd);
+}
+static void _OpusReadOpusxMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    // Loop points are for the 44100hz source; Opus resampled it to 48000hz.
+    u32 loopStart = (u32)((u64)_OpusReadU32(data, dataSize, 0x08) * 48000 / 44100);
+    u32 loopEnd = (u32)((u64)_OpusReadU32(data, dataSize, 0x0C) * 48000 / 44100);
+    // The resampler delay is folded in.
+    _OpusSetVariantLoop(metadata, loopStart >= 120, loopStart - 128, loopEnd - 128);
+}
+static u64 _OpusLocateNus3(const u8* data, u64 dataSize) {
+    return _OpusReadU32BE(data, dataSize, 0x20);
+}
+static void _OpusReadNus3Metadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32BE(data, dataSize, 0x08);
+    u32 loopEnd = _OpusReadU32BE(data, dataSize, 0x18);
+    _OpusSetVariantLoop(metadata, loopEnd != 0, _OpusReadU32BE(data, dataSize, 0x14), loopEnd);
+}
+
+// Nippon Ichi SPS [Ys VIII: Lacrimosa of Dana].
+static int _OpusSniffSpsN1(const u8* data, u64 dataSize) {
+    return _OpusReadU32BE(data, dataSize, 0x00) == 0x09000000;
+}
+static u64 _OpusLocateSpsN1(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x1C) == CHUNK_HEADER_ID ? 0x1C : 0x18;
+}
+static void _OpusReadSpsN1Metadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32(data, dataSize, 0x0C);
+
+    u32 loopStart = _OpusReadU32(data, dataSize, 0x10);
+    if (_OpusLocateSpsN1(data, dataSize) == 0x1C) {
+        // Older games: intro, loop and end section lengths.
+        u32 loopEnd = loopStart + _OpusReadU32(data, dataSize, 0x14);
+        _OpusSetVariantLoop(metadata, _OpusReadU32(data, dataSize, 0x18) != 0, loopStart, loopEnd);
+    }
+    else {
+        // Newer games: start == end when the loop is disabled.
+        u32 loopEnd = _OpusReadU32(data, dataSize, 0x14);
+        _OpusSetVariantLoop(metadata, loopStart != loopEnd, loopStart, loopEnd);
+    }
+}
+
+// Square Enix [Dragon Quest I-III].
+static int _OpusSniffSqex(const u8* data, u64 dataSize) {
+    return _OpusReadU32BE(data, dataSize, 0x00) == 0x01000000;
+}
+static u64 _OpusLocateSqex(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x0C);
+}
+static void _OpusReadSqexMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    metadata->numSamples = _OpusReadU32(data, dataSize, 0x1C);
+    u32 loopEnd = _OpusReadU32(data, dataSize, 0x18);
+    _OpusSetVariantLoop(metadata, loopEnd != 0, _OpusReadU32(data, dataSize, 0x14), loopEnd);
+}
+
+// Nippon Ichi [Disgaea 5]: loop start and end at 0x00/0x08, their high
+// words (0x04/0x0C) zero or all set.
+static int _OpusSniffN1(const u8* data, u64 dataSize) {
+    u32 high0 = _OpusReadU32(data, dataSize, 0x04);
+    u32 high1 = _OpusReadU32(data, dataSize, 0x0C);
+    return dataSize >= 0x10 && high0 == high1 && (high0 == 0 || high0 == 0xFFFFFFFF);
+}
+static void _OpusReadN1Metadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    u32 loopEnd = _OpusReadU32(data, dataSize, 0x08);
+    _OpusSetVariantLoop(metadata, (s32)loopEnd > 0, _OpusReadU32(data, dataSize, 0x00), loopEnd);
+}
+
+// Shin'en [Fast RMX]: loop start and end (0 = no loop), then the header.
+static int _OpusSniffShinen(const u8* data, u64 dataSize) {
+    return _OpusReadU32(data, dataSize, 0x08) == CHUNK_HEADER_ID;
+}
+static void _OpusReadShinenMetadata(const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    u32 loopEnd = _OpusReadU32(data, dataSize, 0x04);
+    _OpusSetVariantLoop(metadata, loopEnd != 0, _OpusReadU32(data, dataSize, 0x00), loopEnd);
+}
+
+static u64 _OpusLocateAt0x00(const u8* data, u64 dataSize) { (void)data; (void)dataSize; return 0x00; }
+static u64 _OpusLocateAt0x08(const u8* data, u64 dataSize) { (void)data; (void)dataSize; return 0x08; }
+static u64 _OpusLocateAt0x10(const u8* data, u64 dataSize) { (void)data; (void)dataSize; return 0x10; }
+static u64 _OpusLocateAt0x18(const u8* data, u64 dataSize) { (void)data; (void)dataSize; return 0x18; }
+static u64 _OpusLocateAt0x1C(const u8* data, u64 dataSize) { return _OpusReadU32(data, dataSize, 0x1C); }
+static u64 _OpusLocateRsnd(const u8* data, u64 dataSize) { return _OpusReadU32(data, dataSize, 0x10); }
+
+// Tried in order; magic IDs come before the layouts recognized only by where
+// the header sits.
+static const OpusVariant OpusVariants[] = {
+    { "nintendo",  "Nintendo",         _OpusSniffNintendo,   _OpusLocateAt0x00,  NULL },
+    { "nop",       "Procyon Studio",   _OpusSniffNop,        _OpusLocateAt0x1C,  _OpusReadNopMetadata },
+    { "nsopus",    "Edelweiss EWNO",   _OpusSniffNsopus,     _OpusLocateAt0x08,  NULL },
+    { "opusnx",    "Edelweiss OPUSNX", _OpusSniffOpusnx,     _OpusLocateAt0x10,  NULL },
+    { "rsnd",      "Idea Factory",     _OpusSniffRsnd,       _OpusLocateRsnd,    _OpusReadRsndMetadata },
+    { "prototype", "Prototype",        _OpusSniffOpusMagic,  _OpusLocateAt0x18,  _OpusReadPrototypeMetadata },
+    { "opusx",     "AQUASTYLE",        _OpusSniffOpusMagic,  _OpusLocateAt0x10,  _OpusReadOpusxMetadata },
+    { "nus3",      "Bandai Namco",     _OpusSniffOpusMagic,  _OpusLocateNus3,    _OpusReadNus3Metadata },
+    { "sps_n1",    "Nippon Ichi SPS",  _OpusSniffSpsN1,      _OpusLocateSpsN1,   _OpusReadSpsN1Metadata },
+    { "sqex",      "Square Enix",      _OpusSniffSqex,       _OpusLocateSqex,    _OpusReadSqexMetadata },
+    { "capcom",    "Capcom",           _OpusSniffCapcom,     _OpusLocateAt0x1C,  _OpusReadCapcomMetadata },
+    { "n1",        "Nippon Ichi",      _OpusSniffN1,         _OpusLocateAt0x10,  _OpusReadN1Metadata },
+    { "shinen",    "Shin'en",          _OpusSniffShinen,     _OpusLocateAt0x08,  _OpusReadShinenMetadata },
+};
+
+#define OPUS_VARIANT_COUNT (sizeof(OpusVariants) / sizeof(OpusVariants[0]))
+
+#define OPUS_NINTENDO_VARIANT (&OpusVariants[0])
+
+// Returns the variant of data (dataSize may only cover the start of the file),
+// or NULL if it isn't one. The located header must carry CHUNK_HEADER_ID.
+const OpusVariant* OpusFindVariant(const u8* data, u64 dataSize) {
+    for (u32 i = 0; i < OPUS_VARIANT_COUNT; i++) {
+        const OpusVariant* variant = &OpusVariants[i];
+        if (!variant->sniff(data, dataSize))
+            continue;
+
+        u64 headerOffset = variant->locateHeader(data, dataSize);
+        if (_OpusReadU32(data, dataSize, headerOffset) == CHUNK_HEADER_ID)
+            return variant;
+    }
+    return NULL;
+}
+
+// Fill metadata from the wrapper and from the context chunk (0x80000003) of
+// the Nintendo header, which takes precedence like in vgmstream. variant may
+// be NULL.
+void OpusReadVariantMetadata(const OpusVariant* variant, const u8* data, u64 dataSize, OpusVariantMetadata* metadata) {
+    memset(metadata, 0, sizeof(OpusVariantMetadata));
+    if (variant == NULL)
+        return;
+
+    if (variant->readMetadata != NULL)
+        variant->readMetadata(data, dataSize, metadata);
+
+    u64 headerOffset = variant->locateHeader(data, dataSize);
+    if (headerOffset + sizeof(OpusFileHeader) > dataSize)
+        return;
+
+    const OpusFileHeader* fileHeader = (const OpusFileHeader*)(data + headerOffset);
+    u64 contextOffset = headerOffset + fileHeader->contextOffset;
+    if (fileHeader->contextOffset == 0 || _OpusReadU32(data, dataSize, contextOffset) != CHUNK_CONTEXT_ID)
+        return;
+
+    // 0x09: loop flag, 0x0C: sample count, 0x10: loop start, 0x14: loop end.
+    if (contextOffset + 0x18 > dataSize)
+        return;
+    metadata->numSamples = _OpusReadU32(data, dataSize, contextOffset + 0x0C);
+    _OpusSetVariantLoop(
+        metadata, data[contextOffset + 0x09] != 0,
+        _OpusReadU32(data, dataSize, contextOffset + 0x10), _OpusReadU32(data, dataSize, contextOffset + 0x14)
+    );
+}
+
+// Returns NULL if the file has no multistream chunk.
+OpusMultistreamChunk* OpusGetMultistreamChunk(OpusFileHeader* fileHeader) {
+    // The chunk sits right after the header, so the data chunk comes later.
+    if (fileHeader->dataOffset < sizeof(OpusFileHeader) + sizeof(OpusMultistreamChunk))
+        return NULL;
+
+    OpusMultistreamChunk* multistreamChunk = (OpusMultistreamChunk*)(fileHeader + 1);
+    if (multistreamChunk->chunkId != CHUNK_MULTISTREAM_ID)
+        return NULL;
+    return multistreamChunk;
+}
+
+// Panics if the file is multistream, for the operations that work on
+// elementary streams only.
+static void _OpusRejectMultistream(const char* function, OpusFileHeader* fileHeader) {
+    if (OpusGetMultistreamChunk(fileHeader) != NULL)
+        panic("%s: multistream (%u channel) files are not supported", function, fileHeader->channelCount);
+}
+
 void OpusPreprocess(u8* opusData) {
     OpusFileHeader* fileHeader = (OpusFileHeader*)opusData;
 
     if (fileHeader->chunkId == OGG_OPUS_ID)
-        panic("A Ogg Opus file was passed; please pass in a Nintendo Opus file.");
+        panic("A Ogg Opus file was passed; please pass in a Nintendo Opus file (see ogg_to_opus).");
     if (fileHeader->chunkId != CHUNK_HEADER_ID)
         panic("OPUS file header ID is nonmatching");
 
-    if (fileHeader->contextOffset != 0)
-        warn("OPUS context is present but will be ignored");
-    
     if (
         fileHeader->sampleRate != 48000 &&
         fileHeader->sampleRate != 24000 &&
@@ -115,15 +451,87 @@ void OpusPreprocess(u8* opusData) {
     )
         panic("Invalid OPUS sample rate (%uhz)", fileHeader->sampleRate);
 
-    if (
-        fileHeader->channelCount != 1 &&
-        fileHeader->channelCount != 2
-    )
-        panic("Invalid OPUS channel count (%u)", fileHeader->channelCount);
-
     OpusDataChunk* dataChunk = (OpusDataChunk*)(opusData + fileHeader->dataOffset);
     if (dataChunk->chunkId != CHUNK_DATA_ID)
         panic("OPUS data chunk ID is nonmatching");
+
+    OpusMultistreamChunk* multistreamChunk = OpusGetMultistreamChunk(fileHeader);
+    if (multistreamChunk == NULL) {
+        if (
+            fileHeader->channelCount != 1 &&
+            fileHeader->channelCount != 2
+        )
+            panic("Invalid OPUS channel count (%u)", fileHeader->channelCount);
+        return;
+    }
+
+    u32 streamCount = multistreamChunk->streamCount;
+    u32 coupledCount = multistreamChunk->coupledCount;
+    if (
+        fileHeader->channelCount == 0 || streamCount == 0 || coupledCount > streamCount ||
+        streamCount + coupledCount > 255 || multistreamChunk->chunkSize < 2u + fileHeader->channelCount
+    )
+        panic(
+            "Invalid OPUS multistream layout (%u channels, %u streams, %u coupled)",
+            fileHeader->channelCount, streamCount, coupledCount
+        );
+
+    for (u32 i = 0; i < fileHeader->channelCount; i++) {
+        u8 mapping = multistreamChunk->channelMapping[i];
+        if (mapping != 255 && mapping >= streamCount + coupledCount)
+            panic("Invalid OPUS multistream channel mapping (channel %u maps to %u)", i, mapping);
+    }
+}
+
+// Returns NULL if the file has no seek chunk.
+OpusSeekChunk* OpusGetSeekChunk(OpusFileHeader* fileHeader) {
+    if (fileHeader->seekOffset == 0)
+        return NULL;
+
+    OpusSeekChunk* seekChunk = (OpusSeekChunk*)((u8*)fileHeader + fileHeader->seekOffset);
+    if (seekChunk->chunkId != CHUNK_SEEK_ID)
+        return NULL;
+    return seekChunk;
+}
+
+u32 OpusGetSeekEntryCount(const OpusSeekChunk* seekChunk) {
+    return seekChunk != NULL ? seekChunk->chunkSize / sizeof(OpusSeekEntry) : 0;
+}
+
+// Find the last entry point at or before sample (per channel, pre-skip
+// included). Returns 0 if there is none.
+int OpusFindSeekEntry(OpusFileHeader* fileHeader, u64 sample, OpusSeekEntry* entry) {
+    OpusSeekChunk* seekChunk = OpusGetSeekChunk(fileHeader);
+    u32 entryCount = OpusGetSeekEntryCount(seekChunk);
+
+    int found = 0;
+    for (u32 i = 0; i < entryCount && seekChunk->entries[i].sampleOffset <= sample; i++) {
+        *entry = seekChunk->entries[i];
+        found = 1;
+    }
+    return found;
+}
+
+// Whether the packet at dataOffset is an entry point. Call for every packet
+// in order; nextEntry (start at 0) tracks the progress.
+int OpusSeekIsEntry(const OpusSeekChunk* seekChunk, u32* nextEntry, u32 dataOffset) {
+    u32 entryCount = OpusGetSeekEntryCount(seekChunk);
+
+    while (*nextEntry < entryCount && seekChunk->entries[*nextEntry].dataOffset < dataOffset)
+        (*nextEntry)++;
+
+    if (*nextEntry < entryCount && seekChunk->entries[*nextEntry].dataOffset == dataOffset) {
+        (*nextEntry)++;
+        return 1;
+    }
+    return 0;
+}
+
+// Reset the decoder if the packet at dataOffset is an entry point (see
+// OpusSeekIsEntry).
+void OpusSeekResetDecoder(OpusDecoder* decoder, const OpusSeekChunk* seekChunk, u32* nextEntry, u32 dataOffset) {
+    if (OpusSeekIsEntry(seekChunk, nextEntry, dataOffset))
+        opus_decoder_ctl(decoder, OPUS_RESET_STATE);
 }
 
 u32 OpusGetChannelCount(u8* opusData) {
@@ -133,524 +541,1436 @@ u32 OpusGetSampleRate(u8* opusData) {
     return ((OpusFileHeader*)opusData)->sampleRate;
 }
 
-ListData OpusDecode(u8* opusData) {
-    OpusFileHeader* fileHeader = (OpusFileHeader*)opusData;
-    OpusDataChunk* dataChunk = (OpusDataChunk*)(opusData + fileHeader->dataOffset);
+// Size of the packet at offset of dataChunk, 0 if its header or payload
+// runs past the end of the chunk (or it is empty).
+static u32 _OpusPacketSizeAt(const OpusDataChunk* dataChunk, u32 offset) {
+    if (offset >= dataChunk->chunkSize || dataChunk->chunkSize - offset < sizeof(OpusPacketHeader))
+        return 0;
 
-    int error;
-    OpusDecoder* decoder = opus_decoder_create(fileHeader->sampleRate, fileHeader->channelCount, &error);
-    if (error != OPUS_OK)
-        panic("OpusDecode: opus_decoder_create fail: %s", opus_strerror(error));
+    const OpusPacketHeader* packetHeader = (const OpusPacketHeader*)(dataChunk->data + offset);
+    u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+    return packetSize <= dataChunk->chunkSize - offset - sizeof(OpusPacketHeader) ? packetSize : 0;
+}
 
-    const unsigned coFrameSize = fileHeader->frameSize != 0 ?
-        fileHeader->frameSize :
-        (fileHeader->sampleRate / 100 * fileHeader->sampleRate);
-    
-    s16* tempSamples = (s16*)malloc(coFrameSize * sizeof(s16));
-    if (!tempSamples)
-        panic("OpusDecode: failed to alloc temp buffer");
+// Count the samples per channel stored in the data chunk (pre-skip included)
+// from the packet TOC bytes alone; nothing is decoded.
+u64 OpusGetPacketSampleCount(OpusFileHeader* fileHeader) {
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
 
-    ListData samples;
-    ListInit(&samples, sizeof(s16), coFrameSize);
-    
+    u64 sampleCount = 0;
     unsigned offset = 0;
 
-    int samplesLeftToSkip = fileHeader->preSkipSamples;
-
     while (offset < dataChunk->chunkSize) {
         OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
-        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+        u32 packetSize = _OpusPacketSizeAt(dataChunk, offset);
+        if (packetSize == 0)
+            panic("OpusGetPacketSampleCount: bad packet at 0x%X: overruns the data chunk", offset);
+
+        int packetSamples = opus_packet_get_nb_samples(packetHeader->packet, packetSize, fileHeader->sampleRate);
+        if (packetSamples < 0)
+            panic("OpusGetPacketSampleCount: bad packet at 0x%X: %s", offset, opus_strerror(packetSamples));
 
         offset += sizeof(OpusPacketHeader) + packetSize;
+        sampleCount += packetSamples;
+    }
 
-        int samplesDecoded = opus_decode(decoder, packetHeader->packet, packetSize, tempSamples, coFrameSize, 0);
-        if (samplesDecoded < 0)
-            panic("OpusProcess: opus_decode fail: %s", opus_strerror(samplesDecoded));
+    return sampleCount;
+}
 
-        if (samplesLeftToSkip > 0) {
-            // Full skip.
-            if (samplesDecoded <= samplesLeftToSkip) {
-                samplesLeftToSkip -= samplesDecoded;
-                continue;
-            }
-            // Partial skip.
-            else {
-                int remainingSamples = samplesDecoded - samplesLeftToSkip;
-                ListAddRange(&samples, tempSamples + samplesLeftToSkip, remainingSamples * fileHeader->channelCount);
-                samplesLeftToSkip = 0;
-            }
-        }
-        // No skip.
-        else
-            ListAddRange(&samples, tempSamples, samplesDecoded * fileHeader->channelCount);
+// Frame length field of the Opus packet framing: one byte below 252, two
+// bytes otherwise. Returns the size of the field, 0 if it is cut off.
+static u32 _OpusReadFrameLength(const u8* data, u32 size, u32* length) {
+    if (size < 1)
+        return 0;
+    if (data[0] < 252) {
+        *length = data[0];
+        return 1;
     }
+    if (size < 2)
+        return 0;
+    *length = data[0] + 4 * data[1];
+    return 2;
+}
 
-    opus_decoder_destroy(decoder);
-    
-    free(tempSamples);
-
-    return samples;
+static u32 _OpusWriteFrameLength(u8* data, u32 length) {
+    if (length < 252) {
+        data[0] = (u8)length;
+        return 1;
+    }
+    data[0] = (u8)(252 + (length & 3));
+    data[1] = (u8)((length - data[0]) >> 2);
+    return 2;
 }
 
-#define OPUS_PACKETSIZE_MAX (1275)
+// Parse the framing of an elementary packet at the start of data. The
+// self-delimited framing stores one more frame length than the regular one,
+// right in front of the frame data; frameDataOffset receives the offset of
+// that spot and lastFrameSize the length stored (or implied) there. Returns
+// the size of the packet (always size for regular framing), 0 if malformed.
+static u32 _OpusParseFraming(const u8* data, u32 size, int selfDelimited, u32* frameDataOffset, u32* lastFrameSize) {
+    if (size < 1)
+        return 0;
 
-// Default bitrate for the standard Nintendo Opus format (make_opus command).
-// Capcom Opus uses 96000 bps (240 bytes per 20ms frame) - see OpusBuildCapcom.
-#define OPUS_DEFAULT_BITRATE (99000)
+    u32 offset = 1;
+    u32 frameCount = 2;
+    u32 lengthSum = 0; // Of the lengths stored by the regular framing.
+    u32 paddingSize = 0;
+    int sizesEqual = 1;
+
+    switch (data[0] & 3) {
+    case 0:
+        frameCount = 1;
+        break;
+    case 1:
+        break;
+    case 2: {
+        u32 fieldSize = _OpusReadFrameLength(data + offset, size - offset, &lengthSum);
+        if (fieldSize == 0)
+            return 0;
+        offset += fieldSize;
+        sizesEqual = 0;
+        break;
+    }
+    case 3: {
+        if (size < 2)
+            return 0;
+        u8 countByte = data[offset++];
+
+        frameCount = countByte & 0x3F;
+        if (frameCount == 0)
+            return 0;
+
+        if (countByte & 0x40) {
+            u8 paddingByte;
+            do {
+                if (offset >= size)
+                    return 0;
+                paddingByte = data[offset++];
+                paddingSize += paddingByte == 255 ? 254 : paddingByte;
+            } while (paddingByte == 255);
+        }
 
-typedef struct OpusBuildPacket {
-    struct OpusBuildPacket* next;
+        sizesEqual = (countByte & 0x80) == 0;
+        for (u32 i = 0; !sizesEqual && i + 1 < frameCount; i++) {
+            u32 length;
+            u32 fieldSize = _OpusReadFrameLength(data + offset, size - offset, &length);
+            if (fieldSize == 0)
+                return 0;
+            offset += fieldSize;
+            lengthSum += length;
+        }
+        break;
+    }
+    }
 
-    u32 packetLen;
-    u32 finalRange;
-    u8 packetData[0];
-} OpusBuildPacket;
+    *frameDataOffset = offset;
 
-MemoryFile OpusBuild(s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount) {
-    if (
-        sampleRate != 48000 && sampleRate != 24000 &&
-        sampleRate != 16000 && sampleRate != 12000 &&
-        sampleRate != 8000
-    ) {
-        panic(
-            "OpusBuild: Invalid sample rate (%uhz)\n"
-            "Allowed sample rates are: 48000, 24000, 16000, 12000, and 8000",
-            sampleRate
-        );
-    }
+    if (selfDelimited) {
+        u32 fieldSize = _OpusReadFrameLength(data + offset, size - offset, lastFrameSize);
+        if (fieldSize == 0)
+            return 0;
 
-    if (
-        channelCount != 1 && channelCount != 2
-    ) {
-        panic(
-            "OpusBuild: Invalid channel count (%u)\n"
-            "Only one or two channels are allowed.",
-            channelCount
-        );
+        u64 packetSize = (u64)offset + fieldSize + paddingSize +
+            (sizesEqual ? (u64)frameCount * *lastFrameSize : (u64)lengthSum + *lastFrameSize);
+        return packetSize <= size ? (u32)packetSize : 0;
     }
 
-    MemoryFile mfResult;
+    if ((u64)offset + paddingSize + lengthSum > size)
+        return 0;
+    u32 frameBytes = size - offset - paddingSize - lengthSum;
 
-    int opusError;
+    if (sizesEqual && frameBytes % frameCount != 0)
+        return 0;
+    *lastFrameSize = sizesEqual ? frameBytes / frameCount : frameBytes;
+    return size;
+}
+
+// Copy the elementary packet of stream out of a multistream packet, in
+// regular framing. output must hold packetSize bytes. Returns its size, 0 if
+// the packet is malformed.
+static u32 _OpusGetStreamPacket(const u8* packet, u32 packetSize, u32 stream, u32 streamCount, u8* output) {
+    u32 offset = 0;
+    u32 frameDataOffset, lastFrameSize;
+
+    for (u32 i = 0; i < stream; i++) {
+        u32 size = _OpusParseFraming(packet + offset, packetSize - offset, 1, &frameDataOffset, &lastFrameSize);
+        if (size == 0)
+            return 0;
+        offset += size;
+    }
 
-    OpusEncoder* encoder = opus_encoder_create(sampleRate, channelCount, OPUS_APPLICATION_AUDIO, &opusError);
-    if (opusError < 0)
-        panic("OpusBuild: opus_encoder_create failed: %s", opus_strerror(opusError));
+    const u8* streamPacket = packet + offset;
+    u32 remaining = packetSize - offset;
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(OPUS_DEFAULT_BITRATE));
-    if (opusError < 0)
-        panic("OpusBuild: failed to set Opus bitrate to %u", OPUS_DEFAULT_BITRATE);
+    if (stream + 1 == streamCount) {
+        memcpy(output, streamPacket, remaining);
+        return remaining;
+    }
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR(1));
-    if (opusError < 0)
-        panic("OpusBuild: failed to enable Opus VBR");
+    u32 size = _OpusParseFraming(streamPacket, remaining, 1, &frameDataOffset, &lastFrameSize);
+    if (size == 0)
+        return 0;
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR_CONSTRAINT(0));
-    if (opusError < 0)
-        panic("OpusBuild: failed to disable Opus VBR constraint");
+    // Drop the extra length field.
+    u32 fieldSize = lastFrameSize < 252 ? 1 : 2;
+    memcpy(output, streamPacket, frameDataOffset);
+    memcpy(output + frameDataOffset, streamPacket + frameDataOffset + fieldSize, size - frameDataOffset - fieldSize);
+    return size - fieldSize;
+}
 
-    u32 frameDurationMs = 20;
-    u32 frameSize = (sampleRate / 1000) * frameDurationMs;
-    u32 samplesPerFrame = frameSize * channelCount;
+// Rewrite a regular elementary packet with self-delimited framing. output
+// must hold size + 2 bytes. Returns the new size, 0 if the packet is malformed.
+static u32 _OpusToSelfDelimited(const u8* packet, u32 size, u8* output) {
+    u32 frameDataOffset, lastFrameSize;
+    if (_OpusParseFraming(packet, size, 0, &frameDataOffset, &lastFrameSize) == 0)
+        return 0;
 
-    int preSkipSamples;
-    opusError = opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&preSkipSamples));
-    if (opusError < 0)
-        panic("OpusBuild: failed to get pre-skip sample count");
+    memcpy(output, packet, frameDataOffset);
+    u32 fieldSize = _OpusWriteFrameLength(output + frameDataOffset, lastFrameSize);
+    memcpy(output + frameDataOffset + fieldSize, packet + frameDataOffset, size - frameDataOffset);
+    return size + fieldSize;
+}
 
-    // Root packet has no data. packetLen holds the packet count.
-    OpusBuildPacket* rootPacket = (OpusBuildPacket*)malloc(sizeof(OpusBuildPacket));
-    if (rootPacket == NULL)
-        panic("OpusBuild: failed to allocate root packet");
+// Channel of stream that a channel mapping value refers to, -1 if another.
+static int _OpusMapStreamChannel(const OpusMultistreamChunk* multistreamChunk, u8 mapping, u32 stream) {
+    u32 coupledChannels = multistreamChunk->coupledCount * 2u;
 
-    rootPacket->next = NULL;
-    rootPacket->packetLen = 0;
-    rootPacket->finalRange = 0;
+    if (mapping < coupledChannels)
+        return mapping / 2 == stream ? (int)(mapping % 2) : -1;
+    if (mapping != 255 && (u32)mapping - multistreamChunk->coupledCount == stream)
+        return 0;
+    return -1;
+}
 
-    OpusBuildPacket* currentPacket = rootPacket;
+typedef struct {
+    OpusFileHeader* fileHeader;
+    const OpusMultistreamChunk* multistreamChunk;
+
+    s16* output; // Interleaved, all channels.
+    u64 totalSamples; // Per channel, from the packet TOC bytes.
+    int gain; // OPUS_SET_GAIN of every stream decoder.
+} _OpusMultistreamDecodeJobs;
+
+// Decode one elementary stream through all packets and scatter it into the
+// output channels mapped to it. Streams are independent, so every stream
+// runs as its own job.
+static void _OpusMultistreamDecodeJob(void* userData, u64 jobIndex) {
+    _OpusMultistreamDecodeJobs* jobs = (_OpusMultistreamDecodeJobs*)userData;
+    OpusFileHeader* fileHeader = jobs->fileHeader;
+    const OpusMultistreamChunk* multistreamChunk = jobs->multistreamChunk;
+
+    u32 stream = (u32)jobIndex;
+    u32 streamChannelCount = stream < multistreamChunk->coupledCount ? 2 : 1;
+    u32 channelCount = fileHeader->channelCount;
+
+    // Stream channel feeding each output channel, -1 if another stream does.
+    // A stream channel may feed several output channels.
+    int mappedChannels[255];
+    for (u32 i = 0; i < channelCount; i++)
+        mappedChannels[i] = _OpusMapStreamChannel(multistreamChunk, multistreamChunk->channelMapping[i], stream);
 
-    u8 buffer[OPUS_PACKETSIZE_MAX];
+    int error;
+    OpusDecoder* decoder = opus_decoder_create(fileHeader->sampleRate, streamChannelCount, &error);
+    if (error != OPUS_OK)
+        panic("OpusDecode: opus_decoder_create fail: %s", opus_strerror(error));
+    if (jobs->gain != 0 && opus_decoder_ctl(decoder, OPUS_SET_GAIN(jobs->gain)) != OPUS_OK)
+        panic("OpusDecode: failed to set decoder gain");
 
-    for (u32 i = 0; i + samplesPerFrame <= sampleCount; i += samplesPerFrame) {
-        int nbBytes = opus_encode(
-            encoder, samples + i, frameSize, buffer, sizeof(buffer)
-        );
-        if (nbBytes < 0)
-            panic("OpusBuild: opus_encode failed: %s", opus_strerror(nbBytes));
+    // Largest possible packet duration is 120ms.
+    u32 maxPacketSamples = fileHeader->sampleRate / 1000 * 120;
+    s16* packetSamples = (s16*)malloc(sizeof(s16) * maxPacketSamples * streamChannelCount);
+    if (packetSamples == NULL)
+        panic("OpusDecode: malloc fail");
 
-        OpusBuildPacket* packet = (OpusBuildPacket*)malloc(sizeof(OpusBuildPacket) + nbBytes);
-        if (packet == NULL)
-            panic("OpusBuild: failed to allocate packet");
+    u8* streamPacket = NULL;
+    u32 streamPacketCapacity = 0;
 
-        packet->next = NULL;
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    OpusSeekChunk* seekChunk = OpusGetSeekChunk(fileHeader);
+    u32 nextSeekEntry = 0;
 
-        packet->packetLen = nbBytes;
-        memcpy(packet->packetData, buffer, nbBytes);
+    u64 samplesWritten = 0;
 
-        opusError = opus_encoder_ctl(encoder, OPUS_GET_FINAL_RANGE(&packet->finalRange));
-        if (opusError < 0)
-            panic("OpusBuild: failed to get encoder final range");
+    unsigned offset = 0;
+    while (offset < dataChunk->chunkSize) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = _OpusPacketSizeAt(dataChunk, offset);
+        if (packetSize == 0)
+            panic("OpusDecode: bad packet at 0x%X (stream %u): overruns the data chunk", offset, stream);
 
-        currentPacket->next = packet;
-        currentPacket = packet;
+        OpusSeekResetDecoder(decoder, seekChunk, &nextSeekEntry, offset);
 
-        rootPacket->packetLen++;
-    }
+        if (packetSize > streamPacketCapacity) {
+            streamPacketCapacity = MAX(packetSize, (u32)OPUS_PACKET_BUFFER_SIZE);
+            streamPacket = (u8*)realloc(streamPacket, streamPacketCapacity);
+            if (streamPacket == NULL)
+                panic("OpusDecode: realloc fail");
+        }
 
-    opus_encoder_destroy(encoder);
+        u32 streamPacketSize = _OpusGetStreamPacket(
+            packetHeader->packet, packetSize, stream, multistreamChunk->streamCount, streamPacket
+        );
+        if (streamPacketSize == 0)
+            panic("OpusDecode: bad packet at 0x%X (stream %u): invalid multistream framing", offset, stream);
+
+        int samplesDecoded = opus_decode(
+            decoder, streamPacket, streamPacketSize, packetSamples, (int)maxPacketSamples, 0
+        );
+        if (samplesDecoded < 0)
+            panic("OpusDecode: bad packet at 0x%X (stream %u): %s", offset, stream, opus_strerror(samplesDecoded));
 
-    // Now to actually write the file.
+        offset += sizeof(OpusPacketHeader) + packetSize;
+        if (samplesWritten + samplesDecoded > jobs->totalSamples)
+            panic("OpusDecode: stream %u is longer than the first stream", stream);
 
-    mfResult.size = sizeof(OpusFileHeader) + sizeof(OpusDataChunk);
+        s16* output = jobs->output + samplesWritten * channelCount;
+        for (u32 i = 0; i < channelCount; i++) {
+            if (mappedChannels[i] < 0)
+                continue;
+            for (int j = 0; j < samplesDecoded; j++)
+                output[(u64)j * channelCount + i] = packetSamples[j * streamChannelCount + mappedChannels[i]];
+        }
 
-    currentPacket = rootPacket->next;
-    while (currentPacket != NULL) {
-        mfResult.size += sizeof(OpusPacketHeader) + currentPacket->packetLen;
-        currentPacket = currentPacket->next;
+        samplesWritten += samplesDecoded;
     }
 
-    mfResult.data_void = malloc(mfResult.size);
-    if (mfResult.data_void == NULL)
-        panic("OpusBuild: failed to allocate file buffer");
+    if (samplesWritten != jobs->totalSamples)
+        panic("OpusDecode: stream %u is shorter than the first stream", stream);
 
-    OpusFileHeader* fileHeader = (OpusFileHeader*)mfResult.data_void;
+    free(streamPacket);
+    free(packetSamples);
+    opus_decoder_destroy(decoder);
+}
 
-    fileHeader->chunkId = CHUNK_HEADER_ID;
-    fileHeader->chunkSize = sizeof(OpusFileHeader) - 8;
+// Incremental decode of a stream, for consumers that work on fixed-size
+// blocks instead of the whole file. At the file's sample rate it returns the
+// same samples as OpusDecodeStream with the same numSamples, with at most one
+// packet of decoded samples held in between reads. Opus decodes to any of its
+// rates, so sampleRate may also differ from the file's; the pre-skip and
+// numSamples (given at the file's rate) are scaled to it. Likewise a stereo
+// stream can be decoded to mono, which libopus downmixes for less work.
+// Multistream files decode every elementary stream packet by packet and
+// scatter them to the output channels (OpusDecodeStream decodes them in
+// parallel instead, whole).
+typedef struct {
+    OpusFileHeader* fileHeader;
+    OpusDataChunk* dataChunk;
+    OpusSeekChunk* seekChunk;
+    u32 nextSeekEntry;
+
+    OpusDecoder** decoders; // One per elementary stream; one for regular files.
+    u32 decoderCount;
+    u32 sampleRate;
+    u32 channelCount;
+
+    // Multistream files only: the layout, the elementary packet split out of
+    // the current packet (grown to the largest packet yet), and the decoded
+    // samples of one stream.
+    const OpusMultistreamChunk* multistreamChunk;
+    u8* streamPacket;
+    u32 streamPacketCapacity;
+    void* streamSamples;
+
+    u32 offset; // Of the next packet, relative to OpusDataChunk::data.
+
+    u64 skipLeft; // Pre-skip samples not dropped yet.
+    u64 sampleCount; // Samples to return in all, per channel; (u64)-1 if unbounded.
+    u64 samplesLeft; // Samples still to return, per channel.
+
+    // Decoded packet not fully returned yet; s16 or float depending on the
+    // read function used (don't mix them on one decoder).
+    void* packetSamples;
+    u32 packetSampleCount;
+    u32 packetSamplePosition;
+
+    // Set when a packet overruns the data chunk or fails to decode; the
+    // stream ends there. Empty otherwise.
+    char error[128];
+} OpusStreamDecoder;
+
+// sampleRate 0 decodes at the file's rate, channelCount 0 to the file's
+// channel count.
+void OpusStreamDecoderInit(
+    OpusStreamDecoder* streamDecoder, OpusFileHeader* fileHeader, u64 numSamples, u32 sampleRate, u32 channelCount
+) {
+    memset(streamDecoder, 0, sizeof(OpusStreamDecoder));
+
+    streamDecoder->fileHeader = fileHeader;
+    streamDecoder->dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    if (streamDecoder->dataChunk->chunkId != CHUNK_DATA_ID)
+        panic("OpusStreamDecoderInit: data chunk ID is nonmatching");
+
+    streamDecoder->seekChunk = OpusGetSeekChunk(fileHeader);
+    streamDecoder->sampleRate = sampleRate != 0 ? sampleRate : fileHeader->sampleRate;
+    streamDecoder->channelCount = channelCount != 0 ? channelCount : fileHeader->channelCount;
+
+    // Largest possible packet duration is 120ms.
+    u32 maxPacketSamples = streamDecoder->sampleRate / 1000 * 120;
+
+    const OpusMultistreamChunk* multistreamChunk = OpusGetMultistreamChunk(fileHeader);
+    streamDecoder->multistreamChunk = multistreamChunk;
+    streamDecoder->decoderCount = multistreamChunk != NULL ? multistreamChunk->streamCount : 1;
+
+    if (multistreamChunk != NULL) {
+        if (streamDecoder->channelCount != fileHeader->channelCount)
+            panic("OpusStreamDecoderInit: multistream files decode to their own channel count");
+
+        streamDecoder->streamSamples = malloc(sizeof(float) * maxPacketSamples * 2);
+        if (streamDecoder->streamSamples == NULL)
+            panic("OpusStreamDecoderInit: malloc fail");
+    }
 
-    fileHeader->version = OPUS_VERSION;
+    streamDecoder->decoders = (OpusDecoder**)malloc(sizeof(OpusDecoder*) * streamDecoder->decoderCount);
+    if (streamDecoder->decoders == NULL)
+        panic("OpusStreamDecoderInit: malloc fail");
 
-    fileHeader->channelCount = channelCount;
+    for (u32 i = 0; i < streamDecoder->decoderCount; i++) {
+        u32 decoderChannelCount = multistreamChunk == NULL ?
+            streamDecoder->channelCount : (i < multistreamChunk->coupledCount ? 2 : 1);
 
-    fileHeader->frameSize = 0; // VBR.
+        int error;
+        streamDecoder->decoders[i] = opus_decoder_create(streamDecoder->sampleRate, decoderChannelCount, &error);
+        if (error != OPUS_OK)
+            panic("OpusStreamDecoderInit: opus_decoder_create fail: %s", opus_strerror(error));
+    }
 
-    fileHeader->sampleRate = sampleRate;
+    streamDecoder->skipLeft = (u64)fileHeader->preSkipSamples * streamDecoder->sampleRate / fileHeader->sampleRate;
+    streamDecoder->sampleCount = numSamples != 0 ?
+        numSamples * streamDecoder->sampleRate / fileHeader->sampleRate : (u64)-1;
+    streamDecoder->samplesLeft = streamDecoder->sampleCount;
 
-    fileHeader->dataOffset = sizeof(OpusFileHeader);
-    fileHeader->_unk14 = 0x00000000;
-    fileHeader->contextOffset = 0x00000000;
+    streamDecoder->packetSamples = malloc(sizeof(float) * maxPacketSamples * streamDecoder->channelCount);
+    if (streamDecoder->packetSamples == NULL)
+        panic("OpusStreamDecoderInit: malloc fail");
+}
 
-    fileHeader->preSkipSamples = preSkipSamples;
+// OPUS_SET_GAIN (1/256 dB) on every decoder.
+void OpusStreamDecoderSetGain(OpusStreamDecoder* streamDecoder, int gain) {
+    for (u32 i = 0; i < streamDecoder->decoderCount; i++) {
+        if (opus_decoder_ctl(streamDecoder->decoders[i], OPUS_SET_GAIN(gain)) != OPUS_OK)
+            panic("OpusStreamDecoderSetGain: failed to set decoder gain");
+    }
+}
 
-    fileHeader->_pad16 = 0x0000;
+static void _OpusStreamDecoderReset(OpusStreamDecoder* streamDecoder) {
+    for (u32 i = 0; i < streamDecoder->decoderCount; i++)
+        opus_decoder_ctl(streamDecoder->decoders[i], OPUS_RESET_STATE);
+}
 
-    OpusDataChunk* dataChunk = (OpusDataChunk*)(fileHeader + 1);
+static void _OpusStreamDecoderFail(OpusStreamDecoder* streamDecoder, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(streamDecoder->error, sizeof(streamDecoder->error), format, args);
+    va_end(args);
 
-    dataChunk->chunkId = CHUNK_DATA_ID;
-    dataChunk->chunkSize = mfResult.size - sizeof(OpusFileHeader) - sizeof(OpusDataChunk);
+    streamDecoder->offset = streamDecoder->dataChunk->chunkSize;
+    streamDecoder->packetSampleCount = 0;
+    streamDecoder->packetSamplePosition = 0;
+}
+
+// Decode one packet into packetSamples; returns the samples per channel, or -1
+// (with streamDecoder->error set) if it doesn't decode.
+static int _OpusStreamDecoderDecode(OpusStreamDecoder* streamDecoder, const u8* packet, u32 packetSize, int isFloat) {
+    int maxPacketSamples = (int)(streamDecoder->sampleRate / 1000 * 120);
+    const OpusMultistreamChunk* multistreamChunk = streamDecoder->multistreamChunk;
+
+    if (multistreamChunk == NULL) {
+        int samplesDecoded = isFloat ?
+            opus_decode_float(streamDecoder->decoders[0], packet, packetSize, (float*)streamDecoder->packetSamples, maxPacketSamples, 0) :
+            opus_decode(streamDecoder->decoders[0], packet, packetSize, (s16*)streamDecoder->packetSamples, maxPacketSamples, 0);
+        if (samplesDecoded < 0) {
+            _OpusStreamDecoderFail(streamDecoder, "packet at 0x%X fails to decode: %s", streamDecoder->offset, opus_strerror(samplesDecoded));
+            return -1;
+        }
+        return samplesDecoded;
+    }
 
-    OpusPacketHeader* currentPacketHeader = (OpusPacketHeader*)dataChunk->data;
+    // _OpusGetStreamPacket needs room for the whole packet.
+    if (packetSize > streamDecoder->streamPacketCapacity) {
+        streamDecoder->streamPacketCapacity = MAX(packetSize, (u32)OPUS_PACKET_BUFFER_SIZE);
+        streamDecoder->streamPacket = (u8*)realloc(streamDecoder->streamPacket, streamDecoder->streamPacketCapacity);
+        if (streamDecoder->streamPacket == NULL)
+            panic("OpusStreamDecoderRead: realloc fail");
+    }
 
-    currentPacket = rootPacket->next;
-    while (currentPacket != NULL) {
-        currentPacketHeader->packetSize = __builtin_bswap32(currentPacket->packetLen);
-        currentPacketHeader->finalRange = __builtin_bswap32(currentPacket->finalRange);
+    u32 channelCount = streamDecoder->channelCount;
+    u32 sampleSize = isFloat ? sizeof(float) : sizeof(s16);
 
-        memcpy(
-            currentPacketHeader->packet,
-            currentPacket->packetData, currentPacket->packetLen
+    int packetSampleCount = 0;
+    for (u32 stream = 0; stream < streamDecoder->decoderCount; stream++) {
+        u32 streamPacketSize = _OpusGetStreamPacket(
+            packet, packetSize, stream, multistreamChunk->streamCount, streamDecoder->streamPacket
         );
+        if (streamPacketSize == 0) {
+            _OpusStreamDecoderFail(streamDecoder, "invalid multistream packet at 0x%X (stream %u)", streamDecoder->offset, stream);
+            return -1;
+        }
 
-        currentPacketHeader = (OpusPacketHeader*)(
-            (u8*)(currentPacketHeader + 1) + currentPacket->packetLen
-        );
+        OpusDecoder* decoder = streamDecoder->decoders[stream];
+        int samplesDecoded = isFloat ?
+            opus_decode_float(decoder, streamDecoder->streamPacket, streamPacketSize, (float*)streamDecoder->streamSamples, maxPacketSamples, 0) :
+            opus_decode(decoder, streamDecoder->streamPacket, streamPacketSize, (s16*)streamDecoder->streamSamples, maxPacketSamples, 0);
+        if (samplesDecoded < 0) {
+            _OpusStreamDecoderFail(
+                streamDecoder, "packet at 0x%X (stream %u) fails to decode: %s",
+                streamDecoder->offset, stream, opus_strerror(samplesDecoded)
+            );
+            return -1;
+        }
+        if (stream != 0 && samplesDecoded != packetSampleCount) {
+            _OpusStreamDecoderFail(
+                streamDecoder, "packet at 0x%X: stream %u decodes to %d samples, stream 0 to %d",
+                streamDecoder->offset, stream, samplesDecoded, packetSampleCount
+            );
+            return -1;
+        }
+        packetSampleCount = samplesDecoded;
+
+        u32 streamChannelCount = stream < multistreamChunk->coupledCount ? 2 : 1;
+        for (u32 channel = 0; channel < channelCount; channel++) {
+            int streamChannel = _OpusMapStreamChannel(multistreamChunk, multistreamChunk->channelMapping[channel], stream);
+            if (streamChannel < 0)
+                continue;
 
-        currentPacket = currentPacket->next;
+            if (isFloat) {
+                float* output = (float*)streamDecoder->packetSamples + channel;
+                const float* input = (const float*)streamDecoder->streamSamples + streamChannel;
+                for (int i = 0; i < samplesDecoded; i++)
+                    output[(u64)i * channelCount] = input[(u64)i * streamChannelCount];
+            }
+            else {
+                s16* output = (s16*)streamDecoder->packetSamples + channel;
+                const s16* input = (const s16*)streamDecoder->streamSamples + streamChannel;
+                for (int i = 0; i < samplesDecoded; i++)
+                    output[(u64)i * channelCount] = input[(u64)i * streamChannelCount];
+            }
+        }
     }
 
-    // Free packets.
-    currentPacket = rootPacket;
-    while (currentPacket) {
-        OpusBuildPacket* nextPacket = currentPacket->next;
-        free(currentPacket);
-        currentPacket = nextPacket;
+    // Silent channels.
+    for (u32 channel = 0; channel < channelCount; channel++) {
+        if (multistreamChunk->channelMapping[channel] != 255)
+            continue;
+        for (int i = 0; i < packetSampleCount; i++)
+            memset((u8*)streamDecoder->packetSamples + ((u64)i * channelCount + channel) * sampleSize, 0, sampleSize);
     }
 
-    return mfResult;
+    return packetSampleCount;
 }
 
-// Build a Capcom-format OPUS file from PCM samples.
-// Replicates the format used in Capcom Switch games (e.g. Resident Evil: Revelations).
-// Uses CELT-only CBR encoding at 96kbps (240 bytes/packet, 20ms frames, pre-skip=120)
-// to match the original Capcom encoder output.
-//
-// File layout:
-//   0x00-0x2F : Capcom header (48 bytes)
-//   0x30-0x4F : Nintendo Opus header (32 bytes)
-//   0x50-0x57 : Data chunk header (8 bytes)
-//   0x58+     : Opus packets (each: 4B BE size + 4B BE finalRange + data)
-//
-// criticalBytes and orig_packet_sizes/orig_packet_count are kept for API compatibility
-// but are no longer used; all values are derived from the audio parameters.
-MemoryFile OpusBuildCapcom(s16* samples, u32 sampleCount, u32 sampleRate,
-    u32 channelCount, u32 loopStart, u32 loopEnd,
-    u8* configData, u8* criticalBytes, u32* orig_packet_sizes, size_t orig_packet_count)
-{
-    // Capcom uses CELT-only CBR encoding:
-    //   96000 bps / 8 bits / 50 frames-per-sec = 240 bytes per 20ms packet
-    //   frame_size field in Nintendo header = 240 + 8 (OpusPacketHeader) = 248 = 0xF8
-    const u32 bitRate = 96000;
-    const u32 frameDurationMs = 20;
-    // Samples per channel per frame (e.g. 960 at 48 kHz for 20 ms)
-    const u32 frameSize = (sampleRate / 1000) * frameDurationMs;
-    // Total interleaved samples consumed per encode call
-    const u32 samplesPerFrame = frameSize * channelCount;
+static u64 _OpusStreamDecoderRead(OpusStreamDecoder* streamDecoder, void* output, u64 sampleCount, int isFloat) {
+    u32 channelCount = streamDecoder->channelCount;
+    u32 sampleSize = isFloat ? sizeof(float) : sizeof(s16);
+
+    u64 written = 0;
+    while (written < sampleCount && streamDecoder->samplesLeft != 0) {
+        if (streamDecoder->packetSamplePosition == streamDecoder->packetSampleCount) {
+            if (streamDecoder->offset >= streamDecoder->dataChunk->chunkSize)
+                break;
+
+            OpusPacketHeader* packetHeader = (OpusPacketHeader*)(streamDecoder->dataChunk->data + streamDecoder->offset);
+            u32 packetSize = _OpusPacketSizeAt(streamDecoder->dataChunk, streamDecoder->offset);
+            if (packetSize == 0) {
+                _OpusStreamDecoderFail(streamDecoder, "packet at 0x%X overruns the data chunk", streamDecoder->offset);
+                break;
+            }
 
-    if (
-        sampleRate != 48000 && sampleRate != 24000 &&
-        sampleRate != 16000 && sampleRate != 12000 &&
-        sampleRate != 8000
-    ) {
-        panic(
-            "OpusBuildCapcom: Invalid sample rate (%uhz)\n"
-            "Allowed sample rates are: 48000, 24000, 16000, 12000, and 8000",
-            sampleRate
-        );
-    }
+            if (OpusSeekIsEntry(streamDecoder->seekChunk, &streamDecoder->nextSeekEntry, streamDecoder->offset))
+                _OpusStreamDecoderReset(streamDecoder);
 
-    if (channelCount != 1 && channelCount != 2) {
-        panic(
-            "OpusBuildCapcom: Invalid channel count (%u)\n"
-            "Only one or two channels are allowed.",
-            channelCount
+            int samplesDecoded = _OpusStreamDecoderDecode(streamDecoder, packetHeader->packet, packetSize, isFloat);
+            if (samplesDecoded < 0)
+                break;
+
+            streamDecoder->offset += sizeof(OpusPacketHeader) + packetSize;
+
+            u32 skip = (u32)MIN(streamDecoder->skipLeft, (u64)samplesDecoded);
+            streamDecoder->skipLeft -= skip;
+
+            streamDecoder->packetSampleCount = (u32)samplesDecoded;
+            streamDecoder->packetSamplePosition = skip;
+            continue;
+        }
+
+        u64 count = MIN(
+            (u64)(streamDecoder->packetSampleCount - streamDecoder->packetSamplePosition),
+            MIN(sampleCount - written, streamDecoder->samplesLeft)
         );
+        memcpy(
+            (u8*)output + written * channelCount * sampleSize,
+            (u8*)streamDecoder->packetSamples + (u64)streamDecoder->packetSamplePosition * channelCount * sampleSize,
+            count * channelCount * sampleSize
+        );
+
+        streamDecoder->packetSamplePosition += (u32)count;
+        streamDecoder->samplesLeft -= count;
+        written += count;
     }
 
-    u32 samplesPerChannel = sampleCount / channelCount;
+    return written;
+}
 
-    // Validate loop points
-    if (loopEnd > samplesPerChannel) {
-        warn("OpusBuildCapcom: loop_end exceeds sample count, clamping");
-        loopEnd = samplesPerChannel;
+// Decode up to sampleCount samples per channel into output. Returns the amount
+// written; less than sampleCount only once the stream has ended (early, with
+// streamDecoder->error set, on a bad packet).
+u64 OpusStreamDecoderRead(OpusStreamDecoder* streamDecoder, s16* output, u64 sampleCount) {
+    return _OpusStreamDecoderRead(streamDecoder, output, sampleCount, 0);
+}
+
+// Same as OpusStreamDecoderRead with float samples, for consumers that pass
+// the audio on to an encoder without rounding it to 16 bits.
+u64 OpusStreamDecoderReadFloat(OpusStreamDecoder* streamDecoder, float* output, u64 sampleCount) {
+    return _OpusStreamDecoderRead(streamDecoder, output, sampleCount, 1);
+}
+
+// Packets decoded ahead of a seek target so the decoder converges (80ms at
+// 20ms packets, as RFC 7845 recommends).
+#define OPUS_SEEK_PREROLL_PACKETS (4)
+
+// Move the stream decoder so the next read starts at sample (per channel, at
+// the file's rate, pre-skip excluded). Decoding restarts prerollPackets
+// packets ahead of the target. CBR files (frameSize set) find the packet by
+// arithmetic; others walk the packet headers without decoding. Returns 0 if
+// sample lies past the end of the stream, or if the walk hits an invalid
+// packet first (the decoder is left as it was then).
+int OpusStreamDecoderSeek(OpusStreamDecoder* streamDecoder, u64 sample, u32 prerollPackets) {
+    OpusFileHeader* fileHeader = streamDecoder->fileHeader;
+    OpusDataChunk* dataChunk = streamDecoder->dataChunk;
+    u32 sampleRate = streamDecoder->sampleRate;
+
+    u64 rateSample = sample * sampleRate / fileHeader->sampleRate;
+    u64 target = rateSample + (u64)fileHeader->preSkipSamples * sampleRate / fileHeader->sampleRate;
+
+    // Offset and first sample of the packet decoding restarts from.
+    u32 startOffset = 0;
+    u64 startSample = 0;
+    int located = 0;
+
+    u32 frameSize = fileHeader->frameSize;
+    if (frameSize > sizeof(OpusPacketHeader) && dataChunk->chunkSize >= frameSize) {
+        OpusPacketHeader* firstHeader = (OpusPacketHeader*)dataChunk->data;
+        u32 packetSize = __builtin_bswap32(firstHeader->packetSize);
+        int packetSamples = opus_packet_get_nb_samples(firstHeader->packet, packetSize, sampleRate);
+
+        u64 index = packetSamples > 0 ? target / packetSamples : 0;
+        if (packetSize + sizeof(OpusPacketHeader) == frameSize && packetSamples > 0 && (index + 1) * frameSize <= dataChunk->chunkSize) {
+            // Trust the arithmetic only if the target packet has the same size and duration.
+            OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + index * frameSize);
+            if (
+                __builtin_bswap32(packetHeader->packetSize) == packetSize &&
+                opus_packet_get_nb_samples(packetHeader->packet, packetSize, sampleRate) == packetSamples
+            ) {
+                u64 startIndex = index - MIN(index, (u64)prerollPackets);
+                startOffset = (u32)(startIndex * frameSize);
+                startSample = startIndex * packetSamples;
+                located = 1;
+            }
+        }
     }
-    if (loopStart > 0 && loopStart >= loopEnd) {
-        warn("OpusBuildCapcom: loop_start >= loop_end, disabling loops");
-        loopStart = 0;
-        loopEnd = 0;
+
+    if (!located) {
+        // The last prerollPackets + 1 packet starts, as a ring.
+        u32 ringSize = prerollPackets + 1;
+        u32* ringOffsets = (u32*)malloc(sizeof(u32) * ringSize);
+        u64* ringSamples = (u64*)malloc(sizeof(u64) * ringSize);
+        if (ringOffsets == NULL || ringSamples == NULL)
+            panic("OpusStreamDecoderSeek: malloc fail");
+
+        u64 packetIndex = 0;
+        u64 position = 0;
+        u32 offset = 0;
+        while (offset < dataChunk->chunkSize) {
+            OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+            u32 packetSize = _OpusPacketSizeAt(dataChunk, offset);
+
+            int packetSamples = packetSize != 0 ?
+                opus_packet_get_nb_samples(packetHeader->packet, packetSize, sampleRate) : OPUS_INVALID_PACKET;
+            if (packetSamples < 0) {
+                free(ringSamples);
+                free(ringOffsets);
+                return 0;
+            }
+
+            ringOffsets[packetIndex % ringSize] = offset;
+            ringSamples[packetIndex % ringSize] = position;
+
+            if (position + packetSamples > target)
+                break;
+
+            position += packetSamples;
+            offset += sizeof(OpusPacketHeader) + packetSize;
+            packetIndex++;
+        }
+
+        if (offset < dataChunk->chunkSize) {
+            u64 startIndex = packetIndex - MIN(packetIndex, (u64)prerollPackets);
+            startOffset = ringOffsets[startIndex % ringSize];
+            startSample = ringSamples[startIndex % ringSize];
+        }
+        else {
+            startOffset = dataChunk->chunkSize;
+            startSample = target;
+        }
+
+        free(ringSamples);
+        free(ringOffsets);
+    }
+
+    _OpusStreamDecoderReset(streamDecoder);
+    streamDecoder->offset = startOffset;
+    streamDecoder->nextSeekEntry = 0;
+
+    // The preroll (and the part of the target packet before sample) is
+    // decoded and dropped like the pre-skip.
+    streamDecoder->skipLeft = target - startSample;
+    streamDecoder->packetSampleCount = 0;
+    streamDecoder->packetSamplePosition = 0;
+
+    if (streamDecoder->sampleCount == (u64)-1)
+        streamDecoder->samplesLeft = (u64)-1;
+    else
+        streamDecoder->samplesLeft = streamDecoder->sampleCount - MIN(rateSample, streamDecoder->sampleCount);
+
+    return startOffset < dataChunk->chunkSize && streamDecoder->samplesLeft != 0;
+}
+
+void OpusStreamDecoderDestroy(OpusStreamDecoder* streamDecoder) {
+    for (u32 i = 0; i < streamDecoder->decoderCount; i++)
+        opus_decoder_destroy(streamDecoder->decoders[i]);
+    free(streamDecoder->decoders);
+
+    free(streamDecoder->streamSamples);
+    free(streamDecoder->streamPacket);
+    free(streamDecoder->packetSamples);
+}
+
+// Decode sinks: consumers that all receive the same decoded blocks, so a WAV,
+// a checksum and statistics cost one decode. begin and end may be NULL.
+typedef struct {
+    void* userData;
+
+    void (*begin)(void* userData, u32 sampleRate, u32 channelCount);
+    // Interleaved s16, sampleCount samples per channel.
+    void (*write)(void* userData, const s16* samples, u64 sampleCount);
+    void (*end)(void* userData);
+} OpusDecodeSink;
+
+#define OPUS_DECODE_BLOCK_SAMPLES (4096) // Per channel, per block handed to the sinks.
+
+// Run streamDecoder to its end, handing every block to each sink in turn.
+// Returns the samples decoded per channel.
+u64 OpusDecodeToSinks(OpusStreamDecoder* streamDecoder, const OpusDecodeSink* sinks, u32 sinkCount) {
+    s16* block = (s16*)malloc(sizeof(s16) * OPUS_DECODE_BLOCK_SAMPLES * streamDecoder->channelCount);
+    if (block == NULL)
+        panic("OpusDecodeToSinks: malloc fail");
+
+    for (u32 i = 0; i < sinkCount; i++) {
+        if (sinks[i].begin != NULL)
+            sinks[i].begin(sinks[i].userData, streamDecoder->sampleRate, streamDecoder->channelCount);
     }
 
-    int opusError = 0;
+    u64 samplesDecoded = 0;
+    u64 count;
+    while ((count = OpusStreamDecoderRead(streamDecoder, block, OPUS_DECODE_BLOCK_SAMPLES)) != 0) {
+        for (u32 i = 0; i < sinkCount; i++)
+            sinks[i].write(sinks[i].userData, block, count);
+        samplesDecoded += count;
+    }
 
-    // OPUS_APPLICATION_RESTRICTED_LOWDELAY forces CELT-only mode.
-    // This gives encoder pre-skip = 120 samples, matching original Capcom files.
-    OpusEncoder* encoder = opus_encoder_create(
-        sampleRate, channelCount, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &opusError);
-    if (opusError < 0)
-        panic("OpusBuildCapcom: opus_encoder_create failed: %s", opus_strerror(opusError));
+    for (u32 i = 0; i < sinkCount; i++) {
+        if (sinks[i].end != NULL)
+            sinks[i].end(sinks[i].userData);
+    }
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitRate));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set Opus bitrate");
+    free(block);
+    return samplesDecoded;
+}
 
-    // CBR mode: each packet will be the same size (240 bytes at 96kbps/50fps)
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR(0));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set CBR mode");
+typedef struct {
+    ListData* samples;
+    u32 channelCount;
+} _OpusListSink;
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR_CONSTRAINT(1));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set hard CBR constraint");
+static void _OpusListSinkBegin(void* userData, u32 sampleRate, u32 channelCount) {
+    (void)sampleRate;
+    ((_OpusListSink*)userData)->channelCount = channelCount;
+}
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(10));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set Opus complexity");
+static void _OpusListSinkWrite(void* userData, const s16* samples, u64 sampleCount) {
+    _OpusListSink* listSink = (_OpusListSink*)userData;
+    ListAddRange(listSink->samples, (void*)samples, sampleCount * listSink->channelCount);
+}
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set Opus signal type");
+// Decode the stream of fileHeader to interleaved s16 samples with the
+// pre-skip dropped, trimmed to numSamples (per channel) when the container
+// stores the exact length (0 keeps all). gain is applied by the decoders
+// (OPUS_SET_GAIN, in 1/256 dB). Regular streams run through OpusDecodeToSinks;
+// multistream files decode their elementary streams in parallel, whole.
+ListData OpusDecodeStream(OpusFileHeader* fileHeader, u64 numSamples, int gain) {
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    if (dataChunk->chunkId != CHUNK_DATA_ID)
+        panic("OpusDecode: data chunk ID is nonmatching");
 
-    opusError = opus_encoder_ctl(encoder, OPUS_SET_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to set Opus bandwidth");
+    u32 channelCount = fileHeader->channelCount;
 
-    // Read the actual pre-skip reported by the encoder
-    int preSkipSamples = 0;
-    opusError = opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&preSkipSamples));
-    if (opusError < 0)
-        panic("OpusBuildCapcom: failed to get pre-skip sample count");
+    // The TOC bytes give the exact decoded length, so the result never regrows.
+    u64 totalSamples = OpusGetPacketSampleCount(fileHeader);
 
-    // Encode all complete frames and accumulate raw packet bytes
-    ListData packetList;
-    ListInit(&packetList, sizeof(u8), 65536);
+    ListData samples;
+    ListInit(&samples, sizeof(s16), MAX(totalSamples * channelCount, (u64)1));
+
+    OpusMultistreamChunk* multistreamChunk = OpusGetMultistreamChunk(fileHeader);
+    if (multistreamChunk == NULL) {
+        OpusStreamDecoder streamDecoder;
+        OpusStreamDecoderInit(&streamDecoder, fileHeader, numSamples, 0, 0);
+        if (gain != 0)
+            OpusStreamDecoderSetGain(&streamDecoder, gain);
+
+        _OpusListSink listSink = { &samples, channelCount };
+        OpusDecodeSink sink = { &listSink, _OpusListSinkBegin, _OpusListSinkWrite, NULL };
+        OpusDecodeToSinks(&streamDecoder, &sink, 1);
+        if (streamDecoder.error[0] != '\0')
+            panic("OpusDecode: %s", streamDecoder.error);
+
+        OpusStreamDecoderDestroy(&streamDecoder);
+        return samples;
+    }
 
-    for (u32 i = 0; i + samplesPerFrame <= sampleCount; i += samplesPerFrame) {
-        u8 buffer[4096];
-        int nbBytes = opus_encode(encoder, samples + i, frameSize, buffer, sizeof(buffer));
-        if (nbBytes < 0)
-            panic("OpusBuildCapcom: opus_encode failed: %s", opus_strerror(nbBytes));
+    // Multistream files decode every elementary stream in parallel, straight
+    // into the result. The TOC count above is the first stream's, which all
+    // streams have to match.
+    s16* output = (s16*)samples.data;
+    memset(output, 0, totalSamples * channelCount * sizeof(s16));
 
-        // Packet header: size and finalRange stored big-endian (matching OpusPacketHeader)
-        u32 packetSizeBE = __builtin_bswap32((u32)nbBytes);
-        ListAddRange(&packetList, (u8*)&packetSizeBE, 4);
+    _OpusMultistreamDecodeJobs jobs = { fileHeader, multistreamChunk, output, totalSamples, gain };
+    JobsRun(multistreamChunk->streamCount, 0, _OpusMultistreamDecodeJob, &jobs);
+
+    // Drop the pre-skip in one move instead of per packet.
+    u64 skipSamples = MIN((u64)fileHeader->preSkipSamples, totalSamples);
+    u64 keptSamples = totalSamples - skipSamples;
+    if (numSamples != 0 && numSamples < keptSamples)
+        keptSamples = numSamples;
+
+    memmove(output, output + skipSamples * channelCount, keptSamples * channelCount * sizeof(s16));
+    samples.elementCount = keptSamples * channelCount;
+
+    return samples;
+}
+
+ListData OpusDecode(u8* opusData) {
+    return OpusDecodeStream((OpusFileHeader*)opusData, 0, 0);
+}
+
+static void _OpusBuildCheckFormat(const char* function, u32 sampleRate, u32 channelCount, u32 maxChannelCount) {
+    if (
+        sampleRate != 48000 && sampleRate != 24000 &&
+        sampleRate != 16000 && sampleRate != 12000 &&
+        sampleRate != 8000
+    ) {
+        panic(
+            "%s: Invalid sample rate (%uhz)\n"
+            "Allowed sample rates are: 48000, 24000, 16000, 12000, and 8000",
+            function, sampleRate
+        );
+    }
+
+    if (
+        channelCount < 1 || channelCount > maxChannelCount
+    ) {
+        if (maxChannelCount == 2)
+            panic(
+                "%s: Invalid channel count (%u)\n"
+                "Only one or two channels are allowed.",
+                function, channelCount
+            );
+        panic(
+            "%s: Invalid channel count (%u)\n"
+            "Between one and %u channels are allowed.",
+            function, channelCount, maxChannelCount
+        );
+    }
+}
+
+// Input of _OpusEncodePackets, pulled one frame at a time so it never has to
+// be held in memory as a whole.
+typedef struct {
+    u64 sampleCount; // Interleaved.
+    int isFloat; // Frames are float instead of s16.
+
+    // Return the frame of samplesPerFrame interleaved samples starting at
+    // index, zero-padded past the end of the input. Frames are requested in
+    // order, except that the previous frame is requested again to prime the
+    // encoder at an entry point.
+    const void* (*getFrame)(void* userData, u64 index, u32 samplesPerFrame);
+    void* userData;
+} _OpusFrameSource;
+
+typedef struct {
+    const s16* samples;
+    u32 sampleCount;
+    s16* paddedFrame;
+} _OpusSampleSource;
+
+// Returns the frame of interleaved samples starting at index, zero-padded
+// into paddedFrame where it runs past the end of the input.
+static const s16* _OpusGetFrame(const s16* samples, u32 sampleCount, u64 index, u32 samplesPerFrame, s16* paddedFrame) {
+    if (index + samplesPerFrame <= sampleCount)
+        return samples + index;
+
+    u64 available = index < sampleCount ? sampleCount - index : 0;
+
+    memset(paddedFrame, 0, samplesPerFrame * sizeof(s16));
+    memcpy(paddedFrame, samples + index, available * sizeof(s16));
+    return paddedFrame;
+}
+
+static const void* _OpusGetSampleSourceFrame(void* userData, u64 index, u32 samplesPerFrame) {
+    _OpusSampleSource* sampleSource = (_OpusSampleSource*)userData;
+    return _OpusGetFrame(sampleSource->samples, sampleSource->sampleCount, index, samplesPerFrame, sampleSource->paddedFrame);
+}
+
+// Encode the input of source with the profile into data chunk contents
+// (OpusPacketHeader followed by the packet, repeated). The last frame is zero-padded and enough
+// silence is appended for the decoder to return every input sample once the
+// pre-skip is dropped. frameUnitSize receives the packet size including the
+// packet header for CBR profiles whose packets all have that size, 0 otherwise.
+// seekEntries (OpusSeekEntry) receives the entry points of seekable profiles.
+static void _OpusEncodeSource(
+    const _OpusFrameSource* source, u32 sampleRate, u32 channelCount,
+    const OpusEncodeProfile* profile,
+    ListData* packetData, ListData* seekEntries, u32* preSkipSamples, u32* frameUnitSize
+) {
+    OpusEncoder* encoder = OpusCreateProfileEncoder(profile, sampleRate, channelCount, preSkipSamples);
+
+    // Samples per channel per packet (e.g. 960 at 48kHz for 20ms).
+    u32 frameSize = OpusProfileFrameSamples(profile, sampleRate);
+    // Interleaved samples consumed per encode call.
+    u32 samplesPerFrame = frameSize * channelCount;
+
+    u64 totalSamples = (source->sampleCount / channelCount + *preSkipSamples) * channelCount;
+
+    ListInit(packetData, sizeof(u8), 65536);
+    ListInit(seekEntries, sizeof(OpusSeekEntry), 64);
+
+    *frameUnitSize = 0;
+    int sizesUniform = 1;
+
+    u8 buffer[OPUS_PACKET_BUFFER_SIZE];
+
+    u32 packetIndex = 0;
+    for (u64 i = 0; i < totalSamples; i += samplesPerFrame, packetIndex++) {
+        if (profile->entryInterval != 0 && packetIndex % profile->entryInterval == 0) {
+            OpusSeekEntry entry;
+            entry.sampleOffset = packetIndex * frameSize;
+            entry.dataOffset = (u32)packetData->elementCount;
+            ListAdd(seekEntries, &entry);
+
+            // Drop everything the encoder carried over, then run the previous
+            // frame through it (output discarded) so the lookahead buffer holds
+            // real audio instead of silence.
+            if (packetIndex != 0) {
+                opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+
+                const void* primeFrame = source->getFrame(source->userData, i - samplesPerFrame, samplesPerFrame);
+                int primeBytes = source->isFloat ?
+                    opus_encode_float(encoder, (const float*)primeFrame, frameSize, buffer, sizeof(buffer)) :
+                    opus_encode(encoder, (const s16*)primeFrame, frameSize, buffer, sizeof(buffer));
+                if (primeBytes < 0)
+                    panic("_OpusEncodePackets: opus_encode failed: %s", opus_strerror(primeBytes));
+            }
+        }
+
+        const void* frame = source->getFrame(source->userData, i, samplesPerFrame);
+
+        int nbBytes = source->isFloat ?
+            opus_encode_float(encoder, (const float*)frame, frameSize, buffer, sizeof(buffer)) :
+            opus_encode(encoder, (const s16*)frame, frameSize, buffer, sizeof(buffer));
+        if (nbBytes < 0)
+            panic("_OpusEncodePackets: opus_encode failed: %s", opus_strerror(nbBytes));
 
         u32 finalRange = 0;
-        opusError = opus_encoder_ctl(encoder, OPUS_GET_FINAL_RANGE(&finalRange));
+        int opusError = opus_encoder_ctl(encoder, OPUS_GET_FINAL_RANGE(&finalRange));
         if (opusError < 0)
-            panic("OpusBuildCapcom: failed to get encoder final range");
+            panic("_OpusEncodePackets: failed to get encoder final range");
+
+        // Packet header: size and finalRange stored big-endian (matching OpusPacketHeader)
+        u32 packetSizeBE = __builtin_bswap32((u32)nbBytes);
+        ListAddRange(packetData, &packetSizeBE, 4);
         u32 finalRangeBE = __builtin_bswap32(finalRange);
-        ListAddRange(&packetList, (u8*)&finalRangeBE, 4);
+        ListAddRange(packetData, &finalRangeBE, 4);
+
+        ListAddRange(packetData, buffer, nbBytes);
 
-        ListAddRange(&packetList, buffer, nbBytes);
+        u32 unitSize = (u32)nbBytes + sizeof(OpusPacketHeader);
+        if (*frameUnitSize == 0 && sizesUniform)
+            *frameUnitSize = unitSize;
+        else if (*frameUnitSize != unitSize)
+            sizesUniform = 0;
     }
 
+    // Only CBR profiles store a frame size, and only if the encoder kept to it.
+    if (!sizesUniform || profile->rateMode != OPUS_RATE_CBR)
+        *frameUnitSize = 0;
+
     opus_encoder_destroy(encoder);
+}
 
-    // -----------------------------------------------------------------------
-    // Build the output file
-    //
-    // Layout (all offsets absolute):
-    //   [0x00-0x2F]  Capcom header         (0x30 bytes)
-    //   [0x30-0x4F]  Nintendo Opus header  (sizeof(OpusFileHeader) = 0x20 bytes)
-    //   [0x50-0x57]  Data chunk header     (sizeof(OpusDataChunk)  = 0x08 bytes)
-    //   [0x58+]      Opus packet data
-    // -----------------------------------------------------------------------
+// _OpusEncodeSource over interleaved samples held in memory.
+static void _OpusEncodePackets(
+    const s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount,
+    const OpusEncodeProfile* profile,
+    ListData* packetData, ListData* seekEntries, u32* preSkipSamples, u32* frameUnitSize
+) {
+    u32 samplesPerFrame = OpusProfileFrameSamples(profile, sampleRate) * channelCount;
 
-    const u32 capcomHdrSize   = 0x30;
-    const u32 totalSize = capcomHdrSize + (u32)sizeof(OpusFileHeader)
-                        + (u32)sizeof(OpusDataChunk) + packetList.elementCount;
+    _OpusSampleSource sampleSource = { samples, sampleCount, (s16*)malloc(samplesPerFrame * sizeof(s16)) };
+    if (sampleSource.paddedFrame == NULL)
+        panic("_OpusEncodePackets: failed to allocate frame buffer");
 
-    MemoryFile result;
-    result.size = totalSize;
-    result.data_void = malloc(totalSize);
-    if (!result.data_void)
-        panic("OpusBuildCapcom: failed to allocate output buffer");
-    memset(result.data_void, 0, totalSize);
+    _OpusFrameSource source = { sampleCount, 0, _OpusGetSampleSourceFrame, &sampleSource };
+    _OpusEncodeSource(&source, sampleRate, channelCount, profile, packetData, seekEntries, preSkipSamples, frameUnitSize);
 
-    u8* fileData = (u8*)result.data_void;
+    free(sampleSource.paddedFrame);
+}
+
+// Size of the whole chunk, 0 without one.
+static u32 _OpusMultistreamChunkSize(const OpusMultistreamChunk* multistreamChunk) {
+    return multistreamChunk != NULL ? 8 + multistreamChunk->chunkSize : 0;
+}
+
+// Size of a Nintendo OPUS stream (header, multistream and seek chunk if any,
+// data chunk).
+static u64 _OpusStreamSize(ListData* packetData, ListData* seekEntries, const OpusMultistreamChunk* multistreamChunk) {
+    u64 size = sizeof(OpusFileHeader) + _OpusMultistreamChunkSize(multistreamChunk) +
+        sizeof(OpusDataChunk) + packetData->elementCount;
+    if (seekEntries->elementCount != 0)
+        size += sizeof(OpusSeekChunk) + seekEntries->elementCount * sizeof(OpusSeekEntry);
+    return size;
+}
+
+// Write a Nintendo OPUS stream of _OpusStreamSize bytes to fileHeader.
+static void _OpusWriteStream(
+    OpusFileHeader* fileHeader, u32 sampleRate, u32 channelCount, u32 preSkipSamples, u32 frameUnitSize,
+    ListData* packetData, ListData* seekEntries, const OpusMultistreamChunk* multistreamChunk
+) {
+    fileHeader->chunkId = CHUNK_HEADER_ID;
+    fileHeader->chunkSize = sizeof(OpusFileHeader) - 8;
+
+    fileHeader->version = OPUS_VERSION;
+
+    fileHeader->channelCount = channelCount;
+
+    fileHeader->frameSize = frameUnitSize; // 0 if VBR.
+
+    fileHeader->sampleRate = sampleRate;
 
-    // --- Capcom header (0x00-0x2F) ---
+    fileHeader->dataOffset = sizeof(OpusFileHeader);
+    fileHeader->seekOffset = 0x00000000;
+    fileHeader->contextOffset = 0x00000000;
+
+    fileHeader->preSkipSamples = preSkipSamples;
+
+    fileHeader->_pad16 = 0x0000;
+
+    // The multistream chunk has no offset field; it must follow the header.
+    if (multistreamChunk != NULL) {
+        memcpy(fileHeader + 1, multistreamChunk, _OpusMultistreamChunkSize(multistreamChunk));
+        fileHeader->dataOffset += _OpusMultistreamChunkSize(multistreamChunk);
+    }
+
+    // The seek chunk goes between the header and the data chunk.
+    if (seekEntries->elementCount != 0) {
+        OpusSeekChunk* seekChunk = (OpusSeekChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+
+        seekChunk->chunkId = CHUNK_SEEK_ID;
+        seekChunk->chunkSize = seekEntries->elementCount * sizeof(OpusSeekEntry);
+        memcpy(seekChunk->entries, seekEntries->data, seekChunk->chunkSize);
+
+        fileHeader->seekOffset = fileHeader->dataOffset;
+        fileHeader->dataOffset += sizeof(OpusSeekChunk) + seekChunk->chunkSize;
+    }
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+
+    dataChunk->chunkId = CHUNK_DATA_ID;
+    dataChunk->chunkSize = packetData->elementCount;
+
+    memcpy(dataChunk->data, packetData->data, packetData->elementCount);
+}
+
+// Write a Capcom header followed directly by the Nintendo stream (at 0x30).
+// The header must be zeroed beforehand.
+static void _OpusWriteCapcomHeader(
+    OpusCapcomHeader* capcomHdr, u32 numSamples, u32 channelCount,
+    u32 loopStart, u32 loopEnd, u32 frameUnitSize, const u8* configData
+) {
     // 0x00: total decoded samples per channel
-    memcpy(fileData + 0x00, &samplesPerChannel, 4);
-    // 0x04: channel count
-    memcpy(fileData + 0x04, &channelCount, 4);
+    capcomHdr->numSamples = numSamples;
+    capcomHdr->channelCount = channelCount;
     // 0x08-0x0F: loop points (0xFFFFFFFF = no loop, matching vgmstream convention)
-    if (loopStart == 0 && loopEnd == 0) {
-        memset(fileData + 0x08, 0xFF, 8);
-    } else {
-        memcpy(fileData + 0x08, &loopStart, 4);
-        memcpy(fileData + 0x0C, &loopEnd, 4);
-    }
-    // 0x10: CBR frame unit size (packet data + 8-byte OpusPacketHeader = 248 = 0xF8)
-    u32 frameUnitSize = (u32)(bitRate / 8 / (1000 / frameDurationMs))
-                      + (u32)sizeof(OpusPacketHeader);
-    memcpy(fileData + 0x10, &frameUnitSize, 4);
+    capcomHdr->loopInfo = OpusCapcomMakeLoopInfo(loopStart, loopEnd);
+    // 0x10: CBR frame unit size (packet data + 8-byte OpusPacketHeader, 0xF8 for
+    // the Capcom profile), 0 if VBR
+    capcomHdr->frameUnitSize = frameUnitSize;
     // 0x14: extra chunk count = 0
     // 0x18: null = 0  (already zeroed)
     // 0x1C: offset to Nintendo Opus header = 0x30
-    u32 nintendoOff = capcomHdrSize;
-    memcpy(fileData + 0x1C, &nintendoOff, 4);
+    capcomHdr->dataOffset = sizeof(OpusCapcomHeader);
     // 0x20-0x2F: game-specific config bytes (ignored by vgmstream)
-    memcpy(fileData + 0x20, configData, 16);
-
-    // --- Nintendo Opus header (0x30-0x4F) ---
-    OpusFileHeader* nintendoHdr = (OpusFileHeader*)(fileData + capcomHdrSize);
-    nintendoHdr->chunkId       = CHUNK_HEADER_ID;
-    nintendoHdr->chunkSize     = (u32)sizeof(OpusFileHeader) - 8; // 0x18
-    nintendoHdr->version       = OPUS_VERSION;
-    nintendoHdr->channelCount  = (u8)channelCount;
-    // CBR packet size including 8-byte OpusPacketHeader (matches 0x10 in Capcom header)
-    // e.g. 240 data bytes + 8 header bytes = 248 = 0xF8 at 96kbps/50fps
-    nintendoHdr->frameSize     = (u16)frameUnitSize;
-    nintendoHdr->sampleRate    = sampleRate;
-    // dataOffset is relative to the start of this Nintendo header
-    nintendoHdr->dataOffset    = (u32)sizeof(OpusFileHeader); // = 0x20 -> data at 0x50
-    nintendoHdr->_unk14        = 0;
-    nintendoHdr->contextOffset = 0;
-    nintendoHdr->preSkipSamples = (u16)preSkipSamples;
-    nintendoHdr->_pad16        = 0;
-
-    // --- Data chunk (0x50-0x57) ---
-    OpusDataChunk* dataChunk = (OpusDataChunk*)(fileData + capcomHdrSize
-                                                + sizeof(OpusFileHeader));
-    dataChunk->chunkId   = CHUNK_DATA_ID;
-    dataChunk->chunkSize = packetList.elementCount;
-
-    // --- Packet data (0x58+) ---
-    memcpy(dataChunk->data, packetList.data, packetList.elementCount);
-
-    ListDestroy(&packetList);
+    memcpy(capcomHdr->configData, configData ? configData : OpusCapcomDefaultConfig, 16);
+}
+
+// Lay out an encoded stream as a Nintendo file, or as a Capcom file if capcom
+// is set (numSamples, the loop and configData are only used then). Destroys
+// packetData and seekEntries. multistreamChunk is NULL for mono and stereo.
+//
+// Capcom layout (all offsets absolute):
+//   [0x00-0x2F]  Capcom header         (0x30 bytes)
+//   [0x30-0x4F]  Nintendo Opus header  (sizeof(OpusFileHeader) = 0x20 bytes)
+//   [0x50-    ]  Seek chunk            (seekable profiles only)
+//   [    -    ]  Data chunk header     (sizeof(OpusDataChunk)  = 0x08 bytes)
+//   [    +    ]  Opus packet data
+static MemoryFile _OpusAssembleFile(
+    u32 sampleRate, u32 channelCount, u32 preSkipSamples, u32 frameUnitSize,
+    ListData* packetData, ListData* seekEntries, const OpusMultistreamChunk* multistreamChunk,
+    int capcom, u32 numSamples, u32 loopStart, u32 loopEnd, const u8* configData
+) {
+    const u32 capcomHdrSize = capcom ? sizeof(OpusCapcomHeader) : 0;
+
+    MemoryFile result;
+    result.size = capcomHdrSize + _OpusStreamSize(packetData, seekEntries, multistreamChunk);
+    result.data_void = malloc(result.size);
+    if (result.data_void == NULL)
+        panic("OpusBuild: failed to allocate file buffer");
+
+    u8* fileData = (u8*)result.data_void;
+
+    if (capcom) {
+        memset(fileData, 0, result.size);
+        _OpusWriteCapcomHeader(
+            (OpusCapcomHeader*)fileData, numSamples, channelCount, loopStart, loopEnd, frameUnitSize, configData
+        );
+    }
+
+    // The Nintendo frameSize matches frameUnitSize at 0x10 in the Capcom header.
+    _OpusWriteStream(
+        (OpusFileHeader*)(fileData + capcomHdrSize), sampleRate, channelCount, preSkipSamples, frameUnitSize,
+        packetData, seekEntries, multistreamChunk
+    );
+
+    ListDestroy(packetData);
+    ListDestroy(seekEntries);
 
     return result;
 }
 
-// Decode a Capcom-format OPUS file to interleaved s16 PCM samples.
-// The Capcom header (0x00-0x2F) is parsed to find the embedded Nintendo
-// Opus header; standard Opus decoding then proceeds from that offset.
-ListData OpusDecodeCapcom(u8* capcomData) {
-    // Validate basic structure
-    if (!capcomData)
-        panic("OpusDecodeCapcom: null input");
+// Clamp or drop loop points that don't fit numSamples, as the Capcom builders
+// always did.
+static void _OpusCheckCapcomLoop(u32 numSamples, u32* loopStart, u32* loopEnd) {
+    if (*loopEnd > numSamples) {
+        warn("OpusBuildCapcom: loop_end exceeds sample count, clamping");
+        *loopEnd = numSamples;
+    }
+    if (*loopStart > 0 && *loopStart >= *loopEnd) {
+        warn("OpusBuildCapcom: loop_start >= loop_end, disabling loops");
+        *loopStart = 0;
+        *loopEnd = 0;
+    }
+}
 
-    // Read the offset of the Nintendo Opus header from the Capcom header
-    u32 nintendoOff;
-    memcpy(&nintendoOff, capcomData + 0x1C, 4);
+// Multistream layout of a file with more than two channels: the channels are
+// paired up in order into coupled streams, and an odd last channel gets a mono
+// stream. multistreamChunk must hold sizeof(OpusMultistreamChunk) + channelCount
+// bytes.
+static void _OpusMakeMultistreamLayout(OpusMultistreamChunk* multistreamChunk, u32 channelCount) {
+    multistreamChunk->chunkId = CHUNK_MULTISTREAM_ID;
+    multistreamChunk->chunkSize = 2 + channelCount;
 
-    u8* nintendoData = capcomData + nintendoOff;
-    OpusFileHeader* fileHeader = (OpusFileHeader*)nintendoData;
+    multistreamChunk->streamCount = (u8)((channelCount + 1) / 2);
+    multistreamChunk->coupledCount = (u8)(channelCount / 2);
 
-    if (fileHeader->chunkId != CHUNK_HEADER_ID)
-        panic("OpusDecodeCapcom: invalid Nintendo OPUS chunk ID at offset 0x%X", nintendoOff);
+    for (u32 i = 0; i < channelCount; i++)
+        multistreamChunk->channelMapping[i] = (u8)i;
+}
 
-    OpusDataChunk* dataChunk = (OpusDataChunk*)(nintendoData + fileHeader->dataOffset);
-    if (dataChunk->chunkId != CHUNK_DATA_ID)
-        panic("OpusDecodeCapcom: invalid data chunk ID");
+typedef struct {
+    ListData packetData;
+    ListData seekEntries;
+    u32 preSkipSamples;
+    u32 frameUnitSize;
+
+    u64 offset; // Merge position in packetData.
+} _OpusStreamEncode;
+
+typedef struct {
+    const s16* samples;
+    u32 sampleCount; // Interleaved, all channels.
+    u32 sampleRate;
+    u32 channelCount;
+
+    const OpusMultistreamChunk* multistreamChunk;
+    const OpusEncodeProfile* profile;
+
+    _OpusStreamEncode* streams;
+} _OpusMultistreamEncodeJobs;
+
+// Encode one elementary stream from the input channels mapped to it. Streams
+// are independent, so every stream runs as its own job.
+static void _OpusMultistreamEncodeJob(void* userData, u64 jobIndex) {
+    _OpusMultistreamEncodeJobs* jobs = (_OpusMultistreamEncodeJobs*)userData;
+    const OpusMultistreamChunk* multistreamChunk = jobs->multistreamChunk;
+
+    u32 stream = (u32)jobIndex;
+    u32 streamChannelCount = stream < multistreamChunk->coupledCount ? 2 : 1;
+    u32 channelCount = jobs->channelCount;
+
+    // Input channel of each stream channel; unmapped ones are silent.
+    int sourceChannels[2] = { -1, -1 };
+    for (u32 i = 0; i < channelCount; i++) {
+        int streamChannel = _OpusMapStreamChannel(multistreamChunk, multistreamChunk->channelMapping[i], stream);
+        if (streamChannel >= 0 && sourceChannels[streamChannel] < 0)
+            sourceChannels[streamChannel] = (int)i;
+    }
 
-    int error;
-    OpusDecoder* decoder = opus_decoder_create(
-        fileHeader->sampleRate, fileHeader->channelCount, &error);
-    if (error != OPUS_OK)
-        panic("OpusDecodeCapcom: opus_decoder_create failed: %s", opus_strerror(error));
+    u32 frameCount = jobs->sampleCount / channelCount;
 
-    // Allocate a decode buffer large enough for the maximum Opus frame (120 ms)
-    const u32 maxSamplesPerChannel = fileHeader->sampleRate / 1000 * 120;
-    s16* tempSamples = (s16*)malloc(
-        maxSamplesPerChannel * fileHeader->channelCount * sizeof(s16));
-    if (!tempSamples)
-        panic("OpusDecodeCapcom: failed to alloc temp buffer");
+    s16* streamSamples = (s16*)malloc(sizeof(s16) * MAX(frameCount * streamChannelCount, 1u));
+    if (streamSamples == NULL)
+        panic("OpusBuild: malloc fail");
 
-    ListData samples;
-    ListInit(&samples, sizeof(s16),
-             maxSamplesPerChannel * fileHeader->channelCount * 16);
+    for (u32 i = 0; i < frameCount; i++) {
+        for (u32 j = 0; j < streamChannelCount; j++) {
+            streamSamples[i * streamChannelCount + j] = sourceChannels[j] >= 0 ?
+                jobs->samples[(u64)i * channelCount + sourceChannels[j]] : 0;
+        }
+    }
 
-    unsigned offset = 0;
-    int samplesLeftToSkip = fileHeader->preSkipSamples;
+    // The profile bitrate is that of a stereo stream; mono streams get half.
+    OpusEncodeProfile profile = *jobs->profile;
+    if (profile.bitRate > 0 && streamChannelCount == 1)
+        profile.bitRate /= 2;
 
-    while (offset < dataChunk->chunkSize) {
-        OpusPacketHeader* packetHeader =
-            (OpusPacketHeader*)(dataChunk->data + offset);
-        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+    _OpusStreamEncode* streamEncode = jobs->streams + stream;
+    _OpusEncodePackets(
+        streamSamples, frameCount * streamChannelCount, jobs->sampleRate, streamChannelCount, &profile,
+        &streamEncode->packetData, &streamEncode->seekEntries, &streamEncode->preSkipSamples, &streamEncode->frameUnitSize
+    );
 
-        offset += (u32)sizeof(OpusPacketHeader) + packetSize;
+    free(streamSamples);
+}
 
-        int samplesDecoded = opus_decode(
-            decoder, packetHeader->packet, packetSize,
-            tempSamples, maxSamplesPerChannel, 0);
-        if (samplesDecoded < 0)
-            panic("OpusDecodeCapcom: opus_decode failed: %s",
-                  opus_strerror(samplesDecoded));
+// Encode every elementary stream of multistreamChunk in parallel, then merge
+// them packet by packet into multistream packets: all but the last stream's
+// packet get self-delimited framing, and the final ranges are XORed like the
+// libopus multistream decoder reports them. Outputs as _OpusEncodePackets.
+static void _OpusEncodeMultistream(
+    const s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount,
+    const OpusMultistreamChunk* multistreamChunk, const OpusEncodeProfile* profile,
+    ListData* packetData, ListData* seekEntries, u32* preSkipSamples, u32* frameUnitSize
+) {
+    u32 streamCount = multistreamChunk->streamCount;
+
+    _OpusStreamEncode* streams = (_OpusStreamEncode*)calloc(streamCount, sizeof(_OpusStreamEncode));
+    if (streams == NULL)
+        panic("OpusBuild: calloc fail");
+
+    _OpusMultistreamEncodeJobs jobs = {
+        samples, sampleCount, sampleRate, channelCount, multistreamChunk, profile, streams
+    };
+    JobsRun(streamCount, 0, _OpusMultistreamEncodeJob, &jobs);
+
+    // Every stream is encoded with the same frame size and encoder delay, so
+    // the packets line up one to one.
+    *preSkipSamples = streams[0].preSkipSamples;
+    for (u32 i = 1; i < streamCount; i++) {
+        if (streams[i].preSkipSamples != *preSkipSamples)
+            panic("OpusBuild: the streams have different pre-skips");
+    }
+
+    ListInit(packetData, sizeof(u8), 65536);
+    ListInit(seekEntries, sizeof(OpusSeekEntry), 64);
+
+    *frameUnitSize = 0;
+    int sizesUniform = 1;
+
+    // Entry points are the same packets in every stream.
+    const OpusSeekEntry* streamEntries = (const OpusSeekEntry*)streams[0].seekEntries.data;
+    u32 nextSeekEntry = 0;
+
+    u8 buffer[OPUS_PACKET_BUFFER_SIZE + 2];
+
+    while (streams[0].offset < streams[0].packetData.elementCount) {
+        if (
+            nextSeekEntry < streams[0].seekEntries.elementCount &&
+            streamEntries[nextSeekEntry].dataOffset == streams[0].offset
+        ) {
+            OpusSeekEntry entry;
+            entry.sampleOffset = streamEntries[nextSeekEntry].sampleOffset;
+            entry.dataOffset = (u32)packetData->elementCount;
+            ListAdd(seekEntries, &entry);
+
+            nextSeekEntry++;
+        }
+
+        u64 headerOffset = packetData->elementCount;
+        OpusPacketHeader packetHeader = { 0, 0 };
+        ListAddRange(packetData, &packetHeader, sizeof(OpusPacketHeader));
+
+        u32 finalRange = 0;
+        for (u32 i = 0; i < streamCount; i++) {
+            _OpusStreamEncode* streamEncode = streams + i;
+            if (streamEncode->offset >= streamEncode->packetData.elementCount)
+                panic("OpusBuild: stream %u ran out of packets", i);
+
+            OpusPacketHeader* streamHeader = (OpusPacketHeader*)((u8*)streamEncode->packetData.data + streamEncode->offset);
+            u32 streamPacketSize = __builtin_bswap32(streamHeader->packetSize);
 
-        if (samplesLeftToSkip > 0) {
-            if (samplesDecoded <= samplesLeftToSkip) {
-                samplesLeftToSkip -= samplesDecoded;
+            streamEncode->offset += sizeof(OpusPacketHeader) + streamPacketSize;
+            finalRange ^= __builtin_bswap32(streamHeader->finalRange);
+
+            if (i + 1 == streamCount) {
+                ListAddRange(packetData, streamHeader->packet, streamPacketSize);
                 continue;
-            } else {
-                int remaining = samplesDecoded - samplesLeftToSkip;
-                // Skip samplesLeftToSkip * channelCount interleaved values
-                ListAddRange(&samples,
-                    tempSamples + samplesLeftToSkip * fileHeader->channelCount,
-                    remaining * fileHeader->channelCount);
-                samplesLeftToSkip = 0;
             }
-        } else {
-            ListAddRange(&samples, tempSamples,
-                         samplesDecoded * fileHeader->channelCount);
+
+            u32 delimitedSize = _OpusToSelfDelimited(streamHeader->packet, streamPacketSize, buffer);
+            if (delimitedSize == 0)
+                panic("OpusBuild: stream %u produced an invalid packet", i);
+            ListAddRange(packetData, buffer, delimitedSize);
         }
+
+        u32 packetSize = (u32)(packetData->elementCount - headerOffset - sizeof(OpusPacketHeader));
+
+        OpusPacketHeader* mergedHeader = (OpusPacketHeader*)((u8*)packetData->data + headerOffset);
+        mergedHeader->packetSize = __builtin_bswap32(packetSize);
+        mergedHeader->finalRange = __builtin_bswap32(finalRange);
+
+        u32 unitSize = packetSize + sizeof(OpusPacketHeader);
+        if (*frameUnitSize == 0 && sizesUniform)
+            *frameUnitSize = unitSize;
+        else if (*frameUnitSize != unitSize)
+            sizesUniform = 0;
     }
 
-    opus_decoder_destroy(decoder);
-    free(tempSamples);
+    if (!sizesUniform || profile->rateMode != OPUS_RATE_CBR)
+        *frameUnitSize = 0;
 
-    return samples;
+    for (u32 i = 0; i < streamCount; i++) {
+        if (streams[i].offset != streams[i].packetData.elementCount)
+            panic("OpusBuild: stream %u has packets left over", i);
+
+        ListDestroy(&streams[i].packetData);
+        ListDestroy(&streams[i].seekEntries);
+    }
+    free(streams);
+}
+
+// Files with more than two channels are multistream (see
+// _OpusMakeMultistreamLayout), each stream encoded on its own thread.
+MemoryFile OpusBuildProfile(s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount, const OpusEncodeProfile* profile) {
+    _OpusBuildCheckFormat("OpusBuild", sampleRate, channelCount, 255);
+
+    ListData packetData, seekEntries;
+    u32 preSkipSamples, frameUnitSize;
+
+    if (channelCount <= 2) {
+        _OpusEncodePackets(
+            samples, sampleCount, sampleRate, channelCount, profile,
+            &packetData, &seekEntries, &preSkipSamples, &frameUnitSize
+        );
+
+        return _OpusAssembleFile(
+            sampleRate, channelCount, preSkipSamples, frameUnitSize, &packetData, &seekEntries, NULL,
+            0, 0, 0, 0, NULL
+        );
+    }
+
+    u8 multistreamData[sizeof(OpusMultistreamChunk) + 255];
+    OpusMultistreamChunk* multistreamChunk = (OpusMultistreamChunk*)multistreamData;
+    _OpusMakeMultistreamLayout(multistreamChunk, channelCount);
+
+    _OpusEncodeMultistream(
+        samples, sampleCount, sampleRate, channelCount, multistreamChunk, profile,
+        &packetData, &seekEntries, &preSkipSamples, &frameUnitSize
+    );
+
+    return _OpusAssembleFile(
+        sampleRate, channelCount, preSkipSamples, frameUnitSize, &packetData, &seekEntries, multistreamChunk,
+        0, 0, 0, 0, NULL
+    );
+}
+
+MemoryFile OpusBuild(s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount) {
+    return OpusBuildProfile(samples, sampleCount, sampleRate, channelCount, OPUS_DEFAULT_PROFILE);
+}
+
+// Build a Capcom-format OPUS file from PCM samples.
+// Replicates the format used in Capcom Switch games (e.g. Resident Evil: Revelations).
+// The original Capcom encoder output is reproduced by OPUS_CAPCOM_PROFILE:
+// CELT-only CBR encoding at 96kbps (240 bytes/packet, 20ms frames, pre-skip=120).
+// With other profiles the frame unit size fields follow the packets produced
+// (0 for VBR).
+//
+// File layout (without a seek chunk):
+//   0x00-0x2F : Capcom header (48 bytes)
+//   0x30-0x4F : Nintendo Opus header (32 bytes)
+//   0x50-0x57 : Data chunk header (8 bytes)
+//   0x58+     : Opus packets (each: 4B BE size + 4B BE finalRange + data)
+MemoryFile OpusBuildCapcomProfile(
+    s16* samples, u32 sampleCount, u32 sampleRate, u32 channelCount,
+    u32 loopStart, u32 loopEnd, const u8* configData, const OpusEncodeProfile* profile
+) {
+    _OpusBuildCheckFormat("OpusBuildCapcom", sampleRate, channelCount, 2);
+
+    u32 samplesPerChannel = sampleCount / channelCount;
+
+    _OpusCheckCapcomLoop(samplesPerChannel, &loopStart, &loopEnd);
+
+    ListData packetData, seekEntries;
+    u32 preSkipSamples, frameUnitSize;
+    _OpusEncodePackets(
+        samples, sampleCount, sampleRate, channelCount, profile,
+        &packetData, &seekEntries, &preSkipSamples, &frameUnitSize
+    );
+
+    return _OpusAssembleFile(
+        sampleRate, channelCount, preSkipSamples, frameUnitSize, &packetData, &seekEntries, NULL,
+        1, samplesPerChannel, loopStart, loopEnd, configData
+    );
+}
+
+// criticalBytes and orig_packet_sizes/orig_packet_count are kept for API compatibility
+// but are no longer used; all values are derived from the audio parameters.
+MemoryFile OpusBuildCapcom(s16* samples, u32 sampleCount, u32 sampleRate,
+    u32 channelCount, u32 loopStart, u32 loopEnd,
+    u8* configData, u8* criticalBytes, u32* orig_packet_sizes, size_t orig_packet_count)
+{
+    (void)criticalBytes;
+    (void)orig_packet_sizes;
+    (void)orig_packet_count;
+
+    return OpusBuildCapcomProfile(
+        samples, sampleCount, sampleRate, channelCount,
+        loopStart, loopEnd, configData, OPUS_CAPCOM_PROFILE
+    );
+}
+
+// Decode a Capcom-format OPUS file to interleaved s16 PCM samples.
+// The Capcom header (0x00-0x2F) is parsed to find the embedded Nintendo
+// Opus header, which is decoded by OpusDecodeStream; the result is trimmed to
+// the header's numSamples, with the decoder gain (see OpusDecodeStream).
+ListData OpusDecodeCapcom(u8* capcomData, int gain) {
+    // Validate basic structure
+    if (!capcomData)
+        panic("OpusDecodeCapcom: null input");
+
+    OpusCapcomHeader* capcomHeader = (OpusCapcomHeader*)capcomData;
+    OpusFileHeader* fileHeader = (OpusFileHeader*)(capcomData + capcomHeader->dataOffset);
+
+    if (fileHeader->chunkId != CHUNK_HEADER_ID)
+        panic("OpusDecodeCapcom: invalid Nintendo OPUS chunk ID at offset 0x%X", capcomHeader->dataOffset);
+
+    return OpusDecodeStream(fileHeader, capcomHeader->numSamples, gain);
 }
 
 // Return the channel count stored in a Capcom OPUS file.
@@ -667,4 +1987,844 @@ u32 OpusCapcomGetSampleRate(u8* capcomData) {
     return ((OpusFileHeader*)(capcomData + nintendoOff))->sampleRate;
 }
 
+// Return the embedded Nintendo OpusFileHeader of an OPUS file of any variant
+// (the start of the file if the variant is unknown).
+OpusFileHeader* OpusGetFileHeader(u8* opusData, u64 dataSize) {
+    const OpusVariant* variant = OpusFindVariant(opusData, dataSize);
+    return (OpusFileHeader*)(opusData + (variant ? variant->locateHeader(opusData, dataSize) : 0));
+}
+
+// Decode an OPUS file of any variant, trimmed to the length its container
+// stores, with the decoder gain (see OpusDecodeStream). metadata receives the
+// length and loop.
+ListData OpusDecodeFile(u8* opusData, u64 dataSize, int gain, OpusVariantMetadata* metadata) {
+    const OpusVariant* variant = OpusFindVariant(opusData, dataSize);
+    if (variant == NULL)
+        panic("OpusDecodeFile: unknown OPUS container");
+
+    OpusReadVariantMetadata(variant, opusData, dataSize, metadata);
+
+    OpusFileHeader* fileHeader = (OpusFileHeader*)(opusData + variant->locateHeader(opusData, dataSize));
+    OpusPreprocess((u8*)fileHeader);
+
+    return OpusDecodeStream(fileHeader, metadata->numSamples, gain);
+}
+
+// Preview decodes trade quality for speed: libopus decodes straight to a
+// lower rate (skipping the synthesis of the upper band) and downmixes to
+// mono, so no resampler or downmix pass follows.
+#define OPUS_PREVIEW_SAMPLE_RATE (16000)
+
+// Set up streamDecoder for a preview of fileHeader: mono at sampleRate (an
+// Opus rate; 0 is OPUS_PREVIEW_SAMPLE_RATE), with the lowest decoder
+// complexity. Decoder complexity only exists from libopus 1.5 on (it gates
+// the neural packet loss concealment and enhancement); older versions refuse
+// it, which is ignored. numSamples as for OpusStreamDecoderInit.
+void OpusStreamDecoderInitPreview(OpusStreamDecoder* streamDecoder, OpusFileHeader* fileHeader, u64 numSamples, u32 sampleRate) {
+    OpusStreamDecoderInit(
+        streamDecoder, fileHeader, numSamples, sampleRate != 0 ? sampleRate : OPUS_PREVIEW_SAMPLE_RATE, 1
+    );
+    opus_decoder_ctl(streamDecoder->decoders[0], OPUS_SET_COMPLEXITY(0));
+}
+
+// Transcode input: decoded float samples, pulled from the stream decoder one
+// frame at a time. Only the current frame is kept; it is also the one handed
+// out again to prime the encoder at an entry point.
+typedef struct {
+    OpusStreamDecoder decoder;
+    u32 channelCount;
+
+    float* frame;
+    u64 frameIndex; // Interleaved index of frame, (u64)-1 before the first one.
+} _OpusTranscodeSource;
+
+static const void* _OpusGetTranscodeFrame(void* userData, u64 index, u32 samplesPerFrame) {
+    _OpusTranscodeSource* transcodeSource = (_OpusTranscodeSource*)userData;
+    if (index == transcodeSource->frameIndex)
+        return transcodeSource->frame;
+
+    u32 channelCount = transcodeSource->channelCount;
+    u64 frameSamples = samplesPerFrame / channelCount;
+
+    u64 samplesRead = OpusStreamDecoderReadFloat(&transcodeSource->decoder, transcodeSource->frame, frameSamples);
+    memset(
+        transcodeSource->frame + samplesRead * channelCount, 0,
+        (frameSamples - samplesRead) * channelCount * sizeof(float)
+    );
+
+    transcodeSource->frameIndex = index;
+    return transcodeSource->frame;
+}
+
+// Decoded length (per channel) of a stream at sampleRate: numSamples if the
+// container stores it (0 if not), else everything after the pre-skip.
+u32 OpusTranscodeLength(OpusFileHeader* fileHeader, u32 numSamples, u32 sampleRate) {
+    u64 length = numSamples != 0 ?
+        numSamples : OpusGetPacketSampleCount(fileHeader) - MIN(OpusGetPacketSampleCount(fileHeader), (u64)fileHeader->preSkipSamples);
+    return (u32)(length * sampleRate / fileHeader->sampleRate);
+}
+
+// Re-encode the stream of fileHeader with the profile, decoding it frame by
+// frame straight into the encoder: no PCM is materialized. The audio stays in
+// float between the decoder and the encoder. numSamples is the stored length
+// (0 if the container has none); sampleRate is the output rate (0 keeps the
+// input's). Capcom outputs (capcom != 0) get the loop, in output samples, and
+// configData (NULL for the default).
+MemoryFile OpusTranscode(
+    OpusFileHeader* fileHeader, u32 numSamples, u32 sampleRate, const OpusEncodeProfile* profile,
+    int capcom, u32 loopStart, u32 loopEnd, const u8* configData
+) {
+    _OpusRejectMultistream("OpusTranscode", fileHeader);
+
+    if (sampleRate == 0)
+        sampleRate = fileHeader->sampleRate;
+    _OpusBuildCheckFormat("OpusTranscode", sampleRate, fileHeader->channelCount, 2);
+
+    u32 channelCount = fileHeader->channelCount;
+    u32 outputLength = OpusTranscodeLength(fileHeader, numSamples, sampleRate);
+
+    if (capcom)
+        _OpusCheckCapcomLoop(outputLength, &loopStart, &loopEnd);
+
+    _OpusTranscodeSource transcodeSource;
+    OpusStreamDecoderInit(&transcodeSource.decoder, fileHeader, numSamples, sampleRate, 0);
+    transcodeSource.channelCount = channelCount;
+    transcodeSource.frameIndex = (u64)-1;
+    transcodeSource.frame = (float*)malloc(sizeof(float) * OpusProfileFrameSamples(profile, sampleRate) * channelCount);
+    if (transcodeSource.frame == NULL)
+        panic("OpusTranscode: malloc fail");
+
+    _OpusFrameSource source = { (u64)outputLength * channelCount, 1, _OpusGetTranscodeFrame, &transcodeSource };
+
+    ListData packetData, seekEntries;
+    u32 preSkipSamples, frameUnitSize;
+    _OpusEncodeSource(
+        &source, sampleRate, channelCount, profile,
+        &packetData, &seekEntries, &preSkipSamples, &frameUnitSize
+    );
+    if (transcodeSource.decoder.error[0] != '\0')
+        panic("OpusTranscode: %s", transcodeSource.decoder.error);
+
+    free(transcodeSource.frame);
+    OpusStreamDecoderDestroy(&transcodeSource.decoder);
+
+    return _OpusAssembleFile(
+        sampleRate, channelCount, preSkipSamples, frameUnitSize, &packetData, &seekEntries, NULL,
+        capcom, outputLength, loopStart, loopEnd, configData
+    );
+}
+
+
+// Returns 0 if no loop is stored in the Capcom header.
+int OpusCapcomGetLoop(u8* capcomData, u32* loopStart, u32* loopEnd) {
+    u64 loopInfo = ((OpusCapcomHeader*)capcomData)->loopInfo;
+    if (loopInfo == CAPCOM_LOOP_NONE) {
+        *loopStart = *loopEnd = 0;
+        return 0;
+    }
+    *loopStart = (u32)loopInfo;
+    *loopEnd = (u32)(loopInfo >> 32);
+    return 1;
+}
+
+// Patch the loop points of a Capcom OPUS file in place. Pass 0/0 to disable looping.
+void OpusCapcomSetLoop(u8* capcomData, u32 loopStart, u32 loopEnd) {
+    OpusCapcomHeader* capcomHeader = (OpusCapcomHeader*)capcomData;
+
+    if (loopEnd > capcomHeader->numSamples)
+        panic("OpusCapcomSetLoop: loop_end (%u) exceeds sample count (%u)", loopEnd, capcomHeader->numSamples);
+    if ((loopStart != 0 || loopEnd != 0) && loopStart >= loopEnd)
+        panic("OpusCapcomSetLoop: loop_start (%u) must be less than loop_end (%u)", loopStart, loopEnd);
+
+    capcomHeader->loopInfo = OpusCapcomMakeLoopInfo(loopStart, loopEnd);
+}
+
+// Wrap a Nintendo OPUS file in a Capcom header without touching the packets.
+// The Nintendo file is copied verbatim after the Capcom header, so every
+// offset inside it stays valid. configData may be NULL to use the defaults.
+MemoryFile OpusRewrapCapcom(u8* opusData, u64 dataSize, u32 loopStart, u32 loopEnd, const u8* configData) {
+    OpusFileHeader* fileHeader = (OpusFileHeader*)opusData;
+    _OpusRejectMultistream("OpusRewrapCapcom", fileHeader);
+
+    u64 packetSamples = OpusGetPacketSampleCount(fileHeader);
+    u32 samplesPerChannel = packetSamples > fileHeader->preSkipSamples ?
+        (u32)(packetSamples - fileHeader->preSkipSamples) : 0;
+
+    if (loopEnd > samplesPerChannel) {
+        warn("OpusRewrapCapcom: loop_end exceeds sample count, clamping");
+        loopEnd = samplesPerChannel;
+    }
+    if ((loopStart != 0 || loopEnd != 0) && loopStart >= loopEnd) {
+        warn("OpusRewrapCapcom: loop_start >= loop_end, disabling loops");
+        loopStart = 0;
+        loopEnd = 0;
+    }
+
+    MemoryFile result;
+    result.size = sizeof(OpusCapcomHeader) + dataSize;
+    result.data_void = malloc(result.size);
+    if (!result.data_void)
+        panic("OpusRewrapCapcom: failed to allocate output buffer");
+
+    OpusCapcomHeader* capcomHeader = (OpusCapcomHeader*)result.data_void;
+    memset(capcomHeader, 0, sizeof(OpusCapcomHeader));
+
+    capcomHeader->numSamples    = samplesPerChannel;
+    capcomHeader->channelCount  = fileHeader->channelCount;
+    capcomHeader->loopInfo      = OpusCapcomMakeLoopInfo(loopStart, loopEnd);
+    // Nintendo CBR frameSize already includes the 8-byte OpusPacketHeader; 0 stays 0 for VBR.
+    capcomHeader->frameUnitSize = fileHeader->frameSize;
+    capcomHeader->dataOffset    = sizeof(OpusCapcomHeader);
+    memcpy(capcomHeader->configData, configData ? configData : OpusCapcomDefaultConfig, 16);
+
+    memcpy(capcomHeader + 1, opusData, dataSize);
+
+    return result;
+}
+
+// Strip the Capcom header, leaving the embedded Nintendo OPUS file as-is.
+MemoryFile OpusRewrapNintendo(u8* capcomData, u64 dataSize) {
+    OpusCapcomHeader* capcomHeader = (OpusCapcomHeader*)capcomData;
+
+    if (capcomHeader->loopInfo != CAPCOM_LOOP_NONE)
+        warn("OpusRewrapNintendo: the Nintendo format has no loop field, loop points are dropped");
+
+    MemoryFile result;
+    result.size = dataSize - capcomHeader->dataOffset;
+    result.data_void = malloc(result.size);
+    if (!result.data_void)
+        panic("OpusRewrapNintendo: failed to allocate output buffer");
+
+    memcpy(result.data_void, capcomData + capcomHeader->dataOffset, result.size);
+
+    return result;
+}
+
+// Packets encoded ahead of a splice (output discarded) so the encoder state
+// has settled by the first rewritten packet.
+#define OPUS_SPLICE_WARMUP_PACKETS (4)
+// Default amount of packets rewritten on each side of the changed range.
+#define OPUS_SPLICE_MARGIN_PACKETS (2)
+
+typedef struct {
+    u32 firstPacket;
+    u32 packetCount; // Packets rewritten.
+    u32 totalPackets;
+    u32 paddedCount; // Rewritten packets that came out short and were padded.
+} OpusSpliceResult;
+
+// Bitrate at which the encoder fills packetSize bytes per frame.
+static int _OpusSpliceBitRate(u32 packetSize, u32 frameSize, u32 sampleRate) {
+    u64 bitRate = (u64)packetSize * 8 * sampleRate / frameSize;
+    return (int)MIN(MAX(bitRate, (u64)500), (u64)512000);
+}
+
+static int _OpusIsSeekEntryOffset(const OpusSeekChunk* seekChunk, u32 dataOffset) {
+    u32 entryCount = OpusGetSeekEntryCount(seekChunk);
+    for (u32 i = 0; i < entryCount; i++) {
+        if (seekChunk->entries[i].dataOffset == dataOffset)
+            return 1;
+    }
+    return 0;
+}
+
+// Replace the audio starting at startSample (per channel, pre-skip excluded)
+// with samples (interleaved, sampleCount in total) in a Nintendo or Capcom
+// OPUS file, patching it in place. Only the packets the replacement reaches
+// are re-encoded, plus marginPackets on each side; each new packet gets the
+// exact size of the one it replaces. The audio around the replacement comes
+// from decoding just the packets re-encoded (and their warm-up), and the first
+// and last crossfadeSamples of the replacement are blended with it. The profile must have the encoder delay the
+// file was made with; its rate settings are replaced by the packet sizes.
+void OpusSplice(
+    u8* opusData, u64 dataSize, const s16* samples, u32 sampleCount, u32 startSample,
+    const OpusEncodeProfile* profile, u32 marginPackets, u32 crossfadeSamples, OpusSpliceResult* result
+) {
+    OpusFileHeader* fileHeader = OpusGetFileHeader(opusData, dataSize);
+    _OpusRejectMultistream("OpusSplice", fileHeader);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    OpusSeekChunk* seekChunk = OpusGetSeekChunk(fileHeader);
+
+    u32 channelCount = fileHeader->channelCount;
+    u32 sampleRate = fileHeader->sampleRate;
+    u32 preSkipSamples = fileHeader->preSkipSamples;
+
+    // Packet k must hold input frame k, so every packet has to cover the same
+    // duration.
+    ListData packetOffsets;
+    ListInit(&packetOffsets, sizeof(u32), 1024);
+
+    u32 frameSize = 0;
+    for (u32 offset = 0; offset < dataChunk->chunkSize;) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = _OpusPacketSizeAt(dataChunk, offset);
+
+        int packetSamples = packetSize != 0 ? opus_packet_get_nb_samples(packetHeader->packet, packetSize, sampleRate) : OPUS_INVALID_PACKET;
+        if (packetSamples <= 0)
+            panic("OpusSplice: invalid packet at 0x%X", offset);
+
+        if (frameSize == 0)
+            frameSize = (u32)packetSamples;
+        else if ((u32)packetSamples != frameSize)
+            panic("OpusSplice: packet durations vary; only streams with a constant frame duration can be spliced");
+
+        ListAdd(&packetOffsets, &offset);
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    u32 packetCount = (u32)packetOffsets.elementCount;
+    if (packetCount == 0)
+        panic("OpusSplice: the stream has no packets");
+
+    // The decoded stream lines up with the original input (pre-skip dropped).
+    u32 replaceCount = sampleCount / channelCount;
+    u64 packetSamples = (u64)packetCount * frameSize;
+    u64 decodedCount = packetSamples - MIN(packetSamples, (u64)preSkipSamples);
+    if (replaceCount == 0 || (u64)startSample + replaceCount > decodedCount)
+        panic(
+            "OpusSplice: the replacement (%u samples at %u) doesn't fit in the stream (%llu samples)",
+            replaceCount, startSample, (unsigned long long)decodedCount
+        );
+
+    // Packet k encodes input frame k; its decoded output is delayed by the
+    // pre-skip, so the changed input reaches pre-skip samples further.
+    u32 firstPacket = startSample / frameSize;
+    u32 lastPacket = (u32)(((u64)startSample + replaceCount - 1 + preSkipSamples) / frameSize);
+
+    firstPacket = firstPacket > marginPackets ? firstPacket - marginPackets : 0;
+    lastPacket = MIN(lastPacket + marginPackets, packetCount - 1);
+
+    u32 warmupPacket = firstPacket > OPUS_SPLICE_WARMUP_PACKETS ? firstPacket - OPUS_SPLICE_WARMUP_PACKETS : 0;
+
+    // Only the input frames encoded below are decoded: from the one priming
+    // an entry packet ahead of the warm-up through lastPacket. The window
+    // holds the replacement, since firstPacket and lastPacket bracket it.
+    u64 windowStart = (u64)(warmupPacket > 0 ? warmupPacket - 1 : 0) * frameSize;
+    u64 windowCount = MIN((u64)(lastPacket + 1) * frameSize, decodedCount) - windowStart;
+
+    s16* source = (s16*)malloc(sizeof(s16) * windowCount * channelCount);
+    if (source == NULL)
+        panic("OpusSplice: failed to allocate the decode window");
+
+    OpusStreamDecoder streamDecoder;
+    OpusStreamDecoderInit(&streamDecoder, fileHeader, 0, 0, 0);
+    u64 windowRead = 0;
+    if (OpusStreamDecoderSeek(&streamDecoder, windowStart, OPUS_SEEK_PREROLL_PACKETS))
+        windowRead = OpusStreamDecoderRead(&streamDecoder, source, windowCount);
+    if (streamDecoder.error[0] != '\0')
+        panic("OpusSplice: %s", streamDecoder.error);
+    if (windowRead != windowCount)
+        panic("OpusSplice: the stream ends before the spliced packets");
+    OpusStreamDecoderDestroy(&streamDecoder);
+
+    // source holds frame k at interleaved index k * samplesPerFrame - windowOffset.
+    u64 windowOffset = windowStart * channelCount;
+    u32 windowLength = (u32)(windowCount * channelCount);
+
+    crossfadeSamples = MIN(crossfadeSamples, replaceCount / 2);
+
+    // Weight of the replacement (out of crossfadeSamples + 1) rises over the
+    // first crossfadeSamples and falls over the last.
+    s64 weightMax = (s64)crossfadeSamples + 1;
+    for (u32 i = 0; i < replaceCount; i++) {
+        s64 weight = weightMax;
+        if (i < crossfadeSamples)
+            weight = i + 1;
+        else if (replaceCount - i <= crossfadeSamples)
+            weight = replaceCount - i;
+
+        for (u32 c = 0; c < channelCount; c++) {
+            s16* target = source + ((u64)startSample + i) * channelCount + c - windowOffset;
+            s64 blended = (samples[(u64)i * channelCount + c] * weight + *target * (weightMax - weight)) / weightMax;
+            *target = (s16)blended;
+        }
+    }
+
+    OpusEncodeProfile spliceProfile = *profile;
+    spliceProfile.rateMode = OPUS_RATE_CBR;
+    spliceProfile.bitRate = _OpusSpliceBitRate(
+        __builtin_bswap32(((OpusPacketHeader*)(dataChunk->data + *(u32*)ListGet(&packetOffsets, firstPacket)))->packetSize),
+        frameSize, sampleRate
+    );
+    spliceProfile.frameDuration = (u32)((u64)frameSize * 10000 / sampleRate);
+    spliceProfile.predictionDisabled |= seekChunk != NULL;
+    spliceProfile.entryInterval = 0;
+
+    u32 encoderPreSkip;
+    OpusEncoder* encoder = OpusCreateProfileEncoder(&spliceProfile, sampleRate, channelCount, &encoderPreSkip);
+    if (encoderPreSkip != preSkipSamples)
+        panic(
+            "OpusSplice: the profile's encoder delay (%u samples) differs from the stream's pre-skip (%u)\n"
+            "Use the profile the file was encoded with.",
+            encoderPreSkip, preSkipSamples
+        );
+
+    u32 samplesPerFrame = frameSize * channelCount;
+
+    s16* paddedFrame = (s16*)malloc(samplesPerFrame * sizeof(s16));
+    if (paddedFrame == NULL)
+        panic("OpusSplice: failed to allocate frame buffer");
+
+    // New final ranges (big-endian) and packets, written over the file once
+    // every packet encoded.
+    ListData newPackets;
+    ListInit(&newPackets, sizeof(u8), 65536);
+
+    memset(result, 0, sizeof(OpusSpliceResult));
+
+    u8 buffer[OPUS_PACKET_BUFFER_SIZE];
+
+    for (u32 k = warmupPacket; k <= lastPacket; k++) {
+        u32 offset = *(u32*)ListGet(&packetOffsets, k);
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        u64 frameIndex = (u64)k * samplesPerFrame - windowOffset;
+
+        // Entry packets start from a reset encoder primed with the previous
+        // frame, like _OpusEncodePackets does.
+        if (k != 0 && _OpusIsSeekEntryOffset(seekChunk, offset)) {
+            opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+
+            const s16* primeFrame = _OpusGetFrame(source, windowLength, frameIndex - samplesPerFrame, samplesPerFrame, paddedFrame);
+            int primeBytes = opus_encode(encoder, primeFrame, frameSize, buffer, sizeof(buffer));
+            if (primeBytes < 0)
+                panic("OpusSplice: opus_encode failed: %s", opus_strerror(primeBytes));
+        }
+
+        opus_encoder_ctl(encoder, OPUS_SET_BITRATE(_OpusSpliceBitRate(packetSize, frameSize, sampleRate)));
+
+        const s16* frame = _OpusGetFrame(source, windowLength, frameIndex, samplesPerFrame, paddedFrame);
+
+        int nbBytes = opus_encode(encoder, frame, frameSize, buffer, k < firstPacket ? sizeof(buffer) : packetSize);
+        if (nbBytes < 0)
+            panic("OpusSplice: opus_encode failed: %s", opus_strerror(nbBytes));
+
+        if (k < firstPacket)
+            continue;
+
+        u32 finalRange = 0;
+        if (opus_encoder_ctl(encoder, OPUS_GET_FINAL_RANGE(&finalRange)) < 0)
+            panic("OpusSplice: failed to get encoder final range");
+
+        // Padding leaves the decoded audio (and final range) unchanged.
+        if ((u32)nbBytes < packetSize) {
+            int opusError = opus_packet_pad(buffer, nbBytes, packetSize);
+            if (opusError != OPUS_OK)
+                panic("OpusSplice: opus_packet_pad failed: %s", opus_strerror(opusError));
+            result->paddedCount++;
+        }
+
+        u32 finalRangeBE = __builtin_bswap32(finalRange);
+        ListAddRange(&newPackets, &finalRangeBE, 4);
+        ListAddRange(&newPackets, buffer, packetSize);
+    }
+
+    u8* newPacket = (u8*)newPackets.data;
+    for (u32 k = firstPacket; k <= lastPacket; k++) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + *(u32*)ListGet(&packetOffsets, k));
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        memcpy(&packetHeader->finalRange, newPacket, 4);
+        memcpy(packetHeader->packet, newPacket + 4, packetSize);
+        newPacket += 4 + packetSize;
+    }
+
+    result->firstPacket = firstPacket;
+    result->packetCount = lastPacket - firstPacket + 1;
+    result->totalPackets = packetCount;
+
+    ListDestroy(&newPackets);
+    free(paddedFrame);
+    opus_encoder_destroy(encoder);
+    free(source);
+    ListDestroy(&packetOffsets);
+}
+
+// Packets kept ahead of a cut so the decoder has converged by its first sample.
+#define OPUS_CUT_PREROLL_PACKETS (2)
+
+typedef struct {
+    u32 firstPacket;
+    u32 packetCount;
+    u32 preSkipSamples; // Of the cut stream (pre-roll included).
+    u32 numSamples;
+} OpusCutResult;
+
+typedef struct {
+    u32 dataOffset; // Relative to OpusDataChunk::data.
+    u32 sampleOffset; // Per channel, pre-skip included.
+} _OpusPacketSpan;
+
+// Copy the packets holding samples [start, end) (per channel, pre-skip
+// excluded) of a Nintendo or Capcom OPUS file into a new file, with up to
+// prerollPackets more ahead of them for the decoder to converge (fewer if an
+// entry point comes first). Nothing is re-encoded. The pre-skip is set so
+// playback starts exactly at start. Capcom outputs (capcom != 0) also get
+// numSamples = end - start and the loop (relative to start, 0/0 for none);
+// Nintendo outputs have no length field and run to the end of the last packet.
+MemoryFile OpusCut(
+    u8* opusData, u64 dataSize, u32 start, u32 end, u32 prerollPackets,
+    int capcom, u32 loopStart, u32 loopEnd, OpusCutResult* result
+) {
+    int sourceCapcom = OpusIsCapcomFormat(opusData, dataSize);
+    OpusFileHeader* fileHeader = OpusGetFileHeader(opusData, dataSize);
+    _OpusRejectMultistream("OpusCut", fileHeader);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    OpusSeekChunk* seekChunk = OpusGetSeekChunk(fileHeader);
+
+    if (start >= end)
+        panic("OpusCut: start (%u) must be less than end (%u)", start, end);
+
+    u64 startSample = (u64)start + fileHeader->preSkipSamples;
+    u64 endSample = (u64)end + fileHeader->preSkipSamples;
+
+    ListData spans;
+    ListInit(&spans, sizeof(_OpusPacketSpan), 1024);
+
+    // Packets holding the first and the last sample.
+    u32 startPacket = 0, endPacket = 0;
+
+    u64 sampleOffset = 0;
+    for (u32 offset = 0; offset < dataChunk->chunkSize;) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        int packetSamples = opus_packet_get_nb_samples(packetHeader->packet, packetSize, fileHeader->sampleRate);
+        if (packetSamples < 0)
+            panic("OpusCut: invalid packet at 0x%X: %s", offset, opus_strerror(packetSamples));
+
+        _OpusPacketSpan span = { offset, (u32)sampleOffset };
+        ListAdd(&spans, &span);
+
+        if (sampleOffset <= startSample)
+            startPacket = (u32)spans.elementCount - 1;
+        if (sampleOffset < endSample)
+            endPacket = (u32)spans.elementCount - 1;
+
+        sampleOffset += packetSamples;
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    if (endSample > sampleOffset)
+        panic(
+            "OpusCut: end (%u) exceeds the stream length (%llu samples)",
+            end, (unsigned long long)(sampleOffset - MIN(sampleOffset, (u64)fileHeader->preSkipSamples))
+        );
+
+    // A decoder reset at an entry point drops whatever came before it.
+    u32 firstPacket = startPacket;
+    for (u32 i = 0; i < prerollPackets && firstPacket > 0; i++) {
+        u32 dataOffset = ((_OpusPacketSpan*)ListGet(&spans, firstPacket))->dataOffset;
+        if (_OpusIsSeekEntryOffset(seekChunk, dataOffset))
+            break;
+        firstPacket--;
+    }
+
+    _OpusPacketSpan* firstSpan = (_OpusPacketSpan*)ListGet(&spans, firstPacket);
+
+    u64 preSkipSamples = startSample - firstSpan->sampleOffset;
+    if (preSkipSamples > 0xFFFF)
+        panic("OpusCut: the pre-roll (%llu samples) doesn't fit the pre-skip field", (unsigned long long)preSkipSamples);
+
+    u32 firstOffset = firstSpan->dataOffset;
+    u32 endOffset = endPacket + 1 < spans.elementCount ?
+        ((_OpusPacketSpan*)ListGet(&spans, endPacket + 1))->dataOffset : dataChunk->chunkSize;
+
+    ListData packetData, seekEntries;
+    ListInit(&packetData, sizeof(u8), endOffset - firstOffset);
+    ListAddRange(&packetData, dataChunk->data + firstOffset, endOffset - firstOffset);
+
+    ListInit(&seekEntries, sizeof(OpusSeekEntry), 64);
+
+    u32 entryCount = OpusGetSeekEntryCount(seekChunk);
+    for (u32 i = 0; i < entryCount; i++) {
+        OpusSeekEntry entry = seekChunk->entries[i];
+        if (entry.dataOffset < firstOffset || entry.dataOffset >= endOffset)
+            continue;
+
+        entry.dataOffset -= firstOffset;
+        entry.sampleOffset -= firstSpan->sampleOffset;
+        ListAdd(&seekEntries, &entry);
+    }
+
+    u32 numSamples = end - start;
+
+    if (loopEnd > numSamples || ((loopStart != 0 || loopEnd != 0) && loopStart >= loopEnd))
+        panic("OpusCut: invalid loop (%u-%u) for %u samples", loopStart, loopEnd, numSamples);
+
+    u64 capcomHdrSize = capcom ? sizeof(OpusCapcomHeader) : 0;
+
+    MemoryFile mfResult;
+    mfResult.size = capcomHdrSize + _OpusStreamSize(&packetData, &seekEntries, NULL);
+    mfResult.data_void = malloc(mfResult.size);
+    if (mfResult.data_void == NULL)
+        panic("OpusCut: failed to allocate output buffer");
+    memset(mfResult.data_void, 0, mfResult.size);
+
+    if (capcom) {
+        const u8* configData = sourceCapcom ? ((OpusCapcomHeader*)opusData)->configData : NULL;
+        _OpusWriteCapcomHeader(
+            (OpusCapcomHeader*)mfResult.data_void, numSamples, fileHeader->channelCount,
+            loopStart, loopEnd, fileHeader->frameSize, configData
+        );
+    }
+
+    _OpusWriteStream(
+        (OpusFileHeader*)(mfResult.data_u8 + capcomHdrSize), fileHeader->sampleRate, fileHeader->channelCount,
+        (u32)preSkipSamples, fileHeader->frameSize, &packetData, &seekEntries, NULL
+    );
+
+    result->firstPacket = firstPacket;
+    result->packetCount = endPacket - firstPacket + 1;
+    result->preSkipSamples = (u32)preSkipSamples;
+    result->numSamples = numSamples;
+
+    ListDestroy(&seekEntries);
+    ListDestroy(&packetData);
+    ListDestroy(&spans);
+
+    return mfResult;
+}
+
+// Lossless repacketization. Consecutive packets are merged into multi-frame
+// packets with the libopus repacketizer, and packets can be padded or unpadded
+// to a size. The audio isn't decoded to be re-encoded; it's only decoded once
+// at the end to store the final range of every new packet.
+
+#define OPUS_REPACKETIZE_KEEP (0) // Leave packet sizes as they are.
+#define OPUS_REPACKETIZE_PAD (1) // Pad packets up to a size (opus_packet_pad).
+#define OPUS_REPACKETIZE_UNPAD (2) // Strip all padding (opus_packet_unpad).
+
+// A packet holds at most 48 frames (of 2.5ms).
+#define OPUS_REPACKETIZE_BUFFER_SIZE (OPUS_PACKETSIZE_MAX * 48 + 96)
+
+typedef struct {
+    u32 packetCountBefore;
+    u32 packetCountAfter;
+    u64 dataSizeBefore; // Data chunk payload bytes.
+    u64 dataSizeAfter;
+
+    u32 padSize; // Target of OPUS_REPACKETIZE_PAD.
+    u32 paddedCount;
+    u32 oversizeCount; // Packets already larger than padSize.
+    u32 unpaddedCount; // Packets that had padding to strip.
+
+    u32 frameUnitSize; // Of the output; 0 if packet sizes vary.
+} OpusRepacketizeResult;
+
+static void _OpusRepacketizeFlush(OpusRepacketizer* repacketizer, u8* buffer, ListData* packetData) {
+    if (opus_repacketizer_get_nb_frames(repacketizer) == 0)
+        return;
+
+    opus_int32 packetSize = opus_repacketizer_out(repacketizer, buffer, OPUS_REPACKETIZE_BUFFER_SIZE);
+    if (packetSize < 0)
+        panic("OpusRepacketize: opus_repacketizer_out fail: %s", opus_strerror(packetSize));
+
+    // The final range is filled in by the decode pass.
+    OpusPacketHeader packetHeader = { __builtin_bswap32((u32)packetSize), 0 };
+    ListAddRange(packetData, &packetHeader, sizeof(OpusPacketHeader));
+    ListAddRange(packetData, buffer, (u64)packetSize);
+
+    opus_repacketizer_init(repacketizer);
+}
+
+// Repacketize a Nintendo or Capcom OPUS file (other variants come out as
+// Nintendo files). maxDuration is the longest merged packet in samples per
+// channel at the file's rate (0 keeps the packets as they are); packets of
+// different modes, bandwidths or frame durations are never merged, and
+// neither are packets across a seek entry point. padSize is the payload size
+// for OPUS_REPACKETIZE_PAD, 0 for the largest packet of the stream, which
+// always gives a fixed packet size.
+MemoryFile OpusRepacketize(
+    u8* opusData, u64 dataSize, u32 maxDuration, int padMode, u32 padSize, OpusRepacketizeResult* result
+) {
+    memset(result, 0, sizeof(OpusRepacketizeResult));
+
+    int capcom = OpusIsCapcomFormat(opusData, dataSize);
+    OpusFileHeader* fileHeader = OpusGetFileHeader(opusData, dataSize);
+    _OpusRejectMultistream("OpusRepacketize", fileHeader);
+
+    OpusDataChunk* dataChunk = (OpusDataChunk*)((u8*)fileHeader + fileHeader->dataOffset);
+    OpusSeekChunk* seekChunk = OpusGetSeekChunk(fileHeader);
+
+    u8* buffer = (u8*)malloc(OPUS_REPACKETIZE_BUFFER_SIZE);
+    if (buffer == NULL)
+        panic("OpusRepacketize: malloc fail");
+
+    // Merge pass. Entry offsets are moved to the merged stream.
+    ListData merged, seekEntries;
+    ListInit(&merged, sizeof(u8), dataChunk->chunkSize);
+    ListInit(&seekEntries, sizeof(OpusSeekEntry), 64);
+
+    OpusRepacketizer* repacketizer = opus_repacketizer_create();
+    if (repacketizer == NULL)
+        panic("OpusRepacketize: opus_repacketizer_create fail");
+
+    u64 totalSamples = 0;
+    u32 pendingSamples = 0;
+
+    for (u32 offset = 0; offset < dataChunk->chunkSize;) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)(dataChunk->data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        int packetSamples = opus_packet_get_nb_samples(packetHeader->packet, packetSize, fileHeader->sampleRate);
+        if (packetSamples < 0)
+            panic("OpusRepacketize: invalid packet at 0x%X: %s", offset, opus_strerror(packetSamples));
+
+        int isEntry = _OpusIsSeekEntryOffset(seekChunk, offset);
+
+        if (maxDuration == 0) {
+            ListAddRange(&merged, packetHeader, sizeof(OpusPacketHeader) + packetSize);
+        }
+        else {
+            if (isEntry || pendingSamples + (u32)packetSamples > maxDuration) {
+                _OpusRepacketizeFlush(repacketizer, buffer, &merged);
+                pendingSamples = 0;
+            }
+
+            // Refused if the TOC differs from the pending frames or the result would exceed 120ms.
+            if (opus_repacketizer_cat(repacketizer, packetHeader->packet, packetSize) != OPUS_OK) {
+                _OpusRepacketizeFlush(repacketizer, buffer, &merged);
+                pendingSamples = 0;
+
+                int error = opus_repacketizer_cat(repacketizer, packetHeader->packet, packetSize);
+                if (error != OPUS_OK)
+                    panic("OpusRepacketize: opus_repacketizer_cat fail at 0x%X: %s", offset, opus_strerror(error));
+            }
+            pendingSamples += (u32)packetSamples;
+        }
+
+        // After a flush the merged stream ends where the entry's packet will start.
+        if (isEntry) {
+            u64 mergedOffset = maxDuration == 0 ?
+                merged.elementCount - sizeof(OpusPacketHeader) - packetSize : merged.elementCount;
+            OpusSeekEntry entry = { (u32)totalSamples, (u32)mergedOffset };
+            ListAdd(&seekEntries, &entry);
+        }
+
+        result->packetCountBefore++;
+        totalSamples += (u64)packetSamples;
+        offset += sizeof(OpusPacketHeader) + packetSize;
+    }
+
+    _OpusRepacketizeFlush(repacketizer, buffer, &merged);
+    opus_repacketizer_destroy(repacketizer);
+
+    // Size pass: pad or unpad, then decode the new packet for its final range.
+    if (padMode == OPUS_REPACKETIZE_PAD && padSize == 0) {
+        for (u64 offset = 0; offset < merged.elementCount;) {
+            u32 packetSize = __builtin_bswap32(((OpusPacketHeader*)((u8*)merged.data + offset))->packetSize);
+            padSize = MAX(padSize, packetSize);
+            offset += sizeof(OpusPacketHeader) + packetSize;
+        }
+    }
+    if (padSize > OPUS_REPACKETIZE_BUFFER_SIZE)
+        panic("OpusRepacketize: pad size %u is too large", padSize);
+    result->padSize = padSize;
+
+    int error;
+    OpusDecoder* decoder = opus_decoder_create(fileHeader->sampleRate, fileHeader->channelCount, &error);
+    if (error != OPUS_OK)
+        panic("OpusRepacketize: opus_decoder_create fail: %s", opus_strerror(error));
+
+    // Largest possible packet duration is 120ms.
+    u32 maxPacketSamples = fileHeader->sampleRate / 1000 * 120;
+    s16* pcm = (s16*)malloc(sizeof(s16) * maxPacketSamples * fileHeader->channelCount);
+    if (pcm == NULL)
+        panic("OpusRepacketize: malloc fail");
+
+    ListData packetData;
+    ListInit(&packetData, sizeof(u8), merged.elementCount);
+
+    u32 nextEntry = 0;
+    u64 decodedSamples = 0;
+    int sizesUniform = 1;
+
+    for (u64 offset = 0; offset < merged.elementCount;) {
+        OpusPacketHeader* packetHeader = (OpusPacketHeader*)((u8*)merged.data + offset);
+        u32 packetSize = __builtin_bswap32(packetHeader->packetSize);
+
+        memcpy(buffer, packetHeader->packet, packetSize);
+
+        if (padMode == OPUS_REPACKETIZE_PAD && packetSize < padSize) {
+            error = opus_packet_pad(buffer, (opus_int32)packetSize, (opus_int32)padSize);
+            if (error != OPUS_OK)
+                panic("OpusRepacketize: opus_packet_pad fail at 0x%llX: %s", (unsigned long long)offset, opus_strerror(error));
+            packetSize = padSize;
+            result->paddedCount++;
+        }
+        else if (padMode == OPUS_REPACKETIZE_PAD && packetSize > padSize)
+            result->oversizeCount++;
+        else if (padMode == OPUS_REPACKETIZE_UNPAD) {
+            opus_int32 unpaddedSize = opus_packet_unpad(buffer, (opus_int32)packetSize);
+            if (unpaddedSize < 0)
+                panic("OpusRepacketize: opus_packet_unpad fail at 0x%llX: %s", (unsigned long long)offset, opus_strerror(unpaddedSize));
+            if ((u32)unpaddedSize != packetSize)
+                result->unpaddedCount++;
+            packetSize = (u32)unpaddedSize;
+        }
+
+        OpusSeekEntry* entries = (OpusSeekEntry*)seekEntries.data;
+        if (nextEntry < seekEntries.elementCount && entries[nextEntry].dataOffset == offset) {
+            entries[nextEntry].dataOffset = (u32)packetData.elementCount;
+            opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+            nextEntry++;
+        }
+
+        int samples = opus_decode(decoder, buffer, (opus_int32)packetSize, pcm, (int)maxPacketSamples, 0);
+        if (samples < 0)
+            panic("OpusRepacketize: opus_decode fail at 0x%llX: %s", (unsigned long long)offset, opus_strerror(samples));
+        decodedSamples += (u64)samples;
+
+        u32 finalRange;
+        opus_decoder_ctl(decoder, OPUS_GET_FINAL_RANGE(&finalRange));
+
+        OpusPacketHeader newHeader = { __builtin_bswap32(packetSize), __builtin_bswap32(finalRange) };
+        ListAddRange(&packetData, &newHeader, sizeof(OpusPacketHeader));
+        ListAddRange(&packetData, buffer, packetSize);
+
+        u32 unitSize = packetSize + sizeof(OpusPacketHeader);
+        if (result->packetCountAfter == 0)
+            result->frameUnitSize = unitSize;
+        else if (result->frameUnitSize != unitSize)
+            sizesUniform = 0;
+
+        result->packetCountAfter++;
+        offset += sizeof(OpusPacketHeader) + __builtin_bswap32(packetHeader->packetSize);
+    }
+
+    free(pcm);
+    opus_decoder_destroy(decoder);
+    ListDestroy(&merged);
+    free(buffer);
+
+    if (decodedSamples != totalSamples)
+        panic(
+            "OpusRepacketize: the new stream decodes to %llu samples instead of %llu",
+            (unsigned long long)decodedSamples, (unsigned long long)totalSamples
+        );
+
+    if (!sizesUniform)
+        result->frameUnitSize = 0;
+
+    result->dataSizeBefore = dataChunk->chunkSize;
+    result->dataSizeAfter = packetData.elementCount;
+
+    u32 numSamples = 0, loopStart = 0, loopEnd = 0;
+    const u8* configData = NULL;
+    if (capcom) {
+        numSamples = ((OpusCapcomHeader*)opusData)->numSamples;
+        OpusCapcomGetLoop(opusData, &loopStart, &loopEnd);
+        configData = ((OpusCapcomHeader*)opusData)->configData;
+    }
+
+    return _OpusAssembleFile(
+        fileHeader->sampleRate, fileHeader->channelCount, fileHeader->preSkipSamples, result->frameUnitSize,
+        &packetData, &seekEntries, NULL, capcom, numSamples, loopStart, loopEnd, configData
+    );
+}
+
 #endif // OPUS_PROCESS_H
@@ -0,0 +1,433 @@
+#ifndef OPUS_PROFILE_H
+#define OPUS_PROFILE_H
+
+#include <stdlib.h>
+
+#include <stdio.h>
+
+#include <string.h>
+
+#include <strings.h>
+
+#include <opus/opus.h>
+
+#include "files.h"
+
+#include "list.h"
+
+#include "type.h"
+
+#include "common.h"
+
+// Encoder settings used by OpusBuildProfile and OpusBuildCapcomProfile.
+// Profiles are picked by name from the built-in table or from a profile file
+// (see OpusLoadProfiles).
+
+#define OPUS_PROFILE_NAME_MAX (32)
+
+// Default bitrate for the standard Nintendo Opus format (make_opus command).
+// Capcom Opus uses 96000 bps (240 bytes per 20ms frame).
+#define OPUS_DEFAULT_BITRATE (99000)
+
+#define OPUS_RATE_VBR (0) // Unconstrained VBR.
+#define OPUS_RATE_CVBR (1) // Constrained VBR.
+#define OPUS_RATE_CBR (2) // Hard CBR; every packet has the same size.
+
+static const char* OpusRateModeNames[] = { "vbr", "cvbr", "cbr" };
+
+typedef struct {
+    char name[OPUS_PROFILE_NAME_MAX];
+
+    int bitRate; // Bits per second, or OPUS_AUTO.
+    int rateMode; // OPUS_RATE_*
+    int complexity; // 0-10, or OPUS_AUTO to keep the libopus default.
+    u32 frameDuration; // Tenths of a millisecond: 25, 50, 100, 200, 400, 600, 800, 1000 or 1200.
+    int application; // OPUS_APPLICATION_*
+    int bandwidth; // OPUS_BANDWIDTH_*, or OPUS_AUTO.
+    int signal; // OPUS_SIGNAL_*, or OPUS_AUTO.
+
+    // Seekable encodes: OPUS_SET_PREDICTION_DISABLED, and every entryInterval
+    // packets the encoder is reset and the packet is recorded in the seek chunk.
+    int predictionDisabled;
+    u32 entryInterval; // Packets, 0 = no entry points.
+
+    int forceMono; // OPUS_SET_FORCE_CHANNELS(1): code stereo input as mono.
+    int dtx; // OPUS_SET_DTX: send near-empty packets during silence.
+} OpusEncodeProfile;
+
+// "default" matches the settings make_opus always used, "capcom" the ones of
+// the original Capcom encoder (CELT-only, 96kbps CBR, 0xF8 frame units).
+static const OpusEncodeProfile OpusBuiltinProfiles[] = {
+    { "default", OPUS_DEFAULT_BITRATE, OPUS_RATE_VBR, OPUS_AUTO, 200, OPUS_APPLICATION_AUDIO, OPUS_AUTO, OPUS_AUTO, 0, 0, 0, 0 },
+    { "capcom", 96000, OPUS_RATE_CBR, 10, 200, OPUS_APPLICATION_RESTRICTED_LOWDELAY, OPUS_BANDWIDTH_FULLBAND, OPUS_SIGNAL_MUSIC, 0, 0, 0, 0 },
+    { "voice", 32000, OPUS_RATE_VBR, 5, 200, OPUS_APPLICATION_VOIP, OPUS_AUTO, OPUS_SIGNAL_VOICE, 0, 0, 0, 0 },
+    { "ambience", 64000, OPUS_RATE_VBR, 5, 600, OPUS_APPLICATION_AUDIO, OPUS_AUTO, OPUS_SIGNAL_MUSIC, 0, 0, 0, 0 },
+};
+#define OPUS_BUILTIN_PROFILE_COUNT (sizeof(OpusBuiltinProfiles) / sizeof(OpusBuiltinProfiles[0]))
+
+#define OPUS_DEFAULT_PROFILE (&OpusBuiltinProfiles[0])
+#define OPUS_CAPCOM_PROFILE (&OpusBuiltinProfiles[1])
+
+typedef struct {
+    const char* name;
+    int value;
+} _OpusProfileKeyword;
+
+static const _OpusProfileKeyword _OpusApplicationKeywords[] = {
+    { "audio", OPUS_APPLICATION_AUDIO },
+    { "voip", OPUS_APPLICATION_VOIP },
+    { "lowdelay", OPUS_APPLICATION_RESTRICTED_LOWDELAY },
+    { NULL, 0 }
+};
+
+static const _OpusProfileKeyword _OpusBandwidthKeywords[] = {
+    { "auto", OPUS_AUTO },
+    { "nb", OPUS_BANDWIDTH_NARROWBAND },
+    { "mb", OPUS_BANDWIDTH_MEDIUMBAND },
+    { "wb", OPUS_BANDWIDTH_WIDEBAND },
+    { "swb", OPUS_BANDWIDTH_SUPERWIDEBAND },
+    { "fb", OPUS_BANDWIDTH_FULLBAND },
+    { NULL, 0 }
+};
+
+static const _OpusProfileKeyword _OpusSignalKeywords[] = {
+    { "auto", OPUS_AUTO },
+    { "voice", OPUS_SIGNAL_VOICE },
+    { "music", OPUS_SIGNAL_MUSIC },
+    { NULL, 0 }
+};
+
+static const _OpusProfileKeyword _OpusRateModeKeywords[] = {
+    { "vbr", OPUS_RATE_VBR },
+    { "cvbr", OPUS_RATE_CVBR },
+    { "cbr", OPUS_RATE_CBR },
+    { NULL, 0 }
+};
+
+static const _OpusProfileKeyword _OpusSwitchKeywords[] = {
+    { "on", 1 },
+    { "off", 0 },
+    { NULL, 0 }
+};
+
+static const char* _OpusProfileKeywordName(const _OpusProfileKeyword* keywords, int value) {
+    for (; keywords->name != NULL; keywords++) {
+        if (keywords->value == value)
+            return keywords->name;
+    }
+    return "?";
+}
+
+// Returns 0 if value isn't one of the keywords.
+static int _OpusProfileParseKeyword(const _OpusProfileKeyword* keywords, const char* str, int* value) {
+    for (; keywords->name != NULL; keywords++) {
+        if (strcasecmp(keywords->name, str) == 0) {
+            *value = keywords->value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Samples per channel in one packet.
+u32 OpusProfileFrameSamples(const OpusEncodeProfile* profile, u32 sampleRate) {
+    return (u32)((u64)sampleRate * profile->frameDuration / 10000);
+}
+
+void OpusValidateProfile(const OpusEncodeProfile* profile) {
+    static const u32 durations[] = { 25, 50, 100, 200, 400, 600, 800, 1000, 1200 };
+
+    int durationValid = 0;
+    for (u32 i = 0; i < sizeof(durations) / sizeof(durations[0]); i++)
+        durationValid |= profile->frameDuration == durations[i];
+    if (!durationValid)
+        panic(
+            "Profile '%s': invalid frame duration (%u.%ums)\n"
+            "Allowed durations are: 2.5, 5, 10, 20, 40, 60, 80, 100 and 120",
+            profile->name, profile->frameDuration / 10, profile->frameDuration % 10
+        );
+
+    if (profile->bitRate != OPUS_AUTO && (profile->bitRate < 500 || profile->bitRate > 512000))
+        panic("Profile '%s': bitrate %d is outside 500-512000", profile->name, profile->bitRate);
+    if (profile->rateMode == OPUS_RATE_CBR && profile->bitRate == OPUS_AUTO)
+        panic("Profile '%s': CBR needs an explicit bitrate", profile->name);
+    // CBR files promise one packet size (frameUnitSize); DTX packets break it.
+    if (profile->rateMode == OPUS_RATE_CBR && profile->dtx)
+        panic("Profile '%s': DTX needs vbr or cvbr mode", profile->name);
+
+    if (profile->complexity != OPUS_AUTO && (profile->complexity < 0 || profile->complexity > 10))
+        panic("Profile '%s': complexity %d is outside 0-10", profile->name, profile->complexity);
+}
+
+// Create an encoder configured with the profile. Returns the pre-skip
+// (encoder lookahead) in preSkipSamples.
+OpusEncoder* OpusCreateProfileEncoder(
+    const OpusEncodeProfile* profile, u32 sampleRate, u32 channelCount, u32* preSkipSamples
+) {
+    OpusValidateProfile(profile);
+
+    int opusError;
+    OpusEncoder* encoder = opus_encoder_create(sampleRate, channelCount, profile->application, &opusError);
+    if (opusError < 0)
+        panic("OpusCreateProfileEncoder: opus_encoder_create failed: %s", opus_strerror(opusError));
+
+    opusError = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(profile->bitRate));
+    if (opusError < 0)
+        panic("OpusCreateProfileEncoder: failed to set Opus bitrate to %d", profile->bitRate);
+
+    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR(profile->rateMode != OPUS_RATE_CBR));
+    if (opusError < 0)
+        panic("OpusCreateProfileEncoder: failed to set Opus VBR");
+
+    opusError = opus_encoder_ctl(encoder, OPUS_SET_VBR_CONSTRAINT(profile->rateMode != OPUS_RATE_VBR));
+    if (opusError < 0)
+        panic("OpusCreateProfileEncoder: failed to set Opus VBR constraint");
+
+    if (profile->complexity != OPUS_AUTO) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(profile->complexity));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to set Opus complexity");
+    }
+
+    if (profile->signal != OPUS_AUTO) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(profile->signal));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to set Opus signal type");
+    }
+
+    if (profile->bandwidth != OPUS_AUTO) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_BANDWIDTH(profile->bandwidth));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to set Opus bandwidth");
+    }
+
+    if (profile->predictionDisabled) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_PREDICTION_DISABLED(1));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to disable Opus prediction");
+    }
+
+    if (profile->forceMono && channelCount == 2) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_FORCE_CHANNELS(1));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to force Opus mono coding");
+    }
+
+    if (profile->dtx) {
+        opusError = opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+        if (opusError < 0)
+            panic("OpusCreateProfileEncoder: failed to enable Opus DTX");
+    }
+
+    int lookahead;
+    opusError = opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+    if (opusError < 0)
+        panic("OpusCreateProfileEncoder: failed to get pre-skip sample count");
+    *preSkipSamples = (u32)lookahead;
+
+    return encoder;
+}
+
+// Look the profile up in profiles (may be NULL) first, then in the built-in
+// table. Returns NULL if there is no profile with that name.
+const OpusEncodeProfile* OpusFindProfile(ListData* profiles, const char* name) {
+    if (profiles != NULL) {
+        for (u64 i = 0; i < profiles->elementCount; i++) {
+            const OpusEncodeProfile* profile = (const OpusEncodeProfile*)ListGet(profiles, i);
+            if (strcasecmp(profile->name, name) == 0)
+                return profile;
+        }
+    }
+
+    for (u32 i = 0; i < OPUS_BUILTIN_PROFILE_COUNT; i++) {
+        if (strcasecmp(OpusBuiltinProfiles[i].name, name) == 0)
+            return &OpusBuiltinProfiles[i];
+    }
+
+    return NULL;
+}
+
+static char* _OpusProfileTrim(char* str) {
+    while (*str == ' ' || *str == '\t')
+        str++;
+
+    char* end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        end--;
+    *end = '\0';
+
+    return str;
+}
+
+// Load the profiles of an INI-style profile file into profiles (initialized
+// here, elements are OpusEncodeProfile):
+//
+//   # comment
+//   [voice_lq]
+//   base = voice            ; start from another profile (first key only)
+//   bitrate = 24000         ; or auto
+//   mode = vbr              ; vbr, cvbr or cbr
+//   complexity = 4          ; 0-10 or auto
+//   frame_duration = 40     ; milliseconds: 2.5, 5, 10, 20, 40, 60, 80, 100, 120
+//   application = voip      ; audio, voip or lowdelay
+//   bandwidth = wb          ; auto, nb, mb, wb, swb or fb
+//   signal = voice          ; auto, voice or music
+//   prediction = off        ; on or off (off makes packets nearly independent)
+//   entry_interval = 50     ; packets between seek entry points, 0 = none
+//   force_mono = on         ; on or off (code stereo input as mono)
+//   dtx = on                ; on or off (discontinuous transmission in silence)
+//
+// Sections without a base start from the "default" profile. Errors panic
+// with the line number.
+void OpusLoadProfiles(const char* path, ListData* profiles) {
+    ListInit(profiles, sizeof(OpusEncodeProfile), 8);
+
+    MemoryFile mfProfiles = MemoryFileCreate(path);
+
+    // Copy into a NUL-terminated buffer for the line parser.
+    char* text = (char*)malloc(mfProfiles.size + 1);
+    if (text == NULL)
+        panic("OpusLoadProfiles: malloc fail");
+    memcpy(text, mfProfiles.data_void, mfProfiles.size);
+    text[mfProfiles.size] = '\0';
+
+    MemoryFileDestroy(&mfProfiles);
+
+    OpusEncodeProfile* profile = NULL;
+    int keyCount = 0;
+
+    u32 lineNumber = 0;
+    char* next = text;
+    while (next != NULL) {
+        char* line = next;
+        next = strchr(line, '\n');
+        if (next != NULL)
+            *next++ = '\0';
+        lineNumber++;
+
+        char* comment = strpbrk(line, "#;");
+        if (comment != NULL)
+            *comment = '\0';
+        line = _OpusProfileTrim(line);
+        if (*line == '\0')
+            continue;
+
+        if (*line == '[') {
+            char* end = strchr(line, ']');
+            if (end == NULL || end == line + 1 || end - line - 1 >= OPUS_PROFILE_NAME_MAX)
+                panic("%s:%u: invalid profile section '%s'", path, lineNumber, line);
+            *end = '\0';
+
+            OpusEncodeProfile newProfile = *OPUS_DEFAULT_PROFILE;
+            strcpy(newProfile.name, line + 1);
+
+            ListAdd(profiles, &newProfile);
+            profile = (OpusEncodeProfile*)ListGet(profiles, profiles->elementCount - 1);
+            keyCount = 0;
+            continue;
+        }
+
+        char* equals = strchr(line, '=');
+        if (equals == NULL)
+            panic("%s:%u: expected 'key = value'", path, lineNumber);
+        if (profile == NULL)
+            panic("%s:%u: key outside of a [profile] section", path, lineNumber);
+
+        *equals = '\0';
+        char* key = _OpusProfileTrim(line);
+        char* value = _OpusProfileTrim(equals + 1);
+
+        int valid = 1;
+        if (strcasecmp(key, "base") == 0) {
+            // Look in the profiles before this one, then the built-ins.
+            profiles->elementCount--;
+            const OpusEncodeProfile* base = OpusFindProfile(profiles, value);
+            profiles->elementCount++;
+
+            if (base == NULL)
+                panic("%s:%u: unknown base profile '%s'", path, lineNumber, value);
+            if (keyCount != 0)
+                panic("%s:%u: 'base' must be the first key of a profile", path, lineNumber);
+
+            char name[OPUS_PROFILE_NAME_MAX];
+            strcpy(name, profile->name);
+            *profile = *base;
+            strcpy(profile->name, name);
+        }
+        else if (strcasecmp(key, "bitrate") == 0) {
+            if (strcasecmp(value, "auto") == 0)
+                profile->bitRate = OPUS_AUTO;
+            else
+                profile->bitRate = atoi(value);
+        }
+        else if (strcasecmp(key, "mode") == 0)
+            valid = _OpusProfileParseKeyword(_OpusRateModeKeywords, value, &profile->rateMode);
+        else if (strcasecmp(key, "complexity") == 0) {
+            if (strcasecmp(value, "auto") == 0)
+                profile->complexity = OPUS_AUTO;
+            else
+                profile->complexity = atoi(value);
+        }
+        else if (strcasecmp(key, "frame_duration") == 0)
+            profile->frameDuration = (u32)(atof(value) * 10.0 + 0.5);
+        else if (strcasecmp(key, "application") == 0)
+            valid = _OpusProfileParseKeyword(_OpusApplicationKeywords, value, &profile->application);
+        else if (strcasecmp(key, "bandwidth") == 0)
+            valid = _OpusProfileParseKeyword(_OpusBandwidthKeywords, value, &profile->bandwidth);
+        else if (strcasecmp(key, "signal") == 0)
+            valid = _OpusProfileParseKeyword(_OpusSignalKeywords, value, &profile->signal);
+        else if (strcasecmp(key, "prediction") == 0) {
+            int enabled = 1;
+            valid = _OpusProfileParseKeyword(_OpusSwitchKeywords, value, &enabled);
+            profile->predictionDisabled = !enabled;
+        }
+        else if (strcasecmp(key, "entry_interval") == 0)
+            profile->entryInterval = (u32)strtoul(value, NULL, 10);
+        else if (strcasecmp(key, "force_mono") == 0)
+            valid = _OpusProfileParseKeyword(_OpusSwitchKeywords, value, &profile->forceMono);
+        else if (strcasecmp(key, "dtx") == 0)
+            valid = _OpusProfileParseKeyword(_OpusSwitchKeywords, value, &profile->dtx);
+        else
+            panic("%s:%u: unknown key '%s'", path, lineNumber, key);
+
+        if (!valid)
+            panic("%s:%u: invalid %s '%s'", path, lineNumber, key, value);
+
+        keyCount++;
+    }
+
+    free(text);
+
+    for (u64 i = 0; i < profiles->elementCount; i++)
+        OpusValidateProfile((OpusEncodeProfile*)ListGet(profiles, i));
+}
+
+void OpusPrintProfile(FILE* fp, const OpusEncodeProfile* profile) {
+    fprintf(fp, "%s: ", profile->name);
+    if (profile->bitRate == OPUS_AUTO)
+        fprintf(fp, "auto bitrate");
+    else
+        fprintf(fp, "%dbps", profile->bitRate);
+    fprintf(
+        fp, " %s, %u.%ums frames, application %s, bandwidth %s, signal %s",
+        OpusRateModeNames[profile->rateMode], profile->frameDuration / 10, profile->frameDuration % 10,
+        _OpusProfileKeywordName(_OpusApplicationKeywords, profile->application),
+        _OpusProfileKeywordName(_OpusBandwidthKeywords, profile->bandwidth),
+        _OpusProfileKeywordName(_OpusSignalKeywords, profile->signal)
+    );
+    if (profile->complexity == OPUS_AUTO)
+        fprintf(fp, ", default complexity");
+    else
+        fprintf(fp, ", complexity %d", profile->complexity);
+    if (profile->predictionDisabled)
+        fprintf(fp, ", no prediction");
+    if (profile->entryInterval != 0)
+        fprintf(fp, ", entry point every %u packets", profile->entryInterval);
+    if (profile->forceMono)
+        fprintf(fp, ", mono coding");
+    if (profile->dtx)
+        fprintf(fp, ", DTX");
+    fprintf(fp, "\n");
+}
+
+#endif // OPUS_PROFILE_H
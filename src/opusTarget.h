@@ -0,0 +1,288 @@
+#ifndef OPUS_TARGET_H
+#define OPUS_TARGET_H
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <math.h>
+
+#include "files.h"
+
+#include "list.h"
+
+#include "type.h"
+
+#include "common.h"
+
+#include "jobs.h"
+
+#include "opusProcess.h"
+
+#include "pcmProcess.h"
+
+// Size- or quality-targeted encoding: the bitrate of the profile is searched
+// for by encoding trial candidates in parallel and narrowing the range around
+// the target. All trials share the same input samples.
+
+#define OPUS_TARGET_SIZE (0) // Largest file not exceeding target bytes.
+#define OPUS_TARGET_SNR (1) // Smallest file reaching target dB of SNR.
+
+#define OPUS_TARGET_BITRATE_MIN (6000)
+#define OPUS_TARGET_BITRATE_MAX (510000)
+
+// Stop once the range is narrower than this ratio (hi / lo).
+#define OPUS_TARGET_TOLERANCE (1.02)
+#define OPUS_TARGET_MAX_ROUNDS (16)
+
+typedef struct {
+    s16* samples;
+    u32 sampleCount;
+    u32 sampleRate;
+    u32 channelCount;
+
+    OpusEncodeProfile profile; // bitRate is overridden by the search.
+
+    int capcom; // Build a Capcom file instead of a Nintendo one.
+    u32 loopStart;
+    u32 loopEnd;
+} OpusEncodeInput;
+
+typedef struct {
+    int bitRate;
+    u64 size;
+    double snr; // Only measured for OPUS_TARGET_SNR.
+
+    int reached; // 0 if no bitrate reached the target; the closest one was used.
+
+    u32 trialCount;
+    u32 roundCount;
+} OpusTargetResult;
+
+MemoryFile OpusBuildInput(const OpusEncodeInput* input, int bitRate) {
+    OpusEncodeProfile profile = input->profile;
+    profile.bitRate = bitRate;
+
+    if (input->capcom) {
+        return OpusBuildCapcomProfile(
+            input->samples, input->sampleCount, input->sampleRate, input->channelCount,
+            input->loopStart, input->loopEnd, NULL, &profile
+        );
+    }
+    return OpusBuildProfile(input->samples, input->sampleCount, input->sampleRate, input->channelCount, &profile);
+}
+
+// Decode a freshly built file (pre-skip dropped, trimmed to its stored
+// length) and measure it against the samples it was encoded from.
+void OpusMeasureInput(const OpusEncodeInput* input, const MemoryFile* file, PcmQuality* quality) {
+    OpusVariantMetadata metadata;
+    ListData decoded = OpusDecodeFile(file->data_u8, file->size, 0, &metadata);
+
+    // Nintendo files also hold the padding of the last packet.
+    u64 count = MIN((u64)input->sampleCount, decoded.elementCount) / input->channelCount;
+    PcmMeasureQuality(input->samples, (s16*)decoded.data, count, input->channelCount, input->sampleRate, quality);
+
+    ListDestroy(&decoded);
+}
+
+typedef struct {
+    int bitRate;
+    MemoryFile file;
+    double snr;
+} _OpusTargetTrial;
+
+typedef struct {
+    const OpusEncodeInput* input;
+    int targetKind;
+    _OpusTargetTrial* trials;
+} _OpusTargetJobs;
+
+static void _OpusTargetJob(void* userData, u64 jobIndex) {
+    _OpusTargetJobs* jobs = (_OpusTargetJobs*)userData;
+    _OpusTargetTrial* trial = jobs->trials + jobIndex;
+
+    trial->file = OpusBuildInput(jobs->input, trial->bitRate);
+    trial->snr = 0.0;
+
+    if (jobs->targetKind == OPUS_TARGET_SNR) {
+        ListData decoded = OpusDecode((u8*)OpusGetFileHeader(trial->file.data_u8, trial->file.size));
+
+        // The decode covers the input plus the padding of the last packet.
+        u64 count = MIN((u64)jobs->input->sampleCount, decoded.elementCount);
+        trial->snr = PcmComputeSnr(jobs->input->samples, (s16*)decoded.data, count);
+
+        ListDestroy(&decoded);
+    }
+}
+
+static int _OpusTargetMet(int targetKind, double target, const _OpusTargetTrial* trial) {
+    if (targetKind == OPUS_TARGET_SIZE)
+        return (double)trial->file.size <= target;
+    return trial->snr >= target;
+}
+
+// Search the bitrate for target (bytes or dB, see OPUS_TARGET_*) with
+// threadCount trial encodes per round (0 = one per CPU). Returns the winning
+// encode; result describes it.
+MemoryFile OpusBuildTargeted(
+    const OpusEncodeInput* input, int targetKind, double target, u32 threadCount, OpusTargetResult* result
+) {
+    if (threadCount == 0)
+        threadCount = JobsGetCpuCount();
+    // At least the two range ends plus one point in between.
+    u32 candidateCount = MAX(threadCount, 3u);
+
+    memset(result, 0, sizeof(OpusTargetResult));
+
+    _OpusTargetTrial* trials = (_OpusTargetTrial*)malloc(sizeof(_OpusTargetTrial) * candidateCount);
+    if (trials == NULL)
+        panic("OpusBuildTargeted: malloc fail");
+
+    _OpusTargetJobs jobs = { input, targetKind, trials };
+
+    // Best trial so far; the one meeting the target closest, or the one
+    // nearest to it if none met it yet.
+    _OpusTargetTrial best = { 0 };
+    int bestMet = 0;
+
+    double lo = OPUS_TARGET_BITRATE_MIN;
+    double hi = OPUS_TARGET_BITRATE_MAX;
+
+    for (u32 round = 0; round < OPUS_TARGET_MAX_ROUNDS && hi / lo > OPUS_TARGET_TOLERANCE; round++) {
+        // Candidates are spread geometrically; the first round includes both
+        // ends so an unreachable target is detected.
+        for (u32 i = 0; i < candidateCount; i++) {
+            double t = round == 0 ?
+                (double)i / (candidateCount - 1) :
+                (double)(i + 1) / (candidateCount + 1);
+            trials[i].bitRate = (int)(lo * pow(hi / lo, t) + 0.5);
+        }
+
+        JobsRun(candidateCount, threadCount, _OpusTargetJob, &jobs);
+
+        result->trialCount += candidateCount;
+        result->roundCount++;
+
+        // Size and SNR both grow with the bitrate, so the candidates that meet
+        // a size target come first and the ones that meet an SNR target last.
+        int boundary = -1; // Last index on the low side of the target.
+        for (u32 i = 0; i < candidateCount; i++) {
+            int met = _OpusTargetMet(targetKind, target, trials + i);
+            if ((targetKind == OPUS_TARGET_SIZE) == met)
+                boundary = (int)i;
+        }
+
+        int winner = targetKind == OPUS_TARGET_SIZE ? boundary : boundary + 1;
+        int newLo = boundary >= 0 ? trials[boundary].bitRate : (int)lo;
+        int newHi = boundary + 1 < (int)candidateCount ? trials[boundary + 1].bitRate : (int)hi;
+
+        int winnerValid = winner >= 0 && winner < (int)candidateCount;
+        if (winnerValid && _OpusTargetMet(targetKind, target, trials + winner)) {
+            if (bestMet)
+                MemoryFileDestroy(&best.file);
+            best = trials[winner];
+            bestMet = 1;
+        }
+        else if (!bestMet && round == 0) {
+            // Nothing reaches the target; keep the closest end (smallest file
+            // for size, highest bitrate for SNR).
+            winner = targetKind == OPUS_TARGET_SIZE ? 0 : (int)candidateCount - 1;
+            best = trials[winner];
+        }
+        else
+            winner = -1;
+
+        for (u32 i = 0; i < candidateCount; i++) {
+            if ((int)i != winner)
+                MemoryFileDestroy(&trials[i].file);
+        }
+
+        if (!bestMet)
+            break;
+
+        lo = newLo;
+        hi = newHi;
+    }
+
+    free(trials);
+
+    result->bitRate = best.bitRate;
+    result->size = best.file.size;
+    result->snr = best.snr;
+    result->reached = bestMet;
+
+    return best.file;
+}
+
+// Content-adaptive settings: narrow the profile to what PcmAnalyze found in
+// the input. The bitrate only scales when the profile sets one.
+
+// Opus audio bandwidths and the share of the fullband bitrate they are given.
+static const struct {
+    int bandwidth;
+    u32 cutoff; // Hz
+    double bitRateScale;
+} _OpusAdaptBands[] = {
+    { OPUS_BANDWIDTH_NARROWBAND, 4000, 0.25 },
+    { OPUS_BANDWIDTH_MEDIUMBAND, 6000, 0.3 },
+    { OPUS_BANDWIDTH_WIDEBAND, 8000, 0.4 },
+    { OPUS_BANDWIDTH_SUPERWIDEBAND, 12000, 0.65 },
+};
+
+#define OPUS_ADAPT_MONO_SCALE (0.6) // Bitrate share of a dual-mono input coded as mono.
+#define OPUS_ADAPT_DTX_SHARE (0.1) // Silent share of the input from which DTX is enabled.
+
+// Adapt profile to analysis; the decisions are written to fp (one line) if
+// it isn't NULL.
+void OpusAdaptProfile(const PcmAnalysis* analysis, u32 channelCount, OpusEncodeProfile* profile, FILE* fp) {
+    double bitRateScale = 1.0;
+    int changed = 0;
+
+    if (channelCount == 2 && analysis->dualMono && !profile->forceMono) {
+        profile->forceMono = 1;
+        bitRateScale *= OPUS_ADAPT_MONO_SCALE;
+
+        if (fp)
+            fprintf(fp, "%sdual-mono -> mono coding", changed++ ? ", " : "");
+    }
+
+    if (analysis->bandwidth != 0) {
+        u32 bandCount = sizeof(_OpusAdaptBands) / sizeof(_OpusAdaptBands[0]);
+        for (u32 i = 0; i < bandCount; i++) {
+            int narrower = profile->bandwidth == OPUS_AUTO || _OpusAdaptBands[i].bandwidth < profile->bandwidth;
+            if (analysis->bandwidth > _OpusAdaptBands[i].cutoff || !narrower)
+                continue;
+
+            profile->bandwidth = _OpusAdaptBands[i].bandwidth;
+            bitRateScale *= _OpusAdaptBands[i].bitRateScale;
+
+            if (fp) {
+                fprintf(
+                    fp, "%s%uHz bandwidth -> %s", changed++ ? ", " : "",
+                    analysis->bandwidth, _OpusProfileKeywordName(_OpusBandwidthKeywords, profile->bandwidth)
+                );
+            }
+            break;
+        }
+    }
+
+    if (bitRateScale != 1.0 && profile->bitRate != OPUS_AUTO) {
+        int bitRate = MAX((int)(profile->bitRate * bitRateScale), OPUS_TARGET_BITRATE_MIN);
+        if (fp)
+            fprintf(fp, "%sbitrate %d -> %dbps", changed++ ? ", " : "", profile->bitRate, bitRate);
+        profile->bitRate = bitRate;
+    }
+
+    // DTX packets would break the fixed packet size of CBR.
+    double silentShare = analysis->sampleCount != 0 ? (double)analysis->silentSamples / analysis->sampleCount : 0.0;
+    if (silentShare >= OPUS_ADAPT_DTX_SHARE && profile->rateMode != OPUS_RATE_CBR && !profile->dtx) {
+        profile->dtx = 1;
+        if (fp)
+            fprintf(fp, "%s%.0f%% silent -> DTX", changed++ ? ", " : "", silentShare * 100.0);
+    }
+
+    if (fp)
+        fprintf(fp, "%s\n", changed ? "" : "no changes");
+}
+
+#endif // OPUS_TARGET_H
@@ -0,0 +1,1576 @@
+#ifndef PCM_PROCESS_H
+#define PCM_PROCESS_H
+
+#include <stdlib.h>
+
+#include <stdio.h>
+
+#include <string.h>
+
+#include <math.h>
+
+#include "list.h"
+
+#include "type.h"
+
+#include "common.h"
+
+// Interleaved s16 PCM helpers: comparisons between a reference signal and a
+// processed one (e.g. the decoded result of an encode).
+
+// Returned instead of an infinite SNR when both signals are identical.
+#define PCM_SNR_IDENTICAL (200.0)
+
+// Running comparison of a test signal against a reference, fed block by
+// block so long signals never have to be held in memory.
+typedef struct {
+    u64 sampleCount; // Interleaved samples compared.
+    u64 differingCount;
+    u64 firstDifference; // Interleaved index of the first differing sample, if any.
+    u32 maxDifference;
+
+    double signalEnergy;
+    double noiseEnergy;
+} PcmDifference;
+
+void PcmDifferenceAdd(PcmDifference* difference, const s16* reference, const s16* test, u64 count) {
+    double signalEnergy = 0.0;
+    double noiseEnergy = 0.0;
+
+    for (u64 i = 0; i < count; i++) {
+        s32 error = (s32)reference[i] - (s32)test[i];
+
+        signalEnergy += (double)reference[i] * reference[i];
+        noiseEnergy += (double)error * error;
+
+        if (error != 0) {
+            u32 magnitude = (u32)(error < 0 ? -error : error);
+            if (difference->differingCount++ == 0)
+                difference->firstDifference = difference->sampleCount + i;
+            difference->maxDifference = MAX(difference->maxDifference, magnitude);
+        }
+    }
+
+    difference->sampleCount += count;
+    difference->signalEnergy += signalEnergy;
+    difference->noiseEnergy += noiseEnergy;
+}
+
+// Signal-to-noise ratio in dB of everything added so far.
+double PcmDifferenceSnr(const PcmDifference* difference) {
+    if (difference->noiseEnergy == 0.0)
+        return PCM_SNR_IDENTICAL;
+    if (difference->signalEnergy == 0.0)
+        return -PCM_SNR_IDENTICAL;
+
+    return 10.0 * log10(difference->signalEnergy / difference->noiseEnergy);
+}
+
+// Signal-to-noise ratio in dB of test against reference over count
+// interleaved samples.
+double PcmComputeSnr(const s16* reference, const s16* test, u64 count) {
+    PcmDifference difference = { 0 };
+    PcmDifferenceAdd(&difference, reference, test, count);
+    return PcmDifferenceSnr(&difference);
+}
+
+// Objective quality of a decoded signal against its source.
+
+#define PCM_SEGMENT_MS (20)
+// Per-segment SNRs are clamped to this range before averaging, as usual for
+// segmental SNR, so a single perfect or ruined segment doesn't dominate.
+#define PCM_SEGMENT_SNR_MIN (-10.0)
+#define PCM_SEGMENT_SNR_MAX (35.0)
+
+// Segments and spectrum frames whose reference mean square is below this
+// (about -60 dBFS) are left out of the per-segment averages.
+#define PCM_SILENCE_ENERGY (1073.0)
+
+#define PCM_SPECTRUM_SIZE (1024) // Frame length of the spectral distance, per channel.
+#define PCM_SPECTRUM_FLOOR (1.0) // Added to every bin power so empty bins stay finite.
+
+typedef struct {
+    u64 sampleCount; // Per channel.
+
+    double snr;
+    double segmentalSnr; // Mean of the clamped per-segment SNRs, silent segments excluded.
+    u32 peakError; // Largest absolute sample difference.
+    double spectralDistance; // Mean log-spectral distance in dB, silent frames excluded.
+} PcmQuality;
+
+// In-place radix-2 FFT of size points; cosTable/sinTable hold the size / 2 twiddles.
+static void _PcmFft(double* re, double* im, u32 size, const double* cosTable, const double* sinTable) {
+    for (u32 i = 1, j = 0; i < size; i++) {
+        u32 bit = size >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    for (u32 length = 2; length <= size; length <<= 1) {
+        u32 half = length >> 1;
+        u32 step = size / length;
+        for (u32 start = 0; start < size; start += length) {
+            for (u32 k = 0; k < half; k++) {
+                double wr = cosTable[k * step];
+                double wi = -sinTable[k * step];
+
+                u32 a = start + k;
+                u32 b = a + half;
+
+                double tr = re[b] * wr - im[b] * wi;
+                double ti = re[b] * wi + im[b] * wr;
+
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+// Mean log-spectral distance of test against reference over non-overlapping
+// Hann-windowed frames of each channel. Both frames go through one complex
+// FFT (reference real, test imaginary) and are separated afterwards.
+static double _PcmSpectralDistance(const s16* reference, const s16* test, u64 sampleCount, u32 channelCount) {
+    const u32 size = PCM_SPECTRUM_SIZE;
+
+    double* buffers = (double*)malloc(sizeof(double) * size * 5);
+    if (buffers == NULL)
+        panic("PcmMeasureQuality: malloc fail");
+
+    double* re = buffers;
+    double* im = buffers + size;
+    double* window = buffers + size * 2;
+    double* cosTable = buffers + size * 3;
+    double* sinTable = buffers + size * 4;
+
+    for (u32 i = 0; i < size; i++)
+        window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / size);
+    for (u32 i = 0; i < size / 2; i++) {
+        cosTable[i] = cos(2.0 * M_PI * i / size);
+        sinTable[i] = sin(2.0 * M_PI * i / size);
+    }
+
+    double distanceSum = 0.0;
+    u64 frameCount = 0;
+
+    for (u32 channel = 0; channel < channelCount; channel++) {
+        for (u64 start = 0; start + size <= sampleCount; start += size) {
+            const s16* r = reference + start * channelCount + channel;
+            const s16* t = test + start * channelCount + channel;
+
+            double energy = 0.0;
+            for (u32 i = 0; i < size; i++) {
+                double value = r[(u64)i * channelCount];
+                energy += value * value;
+                re[i] = value * window[i];
+                im[i] = t[(u64)i * channelCount] * window[i];
+            }
+            if (energy / size < PCM_SILENCE_ENERGY)
+                continue;
+
+            _PcmFft(re, im, size, cosTable, sinTable);
+
+            // X[k] = (Z[k] + conj(Z[N-k])) / 2, Y[k] = (Z[k] - conj(Z[N-k])) / 2i; DC is skipped.
+            double squareSum = 0.0;
+            for (u32 k = 1; k <= size / 2; k++) {
+                double zr = re[k], zi = im[k];
+                double nr = re[size - k], ni = -im[size - k];
+
+                double xr = (zr + nr) * 0.5, xi = (zi + ni) * 0.5;
+                double yr = (zi - ni) * 0.5, yi = (nr - zr) * 0.5;
+
+                double delta =
+                    10.0 * log10(xr * xr + xi * xi + PCM_SPECTRUM_FLOOR) -
+                    10.0 * log10(yr * yr + yi * yi + PCM_SPECTRUM_FLOOR);
+                squareSum += delta * delta;
+            }
+
+            distanceSum += sqrt(squareSum / (size / 2));
+            frameCount++;
+        }
+    }
+
+    free(buffers);
+    return frameCount != 0 ? distanceSum / frameCount : 0.0;
+}
+
+// Measure test against reference, sampleCount samples per channel each. The
+// per-segment loops work on plain integer arrays so the compiler vectorizes them.
+void PcmMeasureQuality(
+    const s16* reference, const s16* test, u64 sampleCount, u32 channelCount, u32 sampleRate, PcmQuality* quality
+) {
+    memset(quality, 0, sizeof(PcmQuality));
+    quality->sampleCount = sampleCount;
+
+    u64 segmentSize = MAX((u64)sampleRate * PCM_SEGMENT_MS / 1000, (u64)1) * channelCount;
+    u64 totalCount = sampleCount * channelCount;
+
+    double signalEnergy = 0.0;
+    double noiseEnergy = 0.0;
+    double segmentSnrSum = 0.0;
+    u64 segmentCount = 0;
+    u32 peakError = 0;
+
+    for (u64 start = 0; start < totalCount; start += segmentSize) {
+        u64 count = MIN(segmentSize, totalCount - start);
+        const s16* r = reference + start;
+        const s16* t = test + start;
+
+        // 20ms of squared s16 fits easily in 64 bits.
+        s64 segmentSignal = 0;
+        s64 segmentNoise = 0;
+        s32 segmentPeak = 0;
+        for (u64 i = 0; i < count; i++) {
+            s32 error = (s32)r[i] - (s32)t[i];
+            s32 magnitude = error < 0 ? -error : error;
+
+            segmentSignal += (s64)((s32)r[i] * (s32)r[i]);
+            segmentNoise += (s64)error * error;
+            segmentPeak = segmentPeak > magnitude ? segmentPeak : magnitude;
+        }
+
+        signalEnergy += (double)segmentSignal;
+        noiseEnergy += (double)segmentNoise;
+        peakError = MAX(peakError, (u32)segmentPeak);
+
+        if ((double)segmentSignal / count < PCM_SILENCE_ENERGY)
+            continue;
+
+        double segmentSnr = segmentNoise == 0 ?
+            PCM_SEGMENT_SNR_MAX : 10.0 * log10((double)segmentSignal / (double)segmentNoise);
+        segmentSnrSum += MIN(MAX(segmentSnr, PCM_SEGMENT_SNR_MIN), PCM_SEGMENT_SNR_MAX);
+        segmentCount++;
+    }
+
+    PcmDifference difference = { 0 };
+    difference.signalEnergy = signalEnergy;
+    difference.noiseEnergy = noiseEnergy;
+
+    quality->snr = PcmDifferenceSnr(&difference);
+    quality->segmentalSnr = segmentCount != 0 ? segmentSnrSum / segmentCount : 0.0;
+    quality->peakError = peakError;
+    quality->spectralDistance = _PcmSpectralDistance(reference, test, sampleCount, channelCount);
+}
+
+// Content analysis of a signal ahead of its encode: whether its channels
+// carry anything different, how high its spectrum reaches and how much of it
+// is silent, so the encoder settings can follow what is actually there.
+
+// Stereo whose side (L-R) energy is below this fraction of the mid (L+R)
+// energy (-60 dB) counts as dual-mono.
+#define PCM_DUAL_MONO_RATIO (1e-6)
+// The effective bandwidth is the lowest frequency above which less than this
+// fraction of the energy lies (-50 dB).
+#define PCM_BANDWIDTH_RATIO (1e-5)
+// Spectrum frames taken for the bandwidth, spread evenly over the signal.
+#define PCM_ANALYSIS_FRAMES (256)
+// Silent segments only count once they form a stretch at least this long.
+#define PCM_SILENCE_STRETCH_MS (500)
+
+typedef struct {
+    u64 sampleCount; // Per channel.
+
+    int identicalChannels; // Every channel holds exactly the same samples.
+    int dualMono; // Stereo with (nearly) identical channels.
+    double sideLevel; // Side energy relative to the mid energy in dB; stereo only.
+
+    u32 bandwidth; // Effective bandwidth in Hz, 0 if the signal is silent.
+
+    u64 silentSamples; // Per channel, in silent stretches.
+    u32 silentStretchCount;
+} PcmAnalysis;
+
+// Highest frequency holding more than PCM_BANDWIDTH_RATIO of the energy of
+// the non-silent frames, from the power spectrum of the channel average.
+static u32 _PcmEffectiveBandwidth(const s16* samples, u64 sampleCount, u32 channelCount, u32 sampleRate) {
+    const u32 size = PCM_SPECTRUM_SIZE;
+    if (sampleCount < size)
+        return sampleRate / 2;
+
+    double* buffers = (double*)malloc(sizeof(double) * (size * 5 + size / 2 + 1));
+    if (buffers == NULL)
+        panic("PcmAnalyze: malloc fail");
+
+    double* re = buffers;
+    double* im = buffers + size;
+    double* window = buffers + size * 2;
+    double* cosTable = buffers + size * 3;
+    double* sinTable = buffers + size * 4;
+    double* power = buffers + size * 5; // size / 2 + 1 bins.
+
+    for (u32 i = 0; i < size; i++)
+        window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / size);
+    for (u32 i = 0; i < size / 2; i++) {
+        cosTable[i] = cos(2.0 * M_PI * i / size);
+        sinTable[i] = sin(2.0 * M_PI * i / size);
+    }
+    memset(power, 0, sizeof(double) * (size / 2 + 1));
+
+    u64 frameCount = MIN((sampleCount / size), (u64)PCM_ANALYSIS_FRAMES);
+    u64 frameStep = (sampleCount - size) / MAX(frameCount - 1, (u64)1);
+
+    // Two frames per FFT, one in the real and one in the imaginary part.
+    double totalEnergy = 0.0;
+    for (u64 frame = 0; frame < frameCount; frame += 2) {
+        for (u32 part = 0; part < 2; part++) {
+            double* target = part == 0 ? re : im;
+            u64 start = MIN(frame + part, frameCount - 1) * frameStep;
+
+            double energy = 0.0;
+            for (u32 i = 0; i < size; i++) {
+                const s16* s = samples + (start + i) * channelCount;
+
+                s32 sum = 0;
+                for (u32 channel = 0; channel < channelCount; channel++)
+                    sum += s[channel];
+
+                double value = (double)sum / channelCount;
+                energy += value * value;
+                target[i] = value * window[i];
+            }
+
+            // Silent or duplicated frames add nothing.
+            if (energy / size < PCM_SILENCE_ENERGY || (part == 1 && frame + 1 >= frameCount))
+                memset(target, 0, sizeof(double) * size);
+        }
+
+        _PcmFft(re, im, size, cosTable, sinTable);
+
+        // |X[k]|^2 + |Y[k]|^2 = (|Z[k]|^2 + |Z[N-k]|^2) / 2; DC is skipped.
+        for (u32 k = 1; k <= size / 2; k++) {
+            double binPower = (
+                re[k] * re[k] + im[k] * im[k] +
+                re[size - k] * re[size - k] + im[size - k] * im[size - k]
+            ) * 0.5;
+            power[k] += binPower;
+            totalEnergy += binPower;
+        }
+    }
+
+    u32 bandwidth = 0;
+    if (totalEnergy > 0.0) {
+        double tailEnergy = 0.0;
+        u32 k = size / 2;
+        for (; k > 1; k--) {
+            tailEnergy += power[k];
+            if (tailEnergy > totalEnergy * PCM_BANDWIDTH_RATIO)
+                break;
+        }
+        bandwidth = (u32)((u64)k * sampleRate / size);
+    }
+
+    free(buffers);
+    return bandwidth;
+}
+
+// Analyze sampleCount samples per channel. The per-segment loops work on plain
+// integer arrays so the compiler vectorizes them.
+void PcmAnalyze(const s16* samples, u64 sampleCount, u32 channelCount, u32 sampleRate, PcmAnalysis* analysis) {
+    memset(analysis, 0, sizeof(PcmAnalysis));
+    analysis->sampleCount = sampleCount;
+
+    u64 segmentSamples = MAX((u64)sampleRate * PCM_SEGMENT_MS / 1000, (u64)1);
+    u64 stretchSamples = (u64)sampleRate * PCM_SILENCE_STRETCH_MS / 1000;
+
+    double midEnergy = 0.0;
+    double sideEnergy = 0.0;
+    int identical = channelCount > 1;
+
+    u64 silentRun = 0;
+
+    for (u64 start = 0; start < sampleCount; start += segmentSamples) {
+        u64 count = MIN(segmentSamples, sampleCount - start);
+        const s16* s = samples + start * channelCount;
+        u64 elementCount = count * channelCount;
+
+        s64 segmentEnergy = 0;
+        for (u64 i = 0; i < elementCount; i++)
+            segmentEnergy += (s64)((s32)s[i] * (s32)s[i]);
+
+        if (channelCount == 2) {
+            s64 segmentMid = 0;
+            s64 segmentSide = 0;
+            for (u64 i = 0; i < count; i++) {
+                s32 mid = (s32)s[i * 2] + (s32)s[i * 2 + 1];
+                s32 side = (s32)s[i * 2] - (s32)s[i * 2 + 1];
+                segmentMid += (s64)mid * mid;
+                segmentSide += (s64)side * side;
+            }
+            midEnergy += (double)segmentMid;
+            sideEnergy += (double)segmentSide;
+            identical = identical && segmentSide == 0;
+        }
+        else if (identical) {
+            for (u64 i = 0; i < count && identical; i++) {
+                for (u32 channel = 1; channel < channelCount; channel++)
+                    identical = identical && s[i * channelCount + channel] == s[i * channelCount];
+            }
+        }
+
+        if ((double)segmentEnergy / elementCount < PCM_SILENCE_ENERGY) {
+            silentRun += count;
+            if (start + count < sampleCount)
+                continue;
+        }
+
+        // End of a silent run (or of the signal).
+        if (silentRun >= stretchSamples && silentRun != 0) {
+            analysis->silentSamples += silentRun;
+            analysis->silentStretchCount++;
+        }
+        silentRun = 0;
+    }
+
+    analysis->identicalChannels = identical;
+    if (channelCount == 2) {
+        analysis->sideLevel = sideEnergy == 0.0 ?
+            -PCM_SNR_IDENTICAL : (midEnergy == 0.0 ? 0.0 : 10.0 * log10(sideEnergy / midEnergy));
+        analysis->dualMono = sideEnergy <= midEnergy * PCM_DUAL_MONO_RATIO;
+    }
+
+    analysis->bandwidth = _PcmEffectiveBandwidth(samples, sampleCount, channelCount, sampleRate);
+}
+
+// Head/tail trimming of digital silence.
+
+// Samples within +-PCM_TRIM_LEVEL (about -72 dBFS) count as silence, so
+// dither noise doesn't keep a silent head or tail alive.
+#define PCM_TRIM_LEVEL (8)
+// Samples per channel tested at once; only the block holding the first
+// non-silent sample is searched sample by sample.
+#define PCM_TRIM_BLOCK (256)
+
+// Whether any sample of the count interleaved samples is outside the trim
+// level. No early exit, so the loop vectorizes.
+static int _PcmBlockAudible(const s16* samples, u64 count) {
+    int audible = 0;
+    for (u64 i = 0; i < count; i++)
+        audible |= (s32)samples[i] > PCM_TRIM_LEVEL || (s32)samples[i] < -PCM_TRIM_LEVEL;
+    return audible;
+}
+
+// Find the silent head and tail of sampleCount samples per channel, in
+// samples per channel. A fully silent signal is all head.
+void PcmFindSilence(const s16* samples, u64 sampleCount, u32 channelCount, u64* headSamples, u64* tailSamples) {
+    u64 head = 0;
+    while (head < sampleCount) {
+        u64 count = MIN((u64)PCM_TRIM_BLOCK, sampleCount - head);
+        if (_PcmBlockAudible(samples + head * channelCount, count * channelCount)) {
+            while (!_PcmBlockAudible(samples + head * channelCount, channelCount))
+                head++;
+            break;
+        }
+        head += count;
+    }
+
+    u64 end = sampleCount;
+    while (end > head) {
+        u64 count = MIN((u64)PCM_TRIM_BLOCK, end - head);
+        if (_PcmBlockAudible(samples + (end - count) * channelCount, count * channelCount)) {
+            while (!_PcmBlockAudible(samples + (end - 1) * channelCount, channelCount))
+                end--;
+            break;
+        }
+        end -= count;
+    }
+
+    *headSamples = head;
+    *tailSamples = sampleCount - end;
+}
+
+// Loudness after ITU-R BS.1770 / EBU R128: integrated loudness over gated
+// 400ms blocks, loudness range over 3s short-term windows and the true peak
+// from 4x oversampling. Measurements are kept as block energies so several
+// signals (an album) can be gated together.
+
+#define PCM_LOUDNESS_SUBBLOCK_MS (100) // Block hop; blocks and windows are built from these.
+#define PCM_LOUDNESS_BLOCK_SUBBLOCKS (4) // 400ms momentary blocks, 75% overlap.
+#define PCM_LOUDNESS_SHORT_TERM_SUBBLOCKS (30) // 3s short-term windows.
+
+#define PCM_LOUDNESS_ABSOLUTE_GATE (-70.0) // LUFS
+#define PCM_LOUDNESS_RELATIVE_GATE (-10.0) // LU below the absolute-gated loudness.
+#define PCM_LOUDNESS_RANGE_GATE (-20.0) // LU, for the loudness range.
+
+// Reported for signals without a block above the absolute gate.
+#define PCM_LOUDNESS_SILENT (-70.0)
+
+#define PCM_TRUE_PEAK_PHASES (4)
+#define PCM_TRUE_PEAK_TAPS (12) // Per phase.
+
+typedef struct {
+    ListData blockEnergies; // double, mean square of every 400ms block.
+    ListData shortTermEnergies; // double, mean square of every 3s window.
+    double peak; // Largest oversampled magnitude, 1.0 = full scale.
+} PcmLoudnessMeter;
+
+typedef struct {
+    double integrated; // LUFS
+    double range; // LU
+    double truePeak; // dBTP
+} PcmLoudness;
+
+typedef struct {
+    double b0, b1, b2, a1, a2;
+} _PcmBiquad;
+
+// The two K-weighting stages (high shelf, then high pass) for sampleRate,
+// as derived for any rate from the 48kHz coefficients of BS.1770.
+static void _PcmKWeighting(u32 sampleRate, _PcmBiquad* shelf, _PcmBiquad* highPass) {
+    double k = tan(M_PI * 1681.974450955533 / sampleRate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+
+    shelf->b0 = (vh + vb * k / q + k * k) / a0;
+    shelf->b1 = 2.0 * (k * k - vh) / a0;
+    shelf->b2 = (vh - vb * k / q + k * k) / a0;
+    shelf->a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf->a2 = (1.0 - k / q + k * k) / a0;
+
+    k = tan(M_PI * 38.13547087602444 / sampleRate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+
+    highPass->b0 = 1.0;
+    highPass->b1 = -2.0;
+    highPass->b2 = 1.0;
+    highPass->a1 = 2.0 * (k * k - 1.0) / a0;
+    highPass->a2 = (1.0 - k / q + k * k) / a0;
+}
+
+// BS.1770 channel weights: the surround pair of 5.1 counts +1.5 dB and the
+// LFE not at all; everything else counts once.
+static double _PcmLoudnessWeight(u32 channel, u32 channelCount) {
+    if (channelCount == 6 && channel == 3)
+        return 0.0;
+    if (channelCount == 6 && channel >= 4)
+        return 1.41;
+    return 1.0;
+}
+
+static double _PcmLoudnessLufs(double energy) {
+    return energy > 0.0 ? -0.691 + 10.0 * log10(energy) : -HUGE_VAL;
+}
+
+// Largest magnitude of channel after 4x polyphase interpolation (windowed
+// sinc). The fixed-length tap loops vectorize.
+static double _PcmTruePeak(const s16* samples, u64 sampleCount, u32 channelCount, u32 channel) {
+    const u32 taps = PCM_TRUE_PEAK_TAPS;
+    const u32 phases = PCM_TRUE_PEAK_PHASES;
+
+    float filter[PCM_TRUE_PEAK_PHASES][PCM_TRUE_PEAK_TAPS];
+    for (u32 phase = 0; phase < phases; phase++) {
+        double sum = 0.0;
+        for (u32 k = 0; k < taps; k++) {
+            double n = (double)(k * phases + phase);
+            double x = (n - (taps * phases - 1) / 2.0) / phases;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 - 0.5 * cos(2.0 * M_PI * (n + 0.5) / (taps * phases));
+            filter[phase][k] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+        for (u32 k = 0; k < taps; k++)
+            filter[phase][k] /= (float)sum;
+    }
+
+    // Newest sample last; the history starts out silent.
+    float history[PCM_TRUE_PEAK_TAPS] = { 0 };
+
+    float peak = 0.0f;
+    for (u64 i = 0; i < sampleCount; i++) {
+        memmove(history, history + 1, sizeof(float) * (taps - 1));
+        history[taps - 1] = samples[i * channelCount + channel] / 32768.0f;
+
+        for (u32 phase = 0; phase < phases; phase++) {
+            float value = 0.0f;
+            for (u32 k = 0; k < taps; k++)
+                value += history[taps - 1 - k] * filter[phase][k];
+            peak = fmaxf(peak, fabsf(value));
+        }
+        peak = fmaxf(peak, fabsf(history[taps - 1]));
+    }
+
+    return peak;
+}
+
+// Measure sampleCount samples per channel into meter (initialized here;
+// free with PcmLoudnessMeterDestroy).
+void PcmLoudnessMeasure(const s16* samples, u64 sampleCount, u32 channelCount, u32 sampleRate, PcmLoudnessMeter* meter) {
+    u64 subblockSamples = MAX((u64)sampleRate * PCM_LOUDNESS_SUBBLOCK_MS / 1000, (u64)1);
+    u64 subblockCount = sampleCount / subblockSamples;
+
+    double* subblockEnergies = (double*)calloc(MAX(subblockCount, (u64)1), sizeof(double));
+    if (subblockEnergies == NULL)
+        panic("PcmLoudnessMeasure: calloc fail");
+
+    _PcmBiquad shelf, highPass;
+    _PcmKWeighting(sampleRate, &shelf, &highPass);
+
+    meter->peak = 0.0;
+
+    // K-weighted energy of every 100ms subblock, summed over the weighted channels.
+    for (u32 channel = 0; channel < channelCount; channel++) {
+        double weight = _PcmLoudnessWeight(channel, channelCount);
+        if (weight != 0.0) {
+            double s1 = 0.0, s2 = 0.0; // Shelf state (transposed direct form II).
+            double h1 = 0.0, h2 = 0.0; // High pass state.
+
+            for (u64 subblock = 0; subblock < subblockCount; subblock++) {
+                const s16* s = samples + subblock * subblockSamples * channelCount + channel;
+
+                double energy = 0.0;
+                for (u64 i = 0; i < subblockSamples; i++) {
+                    double x = s[i * channelCount] / 32768.0;
+
+                    double y = shelf.b0 * x + s1;
+                    s1 = shelf.b1 * x - shelf.a1 * y + s2;
+                    s2 = shelf.b2 * x - shelf.a2 * y;
+
+                    double z = highPass.b0 * y + h1;
+                    h1 = highPass.b1 * y - highPass.a1 * z + h2;
+                    h2 = highPass.b2 * y - highPass.a2 * z;
+
+                    energy += z * z;
+                }
+                subblockEnergies[subblock] += energy * weight;
+            }
+        }
+
+        meter->peak = MAX(meter->peak, _PcmTruePeak(samples, sampleCount, channelCount, channel));
+    }
+
+    ListInit(&meter->blockEnergies, sizeof(double), MAX(subblockCount, (u64)1));
+    ListInit(&meter->shortTermEnergies, sizeof(double), MAX(subblockCount, (u64)1));
+
+    // Running sums over the subblocks of each block and window.
+    double blockSum = 0.0, shortTermSum = 0.0;
+    for (u64 subblock = 0; subblock < subblockCount; subblock++) {
+        blockSum += subblockEnergies[subblock];
+        shortTermSum += subblockEnergies[subblock];
+        if (subblock >= PCM_LOUDNESS_BLOCK_SUBBLOCKS)
+            blockSum -= subblockEnergies[subblock - PCM_LOUDNESS_BLOCK_SUBBLOCKS];
+        if (subblock >= PCM_LOUDNESS_SHORT_TERM_SUBBLOCKS)
+            shortTermSum -= subblockEnergies[subblock - PCM_LOUDNESS_SHORT_TERM_SUBBLOCKS];
+
+        if (subblock + 1 >= PCM_LOUDNESS_BLOCK_SUBBLOCKS) {
+            double energy = MAX(blockSum, 0.0) / (subblockSamples * PCM_LOUDNESS_BLOCK_SUBBLOCKS);
+            ListAdd(&meter->blockEnergies, &energy);
+        }
+        if (subblock + 1 >= PCM_LOUDNESS_SHORT_TERM_SUBBLOCKS) {
+            double energy = MAX(shortTermSum, 0.0) / (subblockSamples * PCM_LOUDNESS_SHORT_TERM_SUBBLOCKS);
+            ListAdd(&meter->shortTermEnergies, &energy);
+        }
+    }
+
+    free(subblockEnergies);
+}
+
+void PcmLoudnessMeterDestroy(PcmLoudnessMeter* meter) {
+    ListDestroy(&meter->blockEnergies);
+    ListDestroy(&meter->shortTermEnergies);
+}
+
+static int _PcmCompareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Gate the blocks of meterCount meters together: one meter gives the figures
+// of its signal, several the ones of the whole album.
+void PcmLoudnessResult(const PcmLoudnessMeter* meters, u32 meterCount, PcmLoudness* loudness) {
+    double absoluteSum = 0.0, peak = 0.0;
+    u64 absoluteCount = 0;
+
+    for (u32 i = 0; i < meterCount; i++) {
+        const double* energies = (const double*)meters[i].blockEnergies.data;
+        for (u64 j = 0; j < meters[i].blockEnergies.elementCount; j++) {
+            if (_PcmLoudnessLufs(energies[j]) > PCM_LOUDNESS_ABSOLUTE_GATE) {
+                absoluteSum += energies[j];
+                absoluteCount++;
+            }
+        }
+        peak = MAX(peak, meters[i].peak);
+    }
+
+    loudness->truePeak = peak > 0.0 ? 20.0 * log10(peak) : -HUGE_VAL;
+    loudness->integrated = PCM_LOUDNESS_SILENT;
+    loudness->range = 0.0;
+
+    if (absoluteCount == 0)
+        return;
+
+    double relativeGate = _PcmLoudnessLufs(absoluteSum / absoluteCount) + PCM_LOUDNESS_RELATIVE_GATE;
+
+    double relativeSum = 0.0;
+    u64 relativeCount = 0;
+    for (u32 i = 0; i < meterCount; i++) {
+        const double* energies = (const double*)meters[i].blockEnergies.data;
+        for (u64 j = 0; j < meters[i].blockEnergies.elementCount; j++) {
+            if (_PcmLoudnessLufs(energies[j]) > relativeGate) {
+                relativeSum += energies[j];
+                relativeCount++;
+            }
+        }
+    }
+    loudness->integrated = _PcmLoudnessLufs(relativeSum / relativeCount);
+
+    // Loudness range (EBU Tech 3342): 10th to 95th percentile of the gated
+    // short-term loudness.
+    ListData gated;
+    ListInit(&gated, sizeof(double), 1);
+
+    double shortTermSum = 0.0;
+    for (u32 i = 0; i < meterCount; i++) {
+        const double* energies = (const double*)meters[i].shortTermEnergies.data;
+        for (u64 j = 0; j < meters[i].shortTermEnergies.elementCount; j++) {
+            double lufs = _PcmLoudnessLufs(energies[j]);
+            if (lufs > PCM_LOUDNESS_ABSOLUTE_GATE) {
+                ListAdd(&gated, &lufs);
+                shortTermSum += energies[j];
+            }
+        }
+    }
+
+    if (gated.elementCount != 0) {
+        double rangeGate = _PcmLoudnessLufs(shortTermSum / gated.elementCount) + PCM_LOUDNESS_RANGE_GATE;
+
+        double* values = (double*)gated.data;
+        u64 count = 0;
+        for (u64 i = 0; i < gated.elementCount; i++) {
+            if (values[i] > rangeGate)
+                values[count++] = values[i];
+        }
+
+        if (count != 0) {
+            qsort(values, count, sizeof(double), _PcmCompareDouble);
+            loudness->range = values[(u64)((count - 1) * 0.95 + 0.5)] - values[(u64)((count - 1) * 0.1 + 0.5)];
+        }
+    }
+
+    ListDestroy(&gated);
+}
+
+// Scale count interleaved samples by gain dB, saturating.
+void PcmApplyGain(s16* samples, u64 count, double gain) {
+    float factor = (float)pow(10.0, gain / 20.0);
+    for (u64 i = 0; i < count; i++) {
+        float value = samples[i] * factor;
+        value = value > 32767.0f ? 32767.0f : (value < -32768.0f ? -32768.0f : value);
+        samples[i] = (s16)lrintf(value);
+    }
+}
+
+// Loop point detection. Masters of looping tracks carry part of the loop
+// body again after the loop end (a rendered tail or a second pass), so the
+// loop length is the lag at which the signal repeats itself. The lag is
+// searched on a downsampled envelope, then refined on the samples.
+
+#define PCM_LOOP_FRAME_MS (5) // Envelope resolution of the coarse search.
+#define PCM_LOOP_MIN_MS (2000) // Shortest loop considered.
+#define PCM_LOOP_MIN_REPEAT_MS (1000) // Repeated material needed after the loop end; also the match window.
+#define PCM_LOOP_PEAKS (64) // Envelope autocorrelation peaks whose repeats are measured.
+#define PCM_LOOP_CANDIDATES (8) // Longest-repeating peaks refined and scored on the samples.
+#define PCM_LOOP_MATCH_ERROR (0.01) // Envelope error (-20 dB) under which a window counts as repeated.
+#define PCM_LOOP_REFINE_SAMPLES (4096) // Correlation length of the sample-accurate lag search.
+#define PCM_LOOP_SEAMLESS (-20.0) // Seam discontinuity (dB) a loop must stay under to count as seamless.
+
+#define PCM_SEAM_WINDOW (512) // Samples compared after a seam.
+
+typedef struct {
+    u32 loopStart; // Per channel.
+    u32 loopEnd; // Exclusive: playback jumps from loopEnd back to loopStart.
+
+    double discontinuity; // dB, see PcmSeamDiscontinuity.
+    double repeatSeconds; // Length of the material found repeated after the loop end.
+    int seamless; // discontinuity is below PCM_LOOP_SEAMLESS.
+} PcmLoop;
+
+// Mismatch in dB between two runs of count interleaved samples: the energy of
+// their difference relative to their energy. -PCM_SNR_IDENTICAL if they are
+// identical, 0 dB for unrelated material (or silence against silence).
+double PcmSeamMismatch(const s16* a, const s16* b, u64 count) {
+    s64 differenceEnergy = 0;
+    s64 energy = 0;
+    for (u64 i = 0; i < count; i++) {
+        s32 difference = (s32)a[i] - (s32)b[i];
+        differenceEnergy += (s64)difference * difference;
+        energy += (s64)a[i] * a[i] + (s64)b[i] * b[i];
+    }
+
+    if (differenceEnergy == 0)
+        return -PCM_SNR_IDENTICAL;
+    if (energy == 0)
+        return 0.0;
+    return 10.0 * log10((double)differenceEnergy / energy);
+}
+
+// Mismatch of a loop seam in dB (see PcmSeamMismatch) between the audio
+// following loopEnd and the audio following loopStart. If they match, jumping
+// back sounds exactly like playing on, so -inf is a perfect seam and 0 dB
+// unrelated material. Needs audio after loopEnd; only the part of the window
+// inside the signal is compared.
+double PcmSeamDiscontinuity(const s16* samples, u64 sampleCount, u32 channelCount, u64 loopStart, u64 loopEnd) {
+    if (loopEnd >= sampleCount || loopStart >= loopEnd)
+        return 0.0;
+
+    return PcmSeamMismatch(
+        samples + loopStart * channelCount, samples + loopEnd * channelCount,
+        MIN((u64)PCM_SEAM_WINDOW, sampleCount - loopEnd) * channelCount
+    );
+}
+
+// Channel average of count samples per channel from start, as float.
+static void _PcmMonoSegment(const s16* samples, u64 start, u64 count, u32 channelCount, float* output) {
+    const s16* s = samples + start * channelCount;
+    for (u64 i = 0; i < count; i++) {
+        s32 sum = 0;
+        for (u32 channel = 0; channel < channelCount; channel++)
+            sum += s[i * channelCount + channel];
+        output[i] = (float)sum / channelCount;
+    }
+}
+
+static float _PcmDot(const float* a, const float* b, u64 count) {
+    float sum = 0.0f;
+    for (u64 i = 0; i < count; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+typedef struct {
+    u64 lag; // Frames.
+    double correlation;
+
+    // Longest run of frames that repeat at lag (see _PcmRepeatRun).
+    u64 runStart;
+    u64 runLength;
+} _PcmLagCandidate;
+
+// Highest PCM_LOOP_PEAKS peaks of the normalized envelope autocorrelation
+// with lags in [minLag, maxLag], computed through the FFT. Returns the amount
+// found.
+static u32 _PcmLagCandidates(const float* envelope, u64 frameCount, u64 minLag, u64 maxLag, _PcmLagCandidate* candidates) {
+    u32 size = 1;
+    while (size < frameCount * 2)
+        size <<= 1;
+
+    double* buffers = (double*)malloc(sizeof(double) * (size * 3 + frameCount + 1));
+    if (buffers == NULL)
+        panic("PcmFindLoop: malloc fail");
+
+    double* re = buffers;
+    double* im = buffers + size;
+    double* cosTable = buffers + size * 2;
+    double* sinTable = buffers + size * 2 + size / 2;
+    double* energySums = buffers + size * 3; // Prefix sums of the squared envelope.
+
+    for (u32 i = 0; i < size / 2; i++) {
+        cosTable[i] = cos(2.0 * M_PI * i / size);
+        sinTable[i] = sin(2.0 * M_PI * i / size);
+    }
+
+    double mean = 0.0;
+    for (u64 i = 0; i < frameCount; i++)
+        mean += envelope[i];
+    mean /= frameCount;
+
+    energySums[0] = 0.0;
+    for (u32 i = 0; i < size; i++) {
+        re[i] = i < frameCount ? envelope[i] - mean : 0.0;
+        im[i] = 0.0;
+        if (i < frameCount)
+            energySums[i + 1] = energySums[i] + re[i] * re[i];
+    }
+
+    // The power spectrum is real and even, so a second forward transform
+    // gives the autocorrelation (times size).
+    _PcmFft(re, im, size, cosTable, sinTable);
+    for (u32 i = 0; i < size; i++) {
+        re[i] = re[i] * re[i] + im[i] * im[i];
+        im[i] = 0.0;
+    }
+    _PcmFft(re, im, size, cosTable, sinTable);
+
+    u32 candidateCount = 0;
+    double previous = 0.0, current = 0.0;
+    for (u64 lag = minLag; lag <= maxLag + 1 && lag < frameCount; lag++) {
+        double overlapEnergy = sqrt(energySums[frameCount - lag] * (energySums[frameCount] - energySums[lag]));
+        double next = overlapEnergy > 0.0 ? re[lag] / size / overlapEnergy : 0.0;
+
+        // current (at lag - 1) is a local maximum.
+        if (lag >= minLag + 2 && current >= previous && current > next && current > 0.0) {
+            _PcmLagCandidate candidate = { lag - 1, current, 0, 0 };
+
+            // Keep the list sorted by correlation, best first.
+            u32 position = candidateCount;
+            while (position > 0 && candidates[position - 1].correlation < candidate.correlation)
+                position--;
+            if (position < PCM_LOOP_PEAKS) {
+                u32 last = MIN(candidateCount, (u32)PCM_LOOP_PEAKS - 1);
+                memmove(candidates + position + 1, candidates + position, sizeof(_PcmLagCandidate) * (last - position));
+                candidates[position] = candidate;
+                candidateCount = MIN(candidateCount + 1, (u32)PCM_LOOP_PEAKS);
+            }
+        }
+
+        previous = current;
+        current = next;
+    }
+
+    free(buffers);
+    return candidateCount;
+}
+
+// Longest run of envelope frames that repeat lag frames later, from running
+// sums over window frames; the run may begin up to a window early.
+static void _PcmRepeatRun(const float* envelope, u64 frameCount, u64 window, _PcmLagCandidate* candidate) {
+    u64 lag = candidate->lag;
+
+    double errorSum = 0.0, energySum = 0.0;
+    u64 runStart = 0, runLength = 0, bestStart = 0, bestLength = 0;
+    for (u64 t = 0; t + lag < frameCount; t++) {
+        double a = envelope[t], b = envelope[t + lag];
+        double d = a - b;
+        errorSum += d * d;
+        energySum += a * a + b * b;
+        if (t >= window) {
+            double oa = envelope[t - window], ob = envelope[t - window + lag];
+            double od = oa - ob;
+            errorSum -= od * od;
+            energySum -= oa * oa + ob * ob;
+        }
+        if (t + 1 < window)
+            continue;
+
+        u64 windowStart = t + 1 - window;
+        if (errorSum <= PCM_LOOP_MATCH_ERROR * energySum && energySum > 0.0) {
+            if (runLength == 0)
+                runStart = windowStart;
+            runLength = t + 1 - runStart;
+            if (runLength > bestLength) {
+                bestStart = runStart;
+                bestLength = runLength;
+            }
+        }
+        else
+            runLength = 0;
+    }
+
+    candidate->runStart = bestStart;
+    candidate->runLength = bestLength;
+}
+
+// Longest repeat first; ties go to the stronger autocorrelation peak.
+static int _PcmCompareLagCandidate(const void* a, const void* b) {
+    const _PcmLagCandidate* x = (const _PcmLagCandidate*)a;
+    const _PcmLagCandidate* y = (const _PcmLagCandidate*)b;
+    if (x->runLength != y->runLength)
+        return x->runLength < y->runLength ? 1 : -1;
+    return (x->correlation < y->correlation) - (x->correlation > y->correlation);
+}
+
+// Find the loop of sampleCount samples per channel. Returns 0 if no part of
+// the signal repeats for long enough (e.g. the file ends right at its loop end).
+int PcmFindLoop(const s16* samples, u64 sampleCount, u32 channelCount, u32 sampleRate, PcmLoop* loop) {
+    memset(loop, 0, sizeof(PcmLoop));
+
+    u64 frameSamples = MAX((u64)sampleRate * PCM_LOOP_FRAME_MS / 1000, (u64)1);
+    u64 frameCount = sampleCount / frameSamples;
+
+    u64 minLag = (u64)PCM_LOOP_MIN_MS / PCM_LOOP_FRAME_MS;
+    u64 window = (u64)PCM_LOOP_MIN_REPEAT_MS / PCM_LOOP_FRAME_MS;
+    if (frameCount < minLag + window + 2)
+        return 0;
+
+    // RMS envelope of the channel average.
+    float* envelope = (float*)malloc(sizeof(float) * frameCount);
+    if (envelope == NULL)
+        panic("PcmFindLoop: malloc fail");
+
+    for (u64 frame = 0; frame < frameCount; frame++) {
+        const s16* s = samples + frame * frameSamples * channelCount;
+
+        s64 energy = 0;
+        for (u64 i = 0; i < frameSamples; i++) {
+            s32 sum = 0;
+            for (u32 channel = 0; channel < channelCount; channel++)
+                sum += s[i * channelCount + channel];
+            energy += (s64)sum * sum;
+        }
+        envelope[frame] = (float)sqrt((double)energy / frameSamples) / channelCount;
+    }
+
+    // Rhythmic material fills the strongest peaks with beat multiples, so
+    // many are kept and ranked by how long they actually repeat; only the
+    // best of those go through the costly sample-level refinement.
+    _PcmLagCandidate candidates[PCM_LOOP_PEAKS];
+    u32 candidateCount = _PcmLagCandidates(envelope, frameCount, minLag, frameCount - window, candidates);
+
+    for (u32 i = 0; i < candidateCount; i++)
+        _PcmRepeatRun(envelope, frameCount, window, candidates + i);
+    qsort(candidates, candidateCount, sizeof(_PcmLagCandidate), _PcmCompareLagCandidate);
+    candidateCount = MIN(candidateCount, (u32)PCM_LOOP_CANDIDATES);
+
+    u64 refineCount = PCM_LOOP_REFINE_SAMPLES;
+    u64 refineRange = frameSamples * 2;
+    float* reference = (float*)malloc(sizeof(float) * (refineCount * 2 + refineRange * 2));
+    if (reference == NULL)
+        panic("PcmFindLoop: malloc fail");
+    float* shifted = reference + refineCount;
+
+    int found = 0;
+
+    for (u32 i = 0; i < candidateCount; i++) {
+        u64 lag = candidates[i].lag;
+        u64 bestStart = candidates[i].runStart;
+        u64 bestLength = candidates[i].runLength;
+        if (bestLength == 0)
+            break;
+
+        // Sample-accurate lag: correlate the middle of the repeated run
+        // against its repeat, within two frames of the envelope lag.
+        u64 lagSamples = lag * frameSamples;
+        u64 center = (bestStart + bestLength / 2) * frameSamples;
+        u64 refStart = center > refineCount / 2 ? center - refineCount / 2 : 0;
+        if (refStart + lagSamples + refineRange + refineCount > sampleCount || lagSamples < refineRange)
+            continue;
+
+        _PcmMonoSegment(samples, refStart, refineCount, channelCount, reference);
+        _PcmMonoSegment(samples, refStart + lagSamples - refineRange, refineCount + refineRange * 2, channelCount, shifted);
+
+        double referenceEnergy = _PcmDot(reference, reference, refineCount);
+        double bestCorrelation = -2.0;
+        u64 bestLag = lagSamples;
+        for (u64 offset = 0; offset <= refineRange * 2; offset++) {
+            double energy = _PcmDot(shifted + offset, shifted + offset, refineCount);
+            double correlation = energy > 0.0 && referenceEnergy > 0.0 ?
+                _PcmDot(reference, shifted + offset, refineCount) / sqrt(energy * referenceEnergy) : 0.0;
+            if (correlation > bestCorrelation) {
+                bestCorrelation = correlation;
+                bestLag = lagSamples - refineRange + offset;
+            }
+        }
+
+        // Loop start: the window test lets the run begin up to a window
+        // early, so the first seamless frame of its first window is looked
+        // for (else the best one), then the best sample within a frame of it.
+        u64 runStartSample = bestStart * frameSamples;
+        u64 coarseStart = runStartSample;
+        double coarseSeam = 1e9;
+        for (u64 frame = 0; frame <= window && runStartSample + (frame + 1) * frameSamples + bestLag <= sampleCount; frame++) {
+            u64 start = runStartSample + frame * frameSamples;
+            double seam = PcmSeamDiscontinuity(samples, sampleCount, channelCount, start, start + bestLag);
+            if (seam < coarseSeam) {
+                coarseSeam = seam;
+                coarseStart = start;
+            }
+            if (seam < PCM_LOOP_SEAMLESS)
+                break;
+        }
+
+        u64 loopStart = coarseStart;
+        double discontinuity = 1e9;
+        u64 firstStart = coarseStart > frameSamples ? coarseStart - frameSamples : 0;
+        for (u64 start = firstStart; start <= coarseStart + frameSamples && start + bestLag <= sampleCount; start++) {
+            double seam = PcmSeamDiscontinuity(samples, sampleCount, channelCount, start, start + bestLag);
+            if (seam < discontinuity) {
+                discontinuity = seam;
+                loopStart = start;
+            }
+        }
+        if (discontinuity > 1e8)
+            continue;
+
+        // Seamless candidates beat the rest; then a seam cleaner by the
+        // PCM_LOOP_SEAMLESS margin wins (tonal material repeats for long at
+        // lags that only nearly fit), else the longest repeat, and among
+        // equal repeats the shorter loop (not a double pass).
+        PcmLoop candidate;
+        candidate.loopStart = (u32)loopStart;
+        candidate.loopEnd = (u32)(loopStart + bestLag);
+        candidate.discontinuity = discontinuity;
+        candidate.repeatSeconds = (double)bestLength * frameSamples / sampleRate;
+        candidate.seamless = discontinuity < PCM_LOOP_SEAMLESS;
+
+        int better = !found;
+        if (found && candidate.seamless != loop->seamless)
+            better = candidate.seamless;
+        else if (found && candidate.seamless) {
+            double ratio = candidate.repeatSeconds / loop->repeatSeconds;
+            if (candidate.discontinuity < loop->discontinuity + PCM_LOOP_SEAMLESS)
+                better = 1;
+            else if (loop->discontinuity < candidate.discontinuity + PCM_LOOP_SEAMLESS)
+                better = 0;
+            else
+                better = ratio > 1.1 || (ratio > 0.9 && candidate.loopEnd - candidate.loopStart < loop->loopEnd - loop->loopStart);
+        }
+        else if (found)
+            better = candidate.discontinuity < loop->discontinuity;
+
+        if (better) {
+            *loop = candidate;
+            found = 1;
+        }
+    }
+
+    free(reference);
+    free(envelope);
+    return found;
+}
+
+// Loop splices: how the jump from loopEnd back to loopStart sounds, judged
+// from the two sides alone (the audio up to loopEnd and the audio from
+// loopStart on). Unlike PcmSeamDiscontinuity this needs nothing after
+// loopEnd, which most looping files end at.
+
+#define PCM_SPLICE_WINDOW (2048) // Samples per channel on each side of the splice.
+#define PCM_SPLICE_PREDICTION (256) // Samples per side whose prediction error is the click baseline.
+#define PCM_SPLICE_BANDS (21) // Third-octave bands of the spectral comparison, above bin 4 (bins 1-4 are the first).
+#define PCM_SPLICE_CLICK (18.0) // dB of click over the baseline that makes a splice bad.
+#define PCM_SPLICE_JUMP (6.0) // dB of spectral jump over the natural flux that makes a splice bad.
+
+typedef struct {
+    double click; // dB: prediction error across the junction over the typical one.
+    double spectralJump; // dB: band level distance between the frames either side of the junction.
+    double spectralFlux; // dB: same distance between consecutive frames on one side.
+    int bad;
+} PcmSplice;
+
+// Band levels (dB) of a Hann-windowed PCM_SPECTRUM_SIZE frame of the channel
+// average. buffers holds 5 * PCM_SPECTRUM_SIZE doubles, the window and FFT
+// tables filled in from index 2 * PCM_SPECTRUM_SIZE on. Returns 0 if the frame
+// is silent.
+static int _PcmBandLevels(const s16* samples, u32 channelCount, double* buffers, double* levels) {
+    const u32 size = PCM_SPECTRUM_SIZE;
+
+    double* re = buffers;
+    double* im = buffers + size;
+    double* window = buffers + size * 2;
+
+    double energy = 0.0;
+    for (u32 i = 0; i < size; i++) {
+        s32 sum = 0;
+        for (u32 channel = 0; channel < channelCount; channel++)
+            sum += samples[(u64)i * channelCount + channel];
+
+        double value = (double)sum / channelCount;
+        energy += value * value;
+        re[i] = value * window[i];
+        im[i] = 0.0;
+    }
+
+    _PcmFft(re, im, size, buffers + size * 3, buffers + size * 4);
+
+    u32 low = 1;
+    for (u32 band = 0; band < PCM_SPLICE_BANDS; band++) {
+        u32 high = band + 1 == PCM_SPLICE_BANDS ?
+            size / 2 + 1 : (u32)(4.0 * pow(2.0, (band + 1) / 3.0)) + 1;
+
+        double power = 0.0;
+        for (u32 k = low; k < high; k++)
+            power += re[k] * re[k] + im[k] * im[k];
+        levels[band] = 10.0 * log10(power / (high - low) + PCM_SPECTRUM_FLOOR);
+
+        low = high;
+    }
+
+    return energy / size >= PCM_SILENCE_ENERGY;
+}
+
+// RMS difference of two band level sets; 0 if both frames are silent.
+static double _PcmBandDistance(const double* a, int audibleA, const double* b, int audibleB) {
+    if (!audibleA && !audibleB)
+        return 0.0;
+
+    double squareSum = 0.0;
+    for (u32 band = 0; band < PCM_SPLICE_BANDS; band++)
+        squareSum += (a[band] - b[band]) * (a[band] - b[band]);
+    return sqrt(squareSum / PCM_SPLICE_BANDS);
+}
+
+// Sample n of one channel of the spliced signal: after[n], or the end of
+// before for negative n.
+static double _PcmSpliceSample(const s16* before, const s16* after, u32 channelCount, u32 channel, s64 n) {
+    if (n < 0)
+        return before[(u64)(PCM_SPLICE_WINDOW + n) * channelCount + channel];
+    return after[(u64)n * channelCount + channel];
+}
+
+// Score a splice: before holds the PCM_SPLICE_WINDOW samples per channel up
+// to loopEnd, after the PCM_SPLICE_WINDOW samples from loopStart on. The
+// click compares the second-order prediction error of the two samples after
+// the junction with that of the samples around it; the spectral jump compares
+// the frames either side of the junction with the flux between consecutive
+// frames on each side, so busy material is not mistaken for a bad splice.
+void PcmMeasureSplice(const s16* before, const s16* after, u32 channelCount, PcmSplice* splice) {
+    const u32 window = PCM_SPLICE_WINDOW;
+    const u32 size = PCM_SPECTRUM_SIZE;
+
+    memset(splice, 0, sizeof(PcmSplice));
+
+    double baselineEnergy = 0.0;
+    double junctionEnergy = 0.0;
+    for (u32 channel = 0; channel < channelCount; channel++) {
+        for (s64 n = -PCM_SPLICE_PREDICTION; n < PCM_SPLICE_PREDICTION + 2; n++) {
+            double error =
+                _PcmSpliceSample(before, after, channelCount, channel, n) -
+                2.0 * _PcmSpliceSample(before, after, channelCount, channel, n - 1) +
+                _PcmSpliceSample(before, after, channelCount, channel, n - 2);
+            if (n == 0 || n == 1)
+                junctionEnergy = MAX(junctionEnergy, error * error);
+            else
+                baselineEnergy += error * error;
+        }
+    }
+    baselineEnergy /= (double)PCM_SPLICE_PREDICTION * 2 * channelCount;
+    splice->click = 10.0 * log10((junctionEnergy + 1.0) / (baselineEnergy + 1.0));
+
+    double* buffers = (double*)malloc(sizeof(double) * size * 5);
+    if (buffers == NULL)
+        panic("PcmMeasureSplice: malloc fail");
+
+    for (u32 i = 0; i < size; i++)
+        buffers[size * 2 + i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / size);
+    for (u32 i = 0; i < size / 2; i++) {
+        buffers[size * 3 + i] = cos(2.0 * M_PI * i / size);
+        buffers[size * 4 + i] = sin(2.0 * M_PI * i / size);
+    }
+
+    // Two frames per side, the inner ones touching the junction.
+    double levels[4][PCM_SPLICE_BANDS];
+    int audible[4];
+    audible[0] = _PcmBandLevels(before + (u64)(window - size * 2) * channelCount, channelCount, buffers, levels[0]);
+    audible[1] = _PcmBandLevels(before + (u64)(window - size) * channelCount, channelCount, buffers, levels[1]);
+    audible[2] = _PcmBandLevels(after, channelCount, buffers, levels[2]);
+    audible[3] = _PcmBandLevels(after + (u64)size * channelCount, channelCount, buffers, levels[3]);
+
+    free(buffers);
+
+    splice->spectralJump = _PcmBandDistance(levels[1], audible[1], levels[2], audible[2]);
+    splice->spectralFlux = MAX(
+        _PcmBandDistance(levels[0], audible[0], levels[1], audible[1]),
+        _PcmBandDistance(levels[2], audible[2], levels[3], audible[3])
+    );
+
+    splice->bad =
+        splice->click > PCM_SPLICE_CLICK ||
+        splice->spectralJump > splice->spectralFlux + PCM_SPLICE_JUMP;
+}
+
+// Running checksum and level statistics of a signal, fed block by block.
+
+#define PCM_HASH_INIT (0xCBF29CE484222325ull) // FNV-1a 64 offset basis.
+
+// FNV-1a 64 over the samples as little-endian bytes; start from PCM_HASH_INIT.
+u64 PcmHashUpdate(u64 hash, const s16* samples, u64 count) {
+    for (u64 i = 0; i < count; i++) {
+        u16 value = (u16)samples[i];
+        hash = (hash ^ (value & 0xFF)) * 0x100000001B3ull;
+        hash = (hash ^ (value >> 8)) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+typedef struct {
+    u64 count; // Interleaved samples.
+    u64 clippedCount; // At full scale.
+    u32 peak;
+
+    double energy;
+    double sum;
+} PcmStats;
+
+void PcmStatsAdd(PcmStats* stats, const s16* samples, u64 count) {
+    s64 energy = 0;
+    s64 sum = 0;
+    u32 peak = stats->peak;
+    u64 clippedCount = 0;
+
+    for (u64 i = 0; i < count; i++) {
+        s32 value = samples[i];
+        u32 magnitude = (u32)(value < 0 ? -value : value);
+
+        energy += value * value;
+        sum += value;
+        peak = MAX(peak, magnitude);
+        clippedCount += value == 32767 || value == -32768;
+    }
+
+    stats->count += count;
+    stats->clippedCount += clippedCount;
+    stats->peak = peak;
+    stats->energy += (double)energy;
+    stats->sum += (double)sum;
+}
+
+// Levels in dBFS; -inf when silent.
+double PcmStatsPeakDb(const PcmStats* stats) {
+    return 20.0 * log10(stats->peak / 32768.0);
+}
+double PcmStatsRmsDb(const PcmStats* stats) {
+    return stats->count != 0 ? 10.0 * log10(stats->energy / stats->count / (32768.0 * 32768.0)) : -INFINITY;
+}
+
+// Waveform overviews: min, max and RMS per bin of samples at several zoom
+// levels, fed block by block so the decoded signal is never held whole. Each
+// level's bins span PCM_PEAKS_LEVEL_FACTOR bins of the level below, and are
+// built from them as they complete.
+
+#define PCM_PEAKS_BIN_SAMPLES (256) // Default bin of the finest level, per channel.
+#define PCM_PEAKS_LEVELS (4) // Default level count.
+#define PCM_PEAKS_LEVELS_MAX (8)
+#define PCM_PEAKS_LEVEL_FACTOR (4)
+
+#define PCM_PEAKS_MAGIC "NPKS"
+#define PCM_PEAKS_VERSION (1)
+
+typedef struct __attribute__((packed)) {
+    s16 min;
+    s16 max;
+    u16 rms;
+} PcmPeak;
+
+// Binary peaks file: this header, a PcmPeaksLevelHeader per level, then the
+// bins of every level in order (channels interleaved), all little-endian.
+typedef struct __attribute__((packed)) {
+    char magic[4]; // PCM_PEAKS_MAGIC
+    u32 version;
+
+    u32 sampleRate;
+    u16 channelCount;
+    u16 levelCount;
+    u64 sampleCount; // Per channel.
+} PcmPeaksFileHeader;
+
+typedef struct __attribute__((packed)) {
+    u32 binSamples;
+    u32 binCount;
+} PcmPeaksLevelHeader;
+
+typedef struct {
+    s32 min;
+    s32 max;
+    double energy;
+} _PcmPeakSum;
+
+typedef struct {
+    u32 channelCount;
+    u32 binSamples; // Per channel, finest level.
+    u32 levelCount;
+
+    u64 sampleCount; // Per channel, added so far.
+
+    ListData levels[PCM_PEAKS_LEVELS_MAX]; // PcmPeak, one per channel per bin.
+
+    // Bin in progress on each level, one sum per channel, with the samples
+    // (per channel) and lower-level bins it holds.
+    _PcmPeakSum* partial;
+    u64 partialSamples[PCM_PEAKS_LEVELS_MAX];
+    u32 partialBins[PCM_PEAKS_LEVELS_MAX];
+} PcmPeaks;
+
+static void _PcmPeakSumReset(_PcmPeakSum* sum) {
+    sum->min = 32767;
+    sum->max = -32768;
+    sum->energy = 0.0;
+}
+
+void PcmPeaksInit(PcmPeaks* peaks, u32 channelCount, u32 binSamples, u32 levelCount) {
+    memset(peaks, 0, sizeof(PcmPeaks));
+
+    if (binSamples == 0)
+        panic("PcmPeaksInit: bin size must be positive");
+    if (levelCount == 0 || levelCount > PCM_PEAKS_LEVELS_MAX)
+        panic("PcmPeaksInit: level count must be within 1..%u", PCM_PEAKS_LEVELS_MAX);
+
+    u64 coarsestBin = binSamples;
+    for (u32 level = 1; level < levelCount; level++)
+        coarsestBin *= PCM_PEAKS_LEVEL_FACTOR;
+    if (coarsestBin > 0xFFFFFFFFull)
+        panic("PcmPeaksInit: bins of the coarsest level are too large");
+
+    peaks->channelCount = channelCount;
+    peaks->binSamples = binSamples;
+    peaks->levelCount = levelCount;
+
+    peaks->partial = (_PcmPeakSum*)malloc(sizeof(_PcmPeakSum) * levelCount * channelCount);
+    if (peaks->partial == NULL)
+        panic("PcmPeaksInit: malloc fail");
+
+    for (u32 level = 0; level < levelCount; level++) {
+        ListInit(peaks->levels + level, sizeof(PcmPeak), 1024);
+        for (u32 channel = 0; channel < channelCount; channel++)
+            _PcmPeakSumReset(peaks->partial + level * channelCount + channel);
+    }
+}
+
+// Close the bin in progress on level and fold it into the next level's.
+static void _PcmPeaksEmit(PcmPeaks* peaks, u32 level) {
+    u32 channelCount = peaks->channelCount;
+    _PcmPeakSum* sums = peaks->partial + level * channelCount;
+    u64 sampleCount = peaks->partialSamples[level];
+
+    int hasNext = level + 1 < peaks->levelCount;
+    _PcmPeakSum* nextSums = sums + channelCount;
+
+    for (u32 channel = 0; channel < channelCount; channel++) {
+        _PcmPeakSum* sum = sums + channel;
+
+        PcmPeak peak;
+        peak.min = (s16)sum->min;
+        peak.max = (s16)sum->max;
+        peak.rms = (u16)MIN(lrint(sqrt(sum->energy / sampleCount)), 32768L);
+        ListAdd(peaks->levels + level, &peak);
+
+        if (hasNext) {
+            _PcmPeakSum* next = nextSums + channel;
+            next->min = MIN(next->min, sum->min);
+            next->max = MAX(next->max, sum->max);
+            next->energy += sum->energy;
+        }
+
+        _PcmPeakSumReset(sum);
+    }
+
+    peaks->partialSamples[level] = 0;
+    peaks->partialBins[level] = 0;
+
+    if (hasNext) {
+        peaks->partialSamples[level + 1] += sampleCount;
+        if (++peaks->partialBins[level + 1] == PCM_PEAKS_LEVEL_FACTOR)
+            _PcmPeaksEmit(peaks, level + 1);
+    }
+}
+
+// Add sampleCount interleaved samples per channel.
+void PcmPeaksAdd(PcmPeaks* peaks, const s16* samples, u64 sampleCount) {
+    u32 channelCount = peaks->channelCount;
+    _PcmPeakSum* sums = peaks->partial;
+
+    while (sampleCount != 0) {
+        // Up to the end of the current bin; the inner loop stays branch-free.
+        u64 count = MIN(sampleCount, peaks->binSamples - peaks->partialSamples[0]);
+
+        for (u32 channel = 0; channel < channelCount; channel++) {
+            const s16* s = samples + channel;
+
+            s32 min = sums[channel].min;
+            s32 max = sums[channel].max;
+            s64 energy = 0;
+            for (u64 i = 0; i < count; i++) {
+                s32 value = s[i * channelCount];
+                min = MIN(min, value);
+                max = MAX(max, value);
+                energy += value * value;
+            }
+
+            sums[channel].min = min;
+            sums[channel].max = max;
+            sums[channel].energy += (double)energy;
+        }
+
+        samples += count * channelCount;
+        sampleCount -= count;
+        peaks->sampleCount += count;
+
+        peaks->partialSamples[0] += count;
+        if (peaks->partialSamples[0] == peaks->binSamples)
+            _PcmPeaksEmit(peaks, 0);
+    }
+}
+
+// Close the bins still in progress (shorter than the rest) at the end of the signal.
+void PcmPeaksFinish(PcmPeaks* peaks) {
+    for (u32 level = 0; level < peaks->levelCount; level++) {
+        if (peaks->partialSamples[level] != 0)
+            _PcmPeaksEmit(peaks, level);
+    }
+}
+
+void PcmPeaksDestroy(PcmPeaks* peaks) {
+    for (u32 level = 0; level < peaks->levelCount; level++)
+        ListDestroy(peaks->levels + level);
+    free(peaks->partial);
+}
+
+// Write finished peaks to path, as the binary layout above or as JSON.
+// Returns 0 on success, without panicking (for worker threads).
+int PcmPeaksWrite(const PcmPeaks* peaks, u32 sampleRate, int json, const char* path) {
+    FILE* fp = fopen(path, json ? "w" : "wb");
+    if (fp == NULL)
+        return -1;
+
+    u32 channelCount = peaks->channelCount;
+
+    if (json) {
+        fprintf(
+            fp, "{\"sample_rate\": %u, \"channels\": %u, \"samples\": %llu, \"levels\": [",
+            sampleRate, channelCount, (unsigned long long)peaks->sampleCount
+        );
+        u32 binSamples = peaks->binSamples;
+        for (u32 level = 0; level < peaks->levelCount; level++) {
+            const ListData* bins = peaks->levels + level;
+            u64 binCount = bins->elementCount / channelCount;
+
+            fprintf(fp, "%s\n  {\"bin_samples\": %u, \"bins\": %llu, \"channels\": [", level != 0 ? "," : "", binSamples, (unsigned long long)binCount);
+            for (u32 channel = 0; channel < channelCount; channel++) {
+                static const char* fields[] = { "min", "max", "rms" };
+
+                fprintf(fp, "%s\n    {", channel != 0 ? "," : "");
+                for (u32 field = 0; field < 3; field++) {
+                    fprintf(fp, "%s\"%s\": [", field != 0 ? ", " : "", fields[field]);
+                    for (u64 bin = 0; bin < binCount; bin++) {
+                        const PcmPeak* peak = (const PcmPeak*)bins->data + bin * channelCount + channel;
+                        int value = field == 0 ? peak->min : field == 1 ? peak->max : peak->rms;
+                        fprintf(fp, bin != 0 ? ",%d" : "%d", value);
+                    }
+                    fprintf(fp, "]");
+                }
+                fprintf(fp, "}");
+            }
+            fprintf(fp, "\n  ]}");
+
+            binSamples *= PCM_PEAKS_LEVEL_FACTOR;
+        }
+        fprintf(fp, "\n]}\n");
+    }
+    else {
+        PcmPeaksFileHeader fileHeader;
+        memcpy(fileHeader.magic, PCM_PEAKS_MAGIC, 4);
+        fileHeader.version = PCM_PEAKS_VERSION;
+        fileHeader.sampleRate = sampleRate;
+        fileHeader.channelCount = (u16)channelCount;
+        fileHeader.levelCount = (u16)peaks->levelCount;
+        fileHeader.sampleCount = peaks->sampleCount;
+        fwrite(&fileHeader, sizeof(fileHeader), 1, fp);
+
+        u32 binSamples = peaks->binSamples;
+        for (u32 level = 0; level < peaks->levelCount; level++) {
+            PcmPeaksLevelHeader levelHeader;
+            levelHeader.binSamples = binSamples;
+            levelHeader.binCount = (u32)(peaks->levels[level].elementCount / channelCount);
+            fwrite(&levelHeader, sizeof(levelHeader), 1, fp);
+
+            binSamples *= PCM_PEAKS_LEVEL_FACTOR;
+        }
+
+        for (u32 level = 0; level < peaks->levelCount; level++)
+            fwrite(peaks->levels[level].data, sizeof(PcmPeak), peaks->levels[level].elementCount, fp);
+    }
+
+    int failed = ferror(fp);
+    if (fclose(fp) != 0)
+        failed = 1;
+    return failed ? -1 : 0;
+}
+
+#endif // PCM_PROCESS_H
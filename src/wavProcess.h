@@ -3,6 +3,8 @@
 
 #include <stdlib.h>
 
+#include <stdio.h>
+
 #include <string.h>
 
 #include <math.h>
@@ -110,6 +112,65 @@ void WavPreprocess(const u8* wavData, u32 wavDataSize) {
         panic("%u-bit FLOAT isn't supported (expected 32-bit FLOAT, 16-bit PCM, or 24-bit PCM)", (unsigned)fmtChunk->bitsPerSample);
 }
 
+// Chunk of a WAV file held in memory that fits in wavDataSize bytes, or NULL.
+static const u8* _WavLocateChunk(const u8* wavData, u64 wavDataSize, u32 targetMagic, u32 minSize) {
+    u64 offset = sizeof(WavFileHeader);
+    while (offset + sizeof(WavChunkHeader) <= wavDataSize) {
+        const WavChunkHeader* chunk = (const WavChunkHeader*)(wavData + offset);
+        if (chunk->magic == targetMagic)
+            return chunk->chunkSize >= minSize && chunk->chunkSize <= wavDataSize - offset - sizeof(WavChunkHeader) ?
+                (const u8*)chunk : NULL;
+
+        offset += sizeof(WavChunkHeader) + chunk->chunkSize + (chunk->chunkSize % 2);
+    }
+    return NULL;
+}
+
+// WavPreprocess for the commands that go over many files: returns 0, or 1
+// with the reason in error. Never panics, so it can run on worker threads;
+// the fmt and data chunks are also known to fit in wavDataSize bytes.
+int WavCheck(const u8* wavData, u64 wavDataSize, char* error, u64 errorSize) {
+    if (wavDataSize > 0xFFFFFFFF) {
+        snprintf(error, errorSize, "WAV file is too large");
+        return 1;
+    }
+
+    const WavFileHeader* fileHeader = (const WavFileHeader*)wavData;
+    if (wavDataSize < sizeof(WavFileHeader) || fileHeader->riffMagic != RIFF_MAGIC || fileHeader->waveMagic != WAVE_MAGIC) {
+        snprintf(error, errorSize, "WAV RIFF/WAVE magic is nonmatching");
+        return 1;
+    }
+
+    const WavFmtChunk* fmtChunk = (const WavFmtChunk*)_WavLocateChunk(
+        wavData, wavDataSize, FMT__MAGIC, sizeof(WavFmtChunk) - sizeof(WavChunkHeader)
+    );
+    if (fmtChunk == NULL) {
+        snprintf(error, errorSize, "WAV 'fmt ' chunk is missing or truncated");
+        return 1;
+    }
+    if (_WavLocateChunk(wavData, wavDataSize, DATA_MAGIC, 0) == NULL) {
+        snprintf(error, errorSize, "WAV 'data' chunk is missing or truncated");
+        return 1;
+    }
+
+    int supported =
+        (fmtChunk->format == FMT_FORMAT_PCM && (fmtChunk->bitsPerSample == 16 || fmtChunk->bitsPerSample == 24)) ||
+        (fmtChunk->format == FMT_FORMAT_FLOAT && fmtChunk->bitsPerSample == 32);
+    if (!supported) {
+        snprintf(
+            error, errorSize, "WAV format %u with %u-bit samples is unsupported",
+            (unsigned)fmtChunk->format, (unsigned)fmtChunk->bitsPerSample
+        );
+        return 1;
+    }
+    if (fmtChunk->channelCount == 0 || fmtChunk->sampleRate == 0) {
+        snprintf(error, errorSize, "WAV channel count or sample rate is zero");
+        return 1;
+    }
+
+    return 0;
+}
+
 u32 WavGetSampleRate(const u8* wavData, u32 wavDataSize) {
     const WavFmtChunk* fmtChunk = (const WavFmtChunk*)_WavFindChunk(
         wavData + sizeof(WavFileHeader),
@@ -251,26 +312,16 @@ s16* WavGetPCM16(const u8* wavData, u32 wavDataSize) {
     return dstSamples;
 }
 
-// Requires PCM16 samples.
-MemoryFile WavBuild(s16* samples, u32 sampleCount, u32 sampleRate, u16 channelCount) {
-    MemoryFile mfResult;
-
-    u32 dataSize = sampleCount * sizeof(s16);
-    u32 fileSize =
-        sizeof(WavFileHeader) + sizeof(WavFmtChunk) +
-        sizeof(WavDataChunk) + dataSize;
+#define WAV_PCM16_HEADER_SIZE (sizeof(WavFileHeader) + sizeof(WavFmtChunk) + sizeof(WavDataChunk))
 
-    mfResult.data_void = malloc(fileSize);
-    if (!mfResult.data_void)
-        panic("WavBuild: failed to allocate memfile");
-    mfResult.size = fileSize;
+// Fill the WAV_PCM16_HEADER_SIZE header of a PCM16 file with dataSize bytes of samples.
+static void _WavFillHeader(u8* header, u32 dataSize, u32 sampleRate, u16 channelCount) {
+    u32 fileSize = WAV_PCM16_HEADER_SIZE + dataSize;
 
-    WavFileHeader* wavFileHeader = (WavFileHeader*)mfResult.data_void;
+    WavFileHeader* wavFileHeader = (WavFileHeader*)header;
     WavFmtChunk* wavFmtChunk = (WavFmtChunk*)(wavFileHeader + 1);
     WavDataChunk* wavDataChunk = (WavDataChunk*)(wavFmtChunk + 1);
 
-    s16* dataStart = (s16*)wavDataChunk->data;
-
     wavFileHeader->riffMagic = RIFF_MAGIC;
     wavFileHeader->waveMagic = WAVE_MAGIC;
 
@@ -288,10 +339,77 @@ MemoryFile WavBuild(s16* samples, u32 sampleCount, u32 sampleRate, u16 channelCo
     wavDataChunk->chunkSize = dataSize;
 
     wavFileHeader->fileSize = fileSize - 8; // Subtract 8 for RIFF header size
-    
-    memcpy(dataStart, samples, dataSize);
+}
+
+// Requires PCM16 samples.
+MemoryFile WavBuild(s16* samples, u32 sampleCount, u32 sampleRate, u16 channelCount) {
+    MemoryFile mfResult;
+
+    u32 dataSize = sampleCount * sizeof(s16);
+    u32 fileSize = WAV_PCM16_HEADER_SIZE + dataSize;
+
+    mfResult.data_void = malloc(fileSize);
+    if (!mfResult.data_void)
+        panic("WavBuild: failed to allocate memfile");
+    mfResult.size = fileSize;
+
+    _WavFillHeader(mfResult.data_u8, dataSize, sampleRate, channelCount);
+    memcpy(mfResult.data_u8 + WAV_PCM16_HEADER_SIZE, samples, dataSize);
 
     return mfResult;
 }
 
+// PCM16 WAV written as the samples come: the header goes out with the sizes
+// left open and is rewritten on close, so no sample is held in memory.
+typedef struct {
+    FILE* fp;
+    u32 sampleRate;
+    u16 channelCount;
+
+    u64 dataSize;
+    int failed;
+} WavWriter;
+
+// Returns 0 on success.
+int WavWriterOpen(WavWriter* writer, const char* path, u32 sampleRate, u16 channelCount) {
+    memset(writer, 0, sizeof(WavWriter));
+    writer->sampleRate = sampleRate;
+    writer->channelCount = channelCount;
+
+    writer->fp = fopen(path, "wb");
+    if (writer->fp == NULL)
+        return 1;
+
+    u8 header[WAV_PCM16_HEADER_SIZE];
+    _WavFillHeader(header, 0, sampleRate, channelCount);
+    if (fwrite(header, sizeof(header), 1, writer->fp) != 1)
+        writer->failed = 1;
+    return 0;
+}
+
+// Append sampleCount interleaved samples per channel.
+void WavWriterWrite(WavWriter* writer, const s16* samples, u64 sampleCount) {
+    u64 count = sampleCount * writer->channelCount;
+    if (fwrite(samples, sizeof(s16), count, writer->fp) != count)
+        writer->failed = 1;
+    writer->dataSize += count * sizeof(s16);
+}
+
+// Write the final sizes and close. Returns 0 on success; WAV sizes are
+// 32-bit, so more than 4 GiB of samples fails.
+int WavWriterClose(WavWriter* writer) {
+    int failed = writer->failed || writer->dataSize > 0xFFFFFFFFull - WAV_PCM16_HEADER_SIZE;
+
+    if (!failed) {
+        u8 header[WAV_PCM16_HEADER_SIZE];
+        _WavFillHeader(header, (u32)writer->dataSize, writer->sampleRate, writer->channelCount);
+        if (fseek(writer->fp, 0, SEEK_SET) != 0 || fwrite(header, sizeof(header), 1, writer->fp) != 1)
+            failed = 1;
+    }
+
+    if (fclose(writer->fp) != 0)
+        failed = 1;
+    return failed;
+}
+
 #endif // WAVPROCESS_H